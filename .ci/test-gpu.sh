@@ -162,11 +162,57 @@ expect {
 DONE
 
 ret="$?"
+
+# ---------------- Headless frame sinks ----------------
+# Boot with the '-F' sink in 'FRAMES', let 'df_drivertest' draw, and power off
+# so that the emulator prints its exit report, which must count frames on
+# scanout 0.
+TEST_FRAME_SINK() {
+  FRAMES="$1" expect <<'DONE'
+set timeout $env(TIMEOUT)
+spawn make check $env(MAKE_CHECK_DISKIMG_ARG) FRAMES=$env(FRAMES)
+expect "buildroot login:" { send "root\r" } timeout { exit 1 }
+expect "# " {
+  send "sh -lc 'kill \u0024(pidof Xorg) 2>/dev/null; sleep 1'\r"
+} timeout { exit 2 }
+expect "# " {
+  send ". /root/local-env.sh >/dev/null 2>&1; df_drivertest >/tmp/dfb.log 2>&1 & sleep $env(DFB_SLEEP); kill \u0024! 2>/dev/null\r"
+}
+expect "# " { send "poweroff -f\r" }
+expect {
+  -re {scanout 0: [1-9][0-9]* frames in} {}
+  timeout { exit 5 }
+  eof { exit 5 }
+}
+expect eof
+DONE
+}
+
+# 'stats' only counts the frames; 'dump' must also write them out as PNG.
+FRAME_DUMP_DIR="${FRAME_DUMP_DIR:-/tmp/semu-frames}"
+if [[ "${ret}" -eq 0 && "${SEMU_DIRECTFB2_TEST}" == "1" ]]; then
+  cleanup
+  TEST_FRAME_SINK stats
+  ret="$?"
+fi
+if [[ "${ret}" -eq 0 && "${SEMU_DIRECTFB2_TEST}" == "1" ]]; then
+  cleanup
+  rm -rf "${FRAME_DUMP_DIR}"
+  TEST_FRAME_SINK "dump,dir=${FRAME_DUMP_DIR}"
+  ret="$?"
+  if [[ "${ret}" -eq 0 ]]; then
+    png="$(ls "${FRAME_DUMP_DIR}"/scanout0-*.png 2>/dev/null | head -n 1)"
+    if [[ -z "${png}" || "$(head -c 4 "${png}" | tail -c 3)" != "PNG" ]]; then
+      ret=6
+    fi
+  fi
+  rm -rf "${FRAME_DUMP_DIR}"
+fi
 set -e  # Re-enable 'errexit' after capturing 'expect' return code.
 
 if [[ "${ret}" -eq 0 ]]; then
   if [[ "${SEMU_DIRECTFB2_TEST}" == "1" ]]; then
-    print_success "PASS: headless virtio-gpu + DirectFB2 checks"
+    print_success "PASS: headless virtio-gpu + DirectFB2 + frame sink checks"
   else
     print_success "PASS: headless virtio-gpu checks"
   fi
@@ -179,6 +225,8 @@ MESSAGES=(
   "FAIL: shell prompt not found"
   "FAIL: virtio-gpu basic checks failed (/dev/dri/card0 or virtio_gpu binding)"
   "FAIL: DirectFB2 check failed (local-env.sh/df_drivertest missing or no DRMKMS init messages)"
+  "FAIL: frame sink exit report counted no frames on scanout 0"
+  "FAIL: '-F dump' wrote no PNG frame for scanout 0"
 )
 
 print_error "${MESSAGES[${ret}]:-FAIL: unknown error (exit code ${ret})}"
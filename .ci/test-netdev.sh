@@ -98,6 +98,52 @@ TEST_NETDEV() {
 DONE
 }
 
+# Test slirp port forwarding: a host connection to HOSTFWD_PORT must reach a
+# listener inside the guest. busybox 'nc' prints whatever it receives.
+HOSTFWD_PORT=${HOSTFWD_PORT:-10080}
+TEST_HOSTFWD() {
+    ASSERT expect <<DONE
+    set timeout ${TIMEOUT}
+    spawn make check NETDEV=user,hostfwd=tcp:127.0.0.1:${HOSTFWD_PORT}-:8080
+    expect "buildroot login:" { send "root\\n" } timeout { exit 1 }
+    expect "# " { send "uname -a\\n" } timeout { exit 2 }
+    expect "riscv32 GNU/Linux" { send "ip addr add 10.0.2.15/24 dev eth0\\n" } timeout { exit 3 }
+    expect "# " { send "ip link set eth0 up\\n" }
+    expect "# " { send "nc -l -p 8080\\n" }
+    # slirp accepts the host connection whether or not the guest listens yet
+    sleep 2
+    exec bash -c "echo semu-hostfwd > /dev/tcp/127.0.0.1/${HOSTFWD_PORT}"
+    expect "semu-hostfwd" { } timeout { exit 4 }
+DONE
+}
+
+# Test the socket netdev: a second instance connects to the hub of the first
+# one and its guest pings the hub guest. The peer boots from its own copy of
+# the disk image so the two guests never share a writable root filesystem.
+SOCKET_PATH=${SOCKET_PATH:-/tmp/semu-netdev-hub.sock}
+TEST_SOCKET() {
+    rm -f "${SOCKET_PATH}"
+    ASSERT make ext4.img
+    cp ext4.img ext4-peer.img
+
+    ASSERT expect <<DONE
+    set timeout ${TIMEOUT}
+    spawn make check NETDEV=socket,listen=${SOCKET_PATH}
+    expect "buildroot login:" { send "root\\n" } timeout { exit 1 }
+    expect "# " { send "ip addr add 10.0.3.1/24 dev eth0\\n" } timeout { exit 2 }
+    expect "# " { send "ip link set eth0 up\\n" }
+    expect "# " { }
+
+    spawn make check NETDEV=socket,connect=${SOCKET_PATH} DISKIMG_FILE=ext4-peer.img
+    expect "buildroot login:" { send "root\\n" } timeout { exit 1 }
+    expect "# " { send "ip addr add 10.0.3.2/24 dev eth0\\n" } timeout { exit 2 }
+    expect "# " { send "ip link set eth0 up\\n" }
+    expect "# " { send "ping -c 3 10.0.3.1\\n" }
+    expect "3 packets transmitted, 3 packets received, 0% packet loss" { } timeout { exit 4 }
+DONE
+    rm -f ext4-peer.img "${SOCKET_PATH}"
+}
+
 # Determine network devices to test based on platform
 if [[ -n "${NETDEV}" ]]; then
     # NETDEV environment variable specified - test only that device
@@ -106,18 +152,18 @@ elif [[ ${IS_MACOS} -eq 1 ]]; then
     # macOS: test both user (no sudo) and vmnet (requires sudo)
     # Default to user if not running as root
     if [[ $EUID -eq 0 ]]; then
-        NETWORK_DEVICES=(user vmnet)
+        NETWORK_DEVICES=(user hostfwd socket vmnet)
     else
-        NETWORK_DEVICES=(user)
+        NETWORK_DEVICES=(user hostfwd socket)
         echo "Note: Running without sudo, testing user mode only"
         echo "Run with 'sudo' to test vmnet mode"
     fi
 else
     # Linux: test tap (requires sudo) and user (no sudo)
     if [[ $EUID -eq 0 ]]; then
-        NETWORK_DEVICES=(tap user)
+        NETWORK_DEVICES=(tap user hostfwd socket)
     else
-        NETWORK_DEVICES=(user)
+        NETWORK_DEVICES=(user hostfwd socket)
         echo "Note: Running without sudo, testing user mode only"
         echo "Run with 'sudo' to test tap mode"
     fi
@@ -132,7 +178,17 @@ for NETDEV in "${NETWORK_DEVICES[@]}"; do
     echo "========================================="
     echo "Testing network device: $NETDEV"
     echo "========================================="
-    TEST_NETDEV $NETDEV
+    case "$NETDEV" in
+        hostfwd)
+            TEST_HOSTFWD
+            ;;
+        socket)
+            TEST_SOCKET
+            ;;
+        *)
+            TEST_NETDEV $NETDEV
+            ;;
+    esac
     echo "✓ $NETDEV test passed"
 done
 
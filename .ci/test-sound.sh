@@ -26,23 +26,68 @@ esac
 # Clean up any existing semu processes before starting tests
 cleanup
 
-# Test sound device
-expect <<DONE
-set timeout ${TIMEOUT}
-spawn make check
-expect "buildroot login:" { send "root\\n" } timeout { exit 1 }
-expect "# " { send "uname -a\\n" } timeout { exit 2 }
-expect "riscv32 GNU/Linux" { send "aplay ${SAMPLE_SOUND} \\n" } timeout { exit 3 }
-expect " Mono" { } timeout { exit 4 }
+# Play the sample through the AUDIO backend ('make check' default if empty).
+# The null and file backends print a report when the guest releases the
+# stream, so wait for REPORT too when given; the file backend has written
+# the final WAV header by then.
+TEST_PLAYBACK() {
+    local AUDIO=$1
+    local REPORT=$2
+
+    expect <<DONE
+    set timeout ${TIMEOUT}
+    spawn make check AUDIO=${AUDIO}
+    expect "buildroot login:" { send "root\\n" } timeout { exit 1 }
+    expect "# " { send "uname -a\\n" } timeout { exit 2 }
+    expect "riscv32 GNU/Linux" { send "aplay ${SAMPLE_SOUND} \\n" } timeout { exit 3 }
+    expect " Mono" { } timeout { exit 4 }
+    if { "${REPORT}" ne "" } {
+        expect "${REPORT}" { } timeout { exit 4 }
+    }
 DONE
+}
+
+# A 44-byte canonical header whose data size accounts for the rest of the file
+CHECK_WAV() {
+    local file=$1
+    local size data_size
+
+    [ -f "$file" ] || return 1
+    [ "$(head -c 4 "$file")" = "RIFF" ] || return 1
+    [ "$(dd if="$file" bs=1 skip=8 count=4 2>/dev/null)" = "WAVE" ] || return 1
+    size=$(wc -c < "$file")
+    data_size=$(od -An -tu4 -j40 -N4 "$file" | tr -d ' ')
+    [ "$data_size" -gt 0 ] && [ "$size" -eq $((44 + data_size)) ]
+}
 
+WAV_OUT=${WAV_OUT:-/tmp/semu-playback.wav}
+rm -f "${WAV_OUT}"
+
+set +e
+TEST_PLAYBACK "" ""
 ret="$?"
+if [ "$ret" -eq 0 ]; then
+    cleanup
+    TEST_PLAYBACK null "virtio-snd: playback stream 0 (null)"
+    ret="$?"
+fi
+if [ "$ret" -eq 0 ]; then
+    cleanup
+    TEST_PLAYBACK "file,out=${WAV_OUT}" "virtio-snd: playback stream 0 (file)"
+    ret="$?"
+fi
+if [ "$ret" -eq 0 ] && ! CHECK_WAV "${WAV_OUT}"; then
+    ret=5
+fi
+set -e
+rm -f "${WAV_OUT}"
 
 MESSAGES=("OK!" \
      "Fail to boot" \
      "Fail to login" \
      "Fail to run playback commands" \
      "Playback fails" \
+     "Playback file is not a valid WAV file" \
 )
 
 if [ "$ret" -eq 0 ]; then
@@ -106,6 +106,7 @@ typedef struct {
     /* feature negotiation */
     uint32_t DeviceFeaturesSel;
     uint32_t DriverFeatures;
+    uint32_t DriverFeatures1; /* upper word, forwarded to a vhost-user peer */
     uint32_t DriverFeaturesSel;
     /* queue config */
     uint32_t QueueSel;
@@ -116,6 +117,7 @@ typedef struct {
     /* supplied by environment */
     netdev_t peer;
     uint32_t *ram;
+    int ram_fd; /* memfd backing 'ram' when shared with the peer, or -1 */
     /* implementation-specific */
     void *priv;
 } virtio_net_state_t;
@@ -132,6 +134,11 @@ void virtio_net_write(hart_t *core,
                       uint32_t value);
 void virtio_net_refresh_queue(virtio_net_state_t *vnet);
 
+/* Returns the host fd that becomes readable when the peer has frames for the
+ * guest, or -1 if the guest currently cannot accept any.
+ */
+int virtio_net_get_rx_fd(virtio_net_state_t *vnet);
+
 void virtio_net_recv_from_peer(void *peer);
 
 bool virtio_net_init(virtio_net_state_t *vnet, const char *name);
@@ -345,6 +352,16 @@ void virtio_gpu_init(virtio_gpu_state_t *vgpu);
 uint32_t virtio_gpu_register_scanout(virtio_gpu_state_t *vgpu,
                                      uint32_t width,
                                      uint32_t height);
+/* Periodic hook from the emulator loop, used to publish display frames that
+ * frame pacing deferred.
+ */
+void virtio_gpu_refresh(virtio_gpu_state_t *vgpu);
+/* The periodic hook does not run while every hart sleeps. Before sleeping, the
+ * emulator loop calls this to publish the deferred frames that are due; it
+ * returns how many milliseconds the sleep may last before the next one is, or
+ * -1 if none is waiting.
+ */
+int virtio_gpu_refresh_idle(virtio_gpu_state_t *vgpu);
 #endif /* SEMU_HAS(VIRTIOGPU) */
 
 /* ACLINT MTIMER */
@@ -482,7 +499,7 @@ void virtio_snd_write(hart_t *core,
                       uint8_t width,
                       uint32_t value);
 
-bool virtio_snd_init(virtio_snd_state_t *vsnd);
+bool virtio_snd_init(virtio_snd_state_t *vsnd, const char *backend);
 #endif /* SEMU_HAS(VIRTIOSND) */
 
 /* VirtIO-File-System */
@@ -491,11 +508,47 @@ bool virtio_snd_init(virtio_snd_state_t *vsnd);
 #define IRQ_VFS 6
 #define IRQ_VFS_BIT (1 << IRQ_VFS)
 
-typedef struct inode_map_entry {
+/* DAX window: host file ranges mapped by FUSE_SETUPMAPPING appear in guest
+ * physical memory right above RAM. Both values are multiples of the memory
+ * section the guest hotplugs for the window and of the 2 MiB ranges it maps.
+ */
+#define VFS_DAX_BASE 0x20000000U
+#define VFS_DAX_SIZE (256 * 1024 * 1024)
+#if VFS_DAX_BASE < RAM_SIZE
+#error "virtio-fs DAX window overlaps RAM"
+#endif
+
+/* Request queues offered to the guest, each drained by the worker pool */
+#define VFS_REQUEST_QUEUES 4
+
+/* Host inode known to the guest. FUSE node IDs are host inode numbers, except
+ * for the root which is always 1.
+ */
+typedef struct vfs_inode {
     uint64_t ino;
+    uint64_t nlookup; /* guest references; dropped by FUSE_FORGET */
+    uint64_t path_hash;
     char *path;
-    struct inode_map_entry *next;
-} inode_map_entry;
+    int wd; /* inotify watch on a directory, 0 if none */
+
+    /* Read-only host fd shared by the guest's read-only opens and kept open
+     * after the last RELEASE, on an LRU list, for the next OPEN.
+     */
+    int fd; /* -1 if none */
+    uint32_t fd_users;
+    struct vfs_inode *lru_prev, *lru_next;
+    bool forgotten; /* out of the table, freed when 'fd_users' drops to 0 */
+} vfs_inode_t;
+
+/* Two open-addressing (linear probing) tables over the same entries, indexed
+ * by inode number and by host path. Both share 'capacity', a power of 2.
+ */
+typedef struct {
+    vfs_inode_t **by_ino;
+    vfs_inode_t **by_path;
+    uint32_t capacity;
+    uint32_t count;
+} vfs_inode_table_t;
 
 typedef struct {
     uint32_t QueueNum;
@@ -514,7 +567,8 @@ typedef struct {
 
     /* queue config */
     uint32_t QueueSel;
-    virtio_fs_queue_t queues[3];
+    /* hiprio, notification, then the request queues */
+    virtio_fs_queue_t queues[2 + VFS_REQUEST_QUEUES];
 
     /* status */
     uint32_t Status;
@@ -526,7 +580,36 @@ typedef struct {
     char *mount_tag; /* guest sees this tag */
     char *shared_dir;
 
-    inode_map_entry *inode_map;
+    vfs_inode_table_t inodes;
+
+    /* how long the guest may cache entries and attributes */
+    uint64_t entry_valid;
+    uint64_t attr_valid;
+    uint32_t entry_valid_nsec;
+    uint32_t attr_valid_nsec;
+
+    /* host changes, turned into FUSE notifications for the guest */
+    int inotify_fd;
+    uint64_t *watch_ino; /* directory inode of each watch descriptor */
+    uint32_t watch_cap;
+    uint8_t *event_buf; /* inotify events read but not delivered yet */
+    uint32_t event_len;
+    uint32_t event_off;
+
+    /* shared memory regions */
+    uint32_t SHMSel;
+    uint32_t *dax_window; /* host view of the DAX window, NULL if unavailable */
+
+    /* host threads serving requests, NULL to serve them in 'QueueNotify' */
+    struct vfs_pool *pool;
+
+    /* open files and directories, FUSE file handle N being slot N - 1 */
+    struct vfs_handle *handles;
+    uint32_t handle_next; /* where the search for a free slot starts */
+
+    /* inodes with an idle cached fd, least recently released first */
+    vfs_inode_t *lru_head, *lru_tail;
+    uint32_t lru_count;
 
     /* optional implementation-specific */
     void *priv;
@@ -547,6 +630,14 @@ void virtio_fs_write(hart_t *core,
 
 bool virtio_fs_init(virtio_fs_state_t *vfs, char *mtag, char *dir);
 
+/* Complete requests finished by the workers and deliver pending host change
+ * notifications
+ */
+void virtio_fs_refresh_queue(virtio_fs_state_t *vfs);
+
+/* Readable when worker threads have finished requests, -1 if none run */
+int virtio_fs_get_fd(virtio_fs_state_t *vfs);
+
 #endif /* SEMU_HAS(VIRTIOFS) */
 
 /* memory mapping */
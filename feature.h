@@ -22,6 +22,13 @@
 #define SEMU_FEATURE_VIRTIOFS 1
 #endif
 
+/* virtio-fs DAX window: maps host files into guest physical memory. Default
+ * off, as a host file truncated while mapped kills the emulator with SIGBUS.
+ */
+#ifndef SEMU_FEATURE_VIRTIOFS_DAX
+#define SEMU_FEATURE_VIRTIOFS_DAX 0
+#endif
+
 /* virtio-input */
 #ifndef SEMU_FEATURE_VIRTIOINPUT
 #define SEMU_FEATURE_VIRTIOINPUT 1
@@ -49,7 +49,11 @@ struct fuse_init_out {
     uint16_t congestion_threshold;
     uint32_t max_write;  /* Maximum write size the device can handle */
     uint32_t time_gran;  /* Time granularity (in nanoseconds) */
-    uint32_t unused[11]; /* Reserved */
+    uint16_t max_pages;  /* Pages per request, honored with FUSE_MAX_PAGES */
+    uint16_t map_alignment;
+    uint32_t flags2;
+    uint32_t max_stack_depth;
+    uint32_t unused[6]; /* Reserved */
 };
 
 struct fuse_getattr_in {
@@ -144,6 +148,78 @@ struct fuse_create_in {
     uint32_t open_flags;
 };
 
+struct fuse_write_in {
+    uint64_t fh;
+    uint64_t offset;
+    uint32_t size;
+    uint32_t write_flags;
+    uint64_t lock_owner;
+    uint32_t flags;
+    uint32_t padding;
+};
+
+struct fuse_write_out {
+    uint32_t size;
+    uint32_t padding;
+};
+
+struct fuse_mkdir_in {
+    uint32_t mode;
+    uint32_t umask;
+};
+
+struct fuse_rename_in {
+    uint64_t newdir; /* inode of the destination directory */
+};
+
+struct fuse_setattr_in {
+    uint32_t valid; /* FATTR_* bitmask of the fields to change */
+    uint32_t padding;
+    uint64_t fh;
+    uint64_t size;
+    uint64_t lock_owner;
+    uint64_t atime;
+    uint64_t mtime;
+    uint64_t ctime;
+    uint32_t atimensec;
+    uint32_t mtimensec;
+    uint32_t ctimensec;
+    uint32_t mode;
+    uint32_t unused4;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t unused5;
+};
+
+struct fuse_setupmapping_in {
+    uint64_t fh;      /* file to map */
+    uint64_t foffset; /* offset into the file */
+    uint64_t len;
+    uint64_t flags;   /* FUSE_SETUPMAPPING_FLAG_* */
+    uint64_t moffset; /* offset into the DAX window */
+};
+
+struct fuse_removemapping_in {
+    uint32_t count; /* number of 'struct fuse_removemapping_one' that follow */
+};
+
+struct fuse_removemapping_one {
+    uint64_t moffset;
+    uint64_t len;
+};
+
+struct fuse_notify_inval_inode_out {
+    uint64_t ino;
+    int64_t off; /* page cache range to drop; a negative 'len' means to EOF */
+    int64_t len;
+};
+
+struct fuse_notify_inval_entry_out {
+    uint64_t parent;
+    uint32_t namelen; /* excluding the NUL that terminates the name */
+    uint32_t flags;
+};
+
 struct fuse_release_in {
     uint64_t fh;
     uint32_t flags;
@@ -50,17 +50,24 @@ static int semu_run_chunk(emu_state_t *emu, int steps);
 enum {
     SEMU_SMP_SLICE_STEPS = 8,
     SEMU_SINGLE_SLICE_STEPS = 512,
-    SEMU_SLIRP_SLICE_STEPS = 8,
 };
 
 /* Define fetch separately since it is simpler (fixed width, already checked
- * alignment, only main RAM is executable).
+ * alignment, only main RAM and the virtio-fs DAX window are executable).
  */
 static void mem_fetch(hart_t *hart, uint32_t n_pages, uint32_t **page_addr)
 {
     emu_state_t *data = PRIV(hart);
     if (unlikely(n_pages >= RAM_SIZE / RV_PAGE_SIZE)) {
-        /* TODO: check for other regions */
+#if SEMU_HAS(VIRTIOFS_DAX)
+        /* Programs run in place from a DAX mount */
+        uint32_t dax_page = n_pages - VFS_DAX_BASE / RV_PAGE_SIZE;
+        if (data->vfs.dax_window && dax_page < VFS_DAX_SIZE / RV_PAGE_SIZE) {
+            *page_addr = &data->vfs.dax_window[dax_page
+                                               << (RV_PAGE_SHIFT - 2)];
+            return;
+        }
+#endif
         vm_set_exception(hart, RV_EXC_FETCH_FAULT, hart->exc_val);
         return;
     }
@@ -250,6 +257,7 @@ static inline void emu_tick_peripherals(emu_state_t *emu)
 #endif
 
 #if SEMU_HAS(VIRTIOFS)
+        virtio_fs_refresh_queue(&emu->vfs);
         if (emu->vfs.InterruptStatus)
             emu_update_vfs_interrupts(vm);
 #endif
@@ -267,9 +275,12 @@ static inline void emu_tick_peripherals(emu_state_t *emu)
         if (virtio_input_irq_pending(&emu->vmouse))
             emu_update_vinput_mouse_interrupts(vm);
 #endif
+#if SEMU_HAS(VIRTIOGPU)
+        virtio_gpu_refresh(&emu->vgpu);
+#endif
 #if SEMU_HAS(VIRTIOINPUT) || SEMU_HAS(VIRTIOGPU)
         /* A closed window is treated like a frontend shutdown request. */
-        if (g_window.window_is_closed())
+        if (g_window->window_is_closed())
             emu->stopped = true;
 #endif
     }
@@ -287,6 +298,15 @@ static void mem_load(hart_t *hart,
         return;
     }
 
+#if SEMU_HAS(VIRTIOFS_DAX)
+    /* virtio-fs DAX window at VFS_DAX_BASE + VFS_DAX_SIZE */
+    if (addr - VFS_DAX_BASE < VFS_DAX_SIZE && data->vfs.dax_window) {
+        ram_read(hart, data->vfs.dax_window, addr - VFS_DAX_BASE, width,
+                 value);
+        return;
+    }
+#endif
+
     if ((addr >> 28) == 0xF) { /* MMIO at 0xF_______ */
         /* 256 regions of 1MiB */
         switch ((addr >> 20) & MASK(8)) {
@@ -367,6 +387,15 @@ static void mem_store(hart_t *hart,
         return;
     }
 
+#if SEMU_HAS(VIRTIOFS_DAX)
+    /* virtio-fs DAX window at VFS_DAX_BASE + VFS_DAX_SIZE */
+    if (addr - VFS_DAX_BASE < VFS_DAX_SIZE && data->vfs.dax_window) {
+        ram_write(hart, data->vfs.dax_window, addr - VFS_DAX_BASE, width,
+                  value);
+        return;
+    }
+#endif
+
     if ((addr >> 28) == 0xF) { /* MMIO at 0xF_______ */
         /* 256 regions of 1MiB */
         switch ((addr >> 20) & MASK(8)) {
@@ -685,6 +714,8 @@ struct mapper {
 
 static struct mapper mapper[N_MAPPERS] = {0};
 static int map_index = 0;
+/* Set when guest RAM is a shared memfd (see 'netdev_needs_shared_ram()') */
+static bool ram_shared = false;
 static void unmap_files(void)
 {
     while (map_index--) {
@@ -706,6 +737,23 @@ static void map_file(char **ram_loc, const char *name)
     struct stat st;
     fstat(fd, &st);
 
+    /* A private file mapping would replace the shared pages and hide the
+     * image from the process RAM is shared with, so copy it in instead.
+     */
+    if (ram_shared) {
+        for (off_t off = 0; off < st.st_size;) {
+            ssize_t n = pread(fd, *ram_loc + off, st.st_size - off, off);
+            if (n <= 0) {
+                fprintf(stderr, "could not read %s\n", name);
+                exit(2);
+            }
+            off += n;
+        }
+        close(fd);
+        *ram_loc += st.st_size;
+        return;
+    }
+
     /* remap to a memory region */
     *ram_loc = mmap(*ram_loc, st.st_size, PROT_READ | PROT_WRITE,
                     MAP_FIXED | MAP_PRIVATE, fd, 0);
@@ -731,7 +779,9 @@ static void usage(const char *execpath)
 {
     fprintf(stderr,
             "Usage: %s -k linux-image [-b dtb] [-i initrd-image] [-d "
-            "disk-image] [-s shared-directory] [-H]\n",
+            "disk-image] [-s shared-directory[,options]] [-a "
+            "audio-backend[,options]] [-H] [-F frame-sink[,options]] [-r "
+            "refresh-hz] [-S WxH[,WxH...]] [-I input-script]\n",
             execpath);
 }
 
@@ -745,10 +795,15 @@ static void handle_options(int argc,
                            int *hart_count,
                            bool *debug,
                            bool *headless,
-                           char **shared_dir)
+                           char **shared_dir,
+                           char **audio,
+                           char **frames,
+                           int *refresh_hz,
+                           char **screens,
+                           char **input_script)
 {
     *kernel_file = *dtb_file = *initrd_file = *disk_file = *net_dev =
-        *shared_dir = NULL;
+        *shared_dir = *audio = *frames = *screens = *input_script = NULL;
 
     int optidx = 0;
     struct option opts[] = {
@@ -756,11 +811,15 @@ static void handle_options(int argc,
         {"initrd", 1, NULL, 'i'},     {"disk", 1, NULL, 'd'},
         {"netdev", 1, NULL, 'n'},     {"smp", 1, NULL, 'c'},
         {"gdbstub", 0, NULL, 'g'},    {"help", 0, NULL, 'h'},
-        {"shared_dir", 1, NULL, 's'}, {"headless", 0, NULL, 'H'}};
+        {"shared_dir", 1, NULL, 's'}, {"headless", 0, NULL, 'H'},
+        {"audio", 1, NULL, 'a'},      {"frames", 1, NULL, 'F'},
+        {"refresh", 1, NULL, 'r'},    {"screens", 1, NULL, 'S'},
+        {"input-script", 1, NULL, 'I'},
+        {0, 0, 0, 0}};
 
     int c;
-    while ((c = getopt_long(argc, argv, "k:b:i:d:n:c:s:ghH", opts, &optidx)) !=
-           -1) {
+    while ((c = getopt_long(argc, argv, "k:b:i:d:n:c:s:a:F:r:S:I:ghH", opts,
+                            &optidx)) != -1) {
         switch (c) {
         case 'k':
             *kernel_file = optarg;
@@ -799,6 +858,35 @@ static void handle_options(int argc,
         case 's':
             *shared_dir = optarg;
             break;
+        case 'a':
+            *audio = optarg;
+            break;
+        case 'F':
+            *frames = optarg;
+            break;
+        case 'r': {
+            /* 0 disables pacing. The upper bound only catches typos: no
+             * host display refreshes that fast.
+             */
+            char *end;
+            errno = 0;
+            long hz = strtol(optarg, &end, 10);
+            if (errno || *end || end == optarg || hz < 0 || hz > 1000) {
+                fprintf(stderr,
+                        "%s: -r expects a refresh rate in Hz in [0,1000], "
+                        "got '%s'\n",
+                        argv[0], optarg);
+                exit(2);
+            }
+            *refresh_hz = (int) hz;
+            break;
+        }
+        case 'S':
+            *screens = optarg;
+            break;
+        case 'I':
+            *input_script = optarg;
+            break;
         case 'g':
             *debug = true;
             break;
@@ -843,6 +931,74 @@ static bool uses_default_minimal_dtb(const char *dtb_file)
 }
 #endif
 
+#if SEMU_HAS(VIRTIOGPU)
+/* Scanout sizes are bounded by the 12-bit EDID timing fields above and by the
+ * 64x64 cursor the Linux driver always uses below.
+ */
+#define SCREEN_MIN_SIZE 64
+#define SCREEN_MAX_SIZE 4095
+
+/* Register one virtio-gpu scanout per "WxH" entry of the '-S' list, or a
+ * single SCREEN_WIDTH x SCREEN_HEIGHT one without it. Returns false on a
+ * malformed list.
+ */
+static bool register_screens(virtio_gpu_state_t *vgpu, const char *screens)
+{
+    uint32_t count = 0;
+
+    if (!screens) {
+        virtio_gpu_register_scanout(vgpu, SCREEN_WIDTH, SCREEN_HEIGHT);
+        vgpu_display_set_scanout_mode(0, SCREEN_WIDTH, SCREEN_HEIGHT);
+        vgpu_display_set_scanout_count(1);
+        return true;
+    }
+
+    const char *p = screens;
+    for (;;) {
+        char *end;
+        errno = 0;
+        long width = strtol(p, &end, 10);
+        if (errno || end == p || *end != 'x')
+            goto invalid;
+        p = end + 1;
+        long height = strtol(p, &end, 10);
+        if (errno || end == p || (*end != ',' && *end != '\0'))
+            goto invalid;
+        if (width < SCREEN_MIN_SIZE || width > SCREEN_MAX_SIZE ||
+            height < SCREEN_MIN_SIZE || height > SCREEN_MAX_SIZE) {
+            fprintf(stderr,
+                    "-S: screen %ldx%ld out of range, each side must be in "
+                    "[%d,%d]\n",
+                    width, height, SCREEN_MIN_SIZE, SCREEN_MAX_SIZE);
+            return false;
+        }
+        if (count == VIRTIO_GPU_MAX_SCANOUTS) {
+            fprintf(stderr, "-S: at most %d screens are supported\n",
+                    VIRTIO_GPU_MAX_SCANOUTS);
+            return false;
+        }
+
+        uint32_t scanout_id = virtio_gpu_register_scanout(
+            vgpu, (uint32_t) width, (uint32_t) height);
+        vgpu_display_set_scanout_mode(scanout_id, (uint32_t) width,
+                                      (uint32_t) height);
+        count = scanout_id + 1U;
+
+        if (*end == '\0')
+            break;
+        p = end + 1;
+    }
+
+    vgpu_display_set_scanout_count(count);
+    return true;
+
+invalid:
+    fprintf(stderr, "-S expects a list of WxH screen sizes, got '%s'\n",
+            screens);
+    return false;
+}
+#endif
+
 #define INIT_HART(hart, emu, id)                  \
     do {                                          \
         hart->priv = emu;                         \
@@ -866,6 +1022,11 @@ static int semu_init(emu_state_t *emu, int argc, char **argv)
     char *disk_file;
     char *netdev;
     char *shared_dir;
+    char *audio;
+    char *frames;
+    int refresh_hz = -1;
+    char *screens;
+    char *input_script;
     int hart_count = 1;
     bool debug = false;
     bool headless = false;
@@ -875,11 +1036,55 @@ static int semu_init(emu_state_t *emu, int argc, char **argv)
     vm_t *vm = &emu->vm;
     handle_options(argc, argv, &kernel_file, &dtb_file, &initrd_file,
                    &disk_file, &netdev, &hart_count, &debug, &headless,
-                   &shared_dir);
+                   &shared_dir, &audio, &frames, &refresh_hz, &screens,
+                   &input_script);
 #if !SEMU_HAS(VIRTIOINPUT) && !SEMU_HAS(VIRTIOGPU)
     (void) headless;
 #endif
 
+    /* The frame sink replaces the SDL window: it runs without a display and
+     * keeps consuming virtio-gpu frames, which '-H' alone discards.
+     */
+    if (frames) {
+#if SEMU_HAS(VIRTIOGPU)
+        if (!window_headless_configure(frames))
+            exit(2);
+        g_window = &g_window_headless;
+#else
+        fprintf(stderr, "-F requires virtio-gpu support\n");
+        exit(2);
+#endif
+    }
+
+    if (refresh_hz >= 0) {
+#if SEMU_HAS(VIRTIOGPU)
+        vgpu_display_set_refresh_rate((uint32_t) refresh_hz);
+#else
+        fprintf(stderr, "-r requires virtio-gpu support\n");
+        exit(2);
+#endif
+    }
+
+#if !SEMU_HAS(VIRTIOGPU)
+    if (screens) {
+        fprintf(stderr, "-S requires virtio-gpu support\n");
+        exit(2);
+    }
+#endif
+
+    /* Scripted input is replayed by the window backend's main loop, the only
+     * producer of the host input queues.
+     */
+    if (input_script) {
+#if SEMU_HAS(VIRTIOINPUT)
+        if (!vinput_script_open(input_script))
+            exit(2);
+#else
+        fprintf(stderr, "-I requires virtio-input support\n");
+        exit(2);
+#endif
+    }
+
 #if SEMU_HAS(EXTERNAL_ROOT)
     if (initrd_file && uses_default_minimal_dtb(dtb_file)) {
         fprintf(stderr,
@@ -899,9 +1104,21 @@ static int semu_init(emu_state_t *emu, int argc, char **argv)
     /* Initialize the emulator */
     memset(emu, 0, sizeof(*emu));
 
-    /* Set up RAM */
+    /* Set up RAM. Backends that let another process access the virtqueues
+     * directly need it in a memfd that can be shared.
+     */
+    int ram_fd = -1;
+#if SEMU_HAS(VIRTIONET) && !defined(__APPLE__)
+    if (netdev && netdev_needs_shared_ram(netdev)) {
+        ram_fd = net_vhost_user_alloc_ram(RAM_SIZE);
+        if (ram_fd < 0)
+            return 2;
+        ram_shared = true;
+    }
+#endif
     emu->ram = mmap(NULL, RAM_SIZE, PROT_READ | PROT_WRITE,
-                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                    ram_shared ? MAP_SHARED : MAP_PRIVATE | MAP_ANONYMOUS,
+                    ram_fd, 0);
     if (emu->ram == MAP_FAILED) {
         fprintf(stderr, "Could not map RAM\n");
         return 2;
@@ -985,6 +1202,7 @@ static int semu_init(emu_state_t *emu, int argc, char **argv)
      * Device tree may still expose the device to guest.
      */
     emu->vnet.ram = emu->ram;
+    emu->vnet.ram_fd = ram_fd;
     if (netdev) {
         if (!virtio_net_init(&emu->vnet, netdev)) {
             fprintf(stderr, "Failed to initialize virtio-net device.\n");
@@ -1010,7 +1228,7 @@ static int semu_init(emu_state_t *emu, int argc, char **argv)
     emu->sswi.ssip = calloc(vm->n_hart, sizeof(uint32_t));
     emu->sswi.n_hart = vm->n_hart;
 #if SEMU_HAS(VIRTIOSND)
-    if (!virtio_snd_init(&(emu->vsnd)))
+    if (!virtio_snd_init(&(emu->vsnd), audio))
         fprintf(stderr, "No virtio-snd functioned\n");
     emu->vsnd.ram = emu->ram;
 #endif
@@ -1018,6 +1236,13 @@ static int semu_init(emu_state_t *emu, int argc, char **argv)
     emu->vfs.ram = emu->ram;
     if (!virtio_fs_init(&(emu->vfs), "myfs", shared_dir))
         fprintf(stderr, "No virtio-fs functioned\n");
+#if SEMU_HAS(VIRTIOFS_DAX)
+    for (uint32_t i = 0; i < vm->n_hart && emu->vfs.dax_window; i++) {
+        vm->hart[i]->window_base = emu->vfs.dax_window;
+        vm->hart[i]->window_start = VFS_DAX_BASE;
+        vm->hart[i]->window_size = VFS_DAX_SIZE;
+    }
+#endif
 #endif
 
 #if SEMU_HAS(VIRTIOINPUT)
@@ -1031,19 +1256,18 @@ static int semu_init(emu_state_t *emu, int argc, char **argv)
 #if SEMU_HAS(VIRTIOGPU)
     emu->vgpu.ram = emu->ram;
     virtio_gpu_init(&(emu->vgpu));
-    uint32_t scanout_id =
-        virtio_gpu_register_scanout(&(emu->vgpu), SCREEN_WIDTH, SCREEN_HEIGHT);
-    vgpu_display_set_scanout_count(scanout_id + 1U);
+    if (!register_screens(&emu->vgpu, screens))
+        exit(2);
 #endif
 
 #if SEMU_HAS(VIRTIOINPUT) || SEMU_HAS(VIRTIOGPU)
-    g_window.window_init(headless, SCREEN_WIDTH, SCREEN_HEIGHT);
+    g_window->window_init(headless, SCREEN_WIDTH, SCREEN_HEIGHT);
 
     emu->wake_fd[0] = emu->wake_fd[1] = -1;
-    if (vm->n_hart > 1 && g_window.window_main_loop) {
+    if (vm->n_hart > 1 && g_window->window_main_loop) {
         if (pipe(emu->wake_fd) < 0) {
             perror("failed to create emulator wake pipe");
-            g_window.window_cleanup();
+            g_window->window_cleanup();
             return EXIT_FAILURE;
         }
 
@@ -1060,7 +1284,7 @@ static int semu_init(emu_state_t *emu, int argc, char **argv)
             close(emu->wake_fd[0]);
             close(emu->wake_fd[1]);
             emu->wake_fd[0] = emu->wake_fd[1] = -1;
-            g_window.window_cleanup();
+            g_window->window_cleanup();
             return EXIT_FAILURE;
         }
     }
@@ -1085,7 +1309,7 @@ static int semu_init(emu_state_t *emu, int argc, char **argv)
             if (emu->wake_fd[1] >= 0)
                 close(emu->wake_fd[1]);
             emu->wake_fd[0] = emu->wake_fd[1] = -1;
-            g_window.window_cleanup();
+            g_window->window_cleanup();
 #endif
             return 1;
         }
@@ -1101,7 +1325,7 @@ static int semu_init(emu_state_t *emu, int argc, char **argv)
                 if (emu->wake_fd[1] >= 0)
                     close(emu->wake_fd[1]);
                 emu->wake_fd[0] = emu->wake_fd[1] = -1;
-                g_window.window_cleanup();
+                g_window->window_cleanup();
 #endif
                 return 1;
             }
@@ -1304,8 +1528,8 @@ static void signal_handler(int sig UNUSED)
 static void semu_close_wake_pipe(emu_state_t *emu)
 {
     signal_wake_fd = -1;
-    if (g_window.window_set_wake_fd)
-        g_window.window_set_wake_fd(-1);
+    if (g_window->window_set_wake_fd)
+        g_window->window_set_wake_fd(-1);
 
     if (emu->wake_fd[0] >= 0) {
         close(emu->wake_fd[0]);
@@ -1489,13 +1713,24 @@ static void semu_run(emu_state_t *emu)
             if (signal_received)
                 break;
             /* Only need fds for timer and UART (no coroutine I/O),
-             * plus an optional wake pipe when a window backend is enabled.
+             * plus an optional wake pipe when a window backend is enabled
+             * and the network peer when it has frames for the guest.
              */
             size_t needed = 2;
 #if SEMU_HAS(VIRTIOINPUT) || SEMU_HAS(VIRTIOGPU)
             if (emu->wake_fd[0] >= 0)
                 needed++;
 #endif
+#if SEMU_HAS(VIRTIONET)
+            int net_fd = virtio_net_get_rx_fd(&emu->vnet);
+            if (net_fd >= 0)
+                needed++;
+#endif
+#if SEMU_HAS(VIRTIOFS)
+            int vfs_fd = virtio_fs_get_fd(&emu->vfs);
+            if (vfs_fd >= 0)
+                needed++;
+#endif
 
             /* Grow buffer if needed (amortized realloc) */
             if (needed > poll_capacity) {
@@ -1605,6 +1840,25 @@ static void semu_run(emu_state_t *emu)
             }
 #endif
 
+#if SEMU_HAS(VIRTIONET)
+            /* Incoming frames (e.g., from the slirp thread) must wake idle
+             * harts just like UART input does; 'emu_tick_peripherals()'
+             * delivers them once the harts are resumed.
+             */
+            if (net_fd >= 0 && pfd_count < poll_capacity) {
+                pfds[pfd_count] = (struct pollfd) {net_fd, POLLIN, 0};
+                pfd_count++;
+            }
+#endif
+
+#if SEMU_HAS(VIRTIOFS)
+            /* Likewise for virtio-fs requests the host workers finished */
+            if (vfs_fd >= 0 && pfd_count < poll_capacity) {
+                pfds[pfd_count] = (struct pollfd) {vfs_fd, POLLIN, 0};
+                pfd_count++;
+            }
+#endif
+
             /* Set poll timeout based on current idle state (adaptive timeout).
              * Three-tier strategy:
              * 1. Blocking (-1): All harts idle + have fds → wait for events
@@ -1627,6 +1881,19 @@ static void semu_run(emu_state_t *emu)
                 poll_timeout = 0;
             }
 
+#if SEMU_HAS(VIRTIOGPU)
+            /* Frames that pacing deferred are published from the peripheral
+             * tick, which stops while the harts sleep. Publish the ones that
+             * are due and wake up in time for the next.
+             */
+            if (poll_timeout != 0) {
+                int refresh_timeout = virtio_gpu_refresh_idle(&emu->vgpu);
+                if (refresh_timeout >= 0 &&
+                    (poll_timeout < 0 || refresh_timeout < poll_timeout))
+                    poll_timeout = refresh_timeout;
+            }
+#endif
+
             /* Execute poll() to wait for I/O events.
              * - timeout=0: non-blocking poll when harts are active
              * - timeout=10: short sleep when some harts idle
@@ -1665,7 +1932,7 @@ static void semu_run(emu_state_t *emu)
              * at most one queued notification byte before the emulator thread
              * drains pending work. Extra shutdown wake bytes do not need to be
              * fully consumed here because the first one is enough to make
-             * 'emu_tick_peripherals()' observe 'g_window.window_is_closed()'
+             * 'emu_tick_peripherals()' observe 'g_window->window_is_closed()'
              * and stop the emulator.
              */
             if (wake_pfd_index >= 0 &&
@@ -1691,10 +1958,6 @@ static void semu_run(emu_state_t *emu)
             for (uint32_t i = 0; i < vm->n_hart; i++) {
                 coro_resume_hart(i);
             }
-
-#if SEMU_HAS(VIRTIONET)
-            /* VirtIO-Net coroutine disabled for now */
-#endif
         }
 
         free(pfds);
@@ -1711,7 +1974,7 @@ static void semu_run(emu_state_t *emu)
 
         /* A closed window is a normal user action, not an error. */
 #if SEMU_HAS(VIRTIOINPUT) || SEMU_HAS(VIRTIOGPU)
-        if (emu->stopped && !g_window.window_is_closed())
+        if (emu->stopped && !g_window->window_is_closed())
 #else
         if (emu->stopped)
 #endif
@@ -1729,44 +1992,11 @@ static void semu_run(emu_state_t *emu)
         /* Break out on SIGINT/SIGTERM so atexit hooks fire on graceful exit. */
         if (signal_received)
             break;
-#if SEMU_HAS(VIRTIONET)
-        int i = 0;
-        if (emu->vnet.peer.type == NETDEV_IMPL_user && boot_complete) {
-            net_user_options_t *usr = (net_user_options_t *) emu->vnet.peer.op;
-
-            uint32_t timeout = -1;
-            usr->pfd_len = 1;
-            slirp_pollfds_fill_socket(usr->slirp, &timeout,
-                                      semu_slirp_add_poll_socket, usr);
-
-            /* Poll the internal pipe for incoming data. If data is
-             * available (POLL_IN), process it and forward it to the
-             * virtio-net device.
-             */
-            int pollout = poll(usr->pfd, usr->pfd_len, 1);
-            if (usr->pfd[0].revents & POLLIN) {
-                virtio_net_recv_from_peer(usr->peer);
-            }
-            slirp_pollfds_poll(usr->slirp, (pollout <= 0),
-                               semu_slirp_get_revents, usr);
-            for (i = 0; i < SLIRP_POLL_INTERVAL; i += SEMU_SLIRP_SLICE_STEPS) {
-                int steps =
-                    MIN(SEMU_SLIRP_SLICE_STEPS, SLIRP_POLL_INTERVAL - i);
-
-                ret = semu_run_chunk(emu, steps);
-                if (ret) {
-                    emu->exit_code = ret;
-                    return;
-                }
-            }
-        } else
-#endif
-        {
-            ret = semu_run_chunk(emu, SEMU_SINGLE_SLICE_STEPS);
-            if (ret) {
-                emu->exit_code = ret;
-                return;
-            }
+        /* User-mode networking is serviced by its own thread (slirp.c) */
+        ret = semu_run_chunk(emu, SEMU_SINGLE_SLICE_STEPS);
+        if (ret) {
+            emu->exit_code = ret;
+            return;
         }
     }
 
@@ -1819,7 +2049,7 @@ static gdb_action_t semu_cont(void *args)
      */
     signal_received = 0;
 #if SEMU_HAS(VIRTIOINPUT) || SEMU_HAS(VIRTIOGPU)
-    while (!semu_is_interrupt(emu) && !g_window.window_is_closed()) {
+    while (!semu_is_interrupt(emu) && !g_window->window_is_closed()) {
 #else
     while (!semu_is_interrupt(emu)) {
 #endif
@@ -1836,7 +2066,7 @@ static gdb_action_t semu_cont(void *args)
 
 #if SEMU_HAS(VIRTIOINPUT) || SEMU_HAS(VIRTIOGPU)
     /* Tell gdbstub_run() to exit cleanly when the window is closed. */
-    if (g_window.window_is_closed())
+    if (g_window->window_is_closed())
         return ACT_SHUTDOWN;
 #endif
     return ACT_RESUME;
@@ -1923,8 +2153,8 @@ static void *emu_thread_func(void *arg)
         semu_run(emu);
 
     /* Unblock 'window_main_loop()' on the main thread so it can return. */
-    if (g_window.window_shutdown)
-        g_window.window_shutdown();
+    if (g_window->window_shutdown)
+        g_window->window_shutdown();
 
     return NULL;
 }
@@ -1967,16 +2197,16 @@ int main(int argc, char **argv)
     /* If the window backend provides 'window_main_loop()', run the emulator in
      * a background thread and use the main thread for window events.
      */
-    if (g_window.window_main_loop) {
+    if (g_window->window_main_loop) {
         pthread_t emu_thread;
 
         if (emu.wake_fd[1] >= 0)
-            g_window.window_set_wake_fd(emu.wake_fd[1]);
+            g_window->window_set_wake_fd(emu.wake_fd[1]);
 
         if (pthread_create(&emu_thread, NULL, emu_thread_func, &emu) != 0) {
             fprintf(stderr, "Failed to create emulator thread\n");
             semu_close_wake_pipe(&emu);
-            g_window.window_cleanup();
+            g_window->window_cleanup();
             return 1;
         }
 
@@ -1986,7 +2216,7 @@ int main(int argc, char **argv)
          * backend's closed state and sets 'emu->stopped', so no direct write to
          * 'emu.stopped' is needed here.
          */
-        g_window.window_main_loop();
+        g_window->window_main_loop();
 
         /* Wait for emulator thread to finish. */
         pthread_join(emu_thread, NULL);
@@ -2001,7 +2231,10 @@ int main(int argc, char **argv)
 
 #if SEMU_HAS(VIRTIOINPUT) || SEMU_HAS(VIRTIOGPU)
     semu_close_wake_pipe(&emu);
-    g_window.window_cleanup();
+    g_window->window_cleanup();
+#endif
+#if SEMU_HAS(VIRTIOINPUT)
+    vinput_script_close();
 #endif
 
 #ifdef MMU_CACHE_STATS
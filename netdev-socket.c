@@ -0,0 +1,493 @@
+/*
+ * Inter-VM socket network backend
+ *
+ * Tunnels Ethernet frames between semu processes over a Unix or TCP stream,
+ * so several guests on one host can share a network without root or TAP
+ * devices. Each frame is prefixed with its length as a 32-bit big-endian
+ * integer, the same framing as QEMU's socket netdev.
+ *
+ * One instance listens and the others connect to it. The listening side
+ * accepts up to NET_SOCKET_PEERS_MAX connections and acts as a hub: a frame
+ * from one peer is delivered to its own guest and repeated to every other
+ * peer, which gives a single broadcast segment for small clusters. Frames are
+ * repeated as soon as they arrive, whether or not the hub's own guest takes
+ * them.
+ *
+ * Frames are staged in per-peer buffers in both directions. The guest's TX
+ * burst is written with one system call per peer at the end of a queue
+ * refresh, and incoming data is read in large chunks and split into frames
+ * in place.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#if defined(__APPLE__)
+#include <sys/event.h>
+#else
+#include <sys/epoll.h>
+#endif
+
+#include "netdev.h"
+
+#define NET_SOCKET_HDR_SIZE 4
+
+static void net_socket_set_nonblock(int fd)
+{
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+#if defined(__APPLE__)
+    /* macOS has no MSG_NOSIGNAL */
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+}
+
+/* Add 'fd' to the pollable set behind 'wait_fd' (level-triggered reads) */
+static bool net_socket_watch(net_socket_options_t *sock, int fd)
+{
+#if defined(__APPLE__)
+    struct kevent ev;
+    EV_SET(&ev, fd, EVFILT_READ, EV_ADD, 0, 0, NULL);
+    return kevent(sock->wait_fd, &ev, 1, NULL, 0, NULL) == 0;
+#else
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = fd};
+    return epoll_ctl(sock->wait_fd, EPOLL_CTL_ADD, fd, &ev) == 0;
+#endif
+}
+
+/* Parse "host:port" (TCP) or a Unix socket path. A path is anything with a
+ * '/' in it or without a ':'.
+ */
+static int net_socket_open(const char *addr, bool listening)
+{
+    const char *colon = strrchr(addr, ':');
+    int fd;
+
+    if (strchr(addr, '/') || !colon) {
+        struct sockaddr_un un = {.sun_family = AF_UNIX};
+        if (strlen(addr) >= sizeof(un.sun_path)) {
+            fprintf(stderr, "[SOCKET] path too long: %s\n", addr);
+            return -1;
+        }
+        strcpy(un.sun_path, addr);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            goto fail;
+        if (listening) {
+            /* Replace a stale socket left by a previous run, nothing else */
+            struct stat st;
+            if (!stat(addr, &st) && S_ISSOCK(st.st_mode))
+                unlink(addr);
+            if (bind(fd, (struct sockaddr *) &un, sizeof(un)) < 0 ||
+                listen(fd, NET_SOCKET_PEERS_MAX) < 0)
+                goto fail;
+        } else if (connect(fd, (struct sockaddr *) &un, sizeof(un)) < 0) {
+            goto fail;
+        }
+        return fd;
+    }
+
+    char host[256];
+    size_t host_len = colon - addr;
+    if (host_len >= sizeof(host)) {
+        fprintf(stderr, "[SOCKET] host name too long: %s\n", addr);
+        return -1;
+    }
+    memcpy(host, addr, host_len);
+    host[host_len] = '\0';
+
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+        .ai_flags = listening ? AI_PASSIVE : 0,
+    };
+    struct addrinfo *res;
+    int ret = getaddrinfo(host_len ? host : (listening ? NULL : "localhost"),
+                          colon + 1, &hints, &res);
+    if (ret) {
+        fprintf(stderr, "[SOCKET] cannot resolve '%s': %s\n", addr,
+                gai_strerror(ret));
+        return -1;
+    }
+
+    fd = -1;
+    for (struct addrinfo *ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        int one = 1;
+        if (listening) {
+            setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+            if (!bind(fd, ai->ai_addr, ai->ai_addrlen) &&
+                !listen(fd, NET_SOCKET_PEERS_MAX))
+                break;
+        } else if (!connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+            /* Frames are batched here; Nagle would only add latency */
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd >= 0)
+        return fd;
+
+fail:
+    fprintf(stderr, "[SOCKET] could not %s '%s': %s\n",
+            listening ? "listen on" : "connect to", addr, strerror(errno));
+    if (fd >= 0)
+        close(fd);
+    return -1;
+}
+
+static bool net_socket_add_peer(net_socket_options_t *sock, int fd)
+{
+    if (sock->npeers >= NET_SOCKET_PEERS_MAX) {
+        fprintf(stderr, "[SOCKET] too many peers, dropping connection\n");
+        close(fd);
+        return false;
+    }
+
+    net_socket_set_nonblock(fd);
+    net_socket_peer_t *peer = &sock->peers[sock->npeers];
+    peer->in_buf = malloc(NET_SOCKET_BUF_SIZE);
+    peer->out_buf = malloc(NET_SOCKET_BUF_SIZE);
+    if (!peer->in_buf || !peer->out_buf || !net_socket_watch(sock, fd)) {
+        fprintf(stderr, "[SOCKET] could not set up peer\n");
+        free(peer->in_buf);
+        free(peer->out_buf);
+        close(fd);
+        return false;
+    }
+    peer->fd = fd;
+    peer->in_off = peer->fwd_off = peer->in_len = peer->out_len = 0;
+    sock->npeers++;
+    return true;
+}
+
+static void net_socket_drop_peer(net_socket_options_t *sock, int idx)
+{
+    net_socket_peer_t *peer = &sock->peers[idx];
+    close(peer->fd); /* also removes it from 'wait_fd' */
+    free(peer->in_buf);
+    free(peer->out_buf);
+    sock->peers[idx] = sock->peers[--sock->npeers];
+    if (sock->rx_next >= sock->npeers)
+        sock->rx_next = 0;
+}
+
+int net_socket_init(net_socket_options_t *sock)
+{
+    if (!sock->listen == !sock->connect) {
+        fprintf(stderr,
+                "[SOCKET] exactly one of 'listen=<addr>' or "
+                "'connect=<addr>' is required\n");
+        return -1;
+    }
+
+#if defined(__APPLE__)
+    sock->wait_fd = kqueue();
+#else
+    sock->wait_fd = epoll_create1(EPOLL_CLOEXEC);
+#endif
+    if (sock->wait_fd < 0) {
+        fprintf(stderr, "[SOCKET] could not create poll set: %s\n",
+                strerror(errno));
+        return -1;
+    }
+
+    if (sock->listen) {
+        sock->listen_fd = net_socket_open(sock->listen, true);
+        if (sock->listen_fd < 0)
+            return -1;
+        net_socket_set_nonblock(sock->listen_fd);
+        if (!net_socket_watch(sock, sock->listen_fd))
+            return -1;
+        return 0;
+    }
+
+    sock->listen_fd = -1;
+    int fd = net_socket_open(sock->connect, false);
+    if (fd < 0 || !net_socket_add_peer(sock, fd))
+        return -1;
+    return 0;
+}
+
+/* Write out as much staged data as the socket takes without blocking */
+static bool net_socket_flush_peer(net_socket_peer_t *peer)
+{
+    size_t off = 0;
+    while (off < peer->out_len) {
+#if defined(__APPLE__)
+        ssize_t n = write(peer->fd, peer->out_buf + off, peer->out_len - off);
+#else
+        ssize_t n = send(peer->fd, peer->out_buf + off, peer->out_len - off,
+                         MSG_NOSIGNAL);
+#endif
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                break;
+            return false;
+        }
+        off += n;
+    }
+    memmove(peer->out_buf, peer->out_buf + off, peer->out_len - off);
+    peer->out_len -= off;
+    return true;
+}
+
+void net_socket_flush(net_socket_options_t *sock)
+{
+    for (int i = 0; i < sock->npeers; i++) {
+        if (sock->peers[i].out_len && !net_socket_flush_peer(&sock->peers[i])) {
+            fprintf(stderr, "[SOCKET] peer disconnected: %s\n",
+                    strerror(errno));
+            net_socket_drop_peer(sock, i--);
+        }
+    }
+}
+
+/* Returns the length of the complete frame at 'off' in the stream received
+ * from 'peer', 0 if it has none yet, or -1 if the stream is corrupt.
+ */
+static ssize_t net_socket_peek(const net_socket_peer_t *peer, size_t off)
+{
+    size_t avail = peer->in_len - off;
+    if (avail < NET_SOCKET_HDR_SIZE)
+        return 0;
+
+    const uint8_t *p = peer->in_buf + off;
+    uint32_t len = (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 |
+                   (uint32_t) p[2] << 8 | p[3];
+    if (len > NET_SOCKET_FRAME_MAX)
+        return -1;
+    return avail >= NET_SOCKET_HDR_SIZE + len ? (ssize_t) len : 0;
+}
+
+static bool net_socket_has_room(const net_socket_peer_t *peer, size_t len)
+{
+    return peer->out_len + NET_SOCKET_HDR_SIZE + len <= NET_SOCKET_BUF_SIZE;
+}
+
+/* Stage one length-prefixed frame for 'peer'. Returns false if it does not
+ * fit until the buffer has been flushed.
+ */
+static bool net_socket_queue(net_socket_peer_t *peer,
+                             const struct iovec *iov,
+                             size_t iovcnt,
+                             size_t len)
+{
+    if (!net_socket_has_room(peer, len))
+        return false;
+
+    uint8_t *dst = peer->out_buf + peer->out_len;
+    dst[0] = len >> 24, dst[1] = len >> 16, dst[2] = len >> 8, dst[3] = len;
+    dst += NET_SOCKET_HDR_SIZE;
+    for (size_t i = 0; i < iovcnt; i++) {
+        memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+        dst += iov[i].iov_len;
+    }
+    peer->out_len += NET_SOCKET_HDR_SIZE + len;
+    return true;
+}
+
+/* Repeat the complete frames received from peer 'src' to every other peer.
+ * A frame that does not fit some peer's buffer even after a flush is held
+ * back, together with everything behind it: the stream then backs up in
+ * 'src's input buffer and, once that is full, in the kernel, pushing back on
+ * the sender. Returns false if the stream is corrupt.
+ */
+static bool net_socket_forward(net_socket_options_t *sock, int src)
+{
+    net_socket_peer_t *peer = &sock->peers[src];
+    for (;;) {
+        ssize_t len = net_socket_peek(peer, peer->fwd_off);
+        if (len <= 0)
+            return len == 0;
+
+        for (int i = 0; i < sock->npeers; i++) {
+            net_socket_peer_t *dst = &sock->peers[i];
+            if (i == src || net_socket_has_room(dst, len))
+                continue;
+            /* A failed write is reported by the next 'net_socket_flush()' */
+            net_socket_flush_peer(dst);
+            if (!net_socket_has_room(dst, len))
+                return true;
+        }
+
+        struct iovec fwd = {
+            .iov_base = peer->in_buf + peer->fwd_off + NET_SOCKET_HDR_SIZE,
+            .iov_len = len,
+        };
+        for (int i = 0; i < sock->npeers; i++) {
+            if (i != src)
+                net_socket_queue(&sock->peers[i], &fwd, 1, len);
+        }
+        peer->fwd_off += NET_SOCKET_HDR_SIZE + len;
+    }
+}
+
+/* Discard the data both the guest and the other peers are done with */
+static void net_socket_compact(net_socket_peer_t *peer)
+{
+    size_t done = MIN(peer->in_off, peer->fwd_off);
+    if (!done)
+        return;
+    memmove(peer->in_buf, peer->in_buf + done, peer->in_len - done);
+    peer->in_len -= done;
+    peer->in_off -= done;
+    peer->fwd_off -= done;
+}
+
+void net_socket_poll(net_socket_options_t *sock)
+{
+    /* One system call covers the listener and every peer when idle */
+    struct pollfd pfd = {sock->wait_fd, POLLIN, 0};
+    if (poll(&pfd, 1, 0) > 0) {
+        if (sock->listen_fd >= 0) {
+            int fd;
+            while ((fd = accept(sock->listen_fd, NULL, NULL)) >= 0) {
+                int one = 1;
+                setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                net_socket_add_peer(sock, fd);
+            }
+        }
+
+        for (int i = 0; i < sock->npeers; i++) {
+            net_socket_peer_t *peer = &sock->peers[i];
+
+            /* Compact once per read rather than once per consumed frame */
+            net_socket_compact(peer);
+            /* The guest takes no frames while its interface is down or its
+             * RX ring is full. Once the buffer fills up, drop the frames it
+             * has not taken but the other peers already got, as a NIC out of
+             * RX buffers would, so it cannot stall traffic between them.
+             */
+            if (peer->in_len == NET_SOCKET_BUF_SIZE &&
+                peer->in_off < peer->fwd_off) {
+                peer->in_off = peer->fwd_off;
+                net_socket_compact(peer);
+            }
+            /* Still full: a frame is held back for a peer whose buffer is
+             * full. Leave the data in the kernel, pushing back on the sender.
+             */
+            if (peer->in_len == NET_SOCKET_BUF_SIZE)
+                continue;
+
+            ssize_t n = read(peer->fd, peer->in_buf + peer->in_len,
+                             NET_SOCKET_BUF_SIZE - peer->in_len);
+            if (n > 0) {
+                peer->in_len += n;
+            } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK &&
+                                  errno != EINTR)) {
+                fprintf(stderr, "[SOCKET] peer disconnected\n");
+                net_socket_drop_peer(sock, i--);
+            }
+        }
+    }
+
+    /* Also retries frames held back by an earlier call */
+    for (int i = 0; i < sock->npeers; i++) {
+        if (!net_socket_forward(sock, i)) {
+            fprintf(stderr, "[SOCKET] corrupt stream, dropping peer\n");
+            net_socket_drop_peer(sock, i--);
+        }
+    }
+    net_socket_flush(sock);
+}
+
+bool net_socket_rx_pending(net_socket_options_t *sock)
+{
+    for (int i = 0; i < sock->npeers; i++) {
+        if (net_socket_peek(&sock->peers[i], sock->peers[i].in_off))
+            return true;
+    }
+    return false;
+}
+
+ssize_t net_socket_readv(net_socket_options_t *sock,
+                         const struct iovec *iov,
+                         size_t iovcnt)
+{
+    /* Round-robin over peers so a busy one cannot starve the others */
+    for (int n = 0; n < sock->npeers; n++) {
+        int idx = (sock->rx_next + n) % sock->npeers;
+        net_socket_peer_t *peer = &sock->peers[idx];
+        ssize_t len = net_socket_peek(peer, peer->in_off);
+        if (len < 0) {
+            fprintf(stderr, "[SOCKET] corrupt stream, dropping peer\n");
+            net_socket_drop_peer(sock, idx);
+            n--;
+            continue;
+        }
+        if (!len)
+            continue;
+
+        uint8_t *frame = peer->in_buf + peer->in_off + NET_SOCKET_HDR_SIZE;
+        size_t copied = 0;
+        for (size_t i = 0; i < iovcnt && copied < (size_t) len; i++) {
+            size_t chunk = MIN(iov[i].iov_len, (size_t) len - copied);
+            memcpy(iov[i].iov_base, frame + copied, chunk);
+            copied += chunk;
+        }
+
+        peer->in_off += NET_SOCKET_HDR_SIZE + len;
+        sock->rx_next = (idx + 1) % sock->npeers;
+        return copied;
+    }
+
+    errno = EAGAIN;
+    return -1;
+}
+
+ssize_t net_socket_writev(net_socket_options_t *sock,
+                          const struct iovec *iov,
+                          size_t iovcnt)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+    if (len > NET_SOCKET_FRAME_MAX) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    /* Make room in every peer first so a frame is never sent to only some */
+    for (int i = 0; i < sock->npeers; i++) {
+        net_socket_peer_t *peer = &sock->peers[i];
+        if (!net_socket_has_room(peer, len)) {
+            net_socket_flush(sock);
+            break;
+        }
+    }
+    for (int i = 0; i < sock->npeers; i++) {
+        net_socket_peer_t *peer = &sock->peers[i];
+        if (!net_socket_has_room(peer, len)) {
+            errno = EAGAIN;
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < sock->npeers; i++)
+        net_socket_queue(&sock->peers[i], iov, iovcnt, len);
+    return len;
+}
+
+int net_socket_get_fd(net_socket_options_t *sock)
+{
+    return sock->wait_fd;
+}
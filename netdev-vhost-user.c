@@ -0,0 +1,355 @@
+/*
+ * vhost-user style network backend for Linux
+ *
+ * semu connects to a Unix socket served by an external switch process and
+ * hands it the guest RAM (a memfd) together with the layout of both
+ * virtqueues, using the message format of the vhost-user protocol. The switch
+ * then moves frames by reading and writing the virtqueues in shared memory;
+ * semu only forwards guest notifications through one "kick" eventfd per queue
+ * and turns the switch's "call" eventfds into virtio interrupts.
+ *
+ * Only the front-end side of the handshake is implemented. On connect semu
+ * claims the switch with SET_OWNER and reads its feature bits, negotiating
+ * an empty protocol feature set when VHOST_USER_F_PROTOCOL_FEATURES is
+ * offered. Once the guest driver is ready, the features it accepted are
+ * forwarded with SET_FEATURES, followed by SET_MEM_TABLE and
+ * SET_VRING_{NUM,ADDR,BASE,KICK,CALL} for each ring. Rings only need
+ * SET_VRING_ENABLE when protocol features were negotiated, as they otherwise
+ * start enabled. On reset, GET_VRING_BASE stops each ring again.
+ *
+ * Frames carry the 12-byte virtio-net header implied by VIRTIO_F_VERSION_1,
+ * which the switch must therefore offer, and the switch is expected to honor
+ * VIRTQ_AVAIL_F_NO_INTERRUPT before signalling a call eventfd.
+ *
+ * scripts/vhost-user-switch.c is a minimal switch speaking this subset.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "netdev.h"
+
+#define VHOST_USER_VERSION 0x1
+#define VHOST_USER_REPLY_MASK (1U << 2)
+#define VHOST_USER_F_PROTOCOL_FEATURES (1ULL << 30)
+#define VHOST_USER_F_VERSION_1 (1ULL << 32)
+
+enum {
+    VHOST_USER_GET_FEATURES = 1,
+    VHOST_USER_SET_FEATURES = 2,
+    VHOST_USER_SET_OWNER = 3,
+    VHOST_USER_SET_MEM_TABLE = 5,
+    VHOST_USER_SET_VRING_NUM = 8,
+    VHOST_USER_SET_VRING_ADDR = 9,
+    VHOST_USER_SET_VRING_BASE = 10,
+    VHOST_USER_GET_VRING_BASE = 11,
+    VHOST_USER_SET_VRING_KICK = 12,
+    VHOST_USER_SET_VRING_CALL = 13,
+    VHOST_USER_GET_PROTOCOL_FEATURES = 15,
+    VHOST_USER_SET_PROTOCOL_FEATURES = 16,
+    VHOST_USER_SET_VRING_ENABLE = 18,
+};
+
+PACKED(struct vhost_user_header {
+    uint32_t request;
+    uint32_t flags;
+    uint32_t size;
+});
+
+struct vhost_user_vring_state {
+    uint32_t index;
+    uint32_t num;
+};
+
+struct vhost_user_vring_addr {
+    uint32_t index;
+    uint32_t flags;
+    uint64_t desc;
+    uint64_t used;
+    uint64_t avail;
+    uint64_t log;
+};
+
+struct vhost_user_memory {
+    uint32_t nregions;
+    uint32_t padding;
+    struct {
+        uint64_t guest_phys_addr;
+        uint64_t memory_size;
+        uint64_t userspace_addr;
+        uint64_t mmap_offset;
+    } regions[1];
+};
+
+/* Send one message, optionally passing 'fd' along with it */
+static bool vhost_user_send(net_vhostuser_options_t *vu,
+                            uint32_t request,
+                            const void *payload,
+                            uint32_t size,
+                            int fd)
+{
+    struct vhost_user_header hdr = {
+        .request = request,
+        .flags = VHOST_USER_VERSION,
+        .size = size,
+    };
+    struct iovec iov[2] = {
+        {.iov_base = &hdr, .iov_len = sizeof(hdr)},
+        {.iov_base = (void *) payload, .iov_len = size},
+    };
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = size ? 2 : 1};
+    union {
+        char buf[CMSG_SPACE(sizeof(int))];
+        struct cmsghdr align;
+    } ctrl;
+
+    if (fd >= 0) {
+        memset(&ctrl, 0, sizeof(ctrl));
+        msg.msg_control = ctrl.buf;
+        msg.msg_controllen = sizeof(ctrl.buf);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    }
+
+    ssize_t n = sendmsg(vu->sock_fd, &msg, MSG_NOSIGNAL);
+    if (n != (ssize_t) (sizeof(hdr) + size)) {
+        fprintf(stderr, "[vhost-user] failed to send request %u: %s\n",
+                request, n < 0 ? strerror(errno) : "short write");
+        return false;
+    }
+    return true;
+}
+
+/* Wait for the reply to 'request' and copy its 'size'-byte payload out */
+static bool vhost_user_recv(net_vhostuser_options_t *vu,
+                            uint32_t request,
+                            void *payload,
+                            uint32_t size)
+{
+    struct vhost_user_header hdr;
+    ssize_t n = recv(vu->sock_fd, &hdr, sizeof(hdr), MSG_WAITALL);
+    if (n == (ssize_t) sizeof(hdr) &&
+        (hdr.flags & ~VHOST_USER_REPLY_MASK) == VHOST_USER_VERSION &&
+        (hdr.flags & VHOST_USER_REPLY_MASK) && hdr.request == request &&
+        hdr.size == size)
+        n = recv(vu->sock_fd, payload, size, MSG_WAITALL);
+    else if (n >= 0)
+        n = -1, errno = EPROTO;
+    if (n != (ssize_t) size) {
+        fprintf(stderr, "[vhost-user] bad reply to request %u: %s\n", request,
+                n < 0 ? strerror(errno) : "short read");
+        return false;
+    }
+    return true;
+}
+
+/* Send a request without payload and read back its 64-bit reply */
+static bool vhost_user_get_u64(net_vhostuser_options_t *vu,
+                               uint32_t request,
+                               uint64_t *value)
+{
+    return vhost_user_send(vu, request, NULL, 0, -1) &&
+           vhost_user_recv(vu, request, value, sizeof(*value));
+}
+
+int net_vhost_user_alloc_ram(size_t size)
+{
+    int fd = memfd_create("semu-ram", MFD_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "[vhost-user] memfd_create failed: %s\n",
+                strerror(errno));
+        return -1;
+    }
+    if (ftruncate(fd, size) < 0) {
+        fprintf(stderr, "[vhost-user] could not size guest RAM: %s\n",
+                strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int net_vhost_user_init(net_vhostuser_options_t *vu)
+{
+    if (!vu->path) {
+        fprintf(stderr, "[vhost-user] missing 'path=<socket>' option\n");
+        return -1;
+    }
+
+    for (int i = 0; i < VHOST_USER_QUEUE_NUM; i++) {
+        vu->kick_fd[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        vu->call_fd[i] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (vu->kick_fd[i] < 0 || vu->call_fd[i] < 0) {
+            fprintf(stderr, "[vhost-user] eventfd failed: %s\n",
+                    strerror(errno));
+            return -1;
+        }
+    }
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", vu->path);
+    vu->sock_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (vu->sock_fd < 0 ||
+        connect(vu->sock_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "[vhost-user] could not connect to '%s': %s\n",
+                vu->path, strerror(errno));
+        return -1;
+    }
+
+    if (!vhost_user_send(vu, VHOST_USER_SET_OWNER, NULL, 0, -1) ||
+        !vhost_user_get_u64(vu, VHOST_USER_GET_FEATURES, &vu->features))
+        return -1;
+    if (!(vu->features & VHOST_USER_F_VERSION_1)) {
+        fprintf(stderr,
+                "[vhost-user] switch does not offer VIRTIO_F_VERSION_1\n");
+        return -1;
+    }
+
+    /* None of the protocol features are used, but once the bit is offered
+     * the switch expects them to be negotiated, and starts rings disabled.
+     */
+    if (vu->features & VHOST_USER_F_PROTOCOL_FEATURES) {
+        uint64_t protocol_features = 0;
+        if (!vhost_user_get_u64(vu, VHOST_USER_GET_PROTOCOL_FEATURES,
+                                &protocol_features))
+            return -1;
+        protocol_features = 0;
+        if (!vhost_user_send(vu, VHOST_USER_SET_PROTOCOL_FEATURES,
+                             &protocol_features, sizeof(protocol_features),
+                             -1))
+            return -1;
+    }
+    return 0;
+}
+
+bool net_vhost_user_start(net_vhostuser_options_t *vu,
+                          uint64_t features,
+                          void *ram,
+                          int ram_fd,
+                          size_t ram_size,
+                          const vhost_user_vring_t *vrings)
+{
+    /* Forward what the guest accepted, limited to what the switch offers */
+    features &= vu->features & ~VHOST_USER_F_PROTOCOL_FEATURES;
+    features |= vu->features & VHOST_USER_F_PROTOCOL_FEATURES;
+    if (!vhost_user_send(vu, VHOST_USER_SET_FEATURES, &features,
+                         sizeof(features), -1))
+        return false;
+
+    struct vhost_user_memory mem = {
+        .nregions = 1,
+        .regions[0] =
+            {
+                .guest_phys_addr = 0,
+                .memory_size = ram_size,
+                .userspace_addr = (uintptr_t) ram,
+                .mmap_offset = 0,
+            },
+    };
+    if (!vhost_user_send(vu, VHOST_USER_SET_MEM_TABLE, &mem, sizeof(mem),
+                         ram_fd))
+        return false;
+
+    for (uint32_t i = 0; i < VHOST_USER_QUEUE_NUM; i++) {
+        const vhost_user_vring_t *vring = &vrings[i];
+        struct vhost_user_vring_state num = {i, vring->num};
+        struct vhost_user_vring_state base = {i, vring->last_avail};
+        struct vhost_user_vring_state enable = {i, 1};
+        /* Ring addresses are given in semu's address space, as in vhost-user,
+         * and resolved by the switch through the memory region above.
+         */
+        struct vhost_user_vring_addr addr = {
+            .index = i,
+            .desc = (uintptr_t) ram + vring->desc_addr,
+            .used = (uintptr_t) ram + vring->used_addr,
+            .avail = (uintptr_t) ram + vring->avail_addr,
+        };
+        uint64_t index = i;
+
+        if (!vhost_user_send(vu, VHOST_USER_SET_VRING_NUM, &num, sizeof(num),
+                             -1) ||
+            !vhost_user_send(vu, VHOST_USER_SET_VRING_ADDR, &addr,
+                             sizeof(addr), -1) ||
+            !vhost_user_send(vu, VHOST_USER_SET_VRING_BASE, &base,
+                             sizeof(base), -1) ||
+            !vhost_user_send(vu, VHOST_USER_SET_VRING_KICK, &index,
+                             sizeof(index), vu->kick_fd[i]) ||
+            !vhost_user_send(vu, VHOST_USER_SET_VRING_CALL, &index,
+                             sizeof(index), vu->call_fd[i]))
+            return false;
+        if ((features & VHOST_USER_F_PROTOCOL_FEATURES) &&
+            !vhost_user_send(vu, VHOST_USER_SET_VRING_ENABLE, &enable,
+                             sizeof(enable), -1))
+            return false;
+    }
+
+    vu->started = true;
+    /* Buffers may have been posted before the switch got the rings */
+    for (int i = 0; i < VHOST_USER_QUEUE_NUM; i++)
+        net_vhost_user_kick(vu, i);
+    return true;
+}
+
+void net_vhost_user_stop(net_vhostuser_options_t *vu)
+{
+    if (!vu->started)
+        return;
+    vu->started = false;
+
+    /* GET_VRING_BASE stops the ring, and its reply tells that the switch
+     * no longer touches guest memory, which is about to be reused.
+     */
+    for (uint32_t i = 0; i < VHOST_USER_QUEUE_NUM; i++) {
+        struct vhost_user_vring_state state = {i, 0};
+        if ((vu->features & VHOST_USER_F_PROTOCOL_FEATURES) &&
+            !vhost_user_send(vu, VHOST_USER_SET_VRING_ENABLE, &state,
+                             sizeof(state), -1))
+            return;
+        if (!vhost_user_send(vu, VHOST_USER_GET_VRING_BASE, &state,
+                             sizeof(state), -1) ||
+            !vhost_user_recv(vu, VHOST_USER_GET_VRING_BASE, &state,
+                             sizeof(state)))
+            return;
+    }
+}
+
+void net_vhost_user_kick(net_vhostuser_options_t *vu, int queue)
+{
+    if (!vu->started)
+        return;
+
+    uint64_t one = 1;
+    ssize_t ret = write(vu->kick_fd[queue], &one, sizeof(one));
+    (void) ret;
+}
+
+bool net_vhost_user_poll_call(net_vhostuser_options_t *vu)
+{
+    struct pollfd pfd[VHOST_USER_QUEUE_NUM];
+    for (int i = 0; i < VHOST_USER_QUEUE_NUM; i++)
+        pfd[i] = (struct pollfd){vu->call_fd[i], POLLIN, 0};
+    if (poll(pfd, VHOST_USER_QUEUE_NUM, 0) <= 0)
+        return false;
+
+    bool signalled = false;
+    for (int i = 0; i < VHOST_USER_QUEUE_NUM; i++) {
+        uint64_t count;
+        if ((pfd[i].revents & POLLIN) &&
+            read(vu->call_fd[i], &count, sizeof(count)) == sizeof(count))
+            signalled = true;
+    }
+    return signalled;
+}
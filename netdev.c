@@ -16,6 +16,7 @@
 
 #if !defined(__APPLE__)
 static int net_init_tap(netdev_t *netdev);
+static int net_init_vhostuser(netdev_t *netdev);
 
 static const char *netdev_impl_lookup[] = {
 #define _(dev) [NETDEV_IMPL_##dev] = #dev,
@@ -38,6 +39,7 @@ static int find_net_dev_idx(const char *net_type, const char **netlookup)
 #endif
 
 static int net_init_user(netdev_t *netdev);
+static int net_init_socket(netdev_t *netdev);
 
 #if !defined(__APPLE__)
 static int net_init_tap(netdev_t *netdev)
@@ -46,7 +48,7 @@ static int net_init_tap(netdev_t *netdev)
     tap->tap_fd = open("/dev/net/tun", O_RDWR);
     if (tap->tap_fd < 0) {
         fprintf(stderr, "failed to open TAP device: %s\n", strerror(errno));
-        return false;
+        return -1;
     }
 
     /* Specify persistent tap device */
@@ -54,7 +56,7 @@ static int net_init_tap(netdev_t *netdev)
     strncpy(ifreq.ifr_name, "tap%d", sizeof(ifreq.ifr_name));
     if (ioctl(tap->tap_fd, TUNSETIFF, &ifreq) < 0) {
         fprintf(stderr, "failed to allocate TAP device: %s\n", strerror(errno));
-        return false;
+        return -1;
     }
 
     fprintf(stderr, "allocated TAP interface: %s\n", ifreq.ifr_name);
@@ -63,20 +65,88 @@ static int net_init_tap(netdev_t *netdev)
     return 0;
 }
 
+static int net_init_vhostuser(netdev_t *netdev)
+{
+    return net_vhost_user_init((net_vhostuser_options_t *) netdev->op);
+}
 #endif
 
 static int net_init_user(netdev_t *netdev)
 {
     net_user_options_t *usr = (net_user_options_t *) netdev->op;
-    memset(usr, 0, sizeof(*usr));
     usr->peer = container_of(netdev, virtio_net_state_t, peer);
-    net_slirp_init(usr);
+    return net_slirp_init(usr);
+}
 
-    return 0;
+static int net_init_socket(netdev_t *netdev)
+{
+    return net_socket_init((net_socket_options_t *) netdev->op);
 }
 
-bool netdev_init(netdev_t *netdev, const char *net_type)
+/* Apply the options following the backend name in "type[,key=value...]".
+ * 'pcap' applies to every backend; the others are backend specific. Options
+ * are applied before the backend starts, e.g., slirp needs its forwarding
+ * rules before its thread runs.
+ */
+static bool netdev_parse_options(netdev_t *netdev, char *opts)
+{
+    char *save = NULL;
+    for (char *opt = strtok_r(opts, ",", &save); opt;
+         opt = strtok_r(NULL, ",", &save)) {
+        char *val = strchr(opt, '=');
+        if (!val || !val[1]) {
+            fprintf(stderr, "netdev option '%s' expects a value\n", opt);
+            return false;
+        }
+        *val++ = '\0';
+
+        if (!strcmp(opt, "pcap")) {
+            netdev->pcap = pcap_open(val);
+            if (!netdev->pcap)
+                return false;
+        } else if (!strcmp(opt, "hostfwd") &&
+                   netdev->type == NETDEV_IMPL_user) {
+            if (!net_slirp_add_hostfwd(netdev->op, val))
+                return false;
+        } else if (!strcmp(opt, "listen") &&
+                   netdev->type == NETDEV_IMPL_socket) {
+            ((net_socket_options_t *) netdev->op)->listen = strdup(val);
+        } else if (!strcmp(opt, "connect") &&
+                   netdev->type == NETDEV_IMPL_socket) {
+            ((net_socket_options_t *) netdev->op)->connect = strdup(val);
+#if !defined(__APPLE__)
+        } else if (!strcmp(opt, "path") &&
+                   netdev->type == NETDEV_IMPL_vhostuser) {
+            ((net_vhostuser_options_t *) netdev->op)->path = strdup(val);
+#endif
+        } else {
+            fprintf(stderr, "unsupported netdev option '%s'\n", opt);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool netdev_needs_shared_ram(const char *spec)
 {
+#if defined(__APPLE__)
+    (void) spec;
+    return false;
+#else
+    size_t len = strcspn(spec, ",");
+    return len == strlen("vhostuser") && !strncmp(spec, "vhostuser", len);
+#endif
+}
+
+bool netdev_init(netdev_t *netdev, const char *spec)
+{
+    /* Split "type[,key=value...]" into the backend name and its options */
+    char *net_type = spec ? strdup(spec) : NULL;
+    char *opts = NULL;
+    if (net_type && (opts = strchr(net_type, ',')))
+        *opts++ = '\0';
+    bool ret = false;
+
 #if defined(__APPLE__)
     /* macOS: support vmnet (kernel, requires sudo) and user (slirp, no sudo) */
     if (!net_type || strcmp(net_type, "vmnet") == 0) {
@@ -84,7 +154,12 @@ bool netdev_init(netdev_t *netdev, const char *net_type)
         netdev->op = calloc(1, sizeof(net_vmnet_options_t));
         if (!netdev->op) {
             fprintf(stderr, "Failed to allocate memory for vmnet device\n");
-            return false;
+            goto out;
+        }
+        if (!netdev_parse_options(netdev, opts)) {
+            free(netdev->op);
+            netdev->op = NULL;
+            goto out;
         }
         if (net_vmnet_init(netdev, SEMU_VMNET_SHARED, NULL) != 0) {
             free(netdev->op);
@@ -93,7 +168,7 @@ bool netdev_init(netdev_t *netdev, const char *net_type)
             if (net_type && strcmp(net_type, "vmnet") == 0) {
                 fprintf(stderr,
                         "vmnet init failed. Run with sudo or use -n user\n");
-                return false;
+                goto out;
             }
             /* Auto-fallback to user mode when no explicit backend specified */
             fprintf(stderr,
@@ -102,7 +177,8 @@ bool netdev_init(netdev_t *netdev, const char *net_type)
             /* Continue to user mode initialization below */
         } else {
             /* vmnet init succeeded */
-            return true;
+            ret = true;
+            goto out;
         }
     }
 
@@ -111,48 +187,76 @@ bool netdev_init(netdev_t *netdev, const char *net_type)
         netdev->type = NETDEV_IMPL_user;
         /* If we already allocated for vmnet, netdev->op is NULL here */
         if (!netdev->op) {
-            netdev->op = malloc(sizeof(net_user_options_t));
+            netdev->op = calloc(1, sizeof(net_user_options_t));
             if (!netdev->op) {
                 fprintf(stderr, "Failed to allocate memory for user device\n");
-                return false;
+                goto out;
             }
         }
-        if (net_init_user(netdev) != 0) {
+        if (!netdev_parse_options(netdev, opts) ||
+            net_init_user(netdev) != 0) {
             free(netdev->op);
             netdev->op = NULL;
-            return false;
+            goto out;
         }
-        return true;
+        ret = true;
+        goto out;
+    }
+
+    if (strcmp(net_type, "socket") == 0) {
+        netdev->type = NETDEV_IMPL_socket;
+        netdev->op = calloc(1, sizeof(net_socket_options_t));
+        if (!netdev->op) {
+            fprintf(stderr, "Failed to allocate memory for socket device\n");
+            goto out;
+        }
+        if (!netdev_parse_options(netdev, opts) ||
+            net_init_socket(netdev) != 0) {
+            free(netdev->op);
+            netdev->op = NULL;
+            goto out;
+        }
+        ret = true;
+        goto out;
     }
 
     fprintf(stderr,
-            "unsupported network type on macOS: %s (use 'vmnet' or 'user')\n",
+            "unsupported network type on macOS: %s (use 'vmnet', 'user' or "
+            "'socket')\n",
             net_type);
-    return false;
 #else
     int dev_idx = find_net_dev_idx(net_type, netdev_impl_lookup);
     if (dev_idx == -1)
-        return false;
+        goto out;
     netdev->type = dev_idx;
 
     switch (dev_idx) {
 #define _(dev)                                                           \
     case NETDEV_IMPL_##dev:                                              \
-        netdev->op = malloc(sizeof(net_##dev##_options_t));              \
+        netdev->op = calloc(1, sizeof(net_##dev##_options_t));           \
         if (!netdev->op) {                                               \
             fprintf(stderr, "Failed to allocate memory for %s device\n", \
                     #dev);                                               \
-            return false;                                                \
+            goto out;                                                    \
+        }                                                                \
+        if (!netdev_parse_options(netdev, opts) ||                       \
+            net_init_##dev(netdev) != 0) {                               \
+            free(netdev->op);                                            \
+            netdev->op = NULL;                                           \
+            goto out;                                                    \
         }                                                                \
-        net_init_##dev(netdev);                                          \
         break;
         SUPPORTED_DEVICES
 #undef _
     default:
         fprintf(stderr, "unknown network device\n");
-        break;
+        goto out;
     }
 
-    return true;
+    ret = true;
 #endif
+
+out:
+    free(net_type);
+    return ret;
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <poll.h>
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <sys/socket.h>
@@ -8,6 +9,7 @@
 #include <unistd.h>
 
 #include "minislirp/src/libslirp.h"
+#include "pcap.h"
 #include "utils.h"
 
 /* Forward declarations */
@@ -17,11 +19,14 @@ typedef struct netdev netdev_t;
 #if defined(__APPLE__)
 #define SUPPORTED_DEVICES   \
         _(vmnet)            \
-        _(user)
+        _(user)             \
+        _(socket)
 #else
 #define SUPPORTED_DEVICES   \
         _(tap)              \
-        _(user)
+        _(user)             \
+        _(vhostuser)        \
+        _(socket)
 #endif
 /* clang-format on */
 
@@ -37,8 +42,6 @@ typedef struct {
 
 /* vmnet (macOS) */
 #if defined(__APPLE__)
-#include <pthread.h>
-
 typedef struct {
     void *iface;     /* interface_ref (opaque) */
     void *queue;     /* dispatch_queue_t (opaque) */
@@ -72,13 +75,89 @@ int net_vmnet_get_fd(net_vmnet_state_t *state);
 void net_vmnet_cleanup(net_vmnet_state_t *state);
 #endif
 
+/* vhost-user style backend (Linux) */
+#if !defined(__APPLE__)
+#define VHOST_USER_QUEUE_NUM 2 /* RX and TX */
+
+/* Virtqueue layout handed to the switch; addresses are guest physical */
+typedef struct {
+    uint32_t num;
+    uint32_t desc_addr;
+    uint32_t avail_addr;
+    uint32_t used_addr;
+    uint16_t last_avail;
+} vhost_user_vring_t;
+
+typedef struct {
+    char *path; /* Unix socket of the switch */
+    int sock_fd;
+    int kick_fd[VHOST_USER_QUEUE_NUM]; /* guest -> switch notifications */
+    int call_fd[VHOST_USER_QUEUE_NUM]; /* switch -> guest completions */
+    uint64_t features; /* offered by the switch */
+    bool started;
+} net_vhostuser_options_t;
+
+/* Guest RAM must be shared with the switch, so it is backed by a memfd
+ * instead of anonymous memory. Returns the fd, or -1 on failure.
+ */
+int net_vhost_user_alloc_ram(size_t size);
+int net_vhost_user_init(net_vhostuser_options_t *vu);
+/* Hand both rings to the switch, along with the guest's 'features' */
+bool net_vhost_user_start(net_vhostuser_options_t *vu,
+                          uint64_t features,
+                          void *ram,
+                          int ram_fd,
+                          size_t ram_size,
+                          const vhost_user_vring_t *vrings);
+void net_vhost_user_stop(net_vhostuser_options_t *vu);
+void net_vhost_user_kick(net_vhostuser_options_t *vu, int queue);
+/* Consume pending completions; true if the switch used any buffer */
+bool net_vhost_user_poll_call(net_vhostuser_options_t *vu);
+#endif
+
+/* Inter-VM stream socket (cross-platform) */
+#define NET_SOCKET_PEERS_MAX 8
+#define NET_SOCKET_FRAME_MAX 65535
+#define NET_SOCKET_BUF_SIZE (128 * 1024)
+
+typedef struct {
+    int fd;
+    uint8_t *in_buf; /* received stream; frames start at 'in_off' */
+    size_t in_off;   /* next frame for the local guest */
+    size_t fwd_off;  /* next frame to repeat to the other peers */
+    size_t in_len;
+    uint8_t *out_buf; /* length-prefixed frames waiting to be written */
+    size_t out_len;
+} net_socket_peer_t;
+
+typedef struct {
+    char *listen;  /* "host:port" or Unix socket path to accept peers on */
+    char *connect; /* "host:port" or Unix socket path of the hub */
+    int listen_fd;
+    int wait_fd; /* epoll (kqueue on macOS) set of all sockets, pollable */
+    net_socket_peer_t peers[NET_SOCKET_PEERS_MAX];
+    int npeers;
+    int rx_next;
+} net_socket_options_t;
+
+int net_socket_init(net_socket_options_t *sock);
+/* Accept new peers and read whatever has arrived, without blocking */
+void net_socket_poll(net_socket_options_t *sock);
+/* Write the frames staged by 'net_socket_writev()' */
+void net_socket_flush(net_socket_options_t *sock);
+bool net_socket_rx_pending(net_socket_options_t *sock);
+ssize_t net_socket_readv(net_socket_options_t *sock,
+                         const struct iovec *iov,
+                         size_t iovcnt);
+ssize_t net_socket_writev(net_socket_options_t *sock,
+                          const struct iovec *iov,
+                          size_t iovcnt);
+int net_socket_get_fd(net_socket_options_t *sock);
+
 /* SLIRP (cross-platform userspace network) */
-#define SLIRP_POLL_INTERVAL 100000
-#define SLIRP_PKT_MAX 16384
 #define SLIRP_READ_SIDE 0
 #define SLIRP_WRITE_SIDE 1
 typedef struct {
-    semu_timer_t timer;
     Slirp *slirp;
     SlirpTimerId id;
     void *cb_opaque;
@@ -86,20 +165,75 @@ typedef struct {
     int64_t expire_timer_msec;
 } slirp_timer;
 
+/* Frames cross between the slirp thread and virtio-net through two lock-free
+ * single-producer/single-consumer rings instead of socket pairs, so a frame
+ * costs one copy and no system call on the fast path. A slot holds a whole
+ * Ethernet frame; slirp is configured with a 1500-byte MTU.
+ */
+#define SLIRP_RING_SIZE 256U /* Must be power of 2 */
+#define SLIRP_RING_MASK (SLIRP_RING_SIZE - 1U)
+#define SLIRP_FRAME_MAX 2048
+
+typedef struct {
+    uint32_t len;
+    uint8_t data[SLIRP_FRAME_MAX];
+} slirp_frame_t;
+
+typedef struct {
+    slirp_frame_t *frames;
+    uint32_t head; /* written by the producer */
+    uint32_t tail; /* written by the consumer */
+    /* Set by the producer when it signals 'wake_fd' and cleared by the
+     * consumer once the ring is drained, so a burst of frames costs a single
+     * notification.
+     */
+    bool wake_pending;
+    /* eventfd on Linux (both entries refer to it), a pipe elsewhere */
+    int wake_fd[2];
+} slirp_ring_t;
+
+/* Host port forwarding rule, as in QEMU's
+ * 'hostfwd=[tcp|udp]:[hostaddr]:hostport-[guestaddr]:guestport'
+ */
+#define SLIRP_HOSTFWD_MAX 16
+typedef struct {
+    bool is_udp;
+    struct in_addr host_addr;
+    int host_port;
+    struct in_addr guest_addr;
+    int guest_port;
+} slirp_hostfwd_t;
+
 typedef struct {
     Slirp *slirp;
-    int guest_to_host_channel[2];
-    int host_to_guest_channel[2];
+    slirp_hostfwd_t hostfwd[SLIRP_HOSTFWD_MAX];
+    int hostfwd_cnt;
+    slirp_ring_t rx_ring; /* slirp -> guest */
+    slirp_ring_t tx_ring; /* guest -> slirp */
     int pfd_len;
     int pfd_size;
     struct pollfd *pfd;
     slirp_timer *timer;
     void *peer;
+    /* minislirp runs on its own thread and exchanges frames with virtio-net
+     * only through the rings above, so 'slirp', 'pfd' and 'timer' are never
+     * touched by the emulator thread after 'net_slirp_init()'.
+     */
+    pthread_t thread;
 } net_user_options_t;
 
 Slirp *slirp_create(net_user_options_t *usr, SlirpConfig *cfg);
 int net_slirp_init(net_user_options_t *usr);
-int net_slirp_read(net_user_options_t *usr);
+bool net_slirp_add_hostfwd(net_user_options_t *usr, const char *spec);
+ssize_t net_slirp_readv(net_user_options_t *usr,
+                        const struct iovec *iov,
+                        size_t iovcnt);
+ssize_t net_slirp_writev(net_user_options_t *usr,
+                         const struct iovec *iov,
+                         size_t iovcnt);
+bool net_slirp_rx_pending(net_user_options_t *usr);
+void net_slirp_rx_rearm(net_user_options_t *usr);
+int net_slirp_get_fd(net_user_options_t *usr);
 int semu_slirp_add_poll_socket(slirp_os_socket fd, int events, void *opaque);
 int semu_slirp_get_revents(int idx, void *opaque);
 
@@ -107,6 +241,9 @@ struct netdev {
     char *name;
     netdev_impl_t type;
     void *op;
+    pcap_writer_t *pcap; /* optional capture of every frame, or NULL */
 };
 
 bool netdev_init(netdev_t *nedtev, const char *net_type);
+/* True if the backend selected by 'net_type' needs guest RAM to be shared */
+bool netdev_needs_shared_ram(const char *net_type);
@@ -0,0 +1,224 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "pcap.h"
+
+#define PCAP_MAGIC 0xa1b2c3d4 /* microsecond timestamps */
+#define PCAP_LINKTYPE_ETHERNET 1
+#define PCAP_SNAPLEN 65535
+
+/* Each of the two buffers holds a few hundred full-sized frames */
+#define PCAP_BUF_SIZE (512 * 1024)
+
+/* A partially filled buffer is written out after this many seconds, so a
+ * capture followed live (e.g., 'tail -f | wireshark -k -i -') stays current.
+ */
+#define PCAP_FLUSH_INTERVAL 1
+
+struct pcap_file_header {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct pcap_record_header {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+};
+
+struct pcap_writer {
+    int fd;
+    char *path;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    /* The emulator appends to 'buf[active]' while the writer thread drains
+     * the other one. 'pending' is the number of bytes awaiting the writer
+     * thread in 'buf[!active]', zero when that buffer is free.
+     */
+    uint8_t *buf[2];
+    int active;
+    size_t len;
+    size_t pending;
+    uint64_t dropped;
+    struct pcap_writer *next;
+};
+
+static pcap_writer_t *pcap_writers;
+
+static void pcap_write_all(pcap_writer_t *pcap, const uint8_t *buf, size_t len)
+{
+    while (len) {
+        ssize_t n = write(pcap->fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            fprintf(stderr, "[PCAP] failed to write '%s': %s\n", pcap->path,
+                    strerror(errno));
+            return;
+        }
+        buf += n;
+        len -= n;
+    }
+}
+
+/* Hand the active buffer to the writer thread. Called with 'lock' held. */
+static void pcap_swap_locked(pcap_writer_t *pcap)
+{
+    pcap->pending = pcap->len;
+    pcap->active ^= 1;
+    pcap->len = 0;
+    pthread_cond_broadcast(&pcap->cond);
+}
+
+static void *pcap_thread(void *arg)
+{
+    pcap_writer_t *pcap = (pcap_writer_t *) arg;
+
+    pthread_mutex_lock(&pcap->lock);
+    while (1) {
+        while (!pcap->pending) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_sec += PCAP_FLUSH_INTERVAL;
+            int ret =
+                pthread_cond_timedwait(&pcap->cond, &pcap->lock, &deadline);
+            if (ret == ETIMEDOUT && !pcap->pending && pcap->len)
+                pcap_swap_locked(pcap);
+        }
+
+        const uint8_t *buf = pcap->buf[pcap->active ^ 1];
+        size_t len = pcap->pending;
+        pthread_mutex_unlock(&pcap->lock);
+        pcap_write_all(pcap, buf, len);
+        pthread_mutex_lock(&pcap->lock);
+        pcap->pending = 0;
+        pthread_cond_broadcast(&pcap->cond);
+    }
+
+    return NULL;
+}
+
+/* Write out whatever is still buffered. Waits for an in-flight batch so the
+ * records stay in order.
+ */
+static void pcap_flush_at_exit(void)
+{
+    for (pcap_writer_t *pcap = pcap_writers; pcap; pcap = pcap->next) {
+        pthread_mutex_lock(&pcap->lock);
+        while (pcap->pending)
+            pthread_cond_wait(&pcap->cond, &pcap->lock);
+        pcap_write_all(pcap, pcap->buf[pcap->active], pcap->len);
+        pcap->len = 0;
+        if (pcap->dropped)
+            fprintf(stderr, "[PCAP] %s: dropped %llu records\n", pcap->path,
+                    (unsigned long long) pcap->dropped);
+        pthread_mutex_unlock(&pcap->lock);
+    }
+}
+
+pcap_writer_t *pcap_open(const char *path)
+{
+    pcap_writer_t *pcap = calloc(1, sizeof(pcap_writer_t));
+    if (!pcap)
+        return NULL;
+
+    pcap->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (pcap->fd < 0) {
+        fprintf(stderr, "[PCAP] failed to open '%s': %s\n", path,
+                strerror(errno));
+        free(pcap);
+        return NULL;
+    }
+    pcap->path = strdup(path);
+    pcap->buf[0] = malloc(PCAP_BUF_SIZE);
+    pcap->buf[1] = malloc(PCAP_BUF_SIZE);
+    if (!pcap->path || !pcap->buf[0] || !pcap->buf[1])
+        goto fail;
+
+    struct pcap_file_header hdr = {
+        .magic = PCAP_MAGIC,
+        .version_major = 2,
+        .version_minor = 4,
+        .snaplen = PCAP_SNAPLEN,
+        .linktype = PCAP_LINKTYPE_ETHERNET,
+    };
+    pcap_write_all(pcap, (const uint8_t *) &hdr, sizeof(hdr));
+
+    pthread_mutex_init(&pcap->lock, NULL);
+    pthread_cond_init(&pcap->cond, NULL);
+    if (pthread_create(&pcap->thread, NULL, pcap_thread, pcap) != 0) {
+        fprintf(stderr, "[PCAP] failed to create writer thread\n");
+        goto fail;
+    }
+    pthread_detach(pcap->thread);
+
+    if (!pcap_writers)
+        atexit(pcap_flush_at_exit);
+    pcap->next = pcap_writers;
+    pcap_writers = pcap;
+    return pcap;
+
+fail:
+    close(pcap->fd);
+    free(pcap->buf[0]);
+    free(pcap->buf[1]);
+    free(pcap->path);
+    free(pcap);
+    return NULL;
+}
+
+void pcap_write_iov(pcap_writer_t *pcap,
+                    const struct iovec *iov,
+                    size_t iovcnt,
+                    size_t len)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    size_t incl_len = len < PCAP_SNAPLEN ? len : PCAP_SNAPLEN;
+    struct pcap_record_header rec = {
+        .ts_sec = (uint32_t) ts.tv_sec,
+        .ts_usec = (uint32_t) (ts.tv_nsec / 1000),
+        .incl_len = (uint32_t) incl_len,
+        .orig_len = (uint32_t) len,
+    };
+    size_t need = sizeof(rec) + incl_len;
+
+    pthread_mutex_lock(&pcap->lock);
+    if (pcap->len + need > PCAP_BUF_SIZE) {
+        if (pcap->pending) {
+            /* Never wait for the disk on the data path */
+            pcap->dropped++;
+            pthread_mutex_unlock(&pcap->lock);
+            return;
+        }
+        pcap_swap_locked(pcap);
+    }
+
+    uint8_t *dst = pcap->buf[pcap->active] + pcap->len;
+    memcpy(dst, &rec, sizeof(rec));
+    dst += sizeof(rec);
+    for (size_t i = 0; i < iovcnt && incl_len; i++) {
+        size_t n = iov[i].iov_len < incl_len ? iov[i].iov_len : incl_len;
+        memcpy(dst, iov[i].iov_base, n);
+        dst += n;
+        incl_len -= n;
+    }
+    pcap->len += need;
+    pthread_mutex_unlock(&pcap->lock);
+}
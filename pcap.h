@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stddef.h>
+#include <sys/uio.h>
+
+/* Wire-level capture of virtio-net frames in the classic libpcap format.
+ *
+ * Records are appended to an in-memory buffer by the emulator thread and
+ * written out in large batches by a dedicated thread, so a slow disk never
+ * stalls the data path. When both buffers are busy the record is dropped and
+ * counted instead of blocking; the count is reported when the process exits.
+ */
+typedef struct pcap_writer pcap_writer_t;
+
+pcap_writer_t *pcap_open(const char *path);
+
+/* Capture the first 'len' bytes described by 'iov' as one Ethernet frame */
+void pcap_write_iov(pcap_writer_t *pcap,
+                    const struct iovec *iov,
+                    size_t iovcnt,
+                    size_t len);
@@ -586,8 +586,18 @@ static inline uint32_t *ram_cache_lookup(hart_t *vm,
     uint32_t page = phys_addr >> RV_PAGE_SHIFT;
     uint32_t *page_base;
 
-    if (unlikely(!vm->ram_base || phys_addr >= vm->ram_size))
+    if (unlikely(!vm->ram_base || phys_addr >= vm->ram_size)) {
+#if SEMU_HAS(VIRTIOFS_DAX)
+        /* Window pages skip the last-page cache, which only tracks RAM; the
+         * TLB entries still get their data_minus_addr.
+         */
+        if (phys_addr - vm->window_start < vm->window_size)
+            return vm->window_base +
+                   (((phys_addr - vm->window_start) >> RV_PAGE_SHIFT)
+                    << (RV_PAGE_SHIFT - 2));
+#endif
         return NULL;
+    }
 
     if (is_store) {
         if (likely(vm->ram_store_last_page == page))
@@ -143,6 +143,15 @@ struct __hart_internal {
     uint32_t ram_store_last_page;
     uint32_t *ram_store_last_ptr;
 
+#if SEMU_HAS(VIRTIOFS_DAX)
+    /* Host memory backing guest physical addresses outside RAM (the virtio-fs
+     * DAX window), reachable through the same direct access paths.
+     */
+    uint32_t *window_base;
+    uint32_t window_start;
+    uint32_t window_size;
+#endif
+
     /* Warm path: interrupt check fields */
     bool sstatus_sie;
     bool s_mode;
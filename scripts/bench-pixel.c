@@ -0,0 +1,124 @@
+/* Micro-benchmark for the virtio-gpu pixel conversion kernels.
+ *
+ * Converts a full-HD frame with every kernel the host supports and reports
+ * the throughput of each against the scalar fallback. Every result is also
+ * compared with the scalar output first, so a broken kernel shows up here
+ * rather than as miscolored pixels in the guest display.
+ *
+ * Usage: scripts/bench-pixel [width height [iterations]]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "vgpu-pixel.h"
+
+/* Pad source rows like a guest framebuffer with a pitch alignment would. */
+#define BENCH_ROW_PAD 64U
+
+static const struct {
+    const char *name;
+    enum vgpu_pixel_swizzle swizzle;
+    bool premultiply;
+} bench_cases[] = {
+    {"copy (BGRX)", VGPU_PIXEL_COPY, false},
+    {"swap_rb (RGBX->BGRX)", VGPU_PIXEL_SWAP_RB, false},
+    {"bswap (XRGB->BGRX)", VGPU_PIXEL_BSWAP, false},
+    {"rotr8 (XBGR->BGRX)", VGPU_PIXEL_ROTR8, false},
+    {"premultiply (cursor)", VGPU_PIXEL_COPY, true},
+    {"bswap+premultiply", VGPU_PIXEL_BSWAP, true},
+};
+
+static double bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t width = 1920, height = 1080, iterations = 200;
+    if (argc >= 3) {
+        width = (uint32_t) strtoul(argv[1], NULL, 0);
+        height = (uint32_t) strtoul(argv[2], NULL, 0);
+    }
+    if (argc >= 4)
+        iterations = (uint32_t) strtoul(argv[3], NULL, 0);
+    if (width == 0 || height == 0 || iterations == 0) {
+        fprintf(stderr, "usage: %s [width height [iterations]]\n", argv[0]);
+        return 1;
+    }
+
+    size_t src_stride = (size_t) width * 4 + BENCH_ROW_PAD;
+    size_t dst_stride = (size_t) width * 4;
+    uint8_t *src = malloc(src_stride * height);
+    uint8_t *expected = malloc(dst_stride * height);
+    uint8_t *dst = malloc(dst_stride * height);
+    if (!src || !expected || !dst) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    /* Arbitrary but reproducible pixels, covering every alpha value. */
+    uint32_t seed = 0x12345678U;
+    for (size_t i = 0; i < src_stride * height; i++) {
+        seed = seed * 1664525U + 1013904223U;
+        src[i] = (uint8_t) (seed >> 24);
+    }
+
+    enum vgpu_pixel_impl best = vgpu_pixel_get_impl();
+    printf("%ux%u, %u iterations, default kernels: %s\n", width, height,
+           iterations, vgpu_pixel_impl_name(best));
+
+    int failed = 0;
+    for (size_t c = 0; c < sizeof(bench_cases) / sizeof(bench_cases[0]);
+         c++) {
+        printf("%s\n", bench_cases[c].name);
+
+        vgpu_pixel_set_impl(VGPU_PIXEL_IMPL_SCALAR);
+        vgpu_pixel_convert(expected, dst_stride, src, src_stride, width,
+                           height, bench_cases[c].swizzle,
+                           bench_cases[c].premultiply);
+
+        double scalar_time = 0;
+        for (int impl = 0; impl < VGPU_PIXEL_IMPL_CNT; impl++) {
+            if (!vgpu_pixel_set_impl((enum vgpu_pixel_impl) impl))
+                continue;
+
+            memset(dst, 0, dst_stride * height);
+            vgpu_pixel_convert(dst, dst_stride, src, src_stride, width, height,
+                               bench_cases[c].swizzle,
+                               bench_cases[c].premultiply);
+            if (memcmp(dst, expected, dst_stride * height) != 0) {
+                printf("  %-8s MISMATCH against scalar output\n",
+                       vgpu_pixel_impl_name((enum vgpu_pixel_impl) impl));
+                failed = 1;
+                continue;
+            }
+
+            double start = bench_now();
+            for (uint32_t i = 0; i < iterations; i++) {
+                vgpu_pixel_convert(dst, dst_stride, src, src_stride, width,
+                                   height, bench_cases[c].swizzle,
+                                   bench_cases[c].premultiply);
+            }
+            double elapsed = (bench_now() - start) / iterations;
+            if (impl == VGPU_PIXEL_IMPL_SCALAR)
+                scalar_time = elapsed;
+
+            double mpixels = (double) width * height / elapsed / 1e6;
+            printf("  %-8s %8.3f ms/frame %9.1f Mpixel/s %6.2fx\n",
+                   vgpu_pixel_impl_name((enum vgpu_pixel_impl) impl),
+                   elapsed * 1e3, mpixels, scalar_time / elapsed);
+        }
+    }
+
+    vgpu_pixel_set_impl(best);
+    free(src);
+    free(expected);
+    free(dst);
+    return failed;
+}
@@ -0,0 +1,549 @@
+/* Minimal vhost-user switch for the 'vhostuser' network backend.
+ *
+ * Listens on a Unix socket and accepts any number of semu instances started
+ * with '-n vhostuser,path=<socket>'. Each of them is one port of a hub: every
+ * frame a guest transmits is copied into the receive ring of all the other
+ * ports, so two guests on the same switch can reach each other directly.
+ *
+ * Only the back-end side of the handshake semu performs is implemented. The
+ * switch offers VIRTIO_F_VERSION_1 and VHOST_USER_F_PROTOCOL_FEATURES with an
+ * empty protocol feature set, maps the guest memory it is given, and then
+ * reads and writes the virtqueues directly. Frames for a port without a free
+ * receive buffer are dropped, as a real link would.
+ *
+ * Usage: scripts/vhost-user-switch <socket>
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define VHOST_USER_VERSION 0x1
+#define VHOST_USER_REPLY_MASK (1U << 2)
+#define VHOST_USER_VRING_NOFD_MASK (1ULL << 8)
+#define VHOST_USER_F_PROTOCOL_FEATURES (1ULL << 30)
+#define VHOST_USER_F_VERSION_1 (1ULL << 32)
+#define VHOST_MEMORY_MAX_NREGIONS 8
+
+enum {
+    VHOST_USER_GET_FEATURES = 1,
+    VHOST_USER_SET_FEATURES = 2,
+    VHOST_USER_SET_OWNER = 3,
+    VHOST_USER_SET_MEM_TABLE = 5,
+    VHOST_USER_SET_VRING_NUM = 8,
+    VHOST_USER_SET_VRING_ADDR = 9,
+    VHOST_USER_SET_VRING_BASE = 10,
+    VHOST_USER_GET_VRING_BASE = 11,
+    VHOST_USER_SET_VRING_KICK = 12,
+    VHOST_USER_SET_VRING_CALL = 13,
+    VHOST_USER_GET_PROTOCOL_FEATURES = 15,
+    VHOST_USER_SET_PROTOCOL_FEATURES = 16,
+    VHOST_USER_SET_VRING_ENABLE = 18,
+};
+
+#define VIRTQ_DESC_F_NEXT 1
+#define VIRTQ_DESC_F_WRITE 2
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 1
+
+#define VNET_HDR_LEN 12 /* struct virtio_net_hdr with num_buffers */
+#define VNET_FRAME_MAX (VNET_HDR_LEN + 65535)
+
+#define SWITCH_PORT_MAX 16
+#define SWITCH_RX 0
+#define SWITCH_TX 1
+
+struct vhost_user_header {
+    uint32_t request;
+    uint32_t flags;
+    uint32_t size;
+} __attribute__((packed));
+
+struct vhost_user_vring_state {
+    uint32_t index;
+    uint32_t num;
+};
+
+struct vhost_user_vring_addr {
+    uint32_t index;
+    uint32_t flags;
+    uint64_t desc;
+    uint64_t used;
+    uint64_t avail;
+    uint64_t log;
+};
+
+struct vhost_user_region {
+    uint64_t guest_phys_addr;
+    uint64_t memory_size;
+    uint64_t userspace_addr;
+    uint64_t mmap_offset;
+};
+
+struct vhost_user_memory {
+    uint32_t nregions;
+    uint32_t padding;
+    struct vhost_user_region regions[VHOST_MEMORY_MAX_NREGIONS];
+};
+
+struct virtq_desc {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+};
+
+struct virtq_used_elem {
+    uint32_t id;
+    uint32_t len;
+};
+
+struct switch_region {
+    struct vhost_user_region info;
+    uint8_t *map; /* whole mapping, starting at file offset 0 */
+    size_t map_len;
+};
+
+struct switch_vring {
+    uint32_t num;
+    struct virtq_desc *desc;
+    uint16_t *avail; /* flags, idx, ring[num] */
+    uint16_t *used;  /* flags, idx, then struct virtq_used_elem[num] */
+    uint16_t last_avail;
+    int kick_fd;
+    int call_fd;
+    bool started; /* kick fd received and GET_VRING_BASE not seen yet */
+    bool enabled;
+};
+
+struct switch_port {
+    int sock_fd;
+    uint64_t features;
+    struct switch_region regions[VHOST_MEMORY_MAX_NREGIONS];
+    uint32_t nregions;
+    struct switch_vring vrings[2];
+};
+
+static struct switch_port ports[SWITCH_PORT_MAX];
+static uint8_t frame[VNET_FRAME_MAX];
+
+/* Translate a guest physical range, or return NULL if it is not mapped */
+static void *switch_gpa(struct switch_port *port, uint64_t addr, size_t len)
+{
+    for (uint32_t i = 0; i < port->nregions; i++) {
+        struct vhost_user_region *r = &port->regions[i].info;
+        if (addr >= r->guest_phys_addr &&
+            len <= r->memory_size - (addr - r->guest_phys_addr))
+            return port->regions[i].map + r->mmap_offset +
+                   (addr - r->guest_phys_addr);
+    }
+    return NULL;
+}
+
+/* Same for the front-end addresses used by SET_VRING_ADDR */
+static void *switch_uva(struct switch_port *port, uint64_t addr, size_t len)
+{
+    for (uint32_t i = 0; i < port->nregions; i++) {
+        struct vhost_user_region *r = &port->regions[i].info;
+        if (addr >= r->userspace_addr &&
+            len <= r->memory_size - (addr - r->userspace_addr))
+            return port->regions[i].map + r->mmap_offset +
+                   (addr - r->userspace_addr);
+    }
+    return NULL;
+}
+
+static void switch_unmap(struct switch_port *port)
+{
+    for (uint32_t i = 0; i < port->nregions; i++)
+        munmap(port->regions[i].map, port->regions[i].map_len);
+    port->nregions = 0;
+    for (int i = 0; i < 2; i++) {
+        struct switch_vring *vring = &port->vrings[i];
+        vring->desc = NULL, vring->avail = NULL, vring->used = NULL;
+        vring->started = false;
+    }
+}
+
+static void switch_close_fd(int *fd)
+{
+    if (*fd >= 0)
+        close(*fd);
+    *fd = -1;
+}
+
+static void switch_port_close(struct switch_port *port)
+{
+    fprintf(stderr, "port %td: disconnected\n", port - ports);
+    switch_unmap(port);
+    for (int i = 0; i < 2; i++) {
+        switch_close_fd(&port->vrings[i].kick_fd);
+        switch_close_fd(&port->vrings[i].call_fd);
+    }
+    switch_close_fd(&port->sock_fd);
+}
+
+static bool switch_vring_ready(struct switch_vring *vring)
+{
+    return vring->started && vring->enabled && vring->num && vring->desc;
+}
+
+/* Pop the next available chain, or return -1 if the ring is empty */
+static int switch_vring_pop(struct switch_vring *vring)
+{
+    uint16_t avail_idx = __atomic_load_n(&vring->avail[1], __ATOMIC_ACQUIRE);
+    if (vring->last_avail == avail_idx)
+        return -1;
+    return vring->avail[2 + vring->last_avail++ % vring->num];
+}
+
+static void switch_vring_push(struct switch_vring *vring,
+                              uint16_t head,
+                              uint32_t len)
+{
+    struct virtq_used_elem *ring = (struct virtq_used_elem *) &vring->used[2];
+    uint16_t used_idx = vring->used[1];
+    ring[used_idx % vring->num] = (struct virtq_used_elem){head, len};
+    __atomic_store_n(&vring->used[1], used_idx + 1, __ATOMIC_RELEASE);
+}
+
+static void switch_vring_notify(struct switch_vring *vring)
+{
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (vring->call_fd < 0 || (vring->avail[0] & VIRTQ_AVAIL_F_NO_INTERRUPT))
+        return;
+    uint64_t one = 1;
+    ssize_t ret = write(vring->call_fd, &one, sizeof(one));
+    (void) ret;
+}
+
+/* Copy one frame into the receive ring of 'port' */
+static void switch_deliver(struct switch_port *port, size_t len)
+{
+    struct switch_vring *vring = &port->vrings[SWITCH_RX];
+    if (!switch_vring_ready(vring))
+        return;
+    int head = switch_vring_pop(vring);
+    if (head < 0)
+        return; /* no buffer posted: drop */
+
+    size_t off = 0;
+    for (uint32_t idx = head, n = 0; off < len && n < vring->num; n++) {
+        struct virtq_desc *desc = &vring->desc[idx % vring->num];
+        uint8_t *buf = switch_gpa(port, desc->addr, desc->len);
+        if (!buf || !(desc->flags & VIRTQ_DESC_F_WRITE))
+            break;
+        size_t chunk = desc->len < len - off ? desc->len : len - off;
+        memcpy(buf, frame + off, chunk);
+        off += chunk;
+        if (!(desc->flags & VIRTQ_DESC_F_NEXT))
+            break;
+        idx = desc->next;
+    }
+    switch_vring_push(vring, head, off);
+    switch_vring_notify(vring);
+}
+
+/* Drain the transmit ring of 'src' and forward every frame to the others */
+static void switch_forward(struct switch_port *src)
+{
+    struct switch_vring *vring = &src->vrings[SWITCH_TX];
+    uint64_t count;
+    ssize_t ret = read(vring->kick_fd, &count, sizeof(count));
+    (void) ret;
+    if (!switch_vring_ready(vring))
+        return;
+
+    int head;
+    while ((head = switch_vring_pop(vring)) >= 0) {
+        size_t len = 0;
+        for (uint32_t idx = head, n = 0; n < vring->num; n++) {
+            struct virtq_desc *desc = &vring->desc[idx % vring->num];
+            uint8_t *buf = switch_gpa(src, desc->addr, desc->len);
+            if (!buf || desc->len > sizeof(frame) - len) {
+                len = 0;
+                break;
+            }
+            memcpy(frame + len, buf, desc->len);
+            len += desc->len;
+            if (!(desc->flags & VIRTQ_DESC_F_NEXT))
+                break;
+            idx = desc->next;
+        }
+        switch_vring_push(vring, head, 0);
+        if (len <= VNET_HDR_LEN)
+            continue;
+
+        /* Each frame fits in one receive chain, so num_buffers is 1 */
+        frame[10] = 1, frame[11] = 0;
+        for (int i = 0; i < SWITCH_PORT_MAX; i++) {
+            if (&ports[i] != src && ports[i].sock_fd >= 0)
+                switch_deliver(&ports[i], len);
+        }
+    }
+    switch_vring_notify(vring);
+}
+
+static bool switch_reply(struct switch_port *port,
+                         uint32_t request,
+                         const void *payload,
+                         uint32_t size)
+{
+    struct vhost_user_header hdr = {
+        .request = request,
+        .flags = VHOST_USER_VERSION | VHOST_USER_REPLY_MASK,
+        .size = size,
+    };
+    struct iovec iov[2] = {
+        {.iov_base = &hdr, .iov_len = sizeof(hdr)},
+        {.iov_base = (void *) payload, .iov_len = size},
+    };
+    struct msghdr msg = {.msg_iov = iov, .msg_iovlen = 2};
+    return sendmsg(port->sock_fd, &msg, MSG_NOSIGNAL) ==
+           (ssize_t) (sizeof(hdr) + size);
+}
+
+static bool switch_set_mem_table(struct switch_port *port,
+                                 const struct vhost_user_memory *mem,
+                                 const int *fds,
+                                 int nfds)
+{
+    if (mem->nregions > VHOST_MEMORY_MAX_NREGIONS ||
+        (int) mem->nregions != nfds)
+        return false;
+    switch_unmap(port);
+    for (uint32_t i = 0; i < mem->nregions; i++) {
+        struct switch_region *region = &port->regions[i];
+        region->info = mem->regions[i];
+        region->map_len = region->info.mmap_offset + region->info.memory_size;
+        region->map = mmap(NULL, region->map_len, PROT_READ | PROT_WRITE,
+                           MAP_SHARED, fds[i], 0);
+        if (region->map == MAP_FAILED) {
+            perror("mmap");
+            return false;
+        }
+        port->nregions++;
+    }
+    return true;
+}
+
+/* Handle one front-end message; false drops the connection */
+static bool switch_handle(struct switch_port *port)
+{
+    struct vhost_user_header hdr;
+    union {
+        uint64_t u64;
+        struct vhost_user_vring_state state;
+        struct vhost_user_vring_addr addr;
+        struct vhost_user_memory mem;
+    } payload;
+    int fds[VHOST_MEMORY_MAX_NREGIONS];
+    union {
+        char buf[CMSG_SPACE(sizeof(fds))];
+        struct cmsghdr align;
+    } ctrl;
+    struct iovec iov = {.iov_base = &hdr, .iov_len = sizeof(hdr)};
+    struct msghdr msg = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = ctrl.buf,
+        .msg_controllen = sizeof(ctrl.buf),
+    };
+
+    if (recvmsg(port->sock_fd, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC) !=
+            (ssize_t) sizeof(hdr) ||
+        hdr.size > sizeof(payload))
+        return false;
+
+    int nfds = 0;
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+         cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            nfds = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            memcpy(fds, CMSG_DATA(cmsg), nfds * sizeof(int));
+        }
+    }
+
+    memset(&payload, 0, sizeof(payload));
+    if (hdr.size &&
+        recv(port->sock_fd, &payload, hdr.size, MSG_WAITALL) !=
+            (ssize_t) hdr.size)
+        return false;
+
+    struct switch_vring *vring = NULL;
+    switch (hdr.request) {
+    case VHOST_USER_SET_VRING_NUM:
+    case VHOST_USER_SET_VRING_ADDR:
+    case VHOST_USER_SET_VRING_BASE:
+    case VHOST_USER_GET_VRING_BASE:
+    case VHOST_USER_SET_VRING_ENABLE:
+        if (payload.state.index >= 2)
+            return false;
+        vring = &port->vrings[payload.state.index];
+        break;
+    case VHOST_USER_SET_VRING_KICK:
+    case VHOST_USER_SET_VRING_CALL:
+        if ((payload.u64 & 0xff) >= 2)
+            return false;
+        vring = &port->vrings[payload.u64 & 0xff];
+        break;
+    }
+
+    bool ok = true;
+    switch (hdr.request) {
+    case VHOST_USER_GET_FEATURES: {
+        uint64_t features =
+            VHOST_USER_F_VERSION_1 | VHOST_USER_F_PROTOCOL_FEATURES;
+        ok = switch_reply(port, hdr.request, &features, sizeof(features));
+        break;
+    }
+    case VHOST_USER_SET_FEATURES:
+        port->features = payload.u64;
+        /* Without protocol features, rings start enabled */
+        for (int i = 0; i < 2; i++)
+            port->vrings[i].enabled =
+                !(port->features & VHOST_USER_F_PROTOCOL_FEATURES);
+        break;
+    case VHOST_USER_GET_PROTOCOL_FEATURES: {
+        uint64_t protocol_features = 0;
+        ok = switch_reply(port, hdr.request, &protocol_features,
+                          sizeof(protocol_features));
+        break;
+    }
+    case VHOST_USER_SET_OWNER:
+    case VHOST_USER_SET_PROTOCOL_FEATURES:
+        break;
+    case VHOST_USER_SET_MEM_TABLE:
+        ok = switch_set_mem_table(port, &payload.mem, fds, nfds);
+        nfds = 0;
+        break;
+    case VHOST_USER_SET_VRING_NUM:
+        ok = payload.state.num && payload.state.num <= 32768;
+        vring->num = payload.state.num;
+        break;
+    case VHOST_USER_SET_VRING_ADDR:
+        vring->desc = switch_uva(port, payload.addr.desc,
+                                 sizeof(struct virtq_desc) * vring->num);
+        vring->avail = switch_uva(port, payload.addr.avail,
+                                  sizeof(uint16_t) * (3 + vring->num));
+        vring->used = switch_uva(
+            port, payload.addr.used,
+            sizeof(uint16_t) * 3 + sizeof(struct virtq_used_elem) * vring->num);
+        ok = vring->desc && vring->avail && vring->used;
+        break;
+    case VHOST_USER_SET_VRING_BASE:
+        vring->last_avail = payload.state.num;
+        break;
+    case VHOST_USER_GET_VRING_BASE:
+        vring->started = false;
+        switch_close_fd(&vring->kick_fd);
+        payload.state.num = vring->last_avail;
+        ok = switch_reply(port, hdr.request, &payload.state,
+                          sizeof(payload.state));
+        break;
+    case VHOST_USER_SET_VRING_KICK:
+    case VHOST_USER_SET_VRING_CALL: {
+        int *fd = hdr.request == VHOST_USER_SET_VRING_KICK ? &vring->kick_fd
+                                                           : &vring->call_fd;
+        switch_close_fd(fd);
+        if (!(payload.u64 & VHOST_USER_VRING_NOFD_MASK) && nfds == 1)
+            *fd = fds[0], nfds = 0;
+        if (hdr.request == VHOST_USER_SET_VRING_KICK)
+            vring->started = true;
+        break;
+    }
+    case VHOST_USER_SET_VRING_ENABLE:
+        vring->enabled = payload.state.num;
+        break;
+    default:
+        fprintf(stderr, "port %td: unsupported request %u\n", port - ports,
+                hdr.request);
+        ok = false;
+        break;
+    }
+
+    for (int i = 0; i < nfds; i++)
+        close(fds[i]);
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc != 2) {
+        fprintf(stderr, "Usage: %s <socket>\n", argv[0]);
+        return 1;
+    }
+
+    struct sockaddr_un addr = {.sun_family = AF_UNIX};
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", argv[1]);
+    unlink(addr.sun_path);
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0 ||
+        bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        listen(listen_fd, SWITCH_PORT_MAX) < 0) {
+        perror(argv[1]);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    for (int i = 0; i < SWITCH_PORT_MAX; i++) {
+        ports[i].sock_fd = -1;
+        for (int j = 0; j < 2; j++)
+            ports[i].vrings[j].kick_fd = ports[i].vrings[j].call_fd = -1;
+    }
+    fprintf(stderr, "listening on %s\n", addr.sun_path);
+
+    for (;;) {
+        /* One entry for the listener, then a socket and a TX kick per port */
+        struct pollfd pfd[1 + 2 * SWITCH_PORT_MAX];
+        pfd[0] = (struct pollfd){listen_fd, POLLIN, 0};
+        for (int i = 0; i < SWITCH_PORT_MAX; i++) {
+            pfd[1 + 2 * i] = (struct pollfd){ports[i].sock_fd, POLLIN, 0};
+            pfd[2 + 2 * i] =
+                (struct pollfd){ports[i].vrings[SWITCH_TX].kick_fd, POLLIN, 0};
+        }
+        if (poll(pfd, 1 + 2 * SWITCH_PORT_MAX, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("poll");
+            return 1;
+        }
+
+        for (int i = 0; i < SWITCH_PORT_MAX; i++) {
+            struct switch_port *port = &ports[i];
+            if (pfd[1 + 2 * i].revents && !switch_handle(port)) {
+                switch_port_close(port);
+                continue;
+            }
+            if (pfd[2 + 2 * i].revents & POLLIN)
+                switch_forward(port);
+        }
+
+        if (pfd[0].revents & POLLIN) {
+            int fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            int i = 0;
+            while (i < SWITCH_PORT_MAX && ports[i].sock_fd >= 0)
+                i++;
+            if (fd >= 0 && i == SWITCH_PORT_MAX) {
+                fprintf(stderr, "no free port, rejecting connection\n");
+                close(fd);
+            } else if (fd >= 0) {
+                memset(&ports[i], 0, sizeof(ports[i]));
+                ports[i].sock_fd = fd;
+                for (int j = 0; j < 2; j++)
+                    ports[i].vrings[j].kick_fd = ports[i].vrings[j].call_fd =
+                        -1;
+                fprintf(stderr, "port %d: connected\n", i);
+            }
+        }
+    }
+}
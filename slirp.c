@@ -1,19 +1,158 @@
-#include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <time.h>
+#if !defined(__APPLE__)
+#include <sys/eventfd.h>
+#endif
 
 #include "netdev.h"
 
+/* Index of the TX ring notification fd in 'usr->pfd'. Slirp sockets are
+ * appended after it on every iteration of the slirp thread.
+ */
+#define SLIRP_PFD_CHANNEL 0
+
+/* Host monotonic time for Slirp timers. The slirp thread must not use
+ * 'semu_timer_get()': during boot that clock source advances a fake tick count
+ * on every call, so reading it from a second thread would perturb guest time.
+ */
+static int64_t net_slirp_host_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static bool slirp_ring_init(slirp_ring_t *ring)
+{
+    ring->frames = calloc(SLIRP_RING_SIZE, sizeof(slirp_frame_t));
+    if (!ring->frames)
+        return false;
+    ring->head = ring->tail = 0;
+    ring->wake_pending = false;
+#if !defined(__APPLE__)
+    int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (fd < 0)
+        goto fail;
+    ring->wake_fd[SLIRP_READ_SIDE] = ring->wake_fd[SLIRP_WRITE_SIDE] = fd;
+#else
+    if (pipe(ring->wake_fd) < 0)
+        goto fail;
+    for (int i = 0; i < 2; i++) {
+        fcntl(ring->wake_fd[i], F_SETFL,
+              fcntl(ring->wake_fd[i], F_GETFL, 0) | O_NONBLOCK);
+        fcntl(ring->wake_fd[i], F_SETFD, FD_CLOEXEC);
+    }
+#endif
+    return true;
+
+fail:
+    free(ring->frames);
+    ring->frames = NULL;
+    return false;
+}
+
+static bool slirp_ring_empty(slirp_ring_t *ring)
+{
+    return __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) ==
+           __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+}
+
+/* Producer side: returns the slot to fill, or NULL if the ring is full */
+static slirp_frame_t *slirp_ring_back(slirp_ring_t *ring)
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    if (((head + 1) & SLIRP_RING_MASK) == tail)
+        return NULL;
+    return &ring->frames[head];
+}
+
+static void slirp_ring_notify(slirp_ring_t *ring)
+{
+#if !defined(__APPLE__)
+    uint64_t one = 1;
+    ssize_t ret = write(ring->wake_fd[SLIRP_WRITE_SIDE], &one, sizeof(one));
+#else
+    uint8_t one = 1;
+    ssize_t ret = write(ring->wake_fd[SLIRP_WRITE_SIDE], &one, sizeof(one));
+#endif
+    (void) ret;
+}
+
+/* Producer side: publishes the slot returned by 'slirp_ring_back()'. Only the
+ * transition of 'wake_pending' from false to true signals the consumer.
+ */
+static void slirp_ring_push(slirp_ring_t *ring)
+{
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->head, (head + 1) & SLIRP_RING_MASK,
+                     __ATOMIC_RELEASE);
+    if (!__atomic_exchange_n(&ring->wake_pending, true, __ATOMIC_SEQ_CST))
+        slirp_ring_notify(ring);
+}
+
+/* Consumer side: returns the oldest frame, or NULL if the ring is empty */
+static slirp_frame_t *slirp_ring_front(slirp_ring_t *ring)
+{
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    if (head == tail)
+        return NULL;
+    return &ring->frames[tail];
+}
+
+static void slirp_ring_pop(slirp_ring_t *ring)
+{
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring->tail, (tail + 1) & SLIRP_RING_MASK,
+                     __ATOMIC_RELEASE);
+}
+
+/* Consumer side: once the ring is drained, consume the notification and allow
+ * the producer to signal again. A frame published between the emptiness check
+ * and clearing 'wake_pending' did not signal, so re-raise it on its behalf.
+ */
+static void slirp_ring_rearm(slirp_ring_t *ring)
+{
+    if (!__atomic_load_n(&ring->wake_pending, __ATOMIC_RELAXED) ||
+        !slirp_ring_empty(ring))
+        return;
+
+#if !defined(__APPLE__)
+    uint64_t count;
+#else
+    uint8_t count[64];
+#endif
+    while (read(ring->wake_fd[SLIRP_READ_SIDE], &count, sizeof(count)) > 0)
+        ;
+    __atomic_store_n(&ring->wake_pending, false, __ATOMIC_SEQ_CST);
+    if (!slirp_ring_empty(ring) &&
+        !__atomic_exchange_n(&ring->wake_pending, true, __ATOMIC_SEQ_CST))
+        slirp_ring_notify(ring);
+}
+
 /* Slirp callback: invoked when Slirp wants to send a packet to the backend */
 static ssize_t net_slirp_send_packet(const void *buf, size_t len, void *opaque)
 {
     net_user_options_t *usr = (net_user_options_t *) opaque;
 
-    return write(usr->guest_to_host_channel[SLIRP_WRITE_SIDE], buf, len);
+    /* Like a full socket buffer, a full ring drops the frame and leaves
+     * recovery to the guest's transport protocols.
+     */
+    slirp_frame_t *frame = slirp_ring_back(&usr->rx_ring);
+    if (!frame || len > SLIRP_FRAME_MAX) {
+        errno = frame ? EMSGSIZE : EAGAIN;
+        return -1;
+    }
+    memcpy(frame->data, buf, len);
+    frame->len = len;
+    slirp_ring_push(&usr->rx_ring);
+    return len;
 }
 
 /* Slirp callback: reports an error from the guest (current unused) */
@@ -25,9 +164,7 @@ static void net_slirp_guest_error(const char *msg UNUSED, void *opaque UNUSED)
 /* Slirp callback: returns current time in nanoseconds for Slirp timers */
 static int64_t net_slirp_clock_get_ns(void *opaque UNUSED)
 {
-    net_user_options_t *usr = (net_user_options_t *) opaque;
-
-    return semu_timer_get(&usr->timer->timer);
+    return net_slirp_host_ns();
 }
 
 /* Slirp callback: called when Slirp has finished initialization */
@@ -40,7 +177,6 @@ static void net_slirp_init_completed(Slirp *slirp, void *opaque)
 static void slirp_timer_init(slirp_timer *t, void (*cb)(void *opaque))
 {
     t->cb = cb;
-    semu_timer_init(&t->timer, CLOCK_FREQ, 1);
 }
 
 static void net_slirp_timer_cb(void *opaque)
@@ -67,19 +203,24 @@ static void *net_slirp_timer_new_opaque(SlirpTimerId id,
 }
 
 /* Slirp callback: releases resources associated with a timer */
-static void net_slirp_timer_free(void *timer, void *opaque UNUSED)
+static void net_slirp_timer_free(void *timer, void *opaque)
 {
+    net_user_options_t *usr = (net_user_options_t *) opaque;
+    if (usr->timer == timer)
+        usr->timer = NULL;
     if (timer)
         free(timer);
 }
 
-/* Slirp callback: modifies the expiration time of an existing timer */
+/* Slirp callback: modifies the expiration time (in milliseconds on the
+ * 'clock_get_ns' time base) of an existing timer
+ */
 static void net_slirp_timer_mod(void *timer,
                                 int64_t expire_time,
                                 void *opaque UNUSED)
 {
     slirp_timer *t = (slirp_timer *) timer;
-    semu_timer_rebase(&t->timer, expire_time);
+    t->expire_timer_msec = expire_time;
 }
 
 /* Slirp callback: registers a pollable socket (unused in this backend) */
@@ -129,6 +270,22 @@ static int poll_to_slirp_poll(int events)
     return ret;
 }
 
+static int slirp_poll_to_poll(int events)
+{
+    int ret = 0;
+    if (events & SLIRP_POLL_IN)
+        ret |= POLLIN;
+    if (events & SLIRP_POLL_OUT)
+        ret |= POLLOUT;
+    if (events & SLIRP_POLL_PRI)
+        ret |= POLLPRI;
+    if (events & SLIRP_POLL_ERR)
+        ret |= POLLERR;
+    if (events & SLIRP_POLL_HUP)
+        ret |= POLLHUP;
+    return ret;
+}
+
 int semu_slirp_get_revents(int idx, void *opaque)
 {
     net_user_options_t *usr = opaque;
@@ -150,27 +307,139 @@ int semu_slirp_add_poll_socket(slirp_os_socket fd, int events, void *opaque)
         int idx = usr->pfd_len++;
         usr->pfd[idx].fd = fd;
 
-        usr->pfd[idx].events = poll_to_slirp_poll(events);
+        usr->pfd[idx].events = slirp_poll_to_poll(events);
         return idx;
     } else {
         return -1;
     }
 }
 
-int net_slirp_read(net_user_options_t *usr)
+/* Feed every frame queued by the guest to Slirp straight from its ring slot */
+static void net_slirp_drain_tx(net_user_options_t *usr)
 {
-    uint8_t pkt[SLIRP_PKT_MAX];
-    ssize_t plen =
-        recv(usr->host_to_guest_channel[SLIRP_READ_SIDE], pkt, sizeof(pkt), 0);
-    if (plen < 0) {
-        if (errno == EAGAIN || errno == EWOULDBLOCK)
-            return 0;
-        fprintf(stderr, "[SLIRP] failed to read packet from virtio-net: %s\n",
-                strerror(errno));
+    slirp_frame_t *frame;
+    while ((frame = slirp_ring_front(&usr->tx_ring))) {
+        slirp_input(usr->slirp, frame->data, frame->len);
+        slirp_ring_pop(&usr->tx_ring);
+    }
+    slirp_ring_rearm(&usr->tx_ring);
+}
+
+ssize_t net_slirp_readv(net_user_options_t *usr,
+                        const struct iovec *iov,
+                        size_t iovcnt)
+{
+    slirp_frame_t *frame = slirp_ring_front(&usr->rx_ring);
+    if (!frame) {
+        errno = EAGAIN;
         return -1;
     }
-    slirp_input(usr->slirp, pkt, plen);
-    return plen;
+
+    /* Like 'readv()' on a datagram socket, excess bytes are discarded */
+    size_t copied = 0;
+    for (size_t i = 0; i < iovcnt && copied < frame->len; i++) {
+        size_t n = MIN(iov[i].iov_len, frame->len - copied);
+        memcpy(iov[i].iov_base, frame->data + copied, n);
+        copied += n;
+    }
+    slirp_ring_pop(&usr->rx_ring);
+    return copied;
+}
+
+ssize_t net_slirp_writev(net_user_options_t *usr,
+                         const struct iovec *iov,
+                         size_t iovcnt)
+{
+    size_t len = 0;
+    for (size_t i = 0; i < iovcnt; i++)
+        len += iov[i].iov_len;
+    if (len > SLIRP_FRAME_MAX) {
+        errno = EMSGSIZE;
+        return -1;
+    }
+
+    slirp_frame_t *frame = slirp_ring_back(&usr->tx_ring);
+    if (!frame) {
+        errno = EAGAIN;
+        return -1;
+    }
+    uint8_t *dst = frame->data;
+    for (size_t i = 0; i < iovcnt; i++) {
+        memcpy(dst, iov[i].iov_base, iov[i].iov_len);
+        dst += iov[i].iov_len;
+    }
+    frame->len = len;
+    slirp_ring_push(&usr->tx_ring);
+    return len;
+}
+
+bool net_slirp_rx_pending(net_user_options_t *usr)
+{
+    return !slirp_ring_empty(&usr->rx_ring);
+}
+
+void net_slirp_rx_rearm(net_user_options_t *usr)
+{
+    slirp_ring_rearm(&usr->rx_ring);
+}
+
+int net_slirp_get_fd(net_user_options_t *usr)
+{
+    return usr->rx_ring.wake_fd[SLIRP_READ_SIDE];
+}
+
+/* Fire the Slirp timer once its deadline has passed. Returns the number of
+ * milliseconds until the (possibly re-armed) deadline, capped at 'timeout'.
+ */
+static uint32_t net_slirp_timer_check(net_user_options_t *usr,
+                                      uint32_t timeout)
+{
+    slirp_timer *t = usr->timer;
+    if (!t || t->expire_timer_msec < 0)
+        return timeout;
+
+    int64_t now_ms = net_slirp_host_ns() / 1000000;
+    if (now_ms >= t->expire_timer_msec) {
+        t->expire_timer_msec = -1;
+        t->cb(t);
+        /* The callback may have freed or re-armed the timer */
+        t = usr->timer;
+        if (!t || t->expire_timer_msec < 0)
+            return timeout;
+        if (now_ms >= t->expire_timer_msec)
+            return 0;
+    }
+    return MIN(timeout, (uint32_t) (t->expire_timer_msec - now_ms));
+}
+
+/* Slirp event loop. Frames transmitted by the guest arrive on 'tx_ring';
+ * frames for the guest leave through 'send_packet' into 'rx_ring', which
+ * virtio-net drains on the emulator thread.
+ * Running here decouples NAT polling from guest instruction execution, so the
+ * emulator neither stalls in 'poll()' nor depends on the hart count.
+ */
+static void *net_slirp_thread(void *arg)
+{
+    net_user_options_t *usr = (net_user_options_t *) arg;
+
+    while (1) {
+        /* Slirp clamps the timeout to its own needs (at most one second) */
+        uint32_t timeout = -1;
+        usr->pfd_len = SLIRP_PFD_CHANNEL + 1;
+        slirp_pollfds_fill_socket(usr->slirp, &timeout,
+                                  semu_slirp_add_poll_socket, usr);
+        timeout = net_slirp_timer_check(usr, timeout);
+
+        int ret = poll(usr->pfd, usr->pfd_len, (int) timeout);
+        if (ret < 0 && errno != EINTR)
+            fprintf(stderr, "[SLIRP] poll failed: %s\n", strerror(errno));
+
+        if (ret > 0 && (usr->pfd[SLIRP_PFD_CHANNEL].revents & POLLIN))
+            net_slirp_drain_tx(usr);
+        slirp_pollfds_poll(usr->slirp, (ret < 0), semu_slirp_get_revents, usr);
+    }
+
+    return NULL;
 }
 
 Slirp *slirp_create(net_user_options_t *usr, SlirpConfig *cfg)
@@ -206,43 +475,111 @@ Slirp *slirp_create(net_user_options_t *usr, SlirpConfig *cfg)
     return slirp_new(cfg, &slirp_cb, usr);
 }
 
+/* Parse "[addr]:port" into 'addr' and 'port'. An empty address leaves
+ * 'addr' untouched so the caller's default applies.
+ */
+static bool net_slirp_parse_addr_port(char *str,
+                                      struct in_addr *addr,
+                                      int *port)
+{
+    char *sep = strrchr(str, ':');
+    if (!sep)
+        return false;
+    *sep = '\0';
+    if (*str && inet_pton(AF_INET, str, addr) != 1)
+        return false;
+
+    char *end;
+    long n = strtol(sep + 1, &end, 10);
+    if (*end || end == sep + 1 || n < 1 || n > 65535)
+        return false;
+    *port = (int) n;
+    return true;
+}
+
+bool net_slirp_add_hostfwd(net_user_options_t *usr, const char *spec)
+{
+    if (usr->hostfwd_cnt >= SLIRP_HOSTFWD_MAX) {
+        fprintf(stderr, "[SLIRP] too many hostfwd rules (max %d)\n",
+                SLIRP_HOSTFWD_MAX);
+        return false;
+    }
+
+    slirp_hostfwd_t fwd = {.host_addr.s_addr = htonl(INADDR_ANY)};
+    inet_pton(AF_INET, "10.0.2.15", &fwd.guest_addr);
+
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%s", spec);
+    char *host = strchr(buf, ':');
+    char *guest = strchr(buf, '-');
+    if (!host || !guest || guest < host)
+        goto invalid;
+    *host++ = '\0';
+    *guest++ = '\0';
+
+    if (!strcmp(buf, "tcp") || !*buf)
+        fwd.is_udp = false;
+    else if (!strcmp(buf, "udp"))
+        fwd.is_udp = true;
+    else
+        goto invalid;
+    if (!net_slirp_parse_addr_port(host, &fwd.host_addr, &fwd.host_port) ||
+        !net_slirp_parse_addr_port(guest, &fwd.guest_addr, &fwd.guest_port))
+        goto invalid;
+
+    usr->hostfwd[usr->hostfwd_cnt++] = fwd;
+    return true;
+
+invalid:
+    fprintf(stderr,
+            "[SLIRP] invalid hostfwd '%s', expected "
+            "[tcp|udp]:[hostaddr]:hostport-[guestaddr]:guestport\n",
+            spec);
+    return false;
+}
+
 int net_slirp_init(net_user_options_t *usr)
 {
     SlirpConfig cfg;
     usr->slirp = slirp_create(usr, &cfg);
     if (usr->slirp == NULL) {
         fprintf(stderr, "create slirp failed\n");
+        return -1;
     }
 
-    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, usr->guest_to_host_channel) < 0)
-        return -1;
-    assert(
-        fcntl(usr->guest_to_host_channel[SLIRP_READ_SIDE], F_SETFL,
-              fcntl(usr->guest_to_host_channel[SLIRP_READ_SIDE], F_GETFL, 0) |
-                  O_NONBLOCK) >= 0);
-    assert(
-        fcntl(usr->guest_to_host_channel[SLIRP_WRITE_SIDE], F_SETFL,
-              fcntl(usr->guest_to_host_channel[SLIRP_WRITE_SIDE], F_GETFL, 0) |
-                  O_NONBLOCK) >= 0);
-
-    if (socketpair(AF_UNIX, SOCK_DGRAM, 0, usr->host_to_guest_channel) < 0)
+    /* Rules must be in place before the slirp thread takes over 'slirp' */
+    for (int i = 0; i < usr->hostfwd_cnt; i++) {
+        slirp_hostfwd_t *fwd = &usr->hostfwd[i];
+        if (slirp_add_hostfwd(usr->slirp, fwd->is_udp, fwd->host_addr,
+                              fwd->host_port, fwd->guest_addr,
+                              fwd->guest_port) < 0) {
+            fprintf(stderr, "[SLIRP] could not forward %s port %d: %s\n",
+                    fwd->is_udp ? "udp" : "tcp", fwd->host_port,
+                    strerror(errno));
+            return -1;
+        }
+    }
+
+    if (!slirp_ring_init(&usr->rx_ring) || !slirp_ring_init(&usr->tx_ring)) {
+        fprintf(stderr, "[SLIRP] failed to allocate frame rings\n");
         return -1;
-    assert(
-        fcntl(usr->host_to_guest_channel[SLIRP_READ_SIDE], F_SETFL,
-              fcntl(usr->host_to_guest_channel[SLIRP_READ_SIDE], F_GETFL, 0) |
-                  O_NONBLOCK) >= 0);
-    assert(
-        fcntl(usr->host_to_guest_channel[SLIRP_WRITE_SIDE], F_SETFL,
-              fcntl(usr->host_to_guest_channel[SLIRP_WRITE_SIDE], F_GETFL, 0) |
-                  O_NONBLOCK) >= 0);
-
-    /* Register the read end of the internal pipe (channel[SLIRP_READ_SIDE])
-     * with slirp's poll system. This allows slirp to monitor it for incoming
-     * data (POLL_IN) or hang-up event (POLL_HUP).
+    }
+
+    /* Register the notification fd of the ring carrying frames transmitted by
+     * the guest as the first poll entry. The slirp thread keeps it in
+     * 'pfd[SLIRP_PFD_CHANNEL]' and appends the sockets of active NAT
+     * connections after it.
+     */
+    semu_slirp_add_poll_socket(usr->tx_ring.wake_fd[SLIRP_READ_SIDE],
+                               SLIRP_POLL_IN, usr);
+
+    /* The thread lives as long as the process, like the other backends which
+     * have no teardown path either.
      */
-    semu_slirp_add_poll_socket(usr->guest_to_host_channel[SLIRP_READ_SIDE],
-                               SLIRP_POLL_IN | SLIRP_POLL_HUP, usr);
-    semu_slirp_add_poll_socket(usr->host_to_guest_channel[SLIRP_READ_SIDE],
-                               SLIRP_POLL_IN | SLIRP_POLL_HUP, usr);
+    if (pthread_create(&usr->thread, NULL, net_slirp_thread, usr) != 0) {
+        fprintf(stderr, "[SLIRP] failed to create slirp thread\n");
+        return -1;
+    }
+    pthread_detach(usr->thread);
     return 0;
 }
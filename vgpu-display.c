@@ -1,16 +1,29 @@
+#include <inttypes.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 
 #include "vgpu-display.h"
 
+/* Frame buffers per scanout and plane: one the window backend may be
+ * uploading, one queued behind it and one the GPU backend is filling. When all
+ * of them are in flight the producer drops the new frame instead of
+ * allocating another buffer.
+ */
+#define VGPU_DISPLAY_POOL_SIZE 3U
+
 /* 'PRIMARY_SET'/'CURSOR_SET' own CPU-frame snapshots, so each queued command
- * can retain significantly more memory than an input event. Keep this backlog
- * deliberately small: display updates are lossy and quickly become stale, and
- * the emulator thread must be able to drop them rather than accumulate a large
- * queue of old frames.
+ * can retain significantly more memory than an input event. Keep each
+ * scanout's backlog deliberately small: display updates are lossy and quickly
+ * become stale, and the emulator thread must be able to drop them rather than
+ * accumulate a large queue of old frames.
  */
 #define VGPU_DISPLAY_CMD_QUEUE_SIZE 64U
 #define VGPU_DISPLAY_CMD_QUEUE_MASK (VGPU_DISPLAY_CMD_QUEUE_SIZE - 1U)
 
+/* Primary frame rate used unless '-r' selects another. */
+#define VGPU_DISPLAY_DEFAULT_REFRESH_HZ 60U
+
 /* Reliable state for plane clear/removal events. The producer advances
  * 'generation' when the guest detaches a plane. The SDL consumer mirrors the
  * last applied value in 'consumed_generation'. Frame payloads remain in the
@@ -27,19 +40,66 @@ static struct vgpu_display_plane_clear_state
     vgpu_display_cursor_clear[VIRTIO_GPU_MAX_SCANOUTS];
 static uint32_t vgpu_display_scanout_count = 1U;
 
-/* The SPSC queue carries lossy frame/move commands. It's process-wide and
- * currently assumes one 'virtio-gpu' producer. The GPU backend is the only
- * producer and the window backend is the only consumer. Commands entering this
- * bridge carry 'scanout_id' values already validated by the guest-facing
- * backend; the SDL consumer relies on that internal contract.
+/* Host display mode of each scanout, set before the window backend starts. */
+static struct {
+    uint32_t width;
+    uint32_t height;
+} vgpu_display_modes[VIRTIO_GPU_MAX_SCANOUTS];
+
+/* Set by the consumer when it cannot apply a partial primary frame, e.g. after
+ * its texture was recreated or an upload failed. The producer consumes it on
+ * the next flush and publishes the whole scanout view instead of the damage.
+ */
+static bool vgpu_display_primary_refresh[VIRTIO_GPU_MAX_SCANOUTS];
+
+/* Each scanout has its own SPSC queue of lossy frame/move commands, so a head
+ * the guest redraws constantly cannot fill the queue and starve the others.
+ * The queues are process-wide and currently assume one 'virtio-gpu' producer.
+ * The GPU backend is the only producer and the window backend is the only
+ * consumer. Commands entering this bridge carry 'scanout_id' values already
+ * validated by the guest-facing backend; the SDL consumer relies on that
+ * internal contract.
+ */
+static struct {
+    struct vgpu_display_cmd cmds[VGPU_DISPLAY_CMD_QUEUE_SIZE];
+    uint32_t head;
+    uint32_t tail;
+} vgpu_display_cmd_queues[VIRTIO_GPU_MAX_SCANOUTS];
+
+/* Consumer-only: queue 'vgpu_display_pop_queued_cmd()' looks at first, so
+ * the scanouts take turns one command at a time.
  */
-static struct vgpu_display_cmd
-    vgpu_display_cmd_queue[VGPU_DISPLAY_CMD_QUEUE_SIZE];
-static uint32_t vgpu_display_cmd_head;
-static uint32_t vgpu_display_cmd_tail;
+static uint32_t vgpu_display_cmd_next_scanout;
 
 static bool vgpu_display_unavailable;
 
+/* Frame pacing, owned by the producer. A scanout may publish its next primary
+ * frame once 'vgpu_display_primary_next_ns' has passed; flushes before that
+ * only add to the damage of the frame waiting for that slot. A zero period
+ * publishes every flush as soon as a buffer is free.
+ */
+static uint64_t vgpu_display_refresh_period_ns =
+    1000000000ULL / VGPU_DISPLAY_DEFAULT_REFRESH_HZ;
+static uint64_t vgpu_display_primary_next_ns[VIRTIO_GPU_MAX_SCANOUTS];
+
+/* Per-scanout counters for 'vgpu_display_report()'. Only the producer writes
+ * them; the report reads them at shutdown, where a slightly stale value is
+ * harmless.
+ */
+static struct {
+    uint64_t published; /* primary frames queued for the window backend */
+    uint64_t coalesced; /* guest flushes folded into a later frame */
+    uint64_t dropped;   /* commands discarded because the queue was full */
+} vgpu_display_stats[VIRTIO_GPU_MAX_SCANOUTS];
+
+/* Buffers are created on first use and then kept, together with their pixel
+ * storage, for the life of the process. Storage only grows, so a stable mode
+ * stops allocating after the first few frames.
+ */
+static struct vgpu_display_payload
+    vgpu_display_pool[VIRTIO_GPU_MAX_SCANOUTS][VGPU_DISPLAY_PLANE_CNT]
+                     [VGPU_DISPLAY_POOL_SIZE];
+
 static bool vgpu_display_is_cmd_stale(const struct vgpu_display_cmd *cmd)
 {
     switch (cmd->type) {
@@ -88,6 +148,13 @@ static bool vgpu_display_pop_pending_clear_cmd(
     return false;
 }
 
+uint64_t vgpu_display_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 void vgpu_display_set_scanout_count(uint32_t scanout_count)
 {
     if (scanout_count > VIRTIO_GPU_MAX_SCANOUTS)
@@ -97,6 +164,27 @@ void vgpu_display_set_scanout_count(uint32_t scanout_count)
                      __ATOMIC_RELEASE);
 }
 
+uint32_t vgpu_display_get_scanout_count(void)
+{
+    return __atomic_load_n(&vgpu_display_scanout_count, __ATOMIC_ACQUIRE);
+}
+
+void vgpu_display_set_scanout_mode(uint32_t scanout_id,
+                                   uint32_t width,
+                                   uint32_t height)
+{
+    vgpu_display_modes[scanout_id].width = width;
+    vgpu_display_modes[scanout_id].height = height;
+}
+
+void vgpu_display_get_scanout_mode(uint32_t scanout_id,
+                                   uint32_t *width,
+                                   uint32_t *height)
+{
+    *width = vgpu_display_modes[scanout_id].width;
+    *height = vgpu_display_modes[scanout_id].height;
+}
+
 void vgpu_display_publish_primary_clear(uint32_t scanout_id)
 {
     if (__atomic_load_n(&vgpu_display_unavailable, __ATOMIC_ACQUIRE))
@@ -115,18 +203,23 @@ void vgpu_display_publish_cursor_clear(uint32_t scanout_id)
                        __ATOMIC_ACQ_REL);
 }
 
-static bool vgpu_display_is_cmd_queue_full(void)
+static bool vgpu_display_is_cmd_queue_full(uint32_t scanout_id)
 {
-    uint32_t head = __atomic_load_n(&vgpu_display_cmd_head, __ATOMIC_RELAXED);
-    uint32_t tail = __atomic_load_n(&vgpu_display_cmd_tail, __ATOMIC_ACQUIRE);
+    uint32_t head = __atomic_load_n(&vgpu_display_cmd_queues[scanout_id].head,
+                                    __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&vgpu_display_cmd_queues[scanout_id].tail,
+                                    __ATOMIC_ACQUIRE);
     uint32_t next = (head + 1U) & VGPU_DISPLAY_CMD_QUEUE_MASK;
     return next == tail;
 }
 
 static void vgpu_display_push_cmd(struct vgpu_display_cmd *cmd)
 {
-    uint32_t head = __atomic_load_n(&vgpu_display_cmd_head, __ATOMIC_RELAXED);
-    uint32_t tail = __atomic_load_n(&vgpu_display_cmd_tail, __ATOMIC_ACQUIRE);
+    uint32_t scanout_id = cmd->scanout_id;
+    uint32_t head = __atomic_load_n(&vgpu_display_cmd_queues[scanout_id].head,
+                                    __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&vgpu_display_cmd_queues[scanout_id].tail,
+                                    __ATOMIC_ACQUIRE);
     uint32_t next = (head + 1U) & VGPU_DISPLAY_CMD_QUEUE_MASK;
 
     /* Keep the producer non-blocking. If the window backend falls behind,
@@ -134,37 +227,108 @@ static void vgpu_display_push_cmd(struct vgpu_display_cmd *cmd)
      * execution on the emulator thread. Clear commands do not use this queue.
      */
     if (next == tail) {
+        vgpu_display_stats[scanout_id].dropped++;
         vgpu_display_release_cmd(cmd);
         return;
     }
 
-    vgpu_display_cmd_queue[head] = *cmd;
-    __atomic_store_n(&vgpu_display_cmd_head, next, __ATOMIC_RELEASE);
+    cmd->publish_ns = vgpu_display_now_ns();
+    vgpu_display_cmd_queues[scanout_id].cmds[head] = *cmd;
+    __atomic_store_n(&vgpu_display_cmd_queues[scanout_id].head, next,
+                     __ATOMIC_RELEASE);
 }
 
 static bool vgpu_display_pop_queued_cmd(struct vgpu_display_cmd *cmd)
 {
-    uint32_t tail = __atomic_load_n(&vgpu_display_cmd_tail, __ATOMIC_RELAXED);
-    uint32_t head = __atomic_load_n(&vgpu_display_cmd_head, __ATOMIC_ACQUIRE);
+    uint32_t scanout_count =
+        __atomic_load_n(&vgpu_display_scanout_count, __ATOMIC_ACQUIRE);
 
-    if (tail == head)
-        return false;
+    for (uint32_t n = 0; n < scanout_count; n++) {
+        uint32_t i = (vgpu_display_cmd_next_scanout + n) % scanout_count;
+        uint32_t tail = __atomic_load_n(&vgpu_display_cmd_queues[i].tail,
+                                        __ATOMIC_RELAXED);
+        uint32_t head = __atomic_load_n(&vgpu_display_cmd_queues[i].head,
+                                        __ATOMIC_ACQUIRE);
 
-    *cmd = vgpu_display_cmd_queue[tail];
-    __atomic_store_n(&vgpu_display_cmd_tail,
-                     (tail + 1U) & VGPU_DISPLAY_CMD_QUEUE_MASK,
-                     __ATOMIC_RELEASE);
-    return true;
+        if (tail == head)
+            continue;
+
+        *cmd = vgpu_display_cmd_queues[i].cmds[tail];
+        __atomic_store_n(&vgpu_display_cmd_queues[i].tail,
+                         (tail + 1U) & VGPU_DISPLAY_CMD_QUEUE_MASK,
+                         __ATOMIC_RELEASE);
+        vgpu_display_cmd_next_scanout = i + 1U;
+        return true;
+    }
+
+    return false;
+}
+
+struct vgpu_display_payload *vgpu_display_acquire_payload(
+    uint32_t scanout_id,
+    enum vgpu_display_plane plane,
+    size_t pixels_size)
+{
+    struct vgpu_display_payload *pool = vgpu_display_pool[scanout_id][plane];
+
+    for (uint32_t i = 0; i < VGPU_DISPLAY_POOL_SIZE; i++) {
+        struct vgpu_display_payload *payload = &pool[i];
+
+        /* Only the producer takes buffers out of the pool, and the consumer
+         * never touches one whose count reached 0. The acquire load orders
+         * the consumer's last reads of the pixels before they are rewritten.
+         */
+        if (__atomic_load_n(&payload->refs, __ATOMIC_ACQUIRE) != 0)
+            continue;
+
+        if (payload->capacity < pixels_size) {
+            uint8_t *storage = malloc(pixels_size);
+            if (!storage)
+                return NULL;
+            free(payload->storage);
+            payload->storage = storage;
+            payload->capacity = pixels_size;
+        }
+        payload->cpu.pixels = payload->storage;
+
+        __atomic_store_n(&payload->refs, 1U, __ATOMIC_RELAXED);
+        return payload;
+    }
+
+    return NULL;
+}
+
+bool vgpu_display_payload_available(uint32_t scanout_id,
+                                    enum vgpu_display_plane plane)
+{
+    struct vgpu_display_payload *pool = vgpu_display_pool[scanout_id][plane];
+
+    for (uint32_t i = 0; i < VGPU_DISPLAY_POOL_SIZE; i++) {
+        if (__atomic_load_n(&pool[i].refs, __ATOMIC_ACQUIRE) == 0)
+            return true;
+    }
+    return false;
+}
+
+void vgpu_display_payload_ref(struct vgpu_display_payload *payload)
+{
+    __atomic_add_fetch(&payload->refs, 1U, __ATOMIC_RELAXED);
+}
+
+void vgpu_display_payload_unref(struct vgpu_display_payload *payload)
+{
+    if (payload)
+        __atomic_sub_fetch(&payload->refs, 1U, __ATOMIC_RELEASE);
 }
 
 void vgpu_display_release_cmd(struct vgpu_display_cmd *cmd)
 {
     switch (cmd->type) {
     case VGPU_DISPLAY_CMD_PRIMARY_SET:
-        free(cmd->u.primary_set.payload);
+        vgpu_display_payload_unref(cmd->u.primary_set.payload);
         break;
     case VGPU_DISPLAY_CMD_CURSOR_SET:
-        free(cmd->u.cursor_set.payload);
+        vgpu_display_payload_unref(cmd->u.cursor_set.payload);
         break;
     default:
         break;
@@ -217,20 +381,84 @@ void vgpu_display_set_unavailable(void)
         vgpu_display_release_cmd(&cmd);
 }
 
-bool vgpu_display_can_publish(void)
+bool vgpu_display_can_publish(uint32_t scanout_id)
 {
     return !__atomic_load_n(&vgpu_display_unavailable, __ATOMIC_ACQUIRE) &&
-           !vgpu_display_is_cmd_queue_full();
+           !vgpu_display_is_cmd_queue_full(scanout_id);
+}
+
+void vgpu_display_request_primary_refresh(uint32_t scanout_id)
+{
+    __atomic_store_n(&vgpu_display_primary_refresh[scanout_id], true,
+                     __ATOMIC_RELEASE);
+}
+
+bool vgpu_display_primary_refresh_pending(uint32_t scanout_id)
+{
+    return __atomic_load_n(&vgpu_display_primary_refresh[scanout_id],
+                           __ATOMIC_ACQUIRE);
+}
+
+bool vgpu_display_take_primary_refresh(uint32_t scanout_id)
+{
+    return __atomic_exchange_n(&vgpu_display_primary_refresh[scanout_id],
+                               false, __ATOMIC_ACQ_REL);
+}
+
+void vgpu_display_set_refresh_rate(uint32_t hz)
+{
+    vgpu_display_refresh_period_ns = hz ? 1000000000ULL / hz : 0;
+}
+
+bool vgpu_display_primary_due(uint32_t scanout_id, uint64_t now_ns)
+{
+    return now_ns >= vgpu_display_primary_next_ns[scanout_id];
+}
+
+uint64_t vgpu_display_primary_due_ns(uint32_t scanout_id)
+{
+    return vgpu_display_primary_next_ns[scanout_id];
+}
+
+void vgpu_display_count_coalesced(uint32_t scanout_id, uint32_t flushes)
+{
+    vgpu_display_stats[scanout_id].coalesced += flushes;
+}
+
+void vgpu_display_report(void)
+{
+    uint32_t scanout_count =
+        __atomic_load_n(&vgpu_display_scanout_count, __ATOMIC_ACQUIRE);
+
+    for (uint32_t i = 0; i < scanout_count; i++) {
+        if (!vgpu_display_stats[i].published && !vgpu_display_stats[i].dropped)
+            continue;
+        fprintf(stderr,
+                VIRTIO_GPU_LOG_PREFIX "scanout %" PRIu32 ": %" PRIu64
+                                      " frames published, %" PRIu64
+                                      " flushes coalesced, %" PRIu64
+                                      " commands dropped\n",
+                i, vgpu_display_stats[i].published,
+                vgpu_display_stats[i].coalesced, vgpu_display_stats[i].dropped);
+    }
 }
 
 void vgpu_display_publish_primary_set(uint32_t scanout_id,
                                       struct vgpu_display_payload *payload)
 {
     if (__atomic_load_n(&vgpu_display_unavailable, __ATOMIC_ACQUIRE)) {
-        free(payload);
+        vgpu_display_payload_unref(payload);
         return;
     }
 
+    /* Start the next refresh slot from now rather than from the previous
+     * slot, so a guest that was idle gets its next flush shown at once.
+     */
+    uint64_t now_ns = vgpu_display_now_ns();
+    vgpu_display_primary_next_ns[scanout_id] =
+        now_ns + vgpu_display_refresh_period_ns;
+    vgpu_display_stats[scanout_id].published++;
+
     struct vgpu_display_cmd cmd = {
         .type = VGPU_DISPLAY_CMD_PRIMARY_SET,
         .scanout_id = scanout_id,
@@ -250,7 +478,7 @@ void vgpu_display_publish_cursor_set(uint32_t scanout_id,
                                      uint32_t hot_y)
 {
     if (__atomic_load_n(&vgpu_display_unavailable, __ATOMIC_ACQUIRE)) {
-        free(payload);
+        vgpu_display_payload_unref(payload);
         return;
     }
 
@@ -9,26 +9,62 @@
 
 #include "virtio-gpu.h"
 
+/* Rectangle in plane coordinates, i.e. relative to the top-left corner of the
+ * scanout view or cursor image rather than to the backing resource.
+ */
+struct vgpu_display_rect {
+    uint32_t x, y;
+    uint32_t width, height;
+};
+
 /* Immutable CPU-frame payload published by the VirtIO GPU backend and later
  * consumed by the window backend when it uploads pixels into its own textures.
+ *
+ * 'width'/'height' give the size of the whole plane, while 'pixels' holds only
+ * the rows of 'damage': 'damage.height' rows of 'damage.width' pixels, 'stride'
+ * bytes apart. Everything outside 'damage' is unchanged since the previous
+ * frame of the same plane, so a consumer that no longer holds that frame must
+ * ask for a full one with 'vgpu_display_request_primary_refresh()'.
+ *
+ * 'format' is always B8G8R8A8 or B8G8R8X8: the GPU backend converts other
+ * guest formats while it snapshots them. Cursor frames are B8G8R8A8 with
+ * premultiplied alpha.
+ *
+ * 'pixels' normally points into the payload's own buffer. A primary plane
+ * already in host order and backed by contiguous guest memory is not copied
+ * at all: 'pixels' then points straight into guest RAM, which stays mapped
+ * for the life of the process but which the guest may keep drawing into, so
+ * such a frame can show pixels newer than the flush that published it.
  */
 struct vgpu_display_cpu_payload {
     enum virtio_gpu_formats format;
     uint32_t width, height;
+    struct vgpu_display_rect damage;
     uint32_t stride;
     uint32_t bits_per_pixel;
     uint8_t *pixels;
 };
 
-/* Owning payload object passed through the display queue. The bridge queues
- * and disposes this object, while GPU and window backends only fill or
- * consume the payload it carries.
+/* Owning payload object passed through the display queue. The bridge owns a
+ * small pool of these per scanout and plane and recycles them once the last
+ * reference is dropped, while GPU and window backends only fill or consume
+ * the payload they carry.
  */
 struct vgpu_display_payload {
     struct vgpu_display_cpu_payload cpu;
     /* TODO: Add a GL/virgl payload when 3D scanout is implemented. The display
      * bridge currently transports CPU-owned 2D frames only.
      */
+
+    uint32_t refs;    /* 0 while the buffer sits idle in its pool */
+    uint8_t *storage; /* buffer owned pixels, 'cpu.pixels' by default */
+    size_t capacity;  /* bytes available at 'storage' */
+};
+
+enum vgpu_display_plane {
+    VGPU_DISPLAY_PLANE_PRIMARY = 0,
+    VGPU_DISPLAY_PLANE_CURSOR,
+    VGPU_DISPLAY_PLANE_CNT,
 };
 
 /* Runtime display commands published by the GPU backend and consumed by the
@@ -54,6 +90,7 @@ struct vgpu_display_cmd {
     enum vgpu_display_cmd_type type;
     uint32_t scanout_id;
     uint32_t generation;
+    uint64_t publish_ns; /* 'vgpu_display_now_ns()' when queued, 0 for clears */
     union {
         struct {
             struct vgpu_display_payload *payload;
@@ -72,14 +109,57 @@ struct vgpu_display_cmd {
     } u;
 };
 
+/* Host monotonic clock used to timestamp published commands. */
+uint64_t vgpu_display_now_ns(void);
+
+/* Scanout layout, fixed before the window backend is initialized: how many
+ * scanouts the GPU exposes and the host display mode of each, which window
+ * backends use to size their windows.
+ */
 void vgpu_display_set_scanout_count(uint32_t scanout_count);
+uint32_t vgpu_display_get_scanout_count(void);
+void vgpu_display_set_scanout_mode(uint32_t scanout_id,
+                                   uint32_t width,
+                                   uint32_t height);
+void vgpu_display_get_scanout_mode(uint32_t scanout_id,
+                                   uint32_t *width,
+                                   uint32_t *height);
 void vgpu_display_publish_primary_clear(uint32_t scanout_id);
 void vgpu_display_publish_cursor_clear(uint32_t scanout_id);
 
+struct vgpu_display_payload *vgpu_display_acquire_payload(
+    uint32_t scanout_id,
+    enum vgpu_display_plane plane,
+    size_t pixels_size);
+/* Producer: true while a buffer of this plane is idle, i.e. the next
+ * 'vgpu_display_acquire_payload()' will not fail for lack of one.
+ */
+bool vgpu_display_payload_available(uint32_t scanout_id,
+                                    enum vgpu_display_plane plane);
+void vgpu_display_payload_ref(struct vgpu_display_payload *payload);
+void vgpu_display_payload_unref(struct vgpu_display_payload *payload);
+
 void vgpu_display_release_cmd(struct vgpu_display_cmd *cmd);
 bool vgpu_display_pop_cmd(struct vgpu_display_cmd *cmd);
 void vgpu_display_set_unavailable(void);
-bool vgpu_display_can_publish(void);
+bool vgpu_display_can_publish(uint32_t scanout_id);
+void vgpu_display_request_primary_refresh(uint32_t scanout_id);
+bool vgpu_display_primary_refresh_pending(uint32_t scanout_id);
+bool vgpu_display_take_primary_refresh(uint32_t scanout_id);
+/* Frame pacing. The GPU backend publishes at most one primary frame per
+ * scanout every 1/'hz' seconds and folds the flushes in between into it; 0
+ * publishes every flush. 'vgpu_display_primary_due()' tells whether the slot
+ * for the next frame has come and 'vgpu_display_primary_due_ns()' when it
+ * comes, and 'vgpu_display_count_coalesced()' records the flushes a frame
+ * absorbed, for 'vgpu_display_report()' to print once the producer has
+ * stopped.
+ */
+void vgpu_display_set_refresh_rate(uint32_t hz);
+bool vgpu_display_primary_due(uint32_t scanout_id, uint64_t now_ns);
+uint64_t vgpu_display_primary_due_ns(uint32_t scanout_id);
+void vgpu_display_count_coalesced(uint32_t scanout_id, uint32_t flushes);
+void vgpu_display_report(void);
+
 void vgpu_display_publish_primary_set(uint32_t scanout_id,
                                       struct vgpu_display_payload *payload);
 void vgpu_display_publish_cursor_set(uint32_t scanout_id,
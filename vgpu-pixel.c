@@ -0,0 +1,423 @@
+#include <string.h>
+
+#include "vgpu-pixel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define VGPU_PIXEL_HAVE_X86 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define VGPU_PIXEL_HAVE_NEON 1
+#endif
+
+/* Row kernels. 'n' counts pixels; pointers carry no alignment guarantee. The
+ * SIMD variants convert whole vectors and leave the remaining tail of each
+ * run to the scalar ones.
+ */
+typedef void (*vgpu_pixel_row_fn)(uint8_t *dst, const uint8_t *src, size_t n);
+typedef void (*vgpu_pixel_premul_fn)(uint8_t *pixels, size_t n);
+
+struct vgpu_pixel_kernels {
+    vgpu_pixel_row_fn swizzle[VGPU_PIXEL_ROTR8 + 1];
+    vgpu_pixel_premul_fn premultiply;
+};
+
+static inline uint32_t vgpu_pixel_load(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void vgpu_pixel_store(uint8_t *p, uint32_t v)
+{
+    memcpy(p, &v, sizeof(v));
+}
+
+/* Round 'c * a / 255' to nearest without a division. Exact for all 8-bit
+ * inputs; the SIMD kernels use the same sequence on 16-bit lanes.
+ */
+static inline uint32_t vgpu_pixel_mul_div255(uint32_t c, uint32_t a)
+{
+    uint32_t t = c * a + 128U;
+    return (t + (t >> 8)) >> 8;
+}
+
+static void vgpu_pixel_copy_row(uint8_t *dst, const uint8_t *src, size_t n)
+{
+    memcpy(dst, src, n * 4);
+}
+
+static void vgpu_pixel_swap_rb_scalar(uint8_t *dst,
+                                      const uint8_t *src,
+                                      size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        uint32_t v = vgpu_pixel_load(src + i * 4);
+        v = (v & 0xff00ff00U) | ((v >> 16) & 0xffU) | ((v & 0xffU) << 16);
+        vgpu_pixel_store(dst + i * 4, v);
+    }
+}
+
+static void vgpu_pixel_bswap_scalar(uint8_t *dst, const uint8_t *src, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        vgpu_pixel_store(dst + i * 4,
+                         __builtin_bswap32(vgpu_pixel_load(src + i * 4)));
+}
+
+static void vgpu_pixel_rotr8_scalar(uint8_t *dst, const uint8_t *src, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        uint32_t v = vgpu_pixel_load(src + i * 4);
+        vgpu_pixel_store(dst + i * 4, (v >> 8) | (v << 24));
+    }
+}
+
+static void vgpu_pixel_premultiply_scalar(uint8_t *pixels, size_t n)
+{
+    for (size_t i = 0; i < n; i++) {
+        uint8_t *p = pixels + i * 4;
+        uint32_t a = p[3];
+        if (a == 0xffU)
+            continue;
+        p[0] = (uint8_t) vgpu_pixel_mul_div255(p[0], a);
+        p[1] = (uint8_t) vgpu_pixel_mul_div255(p[1], a);
+        p[2] = (uint8_t) vgpu_pixel_mul_div255(p[2], a);
+    }
+}
+
+#if VGPU_PIXEL_HAVE_X86
+/* SSE2 has no byte shuffle, so the swizzles are built from lane shifts and
+ * 16-bit shuffles. It is part of the x86-64 baseline; 32-bit hosts check for
+ * it at run time like AVX2.
+ */
+#define VGPU_PIXEL_SSE2 __attribute__((target("sse2")))
+#define VGPU_PIXEL_AVX2 __attribute__((target("avx2")))
+
+VGPU_PIXEL_SSE2
+static void vgpu_pixel_swap_rb_sse2(uint8_t *dst, const uint8_t *src, size_t n)
+{
+    const __m128i ga = _mm_set1_epi32((int) 0xff00ff00U);
+    const __m128i rb = _mm_set1_epi32(0x00ff00ff);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + i * 4));
+        __m128i x = _mm_and_si128(v, rb);
+        x = _mm_or_si128(_mm_slli_epi32(x, 16), _mm_srli_epi32(x, 16));
+        v = _mm_or_si128(_mm_and_si128(v, ga), x);
+        _mm_storeu_si128((__m128i *) (dst + i * 4), v);
+    }
+    vgpu_pixel_swap_rb_scalar(dst + i * 4, src + i * 4, n - i);
+}
+
+VGPU_PIXEL_SSE2
+static void vgpu_pixel_bswap_sse2(uint8_t *dst, const uint8_t *src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + i * 4));
+        /* Swap the bytes of each 16-bit half, then the halves themselves. */
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_si128((__m128i *) (dst + i * 4), v);
+    }
+    vgpu_pixel_bswap_scalar(dst + i * 4, src + i * 4, n - i);
+}
+
+VGPU_PIXEL_SSE2
+static void vgpu_pixel_rotr8_sse2(uint8_t *dst, const uint8_t *src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (src + i * 4));
+        v = _mm_or_si128(_mm_srli_epi32(v, 8), _mm_slli_epi32(v, 24));
+        _mm_storeu_si128((__m128i *) (dst + i * 4), v);
+    }
+    vgpu_pixel_rotr8_scalar(dst + i * 4, src + i * 4, n - i);
+}
+
+/* Premultiply two pixels widened to 16-bit lanes. The alpha lanes are scaled
+ * by 255 instead of by themselves, which leaves them unchanged.
+ */
+VGPU_PIXEL_SSE2
+static inline __m128i vgpu_pixel_premul_epi16_sse2(__m128i px)
+{
+    const __m128i alpha_lanes = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+    __m128i a = _mm_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3));
+    a = _mm_shufflehi_epi16(a, _MM_SHUFFLE(3, 3, 3, 3));
+    a = _mm_or_si128(_mm_andnot_si128(alpha_lanes, a),
+                     _mm_and_si128(alpha_lanes, _mm_set1_epi16(0xff)));
+    __m128i t = _mm_add_epi16(_mm_mullo_epi16(px, a), _mm_set1_epi16(128));
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+VGPU_PIXEL_SSE2
+static void vgpu_pixel_premultiply_sse2(uint8_t *pixels, size_t n)
+{
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *) (pixels + i * 4));
+        __m128i lo = vgpu_pixel_premul_epi16_sse2(_mm_unpacklo_epi8(v, zero));
+        __m128i hi = vgpu_pixel_premul_epi16_sse2(_mm_unpackhi_epi8(v, zero));
+        _mm_storeu_si128((__m128i *) (pixels + i * 4),
+                         _mm_packus_epi16(lo, hi));
+    }
+    vgpu_pixel_premultiply_scalar(pixels + i * 4, n - i);
+}
+
+/* AVX2 shuffles bytes directly, so one kernel covers every swizzle given the
+ * source byte for each destination byte of a pixel.
+ */
+VGPU_PIXEL_AVX2
+static inline void vgpu_pixel_shuffle_avx2(uint8_t *dst,
+                                           const uint8_t *src,
+                                           size_t n,
+                                           __m256i mask,
+                                           vgpu_pixel_row_fn tail)
+{
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (src + i * 4));
+        _mm256_storeu_si256((__m256i *) (dst + i * 4),
+                            _mm256_shuffle_epi8(v, mask));
+    }
+    tail(dst + i * 4, src + i * 4, n - i);
+}
+
+#define VGPU_PIXEL_SHUFFLE_MASK(b0, b1, b2, b3)                              \
+    _mm256_setr_epi8(b0, b1, b2, b3, b0 + 4, b1 + 4, b2 + 4, b3 + 4, b0 + 8, \
+                     b1 + 8, b2 + 8, b3 + 8, b0 + 12, b1 + 12, b2 + 12,      \
+                     b3 + 12, b0, b1, b2, b3, b0 + 4, b1 + 4, b2 + 4,        \
+                     b3 + 4, b0 + 8, b1 + 8, b2 + 8, b3 + 8, b0 + 12,        \
+                     b1 + 12, b2 + 12, b3 + 12)
+
+VGPU_PIXEL_AVX2
+static void vgpu_pixel_swap_rb_avx2(uint8_t *dst, const uint8_t *src, size_t n)
+{
+    vgpu_pixel_shuffle_avx2(dst, src, n, VGPU_PIXEL_SHUFFLE_MASK(2, 1, 0, 3),
+                            vgpu_pixel_swap_rb_scalar);
+}
+
+VGPU_PIXEL_AVX2
+static void vgpu_pixel_bswap_avx2(uint8_t *dst, const uint8_t *src, size_t n)
+{
+    vgpu_pixel_shuffle_avx2(dst, src, n, VGPU_PIXEL_SHUFFLE_MASK(3, 2, 1, 0),
+                            vgpu_pixel_bswap_scalar);
+}
+
+VGPU_PIXEL_AVX2
+static void vgpu_pixel_rotr8_avx2(uint8_t *dst, const uint8_t *src, size_t n)
+{
+    vgpu_pixel_shuffle_avx2(dst, src, n, VGPU_PIXEL_SHUFFLE_MASK(1, 2, 3, 0),
+                            vgpu_pixel_rotr8_scalar);
+}
+
+VGPU_PIXEL_AVX2
+static inline __m256i vgpu_pixel_premul_epi16_avx2(__m256i px)
+{
+    const __m256i alpha_lanes = _mm256_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0, -1,
+                                                 0, 0, 0, -1, 0, 0, 0);
+    __m256i a = _mm256_shufflelo_epi16(px, _MM_SHUFFLE(3, 3, 3, 3));
+    a = _mm256_shufflehi_epi16(a, _MM_SHUFFLE(3, 3, 3, 3));
+    a = _mm256_blendv_epi8(a, _mm256_set1_epi16(0xff), alpha_lanes);
+    __m256i t =
+        _mm256_add_epi16(_mm256_mullo_epi16(px, a), _mm256_set1_epi16(128));
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+VGPU_PIXEL_AVX2
+static void vgpu_pixel_premultiply_avx2(uint8_t *pixels, size_t n)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *) (pixels + i * 4));
+        /* Unpacking and packing both work within 128-bit lanes, so the pixel
+         * order comes out as it went in.
+         */
+        __m256i lo =
+            vgpu_pixel_premul_epi16_avx2(_mm256_unpacklo_epi8(v, zero));
+        __m256i hi =
+            vgpu_pixel_premul_epi16_avx2(_mm256_unpackhi_epi8(v, zero));
+        _mm256_storeu_si256((__m256i *) (pixels + i * 4),
+                            _mm256_packus_epi16(lo, hi));
+    }
+    vgpu_pixel_premultiply_scalar(pixels + i * 4, n - i);
+}
+#endif
+
+#if VGPU_PIXEL_HAVE_NEON
+static void vgpu_pixel_swap_rb_neon(uint8_t *dst, const uint8_t *src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16x4_t v = vld4q_u8(src + i * 4);
+        uint8x16_t r = v.val[0];
+        v.val[0] = v.val[2];
+        v.val[2] = r;
+        vst4q_u8(dst + i * 4, v);
+    }
+    vgpu_pixel_swap_rb_scalar(dst + i * 4, src + i * 4, n - i);
+}
+
+static void vgpu_pixel_bswap_neon(uint8_t *dst, const uint8_t *src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+        vst1q_u8(dst + i * 4, vrev32q_u8(vld1q_u8(src + i * 4)));
+    vgpu_pixel_bswap_scalar(dst + i * 4, src + i * 4, n - i);
+}
+
+static void vgpu_pixel_rotr8_neon(uint8_t *dst, const uint8_t *src, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16x4_t v = vld4q_u8(src + i * 4);
+        uint8x16x4_t w = {{v.val[1], v.val[2], v.val[3], v.val[0]}};
+        vst4q_u8(dst + i * 4, w);
+    }
+    vgpu_pixel_rotr8_scalar(dst + i * 4, src + i * 4, n - i);
+}
+
+/* 'vraddhn(x, vrshr(x, 8))' is '(x + ((x + 128) >> 8) + 128) >> 8', the same
+ * rounding as 'vgpu_pixel_mul_div255()'.
+ */
+static inline uint8x16_t vgpu_pixel_premul_channel_neon(uint8x16_t c,
+                                                        uint8x16_t a)
+{
+    uint16x8_t lo = vmull_u8(vget_low_u8(c), vget_low_u8(a));
+    uint16x8_t hi = vmull_high_u8(c, a);
+    return vcombine_u8(vraddhn_u16(lo, vrshrq_n_u16(lo, 8)),
+                       vraddhn_u16(hi, vrshrq_n_u16(hi, 8)));
+}
+
+static void vgpu_pixel_premultiply_neon(uint8_t *pixels, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16x4_t v = vld4q_u8(pixels + i * 4);
+        for (int c = 0; c < 3; c++)
+            v.val[c] = vgpu_pixel_premul_channel_neon(v.val[c], v.val[3]);
+        vst4q_u8(pixels + i * 4, v);
+    }
+    vgpu_pixel_premultiply_scalar(pixels + i * 4, n - i);
+}
+#endif
+
+#define VGPU_PIXEL_KERNELS(isa)                                  \
+    {                                                            \
+        .swizzle =                                               \
+            {                                                    \
+                [VGPU_PIXEL_COPY] = vgpu_pixel_copy_row,         \
+                [VGPU_PIXEL_SWAP_RB] = vgpu_pixel_swap_rb_##isa, \
+                [VGPU_PIXEL_BSWAP] = vgpu_pixel_bswap_##isa,     \
+                [VGPU_PIXEL_ROTR8] = vgpu_pixel_rotr8_##isa,     \
+            },                                                   \
+        .premultiply = vgpu_pixel_premultiply_##isa,             \
+    }
+
+/* Entries left empty are not built for this host architecture. */
+static const struct vgpu_pixel_kernels
+    vgpu_pixel_kernels[VGPU_PIXEL_IMPL_CNT] = {
+    [VGPU_PIXEL_IMPL_SCALAR] = VGPU_PIXEL_KERNELS(scalar),
+#if VGPU_PIXEL_HAVE_X86
+    [VGPU_PIXEL_IMPL_SSE2] = VGPU_PIXEL_KERNELS(sse2),
+    [VGPU_PIXEL_IMPL_AVX2] = VGPU_PIXEL_KERNELS(avx2),
+#endif
+#if VGPU_PIXEL_HAVE_NEON
+    [VGPU_PIXEL_IMPL_NEON] = VGPU_PIXEL_KERNELS(neon),
+#endif
+};
+
+/* 'VGPU_PIXEL_IMPL_CNT' until the first conversion or explicit selection. */
+static enum vgpu_pixel_impl vgpu_pixel_impl = VGPU_PIXEL_IMPL_CNT;
+
+static bool vgpu_pixel_impl_supported(enum vgpu_pixel_impl impl)
+{
+    if (impl >= VGPU_PIXEL_IMPL_CNT || !vgpu_pixel_kernels[impl].premultiply)
+        return false;
+
+    switch (impl) {
+#if VGPU_PIXEL_HAVE_X86
+    case VGPU_PIXEL_IMPL_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case VGPU_PIXEL_IMPL_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return true;
+    }
+}
+
+enum vgpu_pixel_impl vgpu_pixel_get_impl(void)
+{
+    if (vgpu_pixel_impl == VGPU_PIXEL_IMPL_CNT) {
+        static const enum vgpu_pixel_impl preferred[] = {
+            VGPU_PIXEL_IMPL_AVX2,
+            VGPU_PIXEL_IMPL_NEON,
+            VGPU_PIXEL_IMPL_SSE2,
+        };
+
+        vgpu_pixel_impl = VGPU_PIXEL_IMPL_SCALAR;
+        for (size_t i = 0; i < ARRAY_SIZE(preferred); i++) {
+            if (vgpu_pixel_impl_supported(preferred[i])) {
+                vgpu_pixel_impl = preferred[i];
+                break;
+            }
+        }
+    }
+    return vgpu_pixel_impl;
+}
+
+bool vgpu_pixel_set_impl(enum vgpu_pixel_impl impl)
+{
+    if (!vgpu_pixel_impl_supported(impl))
+        return false;
+    vgpu_pixel_impl = impl;
+    return true;
+}
+
+const char *vgpu_pixel_impl_name(enum vgpu_pixel_impl impl)
+{
+    static const char *const names[VGPU_PIXEL_IMPL_CNT] = {
+        [VGPU_PIXEL_IMPL_SCALAR] = "scalar",
+        [VGPU_PIXEL_IMPL_SSE2] = "sse2",
+        [VGPU_PIXEL_IMPL_AVX2] = "avx2",
+        [VGPU_PIXEL_IMPL_NEON] = "neon",
+    };
+    return impl < VGPU_PIXEL_IMPL_CNT ? names[impl] : "unknown";
+}
+
+void vgpu_pixel_convert(uint8_t *dst,
+                        size_t dst_stride,
+                        const uint8_t *src,
+                        size_t src_stride,
+                        uint32_t width,
+                        uint32_t height,
+                        enum vgpu_pixel_swizzle swizzle,
+                        bool premultiply)
+{
+    const struct vgpu_pixel_kernels *kernels =
+        &vgpu_pixel_kernels[vgpu_pixel_get_impl()];
+    vgpu_pixel_row_fn row = kernels->swizzle[swizzle];
+    size_t n = width;
+    size_t rows = height;
+
+    /* Packed rows on both sides form one run, which keeps the vector loops
+     * going across the row boundaries of narrow damage.
+     */
+    if (src_stride == n * 4 && dst_stride == n * 4) {
+        n *= rows;
+        rows = 1;
+    }
+
+    for (size_t y = 0; y < rows; y++) {
+        uint8_t *d = dst + y * dst_stride;
+        row(d, src + y * src_stride, n);
+        if (premultiply)
+            kernels->premultiply(d, n);
+    }
+}
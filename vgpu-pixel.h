@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Pixel conversion kernels for the display snapshot copy.
+ *
+ * Every format the VirtIO GPU software backend accepts is a 32-bit packed
+ * layout, so converting one into the host display order (B, G, R, A in memory,
+ * i.e. SDL's ARGB8888/XRGB8888 on a little-endian host) is a fixed byte
+ * permutation of each pixel. The permutations below are named after what they
+ * do to a little-endian 32-bit pixel word.
+ */
+enum vgpu_pixel_swizzle {
+    VGPU_PIXEL_COPY = 0, /* already in host order */
+    VGPU_PIXEL_SWAP_RB,  /* R8G8B8A8 <-> B8G8R8A8: swap bytes 0 and 2 */
+    VGPU_PIXEL_BSWAP,    /* A8R8G8B8 <-> B8G8R8A8: reverse all four bytes */
+    VGPU_PIXEL_ROTR8,    /* A8B8G8R8 -> B8G8R8A8: rotate the word right by 8 */
+};
+
+/* Instruction sets a kernel can be built for. The best one the host supports
+ * is picked on first use; 'vgpu_pixel_set_impl()' overrides it.
+ */
+enum vgpu_pixel_impl {
+    VGPU_PIXEL_IMPL_SCALAR = 0,
+    VGPU_PIXEL_IMPL_SSE2,
+    VGPU_PIXEL_IMPL_AVX2,
+    VGPU_PIXEL_IMPL_NEON,
+    VGPU_PIXEL_IMPL_CNT,
+};
+
+/* Convert 'height' rows of 'width' pixels from 'src' into 'dst', each row
+ * 'src_stride'/'dst_stride' bytes apart, applying 'swizzle'. With
+ * 'premultiply', the color channels of the result are also scaled by its
+ * alpha (byte 3), rounded to nearest. The buffers must not overlap and need
+ * no particular alignment.
+ */
+void vgpu_pixel_convert(uint8_t *dst,
+                        size_t dst_stride,
+                        const uint8_t *src,
+                        size_t src_stride,
+                        uint32_t width,
+                        uint32_t height,
+                        enum vgpu_pixel_swizzle swizzle,
+                        bool premultiply);
+
+/* Select the kernels used by 'vgpu_pixel_convert()'. Returns false, leaving
+ * the selection unchanged, when this build or host cannot run 'impl'.
+ */
+bool vgpu_pixel_set_impl(enum vgpu_pixel_impl impl);
+enum vgpu_pixel_impl vgpu_pixel_get_impl(void);
+const char *vgpu_pixel_impl_name(enum vgpu_pixel_impl impl);
@@ -1,11 +1,18 @@
 #include <dirent.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
+#if defined(__linux__)
+#include <sys/inotify.h>
+#endif
 
 #include "device.h"
 #include "fuse.h"
@@ -17,33 +24,357 @@
  */
 #define VFS_DEV_CNT_MAX 1
 
-#define VFS_FEATURES_0 0
+#define VIRTIO_FS_F_NOTIFICATION (1 << 0)
+
+#define VFS_FEATURES_0 VIRTIO_FS_F_NOTIFICATION
 #define VFS_FEATURES_1 1 /* VIRTIO_F_VERSION_1 */
 #define VFS_QUEUE_NUM_MAX 1024
 #define VFS_QUEUE (vfs->queues[vfs->QueueSel])
 #define NUM_REQUEST_QUEUES_ADDR 0x49
+#define NOTIFY_BUF_SIZE_ADDR 0x4a
+#define VFS_SHM_CACHE 0 /* VIRTIO_FS_SHMCAP_ID_CACHE, the DAX window */
+
+/* Queue 0 takes FORGET and other requests that must not wait behind regular
+ * ones. With VIRTIO_FS_F_NOTIFICATION, queue 1 carries notifications to the
+ * guest and request queues follow it.
+ */
+#define VFS_HIPRIO_QUEUE 0
+#define VFS_NOTIFY_QUEUE 1
+#define VFS_NOTIFY_BUF_SIZE                                             \
+    (sizeof(struct fuse_out_header) +                                  \
+     sizeof(struct fuse_notify_inval_entry_out) + VFS_NAME_MAX + 1)
+#define VFS_NAME_MAX 255
+#define VFS_EVENT_BUF_SIZE 4096
+
+/* Default cache lifetime, in seconds, of entries and attributes in the guest.
+ * Host changes only reach guests that take notifications, so without them
+ * this bounds how long the guest may see stale data.
+ */
+#define VFS_DEFAULT_TIMEOUT 1
+
+/* Pages per READ/WRITE request negotiated with FUSE_MAX_PAGES. The guest puts
+ * each page in a descriptor of its own, so this also bounds the chain length.
+ */
+#define VFS_MAX_PAGES 256
+#define VFS_MAX_WRITE (VFS_MAX_PAGES * 4096)
+#define VFS_DESC_MAX (VFS_MAX_PAGES + 8)
+
+/* Host threads serving the request queues */
+#define VFS_WORKERS 4
+
+/* Files and directories the guest may hold open at once, and idle read-only
+ * fds kept around for reopening. Both bound the host fds the device uses.
+ */
+#define VFS_HANDLE_MAX 512
+#define VFS_FD_CACHE_MAX 64
+
+/* Open flags arrive with the values of the guest's Linux ABI (asm-generic),
+ * which are not the host's on macOS.
+ */
+#define LINUX_O_ACCMODE 00000003
+#define LINUX_O_WRONLY 00000001
+#define LINUX_O_RDWR 00000002
+#define LINUX_O_EXCL 00000200
+#define LINUX_O_TRUNC 00001000
+#define LINUX_O_APPEND 00002000
+#define LINUX_O_DSYNC 00010000
+#define LINUX_O_SYNC 04000000
 
 #define PRIV(x) ((struct virtio_fs_config *) x->priv)
 
 PACKED(struct virtio_fs_config {
     char tag[36];
     uint32_t num_request_queues;
-    uint32_t notify_buf_size; /* ignored */
+    uint32_t notify_buf_size;
 });
 
 typedef struct {
     DIR *dir;
     char *path;
+    uint64_t pos; /* 'telldir()' cookie the stream stands at, 0 at the start */
 } dir_handle_t;
 
-inode_map_entry *find_inode_path(inode_map_entry *head, uint64_t ino)
+/* A FUSE file handle: an open file, whose fd may be the one cached in its
+ * inode, or an open directory.
+ */
+struct vfs_handle {
+    int fd;              /* -1 unless an open file */
+    vfs_inode_t *cached; /* owner of 'fd' if shared, NULL if 'fd' is ours */
+    dir_handle_t *dir;   /* NULL unless an open directory */
+};
+
+/* Descriptor chain of one FUSE request. The guest places the request header
+ * and each argument in a device-readable descriptor of its own, bulk data
+ * (e.g., the WRITE payload) taking one descriptor per page, followed by the
+ * device-writable descriptors for the reply header and its arguments.
+ */
+typedef struct {
+    struct virtq_desc desc[VFS_DESC_MAX];
+    uint32_t n_in;  /* device-readable descriptors, starting at desc[0] */
+    uint32_t n_out; /* device-writable descriptors, following them */
+} vfs_req_t;
+
+/* A request handed to the worker pool */
+typedef struct vfs_job {
+    struct vfs_job *next;
+    uint32_t queue; /* index into 'queues' */
+    uint32_t head;  /* first descriptor of the chain */
+    uint32_t len;   /* bytes written into the reply buffers */
+    bool in_use;    /* from submission until published in the used ring */
+    vfs_req_t *req; /* allocated on first use of the slot, then kept */
+} vfs_job_t;
+
+struct vfs_job_list {
+    vfs_job_t *head, *tail;
+};
+
+/* Workers take jobs in submission order, those of the hiprio queue first, and
+ * move them to 'done' when finished; the emulator thread alone touches the
+ * virtqueues, publishing done jobs in the used rings from
+ * 'virtio_fs_refresh_queue()'.
+ */
+struct vfs_pool {
+    pthread_mutex_t lock; /* guards the job lists and 'busy' */
+    pthread_cond_t work;  /* jobs were queued */
+    pthread_cond_t idle;  /* 'busy' dropped to zero */
+    struct vfs_job_list hiprio, regular;
+    vfs_job_t *done;
+    uint32_t busy; /* jobs queued or running */
+    int wake_fd[2];
+
+    /* One job per ring entry of every queue, indexed by the head descriptor
+     * of its chain, which stays unique while the request is in flight. The
+     * slots are small; the descriptor copies, a few KiB each, are allocated
+     * only for the heads the guest actually uses.
+     */
+    vfs_job_t *jobs;
+
+    /* Serializes requests that touch the inode table or other device state.
+     * READ and WRITE only use their file handle and run concurrently.
+     */
+    pthread_mutex_t fs_lock;
+};
+
+#define VFS_INODE_TABLE_MIN 256 /* Must be power of 2 */
+
+static uint32_t vfs_hash_ino(uint64_t ino)
 {
-    while (head) {
-        if (head->ino == ino)
-            return head;
-        head = head->next;
+    /* splitmix64 finalizer: host inode numbers are often sequential */
+    ino ^= ino >> 30;
+    ino *= 0xbf58476d1ce4e5b9ULL;
+    ino ^= ino >> 27;
+    ino *= 0x94d049bb133111ebULL;
+    ino ^= ino >> 31;
+    return (uint32_t) ino;
+}
+
+static uint64_t vfs_hash_path(const char *path)
+{
+    uint64_t h = 0xcbf29ce484222325ULL; /* FNV-1a */
+    while (*path) {
+        h ^= (uint8_t) *path++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint32_t vfs_slot_hash(const vfs_inode_t *inode, bool by_path)
+{
+    return by_path ? (uint32_t) inode->path_hash : vfs_hash_ino(inode->ino);
+}
+
+static void vfs_slot_insert(vfs_inode_t **slots,
+                            uint32_t mask,
+                            vfs_inode_t *inode,
+                            bool by_path)
+{
+    uint32_t i = vfs_slot_hash(inode, by_path) & mask;
+    while (slots[i])
+        i = (i + 1) & mask;
+    slots[i] = inode;
+}
+
+/* Backward-shift deletion keeps probe sequences intact without tombstones */
+static void vfs_slot_remove(vfs_inode_t **slots,
+                            uint32_t mask,
+                            uint32_t i,
+                            bool by_path)
+{
+    slots[i] = NULL;
+    for (uint32_t j = (i + 1) & mask; slots[j]; j = (j + 1) & mask) {
+        uint32_t home = vfs_slot_hash(slots[j], by_path) & mask;
+        /* Leave entries whose home lies cyclically within (i, j] */
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+            continue;
+        slots[i] = slots[j];
+        slots[j] = NULL;
+        i = j;
+    }
+}
+
+static bool vfs_inode_table_resize(vfs_inode_table_t *table, uint32_t capacity)
+{
+    vfs_inode_t **by_ino = calloc(capacity, sizeof(vfs_inode_t *));
+    vfs_inode_t **by_path = calloc(capacity, sizeof(vfs_inode_t *));
+    if (!by_ino || !by_path) {
+        free(by_ino);
+        free(by_path);
+        return false;
+    }
+
+    for (uint32_t i = 0; i < table->capacity; i++) {
+        if (table->by_ino[i])
+            vfs_slot_insert(by_ino, capacity - 1, table->by_ino[i], false);
+        if (table->by_path[i])
+            vfs_slot_insert(by_path, capacity - 1, table->by_path[i], true);
+    }
+    free(table->by_ino);
+    free(table->by_path);
+    table->by_ino = by_ino;
+    table->by_path = by_path;
+    table->capacity = capacity;
+    return true;
+}
+
+static int32_t vfs_inode_slot(const vfs_inode_table_t *table, uint64_t ino)
+{
+    if (!table->capacity)
+        return -1;
+    uint32_t mask = table->capacity - 1;
+    for (uint32_t i = vfs_hash_ino(ino) & mask; table->by_ino[i];
+         i = (i + 1) & mask) {
+        if (table->by_ino[i]->ino == ino)
+            return i;
+    }
+    return -1;
+}
+
+static int32_t vfs_path_slot(const vfs_inode_table_t *table,
+                             const char *path,
+                             uint64_t hash)
+{
+    if (!table->capacity)
+        return -1;
+    uint32_t mask = table->capacity - 1;
+    for (uint32_t i = hash & mask; table->by_path[i]; i = (i + 1) & mask) {
+        vfs_inode_t *inode = table->by_path[i];
+        if (inode->path_hash == hash && !strcmp(inode->path, path))
+            return i;
+    }
+    return -1;
+}
+
+static vfs_inode_t *vfs_inode_get(const vfs_inode_table_t *table, uint64_t ino)
+{
+    int32_t slot = vfs_inode_slot(table, ino);
+    return slot < 0 ? NULL : table->by_ino[slot];
+}
+
+static vfs_inode_t *vfs_inode_find_path(const vfs_inode_table_t *table,
+                                        const char *path)
+{
+    int32_t slot = vfs_path_slot(table, path, vfs_hash_path(path));
+    return slot < 0 ? NULL : table->by_path[slot];
+}
+
+/* Drop 'inode' from the path index only; it stays reachable by number */
+static void vfs_inode_unlink_path(vfs_inode_table_t *table, vfs_inode_t *inode)
+{
+    int32_t slot = vfs_path_slot(table, inode->path, inode->path_hash);
+    if (slot >= 0 && table->by_path[slot] == inode)
+        vfs_slot_remove(table->by_path, table->capacity - 1, slot, true);
+}
+
+/* Point 'inode' at 'path', taking over the path from any stale entry (e.g.,
+ * a host file that was replaced behind the guest's back).
+ */
+static void vfs_inode_set_path(vfs_inode_table_t *table,
+                               vfs_inode_t *inode,
+                               char *path)
+{
+    if (inode->path)
+        vfs_inode_unlink_path(table, inode);
+    uint64_t hash = vfs_hash_path(path);
+    int32_t slot = vfs_path_slot(table, path, hash);
+    if (slot >= 0)
+        vfs_slot_remove(table->by_path, table->capacity - 1, slot, true);
+
+    free(inode->path);
+    inode->path = path;
+    inode->path_hash = hash;
+    vfs_slot_insert(table->by_path, table->capacity - 1, inode, true);
+}
+
+/* Returns the entry for 'ino', creating it with a copy of 'path' if needed */
+static vfs_inode_t *vfs_inode_add(vfs_inode_table_t *table,
+                                  uint64_t ino,
+                                  const char *path)
+{
+    vfs_inode_t *inode = vfs_inode_get(table, ino);
+    if (inode)
+        return inode;
+
+    /* Keep the load factor at or below 1/2 so probe sequences stay short */
+    if ((table->count + 1) * 2 > table->capacity &&
+        !vfs_inode_table_resize(table, table->capacity
+                                           ? table->capacity * 2
+                                           : VFS_INODE_TABLE_MIN))
+        return NULL;
+
+    inode = calloc(1, sizeof(vfs_inode_t));
+    char *copy = strdup(path);
+    if (!inode || !copy) {
+        free(inode);
+        free(copy);
+        return NULL;
+    }
+    inode->ino = ino;
+    inode->fd = -1;
+    vfs_slot_insert(table->by_ino, table->capacity - 1, inode, false);
+    vfs_inode_set_path(table, inode, copy);
+    table->count++;
+    return inode;
+}
+
+/* Take 'inode' out of the table, leaving the entry itself to the caller */
+static void vfs_inode_detach(vfs_inode_table_t *table, vfs_inode_t *inode)
+{
+    int32_t slot = vfs_inode_slot(table, inode->ino);
+    if (slot >= 0)
+        vfs_slot_remove(table->by_ino, table->capacity - 1, slot, false);
+    vfs_inode_unlink_path(table, inode);
+    table->count--;
+}
+
+static void vfs_inode_remove(vfs_inode_table_t *table, vfs_inode_t *inode)
+{
+    vfs_inode_detach(table, inode);
+    free(inode->path);
+    free(inode);
+}
+
+/* A directory moved from 'from' to 'to': follow it with every known inode
+ * below it.
+ */
+static void vfs_inode_move_tree(vfs_inode_table_t *table,
+                                const char *from,
+                                const char *to)
+{
+    size_t from_len = strlen(from), to_len = strlen(to);
+    for (uint32_t i = 0; i < table->capacity; i++) {
+        vfs_inode_t *inode = table->by_ino[i];
+        if (!inode || strncmp(inode->path, from, from_len) ||
+            inode->path[from_len] != '/')
+            continue;
+
+        size_t tail_len = strlen(inode->path + from_len) + 1;
+        char *path = malloc(to_len + tail_len);
+        if (!path)
+            continue;
+        memcpy(path, to, to_len);
+        memcpy(path + to_len, inode->path + from_len, tail_len);
+        vfs_inode_set_path(table, inode, path);
     }
-    return NULL;
 }
 
 static struct virtio_fs_config vfs_configs[VFS_DEV_CNT_MAX];
@@ -64,616 +395,1473 @@ static inline uint32_t vfs_preprocess(virtio_fs_state_t *vfs, uint32_t addr)
     return addr >> 2;
 }
 
-static void virtio_fs_update_status(virtio_fs_state_t *vfs, uint32_t status)
+static void *vfs_req_ptr(const virtio_fs_state_t *vfs,
+                         const struct virtq_desc *desc)
 {
-    vfs->Status |= status;
-    if (status)
-        return;
+    return (void *) ((uintptr_t) vfs->ram + desc->addr);
+}
 
-    /* Reset */
-    uint32_t *ram = vfs->ram;
-    void *priv = vfs->priv;
-    char *mount_tag = vfs->mount_tag;
-    if (!vfs->shared_dir)
-        return;
-    size_t shared_dir_len = strlen(vfs->shared_dir) + 1;
-    char *shared_dir = (char *) malloc(shared_dir_len);
-    if (!shared_dir) {
-        shared_dir = NULL;
-    } else {
-        snprintf(shared_dir, shared_dir_len, "%s", vfs->shared_dir);
+/* Returns argument 'i' of the request, the header being argument 0, if it
+ * holds at least 'size' bytes.
+ */
+static void *vfs_req_arg(const virtio_fs_state_t *vfs,
+                         const vfs_req_t *req,
+                         uint32_t i,
+                         uint32_t size)
+{
+    if (i >= req->n_in || req->desc[i].len < size)
+        return NULL;
+    return vfs_req_ptr(vfs, &req->desc[i]);
+}
+
+/* Returns the NUL-terminated name in argument 'i', refusing names that would
+ * step outside the parent directory.
+ */
+static const char *vfs_req_name(const virtio_fs_state_t *vfs,
+                                const vfs_req_t *req,
+                                uint32_t i)
+{
+    const char *name = vfs_req_arg(vfs, req, i, 1);
+    if (!name || name[req->desc[i].len - 1] != '\0')
+        return NULL;
+    if (!name[0] || strchr(name, '/') || !strcmp(name, ".") ||
+        !strcmp(name, ".."))
+        return NULL;
+    return name;
+}
+
+/* Fill in the reply header for 'size' bytes of reply arguments, which are
+ * already in place. Returns the used length.
+ */
+static uint32_t vfs_reply_header(virtio_fs_state_t *vfs,
+                                 const vfs_req_t *req,
+                                 int32_t error,
+                                 uint32_t size)
+{
+    if (!req->n_out ||
+        req->desc[req->n_in].len < sizeof(struct fuse_out_header))
+        return 0;
+
+    const struct fuse_in_header *in_header = vfs_req_ptr(vfs, &req->desc[0]);
+    struct fuse_out_header *out_header =
+        vfs_req_ptr(vfs, &req->desc[req->n_in]);
+    out_header->len = sizeof(struct fuse_out_header) + size;
+    out_header->error = error;
+    out_header->unique = in_header->unique;
+    return out_header->len;
+}
+
+/* Describe up to 'size' bytes of the reply buffers following the reply
+ * header, which may span several descriptors. Returns the number of iovecs.
+ */
+static int vfs_reply_iov(const virtio_fs_state_t *vfs,
+                         const vfs_req_t *req,
+                         struct iovec *iov,
+                         uint32_t size)
+{
+    int iovcnt = 0;
+    for (uint32_t i = req->n_in + 1; i < req->n_in + req->n_out && size;
+         i++) {
+        uint32_t len = MIN(req->desc[i].len, size);
+        iov[iovcnt].iov_base = vfs_req_ptr(vfs, &req->desc[i]);
+        iov[iovcnt].iov_len = len;
+        iovcnt++;
+        size -= len;
     }
+    return iovcnt;
+}
 
-    inode_map_entry *inode_map = vfs->inode_map;
-    memset(vfs, 0, sizeof(*vfs));
-    vfs->ram = ram;
-    vfs->priv = priv;
-    vfs->mount_tag = mount_tag;
+/* Copy the 'size' bytes of 'payload' into the reply buffers and fill in the
+ * reply header. Returns the used length.
+ */
+static uint32_t vfs_reply(virtio_fs_state_t *vfs,
+                          const vfs_req_t *req,
+                          int32_t error,
+                          const void *payload,
+                          uint32_t size)
+{
+    struct iovec iov[VFS_DESC_MAX];
+    int iovcnt = vfs_reply_iov(vfs, req, iov, size);
+    uint32_t copied = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        memcpy(iov[i].iov_base, (const uint8_t *) payload + copied,
+               iov[i].iov_len);
+        copied += iov[i].iov_len;
+    }
+    if (copied < size)
+        return vfs_reply_header(vfs, req, -EIO, 0);
+    return vfs_reply_header(vfs, req, error, size);
+}
 
-    if (shared_dir) {
-        vfs->shared_dir = strdup(shared_dir);
-        free(shared_dir);
-    } else {
-        if (vfs->shared_dir) {
-            vfs->shared_dir[0] = '\0';
+/* Collect the descriptor chain starting at 'desc_idx', checking that every
+ * buffer lies within guest RAM and that readable ones come first.
+ */
+static int vfs_req_gather(const virtio_fs_state_t *vfs,
+                          const virtio_fs_queue_t *queue,
+                          uint32_t desc_idx,
+                          vfs_req_t *req)
+{
+    req->n_in = req->n_out = 0;
+    for (uint32_t n = 0;; n++) {
+        if (n >= VFS_DESC_MAX || desc_idx >= queue->QueueNum)
+            return -1;
+
+        /* The size of the `struct virtq_desc` is 4 words */
+        const struct virtq_desc *desc =
+            (struct virtq_desc *) &vfs->ram[queue->QueueDesc + desc_idx * 4];
+        if (desc->addr >= RAM_SIZE || desc->len > RAM_SIZE - desc->addr)
+            return -1;
+        if (desc->flags & VIRTIO_DESC_F_WRITE)
+            req->n_out++;
+        else if (req->n_out)
+            return -1;
+        else
+            req->n_in++;
+
+        req->desc[n].addr = desc->addr;
+        req->desc[n].len = desc->len;
+        req->desc[n].flags = desc->flags;
+        if (!(desc->flags & VIRTIO_DESC_F_NEXT))
+            break;
+        desc_idx = desc->next;
+    }
+
+    return 0;
+}
+
+static int vfs_host_open_flags(uint32_t flags)
+{
+    int host_flags = O_RDONLY | O_CLOEXEC;
+    if ((flags & LINUX_O_ACCMODE) == LINUX_O_WRONLY)
+        host_flags = O_WRONLY | O_CLOEXEC;
+    else if ((flags & LINUX_O_ACCMODE) == LINUX_O_RDWR)
+        host_flags = O_RDWR | O_CLOEXEC;
+
+    if (flags & LINUX_O_TRUNC)
+        host_flags |= O_TRUNC;
+    if (flags & LINUX_O_APPEND)
+        host_flags |= O_APPEND;
+    if (flags & LINUX_O_SYNC)
+        host_flags |= O_SYNC;
+    else if (flags & LINUX_O_DSYNC)
+        host_flags |= O_DSYNC;
+    return host_flags;
+}
+
+/* Host path of 'name' inside the directory 'parent', or NULL */
+static char *vfs_child_path(virtio_fs_state_t *vfs,
+                            uint64_t parent,
+                            const char *name)
+{
+    vfs_inode_t *dir = vfs_inode_get(&vfs->inodes, parent);
+    if (!dir || !name)
+        return NULL;
+
+    size_t dir_len = strlen(dir->path), name_len = strlen(name);
+    char *path = malloc(dir_len + 1 + name_len + 1);
+    if (!path)
+        return NULL;
+    memcpy(path, dir->path, dir_len);
+    path[dir_len] = '/';
+    memcpy(path + dir_len + 1, name, name_len + 1);
+    return path;
+}
+
+static void vfs_fill_attr(struct fuse_attr *attr, const struct stat *st)
+{
+    memset(attr, 0, sizeof(*attr));
+    attr->ino = st->st_ino;
+    attr->size = st->st_size;
+    attr->blocks = st->st_blocks;
+    attr->atime = st->st_atime;
+    attr->mtime = st->st_mtime;
+    attr->ctime = st->st_ctime;
+    attr->mode = st->st_mode;
+    attr->nlink = st->st_nlink;
+    attr->uid = st->st_uid;
+    attr->gid = st->st_gid;
+    attr->blksize = st->st_blksize;
+}
+
+static bool vfs_notifications(const virtio_fs_state_t *vfs)
+{
+    return vfs->inotify_fd >= 0 &&
+           (vfs->DriverFeatures & VIRTIO_FS_F_NOTIFICATION);
+}
+
+#if defined(__linux__)
+#define VFS_WATCH_MASK                                                   \
+    (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB | \
+     IN_MODIFY | IN_CLOSE_WRITE | IN_ONLYDIR)
+#endif
+
+/* Watch a directory the guest knows about, so that host-side changes in it
+ * can be pushed out of the guest's caches.
+ */
+static void vfs_watch_dir(virtio_fs_state_t *vfs, vfs_inode_t *inode)
+{
+#if defined(__linux__)
+    if (!vfs_notifications(vfs) || inode->wd > 0)
+        return;
+
+    int wd = inotify_add_watch(vfs->inotify_fd, inode->path, VFS_WATCH_MASK);
+    if (wd <= 0)
+        return;
+    if ((uint32_t) wd >= vfs->watch_cap) {
+        uint32_t cap = vfs->watch_cap ? vfs->watch_cap : 64;
+        while (cap <= (uint32_t) wd)
+            cap *= 2;
+        uint64_t *watch_ino = realloc(vfs->watch_ino, cap * sizeof(uint64_t));
+        if (!watch_ino) {
+            inotify_rm_watch(vfs->inotify_fd, wd);
+            return;
         }
+        memset(watch_ino + vfs->watch_cap, 0,
+               (cap - vfs->watch_cap) * sizeof(uint64_t));
+        vfs->watch_ino = watch_ino;
+        vfs->watch_cap = cap;
     }
+    vfs->watch_ino[wd] = inode->ino;
+    inode->wd = wd;
+#else
+    (void) vfs;
+    (void) inode;
+#endif
+}
 
-    vfs->inode_map = inode_map;
+static void vfs_unwatch_dir(virtio_fs_state_t *vfs, vfs_inode_t *inode)
+{
+#if defined(__linux__)
+    if (inode->wd <= 0)
+        return;
+    inotify_rm_watch(vfs->inotify_fd, inode->wd);
+    vfs->watch_ino[inode->wd] = 0;
+    inode->wd = 0;
+#else
+    (void) vfs;
+    (void) inode;
+#endif
 }
 
-static void virtio_fs_init_handler(virtio_fs_state_t *vfs,
-                                   struct virtq_desc vq_desc[4],
-                                   uint32_t *plen)
+/* Seconds, possibly fractional, as the seconds and nanoseconds FUSE uses */
+static bool vfs_parse_timeout(const char *str, uint64_t *sec, uint32_t *nsec)
 {
-    struct vfs_resp_header *header_resp =
-        (struct vfs_resp_header *) ((uintptr_t) vfs->ram + vq_desc[2].addr);
-    struct fuse_init_out *init_out =
-        (struct fuse_init_out *) ((uintptr_t) vfs->ram + vq_desc[3].addr);
+    char *end;
+    errno = 0;
+    double val = strtod(str, &end);
+    if (errno || end == str || *end || !(val >= 0 && val <= 1e9))
+        return false;
+    *sec = (uint64_t) val;
+    *nsec = (uint32_t) ((val - (double) *sec) * 1e9);
+    return true;
+}
 
-    header_resp->out.len =
-        sizeof(struct fuse_out_header) + sizeof(struct fuse_init_out);
-    header_resp->out.error = 0;
+static bool vfs_parse_options(virtio_fs_state_t *vfs, char *opts)
+{
+    char *save = NULL;
+    for (char *opt = strtok_r(opts, ",", &save); opt;
+         opt = strtok_r(NULL, ",", &save)) {
+        char *val = strchr(opt, '=');
+        if (!val || !val[1]) {
+            fprintf(stderr, "virtio-fs option '%s' expects a value\n", opt);
+            return false;
+        }
+        *val++ = '\0';
 
-    /* Fill init_out with capabilities */
-    init_out->major = 7;
-    init_out->minor = 41;
-    init_out->max_readahead = 0x10000;
-    init_out->flags = FUSE_ASYNC_READ | FUSE_BIG_WRITES | FUSE_DO_READDIRPLUS;
-    init_out->max_background = 64;
-    init_out->congestion_threshold = 32;
-    init_out->max_write = 0x131072;
-    init_out->time_gran = 1;
+        bool entry = !strcmp(opt, "timeout") || !strcmp(opt, "entry_timeout");
+        bool attr = !strcmp(opt, "timeout") || !strcmp(opt, "attr_timeout");
+        if (!entry && !attr) {
+            fprintf(stderr, "unsupported virtio-fs option '%s'\n", opt);
+            return false;
+        }
+        if ((entry && !vfs_parse_timeout(val, &vfs->entry_valid,
+                                         &vfs->entry_valid_nsec)) ||
+            (attr && !vfs_parse_timeout(val, &vfs->attr_valid,
+                                        &vfs->attr_valid_nsec))) {
+            fprintf(stderr, "virtio-fs option '%s' expects seconds\n", opt);
+            return false;
+        }
+    }
+    return true;
+}
 
-    *plen = header_resp->out.len;
+static void vfs_fill_attr_out(const virtio_fs_state_t *vfs,
+                              struct fuse_attr_out *attr_out,
+                              const struct stat *st)
+{
+    memset(attr_out, 0, sizeof(*attr_out));
+    attr_out->attr_valid = vfs->attr_valid;
+    attr_out->attr_valid_nsec = vfs->attr_valid_nsec;
+    vfs_fill_attr(&attr_out->attr, st);
 }
 
-static void virtio_fs_getattr_handler(virtio_fs_state_t *vfs,
-                                      struct virtq_desc vq_desc[4],
-                                      uint32_t *plen)
+/* Describe 'path', whose attributes are 'st', in 'entry_out' and register its
+ * inode. Like a LOOKUP reply, the entry is one reference the guest will
+ * FORGET. Returns 0 or -errno.
+ */
+static int vfs_fill_entry(virtio_fs_state_t *vfs,
+                          const char *path,
+                          const struct stat *st,
+                          struct fuse_entry_out *entry_out)
 {
-    const struct fuse_in_header *in_header =
-        (struct fuse_in_header *) ((uintptr_t) vfs->ram + vq_desc[0].addr);
-    uint64_t inode = in_header->nodeid;
-    struct vfs_resp_header *header_resp =
-        (struct vfs_resp_header *) ((uintptr_t) vfs->ram + vq_desc[2].addr);
-    struct fuse_attr_out *outattr =
-        (struct fuse_attr_out *) ((uintptr_t) vfs->ram + vq_desc[3].addr);
+    vfs_inode_t *inode = vfs_inode_add(&vfs->inodes, st->st_ino, path);
+    if (!inode)
+        return -ENOMEM;
+    /* A known inode reached under another name was renamed (or hard linked)
+     * on the host; follow the name the guest is using now.
+     */
+    if (vfs_inode_find_path(&vfs->inodes, path) != inode) {
+        char *copy = strdup(path);
+        if (copy)
+            vfs_inode_set_path(&vfs->inodes, inode, copy);
+    }
+    inode->nlookup++;
+    if (S_ISDIR(st->st_mode))
+        vfs_watch_dir(vfs, inode);
 
-    header_resp->out.len =
-        sizeof(struct fuse_out_header) + sizeof(struct fuse_attr_out);
-    header_resp->out.error = 0;
+    memset(entry_out, 0, sizeof(*entry_out));
+    entry_out->nodeid = st->st_ino;
+    entry_out->entry_valid = vfs->entry_valid;
+    entry_out->entry_valid_nsec = vfs->entry_valid_nsec;
+    entry_out->attr_valid = vfs->attr_valid;
+    entry_out->attr_valid_nsec = vfs->attr_valid_nsec;
+    vfs_fill_attr(&entry_out->attr, st);
+    return 0;
+}
 
-    const char *target_path = NULL;
+static int vfs_make_entry(virtio_fs_state_t *vfs,
+                          const char *path,
+                          struct fuse_entry_out *entry_out)
+{
     struct stat st;
+    if (lstat(path, &st) < 0)
+        return -errno;
+    return vfs_fill_entry(vfs, path, &st, entry_out);
+}
 
-    /* root entry (inode=1) */
-    if (inode == 1) {
-        target_path = vfs->shared_dir;
-    } else {
-        inode_map_entry *entry = find_inode_path(vfs->inode_map, inode);
-        if (!entry) {
-            header_resp->out.error = -ENOENT;
-            *plen = sizeof(struct fuse_out_header);
-            return;
+/* Returns the handle for 'fh' if it is open */
+static struct vfs_handle *vfs_handle_get(const virtio_fs_state_t *vfs,
+                                         uint64_t fh)
+{
+    if (!fh || fh > VFS_HANDLE_MAX)
+        return NULL;
+    struct vfs_handle *handle = &vfs->handles[fh - 1];
+    return (handle->fd >= 0 || handle->dir) ? handle : NULL;
+}
+
+/* Host fd of an open file, -1 (making the system call fail with EBADF) if
+ * 'fh' is not one.
+ */
+static int vfs_handle_fd(const virtio_fs_state_t *vfs, uint64_t fh)
+{
+    struct vfs_handle *handle = vfs_handle_get(vfs, fh);
+    return handle ? handle->fd : -1;
+}
+
+/* Returns the FUSE handle of a free slot, 0 if all are taken */
+static uint64_t vfs_handle_alloc(virtio_fs_state_t *vfs)
+{
+    for (uint32_t n = 0; n < VFS_HANDLE_MAX; n++) {
+        uint32_t i = (vfs->handle_next + n) % VFS_HANDLE_MAX;
+        if (vfs->handles[i].fd < 0 && !vfs->handles[i].dir) {
+            vfs->handle_next = (i + 1) % VFS_HANDLE_MAX;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static void vfs_lru_unlink(virtio_fs_state_t *vfs, vfs_inode_t *inode)
+{
+    if (inode->lru_prev)
+        inode->lru_prev->lru_next = inode->lru_next;
+    else
+        vfs->lru_head = inode->lru_next;
+    if (inode->lru_next)
+        inode->lru_next->lru_prev = inode->lru_prev;
+    else
+        vfs->lru_tail = inode->lru_prev;
+    inode->lru_prev = inode->lru_next = NULL;
+    vfs->lru_count--;
+}
+
+static void vfs_lru_push(virtio_fs_state_t *vfs, vfs_inode_t *inode)
+{
+    inode->lru_prev = vfs->lru_tail;
+    inode->lru_next = NULL;
+    if (vfs->lru_tail)
+        vfs->lru_tail->lru_next = inode;
+    else
+        vfs->lru_head = inode;
+    vfs->lru_tail = inode;
+    vfs->lru_count++;
+}
+
+/* Close the idle cached fd of 'inode'. An fd that handles still share is
+ * never closed here: READ and WRITE use it without holding 'fs_lock'.
+ */
+static void vfs_fd_uncache(virtio_fs_state_t *vfs, vfs_inode_t *inode)
+{
+    if (inode->fd < 0 || inode->fd_users)
+        return;
+    vfs_lru_unlink(vfs, inode);
+    close(inode->fd);
+    inode->fd = -1;
+}
+
+/* Close idle cached fds, least recently used first, down to 'limit' */
+static void vfs_fd_trim(virtio_fs_state_t *vfs, uint32_t limit)
+{
+    while (vfs->lru_count > limit)
+        vfs_fd_uncache(vfs, vfs->lru_head);
+}
+
+/* 'open()', making room among the idle cached fds when out of fds */
+static int vfs_open(virtio_fs_state_t *vfs,
+                    const char *path,
+                    int flags,
+                    mode_t mode)
+{
+    int fd = open(path, flags, mode);
+    if (fd < 0 && (errno == EMFILE || errno == ENFILE) && vfs->lru_count) {
+        vfs_fd_trim(vfs, 0);
+        fd = open(path, flags, mode);
+    }
+    return fd;
+}
+
+static void vfs_handle_release(virtio_fs_state_t *vfs,
+                               struct vfs_handle *handle)
+{
+    if (handle->dir) {
+        closedir(handle->dir->dir);
+        free(handle->dir->path);
+        free(handle->dir);
+        handle->dir = NULL;
+    } else if (handle->cached) {
+        vfs_inode_t *inode = handle->cached;
+        if (--inode->fd_users == 0 && inode->forgotten) {
+            close(inode->fd);
+            free(inode->path);
+            free(inode);
+        } else if (!inode->fd_users) {
+            vfs_lru_push(vfs, inode);
+            vfs_fd_trim(vfs, VFS_FD_CACHE_MAX);
         }
-        target_path = entry->path;
+        handle->cached = NULL;
+    } else {
+        close(handle->fd);
     }
+    handle->fd = -1;
+}
+
+static uint32_t vfs_page_size(void)
+{
+    static uint32_t page_size;
+    if (!page_size)
+        page_size = (uint32_t) sysconf(_SC_PAGESIZE);
+    return page_size;
+}
+
+static bool vfs_dax_range_valid(const virtio_fs_state_t *vfs,
+                                uint64_t offset,
+                                uint64_t len)
+{
+    if (!vfs->dax_window || !len || ((offset | len) & (vfs_page_size() - 1)))
+        return false;
+    return offset < VFS_DAX_SIZE && len <= VFS_DAX_SIZE - offset;
+}
+
+/* Back a range of the DAX window with anonymous memory again, so that stray
+ * guest accesses read zeros instead of faulting the host. Returns 0 or
+ * -errno.
+ */
+static int vfs_dax_unmap(virtio_fs_state_t *vfs, uint64_t offset, uint64_t len)
+{
+    if (!vfs_dax_range_valid(vfs, offset, len))
+        return -EINVAL;
+
+    void *addr = (uint8_t *) vfs->dax_window + offset;
+    if (mmap(addr, len, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_NORESERVE, -1,
+             0) == MAP_FAILED)
+        return -errno;
+    return 0;
+}
 
-    if (stat(target_path, &st) < 0) {
-        header_resp->out.error = -errno;
-        *plen = sizeof(struct fuse_out_header);
+/* Wait for the workers to finish with guest memory and drop their results,
+ * as the queues they belong to are going away.
+ */
+static void vfs_pool_drain(virtio_fs_state_t *vfs)
+{
+    struct vfs_pool *pool = vfs->pool;
+    pthread_mutex_lock(&pool->lock);
+    while (pool->busy)
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    vfs_job_t *job = pool->done;
+    pool->done = NULL;
+    char drain[64];
+    while (read(pool->wake_fd[0], drain, sizeof(drain)) > 0)
+        ;
+    pthread_mutex_unlock(&pool->lock);
+
+    for (; job; job = job->next)
+        job->in_use = false;
+}
+
+static void virtio_fs_update_status(virtio_fs_state_t *vfs, uint32_t status)
+{
+    vfs->Status |= status;
+    if (status)
         return;
+
+    /* Reset the transport only. The shared directory, the inode table and
+     * the host resources behind them outlive the driver.
+     */
+    if (vfs->pool)
+        vfs_pool_drain(vfs);
+    vfs->DeviceFeaturesSel = 0;
+    vfs->DriverFeatures = 0;
+    vfs->DriverFeaturesSel = 0;
+    vfs->QueueSel = 0;
+    memset(vfs->queues, 0, sizeof(vfs->queues));
+    vfs->InterruptStatus = 0;
+    vfs->SHMSel = 0;
+    if (vfs->dax_window)
+        vfs_dax_unmap(vfs, 0, VFS_DAX_SIZE);
+    /* A new driver starts without open files */
+    for (uint64_t fh = 1; fh <= VFS_HANDLE_MAX; fh++) {
+        struct vfs_handle *handle = vfs_handle_get(vfs, fh);
+        if (handle)
+            vfs_handle_release(vfs, handle);
     }
+    /* Changes already seen are moot for a driver that starts over */
+    vfs->event_off = vfs->event_len;
+}
 
-    outattr->attr_valid = 60;
-    outattr->attr_valid_nsec = 0;
-    outattr->attr.ino = st.st_ino;
-    outattr->attr.size = st.st_size;
-    outattr->attr.blocks = st.st_blocks;
-    outattr->attr.atime = st.st_atime;
-    outattr->attr.mtime = st.st_mtime;
-    outattr->attr.ctime = st.st_ctime;
-    outattr->attr.mode = st.st_mode;
-    outattr->attr.nlink = st.st_nlink;
-    outattr->attr.uid = st.st_uid;
-    outattr->attr.gid = st.st_gid;
-    outattr->attr.blksize = st.st_blksize;
+static void virtio_fs_init_handler(virtio_fs_state_t *vfs,
+                                   const vfs_req_t *req,
+                                   uint32_t *plen)
+{
+    /* Fill init_out with capabilities */
+    struct fuse_init_out init_out = {
+        .major = 7,
+        .minor = 41,
+        .max_readahead = 0x10000,
+        .flags = FUSE_ASYNC_READ | FUSE_BIG_WRITES | FUSE_DO_READDIRPLUS |
+                 FUSE_MAX_PAGES,
+        .max_background = 64,
+        .congestion_threshold = 32,
+        /* Without FUSE_MAX_PAGES the guest caps requests at 32 pages whatever
+         * 'max_write' says.
+         */
+        .max_write = VFS_MAX_WRITE,
+        .max_pages = VFS_MAX_PAGES,
+        .time_gran = 1,
+    };
+    /* The root is registered before the driver shows up */
+    vfs_inode_t *root = vfs_inode_get(&vfs->inodes, 1);
+    if (root)
+        vfs_watch_dir(vfs, root);
+
+    /* DAX ranges must line up with host pages to be mmap()ed */
+    if (vfs->dax_window) {
+        init_out.flags |= FUSE_MAP_ALIGNMENT;
+        init_out.map_alignment = __builtin_ctz(vfs_page_size());
+    }
+    *plen = vfs_reply(vfs, req, 0, &init_out, sizeof(init_out));
+}
+
+static void virtio_fs_getattr_handler(virtio_fs_state_t *vfs,
+                                      const vfs_req_t *req,
+                                      uint32_t *plen)
+{
+    const struct fuse_in_header *in_header = vfs_req_ptr(vfs, &req->desc[0]);
+    vfs_inode_t *entry = vfs_inode_get(&vfs->inodes, in_header->nodeid);
+    if (!entry) {
+        *plen = vfs_reply(vfs, req, -ENOENT, NULL, 0);
+        return;
+    }
 
-    *plen = header_resp->out.len;
+    struct stat st;
+    if (lstat(entry->path, &st) < 0) {
+        *plen = vfs_reply(vfs, req, -errno, NULL, 0);
+        return;
+    }
+
+    struct fuse_attr_out attr_out;
+    vfs_fill_attr_out(vfs, &attr_out, &st);
+    *plen = vfs_reply(vfs, req, 0, &attr_out, sizeof(attr_out));
 }
 
 static void virtio_fs_opendir_handler(virtio_fs_state_t *vfs,
-                                      struct virtq_desc vq_desc[4],
+                                      const vfs_req_t *req,
                                       uint32_t *plen)
 {
-    struct fuse_in_header *in_header =
-        (struct fuse_in_header *) ((uintptr_t) vfs->ram + vq_desc[0].addr);
-    uint64_t nodeid = in_header->nodeid;
-
-    inode_map_entry *entry = find_inode_path(vfs->inode_map, nodeid);
+    const struct fuse_in_header *in_header = vfs_req_ptr(vfs, &req->desc[0]);
+    vfs_inode_t *entry = vfs_inode_get(&vfs->inodes, in_header->nodeid);
     if (!entry) {
+        *plen = vfs_reply(vfs, req, -ENOENT, NULL, 0);
         return;
     }
 
     DIR *dir = opendir(entry->path);
     if (!dir) {
+        *plen = vfs_reply(vfs, req, -errno, NULL, 0);
         return;
     }
 
-    /* Allocate dir_handle_t structure */
+    uint64_t fh = vfs_handle_alloc(vfs);
     dir_handle_t *handle = malloc(sizeof(dir_handle_t));
-    if (!handle) {
-        closedir(dir);
-        return;
-    }
-    handle->dir = dir;
-
-    /* Dynamically allocate and copy the path string */
-    size_t path_len = strlen(entry->path) + 1;
-    handle->path = malloc(path_len);
-    if (!handle->path) {
+    char *path = strdup(entry->path);
+    if (!fh || !handle || !path) {
         closedir(dir);
         free(handle);
+        free(path);
+        *plen = vfs_reply(vfs, req, fh ? -ENOMEM : -ENFILE, NULL, 0);
         return;
     }
-    memcpy(handle->path, entry->path, path_len);
+    handle->dir = dir;
+    handle->path = path;
+    handle->pos = 0;
+    vfs->handles[fh - 1].dir = handle;
 
-    struct fuse_open_out *open_out =
-        (struct fuse_open_out *) ((uintptr_t) vfs->ram + vq_desc[3].addr);
-    memset(open_out, 0, sizeof(*open_out));
-    open_out->fh = (uint64_t) handle;
-    open_out->open_flags = 0;
+    struct fuse_open_out open_out = {.fh = fh};
+    *plen = vfs_reply(vfs, req, 0, &open_out, sizeof(open_out));
+}
 
-    struct vfs_resp_header *header_resp =
-        (struct vfs_resp_header *) ((uintptr_t) vfs->ram + vq_desc[2].addr);
-    header_resp->out.len =
-        sizeof(struct fuse_out_header) + sizeof(struct fuse_open_out);
-    header_resp->out.error = 0;
-    *plen = header_resp->out.len;
+static void vfs_dir_seek(dir_handle_t *handle, uint64_t pos)
+{
+    if (pos)
+        seekdir(handle->dir, (long) pos);
+    else
+        rewinddir(handle->dir);
+    handle->pos = pos;
 }
 
 static void virtio_fs_readdirplus_handler(virtio_fs_state_t *vfs,
-                                          struct virtq_desc vq_desc[4],
+                                          const vfs_req_t *req,
                                           uint32_t *plen)
 {
-    struct fuse_read_in *read_in =
-        (struct fuse_read_in *) ((uintptr_t) vfs->ram + vq_desc[1].addr);
-    dir_handle_t *handle = (dir_handle_t *) (uintptr_t) read_in->fh;
-    if (!handle || !handle->dir) {
+    const struct fuse_read_in *read_in =
+        vfs_req_arg(vfs, req, 1, sizeof(struct fuse_read_in));
+    struct vfs_handle *fh = read_in ? vfs_handle_get(vfs, read_in->fh) : NULL;
+    dir_handle_t *handle = fh ? fh->dir : NULL;
+    if (!handle) {
+        *plen = vfs_reply(vfs, req, -EBADF, NULL, 0);
         return;
     }
 
     DIR *dir = handle->dir;
-    const char *dir_path = handle->path;
+    size_t dir_len = strlen(handle->path);
+
+    /* Entries straddle the guest's page-sized buffers, so they are laid out
+     * here first and scattered by 'vfs_reply()'. 'path' is reused for every
+     * entry, since each one has to be registered under its full name.
+     */
+    size_t size = MIN(read_in->size, VFS_MAX_WRITE);
+    uint8_t *buf = malloc(size);
+    char *path = malloc(dir_len + 1 + VFS_NAME_MAX + 1);
+    if (!buf || !path) {
+        free(buf);
+        free(path);
+        *plen = vfs_reply(vfs, req, -ENOMEM, NULL, 0);
+        return;
+    }
+    memcpy(path, handle->path, dir_len);
+    path[dir_len] = '/';
 
-    uintptr_t base = (uintptr_t) vfs->ram + vq_desc[3].addr;
-    size_t offset = 0;
+    /* Sequential reads carry on where the last reply stopped; anything else
+     * (a rewind, or a guest resuming from an older cookie) seeks.
+     */
+    if (read_in->offset != handle->pos)
+        vfs_dir_seek(handle, read_in->offset);
 
-    rewinddir(dir);
+    size_t offset = 0;
     struct dirent *entry;
-    while ((entry = readdir(dir)) != NULL) {
-        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
-            continue;
-
-        size_t dir_len = strlen(dir_path);
-        size_t name_len = strlen(entry->d_name);
-        size_t full_len = dir_len + 1 + name_len + 1; /* '/' + name + '\0' */
-
-        /* Dynamically allocate buffer for full_path */
-        char *full_path = (char *) malloc(full_len);
-        if (!full_path) {
-            fprintf(stderr, "malloc failed for full_path\n");
+    while ((entry = readdir(dir)) != NULL) {
+        const char *name = entry->d_name;
+        size_t name_len = strlen(name);
+        uint64_t next = (uint64_t) telldir(dir);
+        if (!strcmp(name, ".") || !strcmp(name, "..") ||
+            name_len > VFS_NAME_MAX) {
+            handle->pos = next;
             continue;
         }
 
-        /* Build the full path */
-        memcpy(full_path, dir_path, dir_len);
-        full_path[dir_len] = '/';
-        memcpy(full_path + dir_len + 1, entry->d_name, name_len);
-        full_path[dir_len + 1 + name_len] = '\0';
+        size_t entry_size = FUSE_DIRENT_ALIGN(sizeof(struct fuse_direntplus) +
+                                              name_len);
+        if (offset + entry_size > size) {
+            /* Leave it for the next call. An empty reply would read as the
+             * end of the directory, so a buffer too small for even one entry
+             * is an error, as in FUSE.
+             */
+            vfs_dir_seek(handle, handle->pos);
+            if (!offset) {
+                free(path);
+                free(buf);
+                *plen = vfs_reply(vfs, req, -EINVAL, NULL, 0);
+                return;
+            }
+            break;
+        }
 
+        /* A symlink is an entry of its own, resolved by the guest */
         struct stat st;
-        if (stat(full_path, &st) < 0) {
-            printf("[READDIRPLUS] stat failed for: %s\n", full_path);
-            free(full_path);
+        if (fstatat(dirfd(dir), name, &st, AT_SYMLINK_NOFOLLOW) < 0) {
+            /* Gone since 'readdir()' */
+            handle->pos = next;
             continue;
         }
 
-        struct fuse_entry_out *entry_out =
-            (struct fuse_entry_out *) (base + offset);
-        memset(entry_out, 0, sizeof(*entry_out));
-        entry_out->nodeid = st.st_ino;
-        entry_out->attr.ino = st.st_ino;
-        entry_out->attr.mode = st.st_mode;
-        entry_out->attr.nlink = st.st_nlink;
-        entry_out->attr.size = st.st_size;
-        entry_out->attr.atime = st.st_atime;
-        entry_out->attr.mtime = st.st_mtime;
-        entry_out->attr.ctime = st.st_ctime;
-        entry_out->attr.uid = st.st_uid;
-        entry_out->attr.gid = st.st_gid;
-        entry_out->attr.blksize = st.st_blksize;
-        entry_out->attr.blocks = st.st_blocks;
-
         struct fuse_direntplus *direntplus =
-            (struct fuse_direntplus *) (base + offset +
-                                        sizeof(struct fuse_entry_out));
+            (struct fuse_direntplus *) (buf + offset);
+        memcpy(path + dir_len + 1, name, name_len + 1);
+        int err = vfs_fill_entry(vfs, path, &st, &direntplus->entry_out);
+        if (err < 0) {
+            vfs_dir_seek(handle, handle->pos);
+            if (!offset) {
+                free(path);
+                free(buf);
+                *plen = vfs_reply(vfs, req, err, NULL, 0);
+                return;
+            }
+            break;
+        }
+
+        memset(&direntplus->dirent, 0,
+               entry_size - sizeof(struct fuse_entry_out));
         direntplus->dirent.ino = st.st_ino;
+        direntplus->dirent.off = next;
         direntplus->dirent.namelen = name_len;
-        direntplus->dirent.type = S_ISDIR(st.st_mode) ? 4 : 8;
-        memcpy(direntplus->dirent.name, entry->d_name, name_len);
+        direntplus->dirent.type = (st.st_mode & S_IFMT) >> 12;
+        memcpy(direntplus->dirent.name, name, name_len);
+
+        offset += entry_size;
+        handle->pos = next;
+    }
 
-        size_t dirent_size = sizeof(struct fuse_direntplus) + name_len;
-        size_t dirent_aligned = (dirent_size + 7) & ~7;
-        offset += sizeof(struct fuse_entry_out) + dirent_aligned;
+    free(path);
+    *plen = vfs_reply(vfs, req, 0, buf, offset);
+    free(buf);
+}
 
-        free(full_path);
+static void virtio_fs_readlink_handler(virtio_fs_state_t *vfs,
+                                       const vfs_req_t *req,
+                                       uint32_t *plen)
+{
+    const struct fuse_in_header *in_header = vfs_req_ptr(vfs, &req->desc[0]);
+    vfs_inode_t *entry = vfs_inode_get(&vfs->inodes, in_header->nodeid);
+    if (!entry) {
+        *plen = vfs_reply(vfs, req, -ENOENT, NULL, 0);
+        return;
     }
 
-    struct vfs_resp_header *header_resp =
-        (struct vfs_resp_header *) ((uintptr_t) vfs->ram + vq_desc[2].addr);
-    header_resp->out.len = sizeof(struct fuse_out_header) + offset;
-    header_resp->out.error = 0;
-    *plen = header_resp->out.len;
-    if (header_resp->out.error)
-        printf("[READDIRPLUS] error: %d\n", header_resp->out.error);
+    /* The target is returned as is, without a terminating NUL */
+    char target[PATH_MAX];
+    ssize_t len = readlink(entry->path, target, sizeof(target));
+    if (len < 0 || len == sizeof(target)) {
+        *plen = vfs_reply(vfs, req, len < 0 ? -errno : -ENAMETOOLONG, NULL, 0);
+        return;
+    }
+    *plen = vfs_reply(vfs, req, 0, target, len);
 }
 
 static void virtio_fs_releasedir_handler(virtio_fs_state_t *vfs,
-                                         struct virtq_desc vq_desc[4],
+                                         const vfs_req_t *req,
                                          uint32_t *plen)
 {
-    struct fuse_release_in *release_in =
-        (struct fuse_release_in *) ((uintptr_t) vfs->ram + vq_desc[1].addr);
-    dir_handle_t *handle = (dir_handle_t *) (uintptr_t) release_in->fh;
-    if (handle) {
-        if (handle->dir)
-            closedir(handle->dir);
-        if (handle->path)
-            free(handle->path);
-        free(handle);
-    }
-    struct vfs_resp_header *header_resp =
-        (struct vfs_resp_header *) ((uintptr_t) vfs->ram + vq_desc[2].addr);
-    header_resp->out.len = sizeof(struct fuse_out_header);
-    header_resp->out.error = 0;
-    *plen = header_resp->out.len;
+    const struct fuse_release_in *release_in =
+        vfs_req_arg(vfs, req, 1, sizeof(struct fuse_release_in));
+    struct vfs_handle *handle =
+        release_in ? vfs_handle_get(vfs, release_in->fh) : NULL;
+    if (handle && handle->dir)
+        vfs_handle_release(vfs, handle);
+    *plen = vfs_reply(vfs, req, 0, NULL, 0);
 }
 
 static void virtio_fs_lookup_handler(virtio_fs_state_t *vfs,
-                                     struct virtq_desc vq_desc[4],
+                                     const vfs_req_t *req,
                                      uint32_t *plen)
 {
-    const struct fuse_in_header *in_header =
-        (struct fuse_in_header *) ((uintptr_t) vfs->ram + vq_desc[0].addr);
-    uint64_t parent_inode = in_header->nodeid;
-
-    struct fuse_lookup_in *lookup_in =
-        (struct fuse_lookup_in *) ((uintptr_t) vfs->ram + vq_desc[1].addr);
-    char *name = (char *) (lookup_in);
-    size_t name_len = vq_desc[1].len;
-
-    if (name_len == 0) {
-        return;
-    }
-    char *name_buf = malloc(name_len + 1);
-    if (!name_buf) {
-        fprintf(stderr, "malloc failed for name_buf\n");
-        return;
-    }
-    memcpy(name_buf, name, name_len);
-    name_buf[name_len] = '\0';
-
-    inode_map_entry *parent_entry =
-        find_inode_path(vfs->inode_map, parent_inode);
-    if (!parent_entry) {
-        free(name_buf);
+    const struct fuse_in_header *in_header = vfs_req_ptr(vfs, &req->desc[0]);
+    char *host_path =
+        vfs_child_path(vfs, in_header->nodeid, vfs_req_name(vfs, req, 1));
+    if (!host_path) {
+        *plen = vfs_reply(vfs, req, -ENOENT, NULL, 0);
         return;
     }
-    const char *parent_path = parent_entry->path;
 
-    size_t parent_len = strlen(parent_path);
-    size_t name_len1 = strlen(name_buf);
-    size_t host_path_len = parent_len + 1 + name_len1 + 1;
+    struct fuse_entry_out entry_out;
+    int err = vfs_make_entry(vfs, host_path, &entry_out);
+    free(host_path);
+    *plen = err ? vfs_reply(vfs, req, err, NULL, 0)
+                : vfs_reply(vfs, req, 0, &entry_out, sizeof(entry_out));
+}
 
-    char *host_path = malloc(host_path_len);
-    if (!host_path) {
-        fprintf(stderr, "malloc failed for host_path\n");
-        free(name_buf);
+static void virtio_fs_open_handler(virtio_fs_state_t *vfs,
+                                   const vfs_req_t *req,
+                                   uint32_t *plen)
+{
+    const struct fuse_in_header *in_header = vfs_req_ptr(vfs, &req->desc[0]);
+    const struct fuse_open_in *open_in =
+        vfs_req_arg(vfs, req, 1, sizeof(struct fuse_open_in));
+    vfs_inode_t *entry = vfs_inode_get(&vfs->inodes, in_header->nodeid);
+    if (!open_in || !entry) {
+        *plen = vfs_reply(vfs, req, open_in ? -ENOENT : -EINVAL, NULL, 0);
         return;
     }
-    memcpy(host_path, parent_path, parent_len);
-    host_path[parent_len] = '/';
-    memcpy(host_path + parent_len + 1, name_buf, name_len1);
-    host_path[parent_len + 1 + name_len1] = '\0';
 
-    struct stat st;
-    if (stat(host_path, &st) < 0) {
-        free(name_buf);
-        free(host_path);
-        struct vfs_resp_header *header_resp =
-            (struct vfs_resp_header *) ((uintptr_t) vfs->ram + vq_desc[2].addr);
-        header_resp->out.error = -ENOENT;
-        *plen = sizeof(struct fuse_out_header);
+    uint64_t fh = vfs_handle_alloc(vfs);
+    if (!fh) {
+        *plen = vfs_reply(vfs, req, -ENFILE, NULL, 0);
         return;
     }
-
-    inode_map_entry *entry = find_inode_path(vfs->inode_map, st.st_ino);
-    if (!entry) {
-        entry = malloc(sizeof(inode_map_entry));
-        if (!entry) {
-            free(name_buf);
-            free(host_path);
-            fprintf(stderr, "malloc failed for inode_map_entry\n");
+    struct vfs_handle *handle = &vfs->handles[fh - 1];
+
+    /* Plain read-only opens share one fd per inode, which outlives them so
+     * that files opened over and over (headers, scripts) skip the path walk.
+     */
+    int flags = vfs_host_open_flags(open_in->flags);
+    bool shared = flags == (O_RDONLY | O_CLOEXEC);
+    if (shared && entry->fd >= 0) {
+        if (!entry->fd_users++)
+            vfs_lru_unlink(vfs, entry);
+        handle->fd = entry->fd;
+        handle->cached = entry;
+    } else {
+        int fd = vfs_open(vfs, entry->path, flags, 0);
+        if (fd < 0) {
+            *plen = vfs_reply(vfs, req, -errno, NULL, 0);
+            fprintf(stderr, "[OPEN] failed: %s, error=%s\n", entry->path,
+                    strerror(errno));
             return;
         }
-        entry->ino = st.st_ino;
-        entry->path = strdup(host_path);
-        if (!entry->path) {
-            free(entry);
-            free(name_buf);
-            free(host_path);
-            fprintf(stderr, "strdup failed for entry->path\n");
-            return;
+        handle->fd = fd;
+        if (shared) {
+            entry->fd = fd;
+            entry->fd_users = 1;
+            handle->cached = entry;
         }
-        entry->next = vfs->inode_map;
-        vfs->inode_map = entry;
     }
 
-    free(name_buf);
-    free(host_path);
-
-    struct fuse_entry_out *entry_out =
-        (struct fuse_entry_out *) ((uintptr_t) vfs->ram + vq_desc[3].addr);
-    memset(entry_out, 0, sizeof(*entry_out));
-    entry_out->nodeid = st.st_ino;
-    entry_out->attr.ino = st.st_ino;
-    entry_out->attr.mode = st.st_mode;
-    entry_out->attr.nlink = st.st_nlink;
-    entry_out->attr.size = st.st_size;
-    entry_out->attr.atime = st.st_atime;
-    entry_out->attr.mtime = st.st_mtime;
-    entry_out->attr.ctime = st.st_ctime;
-    entry_out->attr.uid = st.st_uid;
-    entry_out->attr.gid = st.st_gid;
-    entry_out->attr.blksize = st.st_blksize;
-    entry_out->attr.blocks = st.st_blocks;
-
-    struct vfs_resp_header *header_resp =
-        (struct vfs_resp_header *) ((uintptr_t) vfs->ram + vq_desc[2].addr);
-    header_resp->out.len =
-        sizeof(struct fuse_out_header) + sizeof(struct fuse_entry_out);
-    header_resp->out.error = 0;
-    *plen = header_resp->out.len;
+    struct fuse_open_out open_out = {.fh = fh};
+    *plen = vfs_reply(vfs, req, 0, &open_out, sizeof(open_out));
 }
 
-static void virtio_fs_open_handler(virtio_fs_state_t *vfs,
-                                   struct virtq_desc vq_desc[4],
+static void virtio_fs_read_handler(virtio_fs_state_t *vfs,
+                                   const vfs_req_t *req,
                                    uint32_t *plen)
 {
-    const struct fuse_in_header *in_header =
-        (struct fuse_in_header *) ((uintptr_t) vfs->ram + vq_desc[0].addr);
-    uint64_t inode = in_header->nodeid;
-
-    const char *target_path = NULL;
-    if (inode == 1) {
-        target_path = vfs->shared_dir;
-    } else {
-        inode_map_entry *entry = find_inode_path(vfs->inode_map, inode);
-        if (!entry) {
-            struct vfs_resp_header *header_resp =
-                (struct vfs_resp_header *) ((uintptr_t) vfs->ram +
-                                            vq_desc[2].addr);
-            header_resp->out.error = -ENOENT;
-            *plen = sizeof(struct fuse_out_header);
-            return;
-        }
-        target_path = entry->path;
+    const struct fuse_read_in *read_in =
+        vfs_req_arg(vfs, req, 1, sizeof(struct fuse_read_in));
+    if (!read_in) {
+        *plen = vfs_reply(vfs, req, -EINVAL, NULL, 0);
+        return;
     }
 
-    int fd = open(target_path, O_RDONLY);
-    if (fd < 0) {
-        struct vfs_resp_header *header_resp =
-            (struct vfs_resp_header *) ((uintptr_t) vfs->ram + vq_desc[2].addr);
-        header_resp->out.error = -errno;
-        *plen = sizeof(struct fuse_out_header);
-        fprintf(stderr, "[OPEN] failed: %s, error=%s\n", target_path,
-                strerror(errno));
+    /* Read straight into the guest's reply buffers, typically one per page */
+    struct iovec iov[VFS_DESC_MAX];
+    int iovcnt = vfs_reply_iov(vfs, req, iov, read_in->size);
+    int fd = vfs_handle_fd(vfs, read_in->fh);
+    ssize_t n = preadv(fd, iov, iovcnt, read_in->offset);
+    if (n < 0) {
+        *plen = vfs_reply(vfs, req, -errno, NULL, 0);
+        fprintf(stderr, "[READ] failed: fd=%d, errno=%d\n", fd, errno);
         return;
     }
 
-    struct vfs_resp_header *header_resp =
-        (struct vfs_resp_header *) ((uintptr_t) vfs->ram + vq_desc[2].addr);
-    struct fuse_open_out *open_out =
-        (struct fuse_open_out *) ((uintptr_t) vfs->ram + vq_desc[3].addr);
+    *plen = vfs_reply_header(vfs, req, 0, (uint32_t) n);
+}
 
-    open_out->fh = (uint64_t) fd;
-    open_out->open_flags = 0;
-    header_resp->out.len =
-        sizeof(struct fuse_out_header) + sizeof(struct fuse_open_out);
-    header_resp->out.error = 0;
-    *plen = header_resp->out.len;
+static void virtio_fs_release_handler(virtio_fs_state_t *vfs,
+                                      const vfs_req_t *req,
+                                      uint32_t *plen)
+{
+    const struct fuse_release_in *release_in =
+        vfs_req_arg(vfs, req, 1, sizeof(struct fuse_release_in));
+    struct vfs_handle *handle =
+        release_in ? vfs_handle_get(vfs, release_in->fh) : NULL;
+    if (handle && !handle->dir)
+        vfs_handle_release(vfs, handle);
+    *plen = vfs_reply(vfs, req, 0, NULL, 0);
 }
 
-static void virtio_fs_read_handler(virtio_fs_state_t *vfs,
-                                   struct virtq_desc vq_desc[4],
-                                   uint32_t *plen)
+static void virtio_fs_forget_handler(virtio_fs_state_t *vfs,
+                                     const vfs_req_t *req,
+                                     uint32_t *plen)
 {
-    struct fuse_read_in *read_in =
-        (struct fuse_read_in *) ((uintptr_t) vfs->ram + vq_desc[1].addr);
-    int fd = (int) (uintptr_t) read_in->fh;
-    off_t offset = read_in->offset;
-    size_t size = read_in->size;
+    const struct fuse_in_header *in_header = vfs_req_ptr(vfs, &req->desc[0]);
+    const struct fuse_forget_in *forget_in =
+        vfs_req_arg(vfs, req, 1, sizeof(struct fuse_forget_in));
+
+    /* FORGET has no reply, so there is no output descriptor to fill */
+    *plen = 0;
+    if (!forget_in)
+        return;
 
-    char *buf = malloc(size);
-    if (!buf) {
-        struct vfs_resp_header *header_resp =
-            (struct vfs_resp_header *) ((uintptr_t) vfs->ram + vq_desc[2].addr);
-        header_resp->out.error = -ENOMEM;
-        *plen = sizeof(struct fuse_out_header);
-        fprintf(stderr, "[READ] malloc failed, size=%zu\n", size);
+    /* The root is never looked up, hence never forgotten */
+    vfs_inode_t *entry = vfs_inode_get(&vfs->inodes, in_header->nodeid);
+    if (!entry || entry->ino == 1)
         return;
+
+    if (entry->nlookup > forget_in->nlookup) {
+        entry->nlookup -= forget_in->nlookup;
+    } else if (entry->fd_users) {
+        /* The guest does not FORGET open files, so this is only a guard:
+         * the handles keep the shared fd, and the entry, until released.
+         */
+        vfs_unwatch_dir(vfs, entry);
+        vfs_inode_detach(&vfs->inodes, entry);
+        entry->forgotten = true;
+    } else {
+        vfs_unwatch_dir(vfs, entry);
+        vfs_fd_uncache(vfs, entry);
+        vfs_inode_remove(&vfs->inodes, entry);
     }
+}
 
-    ssize_t n = pread(fd, buf, size, offset);
-    if (n < 0) {
-        struct vfs_resp_header *header_resp =
-            (struct vfs_resp_header *) ((uintptr_t) vfs->ram + vq_desc[2].addr);
-        header_resp->out.error = -errno;
-        *plen = sizeof(struct fuse_out_header);
-        fprintf(stderr, "[READ] failed: fd=%d, errno=%d\n", fd, errno);
-        free(buf);
+static void virtio_fs_write_handler(virtio_fs_state_t *vfs,
+                                    const vfs_req_t *req,
+                                    uint32_t *plen)
+{
+    const struct fuse_write_in *write_in =
+        vfs_req_arg(vfs, req, 1, sizeof(struct fuse_write_in));
+    if (!write_in) {
+        *plen = vfs_reply(vfs, req, -EINVAL, NULL, 0);
         return;
     }
 
-    memcpy((void *) ((uintptr_t) vfs->ram + vq_desc[3].addr), buf, n);
+    /* The payload follows in descriptors of its own, one per guest page, and
+     * goes to the host file straight from guest memory.
+     */
+    struct iovec iov[VFS_DESC_MAX];
+    int iovcnt = 0;
+    uint32_t left = write_in->size;
+    for (uint32_t i = 2; i < req->n_in && left; i++) {
+        uint32_t len = MIN(req->desc[i].len, left);
+        iov[iovcnt].iov_base = vfs_req_ptr(vfs, &req->desc[i]);
+        iov[iovcnt].iov_len = len;
+        iovcnt++;
+        left -= len;
+    }
+    if (left) {
+        *plen = vfs_reply(vfs, req, -EINVAL, NULL, 0);
+        return;
+    }
 
-    struct vfs_resp_header *header_resp =
-        (struct vfs_resp_header *) ((uintptr_t) vfs->ram + vq_desc[2].addr);
-    header_resp->out.len = sizeof(struct fuse_out_header) + n;
-    header_resp->out.error = 0;
-    *plen = header_resp->out.len;
+    int fd = vfs_handle_fd(vfs, write_in->fh);
+    ssize_t n = pwritev(fd, iov, iovcnt, write_in->offset);
+    if (n < 0) {
+        *plen = vfs_reply(vfs, req, -errno, NULL, 0);
+        return;
+    }
 
-    free(buf);
+    struct fuse_write_out write_out = {.size = (uint32_t) n};
+    *plen = vfs_reply(vfs, req, 0, &write_out, sizeof(write_out));
 }
 
-static void virtio_fs_release_handler(virtio_fs_state_t *vfs,
-                                      struct virtq_desc vq_desc[4],
-                                      uint32_t *plen)
+static void virtio_fs_create_handler(virtio_fs_state_t *vfs,
+                                     const vfs_req_t *req,
+                                     uint32_t *plen)
 {
-    struct fuse_release_in *release_in =
-        (struct fuse_release_in *) ((uintptr_t) vfs->ram + vq_desc[1].addr);
-    int fd = (int) release_in->fh;
-    close(fd);
-    struct vfs_resp_header *header_resp =
-        (struct vfs_resp_header *) ((uintptr_t) vfs->ram + vq_desc[2].addr);
-    header_resp->out.len = sizeof(struct fuse_out_header);
-    header_resp->out.error = 0;
-    *plen = header_resp->out.len;
+    const struct fuse_in_header *in_header = vfs_req_ptr(vfs, &req->desc[0]);
+    const struct fuse_create_in *create_in =
+        vfs_req_arg(vfs, req, 1, sizeof(struct fuse_create_in));
+    char *path = create_in ? vfs_child_path(vfs, in_header->nodeid,
+                                            vfs_req_name(vfs, req, 2))
+                           : NULL;
+    if (!path) {
+        *plen = vfs_reply(vfs, req, -EINVAL, NULL, 0);
+        return;
+    }
+
+    int flags = vfs_host_open_flags(create_in->flags) | O_CREAT;
+    if (create_in->flags & LINUX_O_EXCL)
+        flags |= O_EXCL;
+    uint64_t fh = vfs_handle_alloc(vfs);
+    int fd = fh ? vfs_open(vfs, path, flags, create_in->mode & 07777) : -1;
+    if (fd < 0) {
+        *plen = vfs_reply(vfs, req, fh ? -errno : -ENFILE, NULL, 0);
+        free(path);
+        return;
+    }
+
+    /* CREATE answers with the new entry followed by the open file */
+    struct {
+        struct fuse_entry_out entry;
+        struct fuse_open_out open;
+    } out = {.open.fh = fh};
+    int err = vfs_make_entry(vfs, path, &out.entry);
+    free(path);
+    if (err) {
+        close(fd);
+        *plen = vfs_reply(vfs, req, err, NULL, 0);
+        return;
+    }
+    vfs->handles[fh - 1].fd = fd;
+    *plen = vfs_reply(vfs, req, 0, &out, sizeof(out));
 }
 
-static void virtio_fs_flush_handler(virtio_fs_state_t *vfs,
-                                    struct virtq_desc vq_desc[4],
+static void virtio_fs_mkdir_handler(virtio_fs_state_t *vfs,
+                                    const vfs_req_t *req,
                                     uint32_t *plen)
 {
-    struct vfs_resp_header *header_resp =
-        (struct vfs_resp_header *) ((uintptr_t) vfs->ram + vq_desc[2].addr);
-    header_resp->out.len = sizeof(struct fuse_out_header);
-    header_resp->out.error = 0;
-    *plen = header_resp->out.len;
+    const struct fuse_in_header *in_header = vfs_req_ptr(vfs, &req->desc[0]);
+    const struct fuse_mkdir_in *mkdir_in =
+        vfs_req_arg(vfs, req, 1, sizeof(struct fuse_mkdir_in));
+    char *path = mkdir_in ? vfs_child_path(vfs, in_header->nodeid,
+                                           vfs_req_name(vfs, req, 2))
+                          : NULL;
+    if (!path) {
+        *plen = vfs_reply(vfs, req, -EINVAL, NULL, 0);
+        return;
+    }
+
+    struct fuse_entry_out entry_out;
+    int err = mkdir(path, mkdir_in->mode & 07777) < 0
+                  ? -errno
+                  : vfs_make_entry(vfs, path, &entry_out);
+    free(path);
+    *plen = err ? vfs_reply(vfs, req, err, NULL, 0)
+                : vfs_reply(vfs, req, 0, &entry_out, sizeof(entry_out));
 }
 
+/* UNLINK and RMDIR */
+static void virtio_fs_remove_handler(virtio_fs_state_t *vfs,
+                                     const vfs_req_t *req,
+                                     bool is_dir,
+                                     uint32_t *plen)
+{
+    const struct fuse_in_header *in_header = vfs_req_ptr(vfs, &req->desc[0]);
+    char *path =
+        vfs_child_path(vfs, in_header->nodeid, vfs_req_name(vfs, req, 1));
+    if (!path) {
+        *plen = vfs_reply(vfs, req, -EINVAL, NULL, 0);
+        return;
+    }
 
-static void virtio_fs_forget_handler(virtio_fs_state_t *vfs,
-                                     struct virtq_desc vq_desc[4],
+    int err = (is_dir ? rmdir(path) : unlink(path)) < 0 ? -errno : 0;
+    if (!err) {
+        /* The inode lives on until the guest forgets it, but the name is
+         * gone and may be reused by a different file.
+         */
+        vfs_inode_t *inode = vfs_inode_find_path(&vfs->inodes, path);
+        if (inode)
+            vfs_inode_unlink_path(&vfs->inodes, inode);
+    }
+    free(path);
+    *plen = vfs_reply(vfs, req, err, NULL, 0);
+}
+
+static void virtio_fs_rename_handler(virtio_fs_state_t *vfs,
+                                     const vfs_req_t *req,
                                      uint32_t *plen)
 {
-    struct vfs_resp_header *header_resp =
-        (struct vfs_resp_header *) ((uintptr_t) vfs->ram + vq_desc[2].addr);
-    header_resp->out.len = sizeof(struct fuse_out_header);
-    header_resp->out.error = 0;
-    *plen = header_resp->out.len;
+    const struct fuse_in_header *in_header = vfs_req_ptr(vfs, &req->desc[0]);
+    const struct fuse_rename_in *rename_in =
+        vfs_req_arg(vfs, req, 1, sizeof(struct fuse_rename_in));
+    char *from =
+        vfs_child_path(vfs, in_header->nodeid, vfs_req_name(vfs, req, 2));
+    char *to = rename_in ? vfs_child_path(vfs, rename_in->newdir,
+                                          vfs_req_name(vfs, req, 3))
+                         : NULL;
+    if (!from || !to) {
+        *plen = vfs_reply(vfs, req, -EINVAL, NULL, 0);
+        goto out;
+    }
+
+    if (rename(from, to) < 0) {
+        *plen = vfs_reply(vfs, req, -errno, NULL, 0);
+        goto out;
+    }
+
+    vfs_inode_t *inode = vfs_inode_find_path(&vfs->inodes, from);
+    if (inode) {
+        char *path = strdup(to);
+        if (path)
+            vfs_inode_set_path(&vfs->inodes, inode, path);
+    }
+    struct stat st;
+    if (stat(to, &st) == 0 && S_ISDIR(st.st_mode))
+        vfs_inode_move_tree(&vfs->inodes, from, to);
+    *plen = vfs_reply(vfs, req, 0, NULL, 0);
+
+out:
+    free(from);
+    free(to);
 }
 
-static void virtio_fs_destroy_handler(virtio_fs_state_t *vfs,
-                                      struct virtq_desc vq_desc[4],
+static void virtio_fs_setattr_handler(virtio_fs_state_t *vfs,
+                                      const vfs_req_t *req,
                                       uint32_t *plen)
 {
-    struct vfs_resp_header *header_resp =
-        (struct vfs_resp_header *) ((uintptr_t) vfs->ram + vq_desc[2].addr);
-    header_resp->out.len = sizeof(struct fuse_out_header);
-    header_resp->out.error = 0;
-    *plen = header_resp->out.len;
+    const struct fuse_in_header *in_header = vfs_req_ptr(vfs, &req->desc[0]);
+    const struct fuse_setattr_in *setattr_in =
+        vfs_req_arg(vfs, req, 1, sizeof(struct fuse_setattr_in));
+    vfs_inode_t *inode = vfs_inode_get(&vfs->inodes, in_header->nodeid);
+    if (!setattr_in || !inode) {
+        *plen = vfs_reply(vfs, req, setattr_in ? -ENOENT : -EINVAL, NULL, 0);
+        return;
+    }
+
+    const char *path = inode->path;
+    uint32_t valid = setattr_in->valid;
+    int ret = 0;
+    if (valid & FATTR_MODE)
+        ret = chmod(path, setattr_in->mode & 07777);
+    if (!ret && (valid & (FATTR_UID | FATTR_GID)))
+        ret = chown(path, (valid & FATTR_UID) ? setattr_in->uid : (uid_t) -1,
+                    (valid & FATTR_GID) ? setattr_in->gid : (gid_t) -1);
+    if (!ret && (valid & FATTR_SIZE))
+        ret = (valid & FATTR_FH)
+                  ? ftruncate(vfs_handle_fd(vfs, setattr_in->fh),
+                              setattr_in->size)
+                  : truncate(path, setattr_in->size);
+    if (!ret && (valid & (FATTR_ATIME | FATTR_MTIME))) {
+        struct timespec times[2] = {
+            {.tv_nsec = UTIME_OMIT},
+            {.tv_nsec = UTIME_OMIT},
+        };
+        if (valid & FATTR_ATIME_NOW)
+            times[0].tv_nsec = UTIME_NOW;
+        else if (valid & FATTR_ATIME)
+            times[0] = (struct timespec){setattr_in->atime,
+                                         setattr_in->atimensec};
+        if (valid & FATTR_MTIME_NOW)
+            times[1].tv_nsec = UTIME_NOW;
+        else if (valid & FATTR_MTIME)
+            times[1] = (struct timespec){setattr_in->mtime,
+                                         setattr_in->mtimensec};
+        ret = utimensat(AT_FDCWD, path, times, 0);
+    }
+
+    struct stat st;
+    if (ret < 0 || lstat(path, &st) < 0) {
+        *plen = vfs_reply(vfs, req, -errno, NULL, 0);
+        return;
+    }
+
+    struct fuse_attr_out attr_out;
+    vfs_fill_attr_out(vfs, &attr_out, &st);
+    *plen = vfs_reply(vfs, req, 0, &attr_out, sizeof(attr_out));
 }
 
-static void virtio_fs_default_handler(virtio_fs_state_t *vfs,
-                                      struct virtq_desc vq_desc[4],
-                                      uint32_t *plen)
+static void virtio_fs_setupmapping_handler(virtio_fs_state_t *vfs,
+                                           const vfs_req_t *req,
+                                           uint32_t *plen)
 {
-    const struct vfs_req_header *header_req =
-        (struct vfs_req_header *) ((uintptr_t) vfs->ram + vq_desc[0].addr);
-    struct fuse_out_header out = {
-        .len = sizeof(struct fuse_out_header),
-        .error = -EOPNOTSUPP,
-        .unique = header_req->in.unique,
-    };
-    /* Copy to output buffer */
-    if (vq_desc[2].len >= sizeof(out)) {
-        memcpy((void *) ((uintptr_t) vfs->ram + vq_desc[2].addr), &out,
-               sizeof(out));
-        *plen = sizeof(out);
-    } else {
-        fprintf(stderr, "output buffer too small for error reply!\n");
-        *plen = 0;
+    const struct fuse_setupmapping_in *setup_in =
+        vfs_req_arg(vfs, req, 1, sizeof(struct fuse_setupmapping_in));
+    if (!setup_in ||
+        !vfs_dax_range_valid(vfs, setup_in->moffset, setup_in->len) ||
+        (setup_in->foffset & (vfs_page_size() - 1))) {
+        *plen = vfs_reply(vfs, req, -EINVAL, NULL, 0);
+        return;
+    }
+
+    /* The window stays writable either way: a read-only range gets a private
+     * mapping, so a guest store lands in a copy instead of faulting the host
+     * or reaching a file that was opened read-only.
+     */
+    int flags = MAP_FIXED | ((setup_in->flags & FUSE_SETUPMAPPING_FLAG_WRITE)
+                                 ? MAP_SHARED
+                                 : MAP_PRIVATE);
+    void *addr = (uint8_t *) vfs->dax_window + setup_in->moffset;
+    if (mmap(addr, setup_in->len, PROT_READ | PROT_WRITE, flags,
+             vfs_handle_fd(vfs, setup_in->fh),
+             setup_in->foffset) == MAP_FAILED) {
+        int err = -errno;
+        /* A failed MAP_FIXED may have torn down the previous mapping */
+        vfs_dax_unmap(vfs, setup_in->moffset, setup_in->len);
+        *plen = vfs_reply(vfs, req, err, NULL, 0);
+        return;
     }
+    *plen = vfs_reply(vfs, req, 0, NULL, 0);
 }
 
-static int virtio_fs_desc_handler(virtio_fs_state_t *vfs,
-                                  const virtio_fs_queue_t *queue,
-                                  uint32_t desc_idx,
-                                  uint32_t *plen)
+static void virtio_fs_removemapping_handler(virtio_fs_state_t *vfs,
+                                            const vfs_req_t *req,
+                                            uint32_t *plen)
 {
-    struct virtq_desc vq_desc[4];
-    for (int i = 0; i < 4; i++) {
-        /* The size of the `struct virtq_desc` is 4 words */
-        const struct virtq_desc *desc =
-            (struct virtq_desc *) &vfs->ram[queue->QueueDesc + desc_idx * 4];
-        vq_desc[i].addr = desc->addr;
-        vq_desc[i].len = desc->len;
-        vq_desc[i].flags = desc->flags;
-        desc_idx = desc->next;
+    const struct fuse_removemapping_in *remove_in =
+        vfs_req_arg(vfs, req, 1, sizeof(struct fuse_removemapping_in));
+    const struct fuse_removemapping_one *ranges = vfs_req_arg(vfs, req, 2, 0);
+    if (!remove_in || !ranges ||
+        remove_in->count >
+            req->desc[2].len / sizeof(struct fuse_removemapping_one)) {
+        *plen = vfs_reply(vfs, req, -EINVAL, NULL, 0);
+        return;
+    }
+
+    int err = 0;
+    for (uint32_t i = 0; i < remove_in->count; i++) {
+        int ret = vfs_dax_unmap(vfs, ranges[i].moffset, ranges[i].len);
+        if (ret)
+            err = ret;
     }
+    *plen = vfs_reply(vfs, req, err, NULL, 0);
+}
+
+/* Gather the request at 'desc_idx' into 'req', checking it has a header */
+static int vfs_req_load(const virtio_fs_state_t *vfs,
+                        const virtio_fs_queue_t *queue,
+                        uint32_t desc_idx,
+                        vfs_req_t *req)
+{
+    if (vfs_req_gather(vfs, queue, desc_idx, req) < 0 || !req->n_in ||
+        req->desc[0].len < sizeof(struct fuse_in_header))
+        return -1;
+    return 0;
+}
 
-    const struct vfs_req_header *header_req =
-        (struct vfs_req_header *) ((uintptr_t) vfs->ram + vq_desc[0].addr);
+static void vfs_dispatch(virtio_fs_state_t *vfs,
+                         const vfs_req_t *req,
+                         uint32_t *plen)
+{
+    const struct vfs_req_header *header_req = vfs_req_ptr(vfs, &req->desc[0]);
     uint32_t op = header_req->in.opcode;
+    bool locked = vfs->pool && op != FUSE_READ && op != FUSE_WRITE;
+    if (locked)
+        pthread_mutex_lock(&vfs->pool->fs_lock);
+
     switch (op) {
     case FUSE_INIT:
-        virtio_fs_init_handler(vfs, vq_desc, plen);
+        virtio_fs_init_handler(vfs, req, plen);
         break;
     case FUSE_GETATTR:
-        virtio_fs_getattr_handler(vfs, vq_desc, plen);
+        virtio_fs_getattr_handler(vfs, req, plen);
         break;
     case FUSE_OPENDIR:
-        virtio_fs_opendir_handler(vfs, vq_desc, plen);
+        virtio_fs_opendir_handler(vfs, req, plen);
         break;
     case FUSE_READDIRPLUS:
-        virtio_fs_readdirplus_handler(vfs, vq_desc, plen);
+        virtio_fs_readdirplus_handler(vfs, req, plen);
         break;
     case FUSE_LOOKUP:
-        virtio_fs_lookup_handler(vfs, vq_desc, plen);
+        virtio_fs_lookup_handler(vfs, req, plen);
+        break;
+    case FUSE_READLINK:
+        virtio_fs_readlink_handler(vfs, req, plen);
         break;
     case FUSE_FORGET:
-        virtio_fs_forget_handler(vfs, vq_desc, plen);
+        virtio_fs_forget_handler(vfs, req, plen);
         break;
     case FUSE_RELEASEDIR:
-        virtio_fs_releasedir_handler(vfs, vq_desc, plen);
+        virtio_fs_releasedir_handler(vfs, req, plen);
         break;
     case FUSE_OPEN:
-        virtio_fs_open_handler(vfs, vq_desc, plen);
+        virtio_fs_open_handler(vfs, req, plen);
         break;
     case FUSE_READ:
-        virtio_fs_read_handler(vfs, vq_desc, plen);
+        virtio_fs_read_handler(vfs, req, plen);
         break;
     case FUSE_RELEASE:
-        virtio_fs_release_handler(vfs, vq_desc, plen);
+        virtio_fs_release_handler(vfs, req, plen);
         break;
-    case FUSE_FLUSH:
-        virtio_fs_flush_handler(vfs, vq_desc, plen);
+    case FUSE_WRITE:
+        virtio_fs_write_handler(vfs, req, plen);
+        break;
+    case FUSE_CREATE:
+        virtio_fs_create_handler(vfs, req, plen);
+        break;
+    case FUSE_MKDIR:
+        virtio_fs_mkdir_handler(vfs, req, plen);
+        break;
+    case FUSE_UNLINK:
+        virtio_fs_remove_handler(vfs, req, false, plen);
+        break;
+    case FUSE_RMDIR:
+        virtio_fs_remove_handler(vfs, req, true, plen);
         break;
+    case FUSE_RENAME:
+        virtio_fs_rename_handler(vfs, req, plen);
+        break;
+    case FUSE_SETATTR:
+        virtio_fs_setattr_handler(vfs, req, plen);
+        break;
+    case FUSE_SETUPMAPPING:
+        virtio_fs_setupmapping_handler(vfs, req, plen);
+        break;
+    case FUSE_REMOVEMAPPING:
+        virtio_fs_removemapping_handler(vfs, req, plen);
+        break;
+    case FUSE_FLUSH:
     case FUSE_DESTROY:
-        virtio_fs_destroy_handler(vfs, vq_desc, plen);
+        *plen = vfs_reply(vfs, req, 0, NULL, 0);
         break;
     default:
-        virtio_fs_default_handler(vfs, vq_desc, plen);
+        *plen = vfs_reply(vfs, req, -EOPNOTSUPP, NULL, 0);
         break;
     }
-    /* TODO: FUSE_WRITE, FUSE_MKDIR, FUSE_RMDIR, FUSE_CREATE */
 
+    if (locked)
+        pthread_mutex_unlock(&vfs->pool->fs_lock);
+}
+
+static int virtio_fs_desc_handler(virtio_fs_state_t *vfs,
+                                  const virtio_fs_queue_t *queue,
+                                  uint32_t desc_idx,
+                                  uint32_t *plen)
+{
+    vfs_req_t req;
+    if (vfs_req_load(vfs, queue, desc_idx, &req) < 0)
+        return -1;
+    vfs_dispatch(vfs, &req, plen);
+    return 0;
+}
+
+static void *vfs_worker(void *arg)
+{
+    virtio_fs_state_t *vfs = arg;
+    struct vfs_pool *pool = vfs->pool;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->hiprio.head && !pool->regular.head)
+            pthread_cond_wait(&pool->work, &pool->lock);
+        struct vfs_job_list *list =
+            pool->hiprio.head ? &pool->hiprio : &pool->regular;
+        vfs_job_t *job = list->head;
+        list->head = job->next;
+        if (!list->head)
+            list->tail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        job->len = 0;
+        vfs_dispatch(vfs, job->req, &job->len);
+
+        pthread_mutex_lock(&pool->lock);
+        /* One wake byte per batch; the emulator drains them all */
+        if (!pool->done) {
+            char byte = 0;
+            ssize_t ret = write(pool->wake_fd[1], &byte, 1);
+            (void) ret;
+        }
+        job->next = pool->done;
+        __atomic_store_n(&pool->done, job, __ATOMIC_RELEASE);
+        if (--pool->busy == 0)
+            pthread_cond_broadcast(&pool->idle);
+    }
+    return NULL;
+}
+
+static int vfs_pool_submit(virtio_fs_state_t *vfs,
+                           uint32_t index,
+                           uint32_t desc_idx)
+{
+    struct vfs_pool *pool = vfs->pool;
+    if (desc_idx >= VFS_QUEUE_NUM_MAX)
+        return -1;
+    /* A head still in flight cannot be made available again */
+    vfs_job_t *job = &pool->jobs[index * VFS_QUEUE_NUM_MAX + desc_idx];
+    if (job->in_use)
+        return -1;
+    if (!job->req && !(job->req = malloc(sizeof(vfs_req_t))))
+        return -1;
+    if (vfs_req_load(vfs, &vfs->queues[index], desc_idx, job->req))
+        return -1;
+    job->next = NULL;
+    job->queue = index;
+    job->head = desc_idx;
+    job->in_use = true;
+
+    struct vfs_job_list *list =
+        index == VFS_HIPRIO_QUEUE ? &pool->hiprio : &pool->regular;
+    pthread_mutex_lock(&pool->lock);
+    if (list->tail)
+        list->tail->next = job;
+    else
+        list->head = job;
+    list->tail = job;
+    pool->busy++;
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
     return 0;
 }
 
+/* Publish the jobs the workers have finished in the used rings */
+static void vfs_pool_complete(virtio_fs_state_t *vfs)
+{
+    struct vfs_pool *pool = vfs->pool;
+    /* Checked on every tick, so skip the locking while nothing finished */
+    if (!__atomic_load_n(&pool->done, __ATOMIC_ACQUIRE))
+        return;
+
+    /* Workers write the wake byte under the lock, so the pipe is empty
+     * exactly when 'done' is.
+     */
+    pthread_mutex_lock(&pool->lock);
+    vfs_job_t *job = pool->done;
+    pool->done = NULL;
+    char drain[64];
+    while (read(pool->wake_fd[0], drain, sizeof(drain)) > 0)
+        ;
+    pthread_mutex_unlock(&pool->lock);
+
+    uint32_t *ram = vfs->ram;
+    while (job) {
+        vfs_job_t *next = job->next;
+        virtio_fs_queue_t *queue = &vfs->queues[job->queue];
+        uint16_t new_used = ram[queue->QueueUsed] >> 16;
+        uint32_t vq_used_addr =
+            queue->QueueUsed + 1 + (new_used % queue->QueueNum) * 2;
+        ram[vq_used_addr] = job->head;
+        ram[vq_used_addr + 1] = job->len;
+        new_used++;
+        ram[queue->QueueUsed] &= MASK(16);
+        ram[queue->QueueUsed] |= ((uint32_t) new_used) << 16;
+
+        if (!(ram[queue->QueueAvail] & 1))
+            vfs->InterruptStatus |= VIRTIO_INT__USED_RING;
+        job->in_use = false;
+        job = next;
+    }
+}
+
+static struct vfs_pool *vfs_pool_create(virtio_fs_state_t *vfs)
+{
+    struct vfs_pool *pool = calloc(1, sizeof(struct vfs_pool));
+    if (!pool)
+        return NULL;
+    pool->jobs =
+        calloc(ARRAY_SIZE(vfs->queues) * VFS_QUEUE_NUM_MAX, sizeof(vfs_job_t));
+    if (!pool->jobs || pipe(pool->wake_fd) < 0) {
+        free(pool->jobs);
+        free(pool);
+        return NULL;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(pool->wake_fd[i], F_SETFL, O_NONBLOCK);
+        fcntl(pool->wake_fd[i], F_SETFD, FD_CLOEXEC);
+    }
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+    pthread_mutex_init(&pool->fs_lock, NULL);
+
+    /* Workers find the pool through 'vfs' */
+    vfs->pool = pool;
+    int started = 0;
+    for (int i = 0; i < VFS_WORKERS; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, vfs_worker, vfs) != 0)
+            break;
+        pthread_detach(tid);
+        started++;
+    }
+    if (!started) {
+        vfs->pool = NULL;
+        close(pool->wake_fd[0]);
+        close(pool->wake_fd[1]);
+        free(pool->jobs);
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+
 static void virtio_queue_notify_handler(virtio_fs_state_t *vfs, int index)
 {
     uint32_t *ram = vfs->ram;
@@ -691,6 +1879,27 @@ static void virtio_queue_notify_handler(virtio_fs_state_t *vfs, int index)
     if (queue->last_avail == new_avail)
         return;
 
+    /* Fresh notification buffers: deliver whatever was held back for them */
+    if (index == VFS_NOTIFY_QUEUE &&
+        (vfs->DriverFeatures & VIRTIO_FS_F_NOTIFICATION))
+        return virtio_fs_refresh_queue(vfs);
+
+    /* Requests go to the workers and complete later, out of order. FORGET on
+     * the hiprio queue needs the inode table too, so it must not wait for
+     * 'fs_lock' on the hart thread either; the workers take it first.
+     */
+    if (vfs->pool) {
+        while (queue->last_avail != new_avail) {
+            uint16_t queue_idx = queue->last_avail % queue->QueueNum;
+            uint16_t buffer_idx = ram[queue->QueueAvail + 1 + queue_idx / 2] >>
+                                  (16 * (queue_idx % 2));
+            if (vfs_pool_submit(vfs, index, buffer_idx) < 0)
+                return virtio_fs_set_fail(vfs);
+            queue->last_avail++;
+        }
+        return;
+    }
+
     uint16_t new_used = ram[queue->QueueUsed] >> 16;
     while (queue->last_avail != new_avail) {
         uint16_t queue_idx = queue->last_avail % queue->QueueNum;
@@ -717,6 +1926,163 @@ static void virtio_queue_notify_handler(virtio_fs_state_t *vfs, int index)
         vfs->InterruptStatus |= VIRTIO_INT__USED_RING;
 }
 
+/* Post one notification into the next buffer of the notification queue.
+ * Returns false if the guest has no buffer available.
+ */
+static bool vfs_notify_send(virtio_fs_state_t *vfs,
+                            const void *msg,
+                            uint32_t len)
+{
+    uint32_t *ram = vfs->ram;
+    virtio_fs_queue_t *queue = &vfs->queues[VFS_NOTIFY_QUEUE];
+    if (!queue->ready ||
+        queue->last_avail == (uint16_t) (ram[queue->QueueAvail] >> 16))
+        return false;
+
+    uint16_t queue_idx = queue->last_avail % queue->QueueNum;
+    uint16_t buffer_idx = ram[queue->QueueAvail + 1 + queue_idx / 2] >>
+                          (16 * (queue_idx % 2));
+    vfs_req_t req;
+    if (vfs_req_gather(vfs, queue, buffer_idx, &req) < 0 || req.n_in) {
+        virtio_fs_set_fail(vfs);
+        return false;
+    }
+
+    uint32_t copied = 0;
+    for (uint32_t i = 0; i < req.n_out && copied < len; i++) {
+        uint32_t n = MIN(req.desc[i].len, len - copied);
+        memcpy(vfs_req_ptr(vfs, &req.desc[i]), (const uint8_t *) msg + copied,
+               n);
+        copied += n;
+    }
+
+    uint16_t new_used = ram[queue->QueueUsed] >> 16;
+    uint32_t vq_used_addr =
+        queue->QueueUsed + 1 + (new_used % queue->QueueNum) * 2;
+    ram[vq_used_addr] = buffer_idx;
+    ram[vq_used_addr + 1] = copied;
+    queue->last_avail++;
+    new_used++;
+    ram[queue->QueueUsed] &= MASK(16);
+    ram[queue->QueueUsed] |= ((uint32_t) new_used) << 16;
+
+    if (!(ram[queue->QueueAvail] & 1))
+        vfs->InterruptStatus |= VIRTIO_INT__USED_RING;
+    return true;
+}
+
+#if defined(__linux__)
+/* Translate an inotify event into a FUSE notification in 'msg'. Returns its
+ * length, 0 if the guest has nothing cached that the event affects.
+ */
+static uint32_t vfs_event_to_notify(virtio_fs_state_t *vfs,
+                                    const struct inotify_event *event,
+                                    uint8_t *msg)
+{
+    if (event->wd <= 0 || (uint32_t) event->wd >= vfs->watch_cap ||
+        !vfs->watch_ino[event->wd])
+        return 0;
+    uint64_t dir_ino = vfs->watch_ino[event->wd];
+    size_t name_len = event->len ? strlen(event->name) : 0;
+    if (name_len > VFS_NAME_MAX)
+        return 0;
+
+    struct fuse_out_header *out_header = (struct fuse_out_header *) msg;
+    out_header->unique = 0;
+
+    /* A name appeared or went away: drop the dentry, positive or negative */
+    if (name_len &&
+        (event->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))) {
+        struct fuse_notify_inval_entry_out *inval =
+            (struct fuse_notify_inval_entry_out *) (out_header + 1);
+        inval->parent = dir_ino;
+        inval->namelen = name_len;
+        inval->flags = 0;
+        memcpy(inval + 1, event->name, name_len + 1);
+        out_header->error = FUSE_NOTIFY_INVAL_ENTRY;
+        out_header->len = sizeof(*out_header) + sizeof(*inval) + name_len + 1;
+        return out_header->len;
+    }
+
+    /* Attributes or contents changed: only inodes the guest holds matter */
+    uint64_t ino = dir_ino;
+    if (name_len) {
+        char *path = vfs_child_path(vfs, dir_ino, event->name);
+        vfs_inode_t *inode =
+            path ? vfs_inode_find_path(&vfs->inodes, path) : NULL;
+        free(path);
+        if (!inode)
+            return 0;
+        ino = inode->ino;
+    }
+
+    struct fuse_notify_inval_inode_out *inval =
+        (struct fuse_notify_inval_inode_out *) (out_header + 1);
+    inval->ino = ino;
+    /* A negative offset keeps the page cache and drops the attributes only */
+    inval->off = (event->mask & (IN_MODIFY | IN_CLOSE_WRITE)) ? 0 : -1;
+    inval->len = 0;
+    out_header->error = FUSE_NOTIFY_INVAL_INODE;
+    out_header->len = sizeof(*out_header) + sizeof(*inval);
+    return out_header->len;
+}
+#endif
+
+#if defined(__linux__)
+static void vfs_notify_pending(virtio_fs_state_t *vfs)
+{
+    while (1) {
+        if (vfs->event_off >= vfs->event_len) {
+            ssize_t n =
+                read(vfs->inotify_fd, vfs->event_buf, VFS_EVENT_BUF_SIZE);
+            if (n <= 0)
+                return;
+            vfs->event_len = n;
+            vfs->event_off = 0;
+        }
+
+        const struct inotify_event *event =
+            (const struct inotify_event *) (vfs->event_buf + vfs->event_off);
+        uint8_t msg[VFS_NOTIFY_BUF_SIZE];
+        uint32_t len = vfs_event_to_notify(vfs, event, msg);
+        /* Without a buffer, the event waits here and later ones in the
+         * kernel until the guest posts more.
+         */
+        if (len && !vfs_notify_send(vfs, msg, len))
+            return;
+        vfs->event_off += sizeof(struct inotify_event) + event->len;
+    }
+}
+#endif
+
+void virtio_fs_refresh_queue(virtio_fs_state_t *vfs)
+{
+    if (vfs->pool)
+        vfs_pool_complete(vfs);
+
+#if defined(__linux__)
+    if (!vfs_notifications(vfs) || !(vfs->Status & VIRTIO_STATUS__DRIVER_OK) ||
+        (vfs->Status & VIRTIO_STATUS__DEVICE_NEEDS_RESET))
+        return;
+
+    /* Events are matched against the inode table. If a worker holds it,
+     * they are picked up on a later tick rather than stalling the harts.
+     */
+    if (vfs->pool && pthread_mutex_trylock(&vfs->pool->fs_lock))
+        return;
+    vfs_notify_pending(vfs);
+    if (vfs->pool)
+        pthread_mutex_unlock(&vfs->pool->fs_lock);
+#endif
+}
+
+int virtio_fs_get_fd(virtio_fs_state_t *vfs)
+{
+    if (!vfs->pool || !(vfs->Status & VIRTIO_STATUS__DRIVER_OK))
+        return -1;
+    return vfs->pool->wake_fd[0];
+}
+
 static bool virtio_fs_reg_read(virtio_fs_state_t *vfs,
                                uint32_t addr,
                                uint32_t *value)
@@ -756,8 +2122,23 @@ static bool virtio_fs_reg_read(virtio_fs_state_t *vfs,
         *value = 0;
         return true;
     case NUM_REQUEST_QUEUES_ADDR:
+    case NOTIFY_BUF_SIZE_ADDR:
         *value = ((uint32_t *) PRIV(vfs))[addr - _(Config)];
         return true;
+    case _(SHMLenLow):
+    case _(SHMLenHigh):
+    case _(SHMBaseLow):
+    case _(SHMBaseHigh):
+        /* A length of all ones reports that the region does not exist */
+        if (vfs->SHMSel != VFS_SHM_CACHE || !vfs->dax_window)
+            *value = 0xFFFFFFFF;
+        else if (addr == _(SHMLenLow))
+            *value = VFS_DAX_SIZE;
+        else if (addr == _(SHMBaseLow))
+            *value = VFS_DAX_BASE;
+        else
+            *value = 0;
+        return true;
     default:
         if (!RANGE_CHECK((addr >> 2), _(Config),
                          sizeof(struct virtio_fs_config)))
@@ -787,6 +2168,9 @@ static bool virtio_fs_reg_write(virtio_fs_state_t *vfs,
     case _(DriverFeaturesSel):
         vfs->DriverFeaturesSel = value;
         return true;
+    case _(SHMSel):
+        vfs->SHMSel = value;
+        return true;
     case _(QueueSel):
         if (value < ARRAY_SIZE(vfs->queues)) {
             vfs->QueueSel = value;
@@ -913,46 +2297,84 @@ bool virtio_fs_init(virtio_fs_state_t *vfs, char *mtag, char *dir)
     }
 
     vfs->priv = &vfs_configs[vfs_dev_cnt++];
+    vfs->inotify_fd = -1;
 
     if (!dir) {
         /* -s parameter is empty, virtio-fs is unused. */
         return false;
     }
 
+    /* "dir,timeout=N": options follow the first comma */
+    vfs->entry_valid = vfs->attr_valid = VFS_DEFAULT_TIMEOUT;
+    dir = strdup(dir);
+    if (!dir) {
+        fprintf(stderr, "Failed to allocate memory for shared_dir\n");
+        exit(2);
+    }
+    char *opts = strchr(dir, ',');
+    if (opts) {
+        *opts++ = '\0';
+        if (!vfs_parse_options(vfs, opts))
+            exit(2);
+    }
+
     int dir_fd = open(dir, O_RDONLY);
     if (dir_fd < 0) {
         fprintf(stderr, "Could not open directory: %s\n", dir);
         exit(2);
     }
 
-    size_t dir_len = strlen(dir) + 1;
-    vfs->shared_dir = malloc(dir_len);
-    if (!vfs->shared_dir) {
-        fprintf(stderr, "Failed to allocate memory for shared_dir\n");
-        exit(2);
-    }
-    memcpy(vfs->shared_dir, dir, dir_len);
+    vfs->shared_dir = dir;
 
     snprintf(PRIV(vfs)->tag, sizeof(PRIV(vfs)->tag), "%s", mtag);
-    PRIV(vfs)->num_request_queues = 2;
+    PRIV(vfs)->num_request_queues = VFS_REQUEST_QUEUES;
+    PRIV(vfs)->notify_buf_size = VFS_NOTIFY_BUF_SIZE;
     vfs->mount_tag = mtag;
 
-    inode_map_entry *root_entry = malloc(sizeof(inode_map_entry));
-    if (!root_entry) {
-        fprintf(stderr, "Failed to allocate memory for root_entry\n");
-        return false;
+#if SEMU_HAS(VIRTIOFS_DAX)
+    /* Only address space is reserved up front; pages get backed as the guest
+     * touches them or maps files in.
+     */
+    vfs->dax_window = mmap(NULL, VFS_DAX_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (vfs->dax_window == MAP_FAILED) {
+        fprintf(stderr, "Could not reserve the virtio-fs DAX window: %s\n",
+                strerror(errno));
+        vfs->dax_window = NULL;
+    }
+#endif
+
+#if defined(__linux__)
+    /* Without inotify the device still works, the guest just relies on the
+     * cache timeouts alone.
+     */
+    vfs->inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    vfs->event_buf = malloc(VFS_EVENT_BUF_SIZE);
+    if (vfs->inotify_fd < 0 || !vfs->event_buf) {
+        fprintf(stderr, "virtio-fs: host change notifications unavailable\n");
+        if (vfs->inotify_fd >= 0)
+            close(vfs->inotify_fd);
+        vfs->inotify_fd = -1;
     }
-    root_entry->ino = 1;
+#endif
 
-    root_entry->path = strdup(vfs->shared_dir);
-    if (!root_entry->path) {
-        fprintf(stderr, "Failed to allocate memory for root_entry->path\n");
-        free(root_entry);
-        return false;
+    vfs->handles = calloc(VFS_HANDLE_MAX, sizeof(struct vfs_handle));
+    if (!vfs->handles) {
+        fprintf(stderr, "Failed to allocate memory for virtio-fs handles\n");
+        exit(2);
     }
+    for (uint32_t i = 0; i < VFS_HANDLE_MAX; i++)
+        vfs->handles[i].fd = -1;
+
+    if (!vfs_pool_create(vfs))
+        fprintf(stderr,
+                "virtio-fs: no worker threads, serving requests inline\n");
 
-    root_entry->next = vfs->inode_map;
-    vfs->inode_map = root_entry;
+    vfs_inode_t *root_entry = vfs_inode_add(&vfs->inodes, 1, vfs->shared_dir);
+    if (!root_entry) {
+        fprintf(stderr, "Failed to allocate memory for root_entry\n");
+        return false;
+    }
 
     return true;
 }
@@ -8,6 +8,7 @@
 #include "device.h"
 #include "utils.h"
 #include "vgpu-display.h"
+#include "vgpu-pixel.h"
 #include "virtio-gpu.h"
 #include "virtio.h"
 
@@ -25,6 +26,9 @@
 #define VGPU_SW_MAX_BACKING_ENTRIES \
     (RAM_SIZE / VGPU_SW_BACKING_ENTRY_PAGE_SIZE + 1U)
 
+#define VGPU_SW_RES_TABLE_MIN 64 /* Must be power of 2 */
+#define VGPU_SW_BLOB_CURSOR_SIZE 64U
+
 /* Host-side 2D resource owned by the software backend. It keeps the copied
  * 'image' plus any attached guest backing metadata needed by transfers.
  */
@@ -39,6 +43,19 @@ struct vgpu_sw_resource_2d {
     size_t page_cnt;
     struct iovec *iovec;
     struct list_head list;
+
+    /* Host view of the backing when it is one contiguous range of guest RAM
+     * large enough for the whole image, NULL otherwise. Frames are then read
+     * straight from guest memory and 'image' is not kept up to date.
+     */
+    uint8_t *direct;
+
+    /* Guest-memory blob resources have no format or size of their own until
+     * 'SET_SCANOUT_BLOB' (or a cursor update) describes the image at 'offset'
+     * in the blob. 'blob_size' is 0 for regular 2D resources.
+     */
+    uint64_t blob_size;
+    uint32_t offset;
 };
 
 /* Process-wide singleton: semu currently assumes at most one software
@@ -47,6 +64,33 @@ struct vgpu_sw_resource_2d {
 static LIST_HEAD(g_vgpu_sw_res_2d_list);
 static size_t g_vgpu_sw_hostmem;
 
+/* Open-addressed index of 'g_vgpu_sw_res_2d_list' by resource id, so every
+ * command finds its resource in constant time however many a compositor has
+ * allocated. Linear probing, load factor kept at or below 1/2.
+ */
+static struct {
+    struct vgpu_sw_resource_2d **slots;
+    uint32_t capacity;
+    uint32_t count;
+} g_vgpu_sw_res_2d_table;
+
+/* Per-scanout region, in view coordinates, that changed since the last
+ * primary frame published for it. Flushes that cannot be published right away
+ * leave their damage here so the next successful one covers them too.
+ */
+static struct vgpu_display_rect g_vgpu_sw_damage[VIRTIO_GPU_MAX_SCANOUTS];
+
+/* Guest flushes folded into 'g_vgpu_sw_damage' that are still waiting to be
+ * published. Non-zero means the frame was deferred by pacing or a busy
+ * display, and 'vgpu_sw_refresh()' publishes it once its slot comes.
+ */
+static uint32_t g_vgpu_sw_flushes[VIRTIO_GPU_MAX_SCANOUTS];
+
+/* 'vgpu_sw_refresh()' runs on every peripheral tick; only look at the clock
+ * on one tick in this many.
+ */
+#define VGPU_SW_REFRESH_TICKS 16U
+
 static size_t vgpu_sw_iov_to_buf(const struct iovec *iov,
                                  unsigned int iov_cnt,
                                  size_t offset,
@@ -197,8 +241,264 @@ static bool vgpu_sw_copy_image_from_pages(
     return true;
 }
 
+/* The software backend currently supports only 32bpp packed formats. Returns
+ * 0 for anything else.
+ */
+static uint32_t vgpu_sw_format_bpp(uint32_t format)
+{
+    switch (format) {
+    case VIRTIO_GPU_FORMAT_B8G8R8A8_UNORM:
+    case VIRTIO_GPU_FORMAT_B8G8R8X8_UNORM:
+    case VIRTIO_GPU_FORMAT_A8R8G8B8_UNORM:
+    case VIRTIO_GPU_FORMAT_X8R8G8B8_UNORM:
+    case VIRTIO_GPU_FORMAT_R8G8B8A8_UNORM:
+    case VIRTIO_GPU_FORMAT_X8B8G8R8_UNORM:
+    case VIRTIO_GPU_FORMAT_A8B8G8R8_UNORM:
+    case VIRTIO_GPU_FORMAT_R8G8B8X8_UNORM:
+        return 32;
+    default:
+        return 0;
+    }
+}
+
+/* Pick the byte permutation that turns 'format' into the host display order.
+ * '*host_format' receives the matching B8G8R8A8/B8G8R8X8 format, so a frame
+ * already in that order can be handed over as is.
+ */
+static enum vgpu_pixel_swizzle vgpu_sw_format_swizzle(uint32_t format,
+                                                      uint32_t *host_format)
+{
+    switch (format) {
+    case VIRTIO_GPU_FORMAT_B8G8R8A8_UNORM:
+        *host_format = VIRTIO_GPU_FORMAT_B8G8R8A8_UNORM;
+        return VGPU_PIXEL_COPY;
+    case VIRTIO_GPU_FORMAT_A8R8G8B8_UNORM:
+        *host_format = VIRTIO_GPU_FORMAT_B8G8R8A8_UNORM;
+        return VGPU_PIXEL_BSWAP;
+    case VIRTIO_GPU_FORMAT_R8G8B8A8_UNORM:
+        *host_format = VIRTIO_GPU_FORMAT_B8G8R8A8_UNORM;
+        return VGPU_PIXEL_SWAP_RB;
+    case VIRTIO_GPU_FORMAT_A8B8G8R8_UNORM:
+        *host_format = VIRTIO_GPU_FORMAT_B8G8R8A8_UNORM;
+        return VGPU_PIXEL_ROTR8;
+    case VIRTIO_GPU_FORMAT_X8R8G8B8_UNORM:
+        *host_format = VIRTIO_GPU_FORMAT_B8G8R8X8_UNORM;
+        return VGPU_PIXEL_BSWAP;
+    case VIRTIO_GPU_FORMAT_R8G8B8X8_UNORM:
+        *host_format = VIRTIO_GPU_FORMAT_B8G8R8X8_UNORM;
+        return VGPU_PIXEL_SWAP_RB;
+    case VIRTIO_GPU_FORMAT_X8B8G8R8_UNORM:
+        *host_format = VIRTIO_GPU_FORMAT_B8G8R8X8_UNORM;
+        return VGPU_PIXEL_ROTR8;
+    case VIRTIO_GPU_FORMAT_B8G8R8X8_UNORM:
+    default:
+        *host_format = VIRTIO_GPU_FORMAT_B8G8R8X8_UNORM;
+        return VGPU_PIXEL_COPY;
+    }
+}
+
+/* Bytes of backing the image needs, from its first byte in the backing */
+static uint64_t vgpu_sw_backing_needed(const struct vgpu_sw_resource_2d *res_2d)
+{
+    if (res_2d->blob_size)
+        return res_2d->blob_size;
+    return res_2d->image_size;
+}
+
+/* Point 'direct' at the backing if all of it is one contiguous guest range.
+ * Guest RAM is a single host mapping, so entries that follow each other in
+ * guest physical memory also follow each other on the host. Allocators such as
+ * CMA usually hand out scanout buffers this way.
+ */
+static void vgpu_sw_update_direct(struct vgpu_sw_resource_2d *res_2d)
+{
+    uint8_t *base = NULL, *end = NULL;
+
+    res_2d->direct = NULL;
+    for (size_t i = 0; i < res_2d->page_cnt; i++) {
+        const struct iovec *iov = &res_2d->iovec[i];
+        if (iov->iov_len == 0)
+            continue;
+        if (!base)
+            base = end = iov->iov_base;
+        if (iov->iov_base != end)
+            return;
+        end += iov->iov_len;
+    }
+
+    if (base && (uint64_t) (end - base) >= vgpu_sw_backing_needed(res_2d))
+        res_2d->direct = base;
+}
+
+/* Stop reading a 2D resource straight from guest memory, e.g. before its
+ * backing goes away. The host image has not followed the transfers skipped
+ * so far, so bring it up to date with the whole backing first.
+ */
+static void vgpu_sw_drop_direct(struct vgpu_sw_resource_2d *res_2d)
+{
+    if (!res_2d->direct)
+        return;
+    if (!res_2d->blob_size)
+        memcpy(res_2d->image, res_2d->direct, res_2d->image_size);
+    res_2d->direct = NULL;
+}
+
+/* Describe the image a blob holds and, unless it can be read in place, make
+ * room for a host copy of it. Returns a control response type.
+ */
+static uint32_t vgpu_sw_blob_set_layout(struct vgpu_sw_resource_2d *res_2d,
+                                        uint32_t format,
+                                        uint32_t width,
+                                        uint32_t height,
+                                        uint32_t stride,
+                                        uint32_t offset)
+{
+    uint32_t bits_per_pixel = vgpu_sw_format_bpp(format);
+    uint64_t row_bytes = (uint64_t) width * (bits_per_pixel / 8);
+
+    if (bits_per_pixel == 0 || width == 0 || height == 0 || stride < row_bytes)
+        return VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
+
+    /* All terms are 32-bit, so the end of the last row cannot wrap here. */
+    uint64_t end = offset + (uint64_t) stride * (height - 1) + row_bytes;
+    if (end > res_2d->blob_size)
+        return VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
+
+    /* The host copy keeps the blob's own layout from the image's first row so
+     * 'vgpu_sw_copy_image_from_pages()' can refresh it in place.
+     */
+    size_t image_size = (size_t) stride * height;
+    if (!res_2d->direct && res_2d->image_size != image_size) {
+        if (image_size > VGPU_SW_MAX_HOSTMEM ||
+            g_vgpu_sw_hostmem - res_2d->image_size >
+                VGPU_SW_MAX_HOSTMEM - image_size)
+            return VIRTIO_GPU_RESP_ERR_OUT_OF_MEMORY;
+
+        uint32_t *image = calloc(1, image_size);
+        if (!image)
+            return VIRTIO_GPU_RESP_ERR_OUT_OF_MEMORY;
+        free(res_2d->image);
+        g_vgpu_sw_hostmem = g_vgpu_sw_hostmem - res_2d->image_size + image_size;
+        res_2d->image = image;
+        res_2d->image_size = image_size;
+    }
+
+    res_2d->format = format;
+    res_2d->bits_per_pixel = bits_per_pixel;
+    res_2d->width = width;
+    res_2d->height = height;
+    res_2d->stride = stride;
+    res_2d->offset = offset;
+    return VIRTIO_GPU_RESP_OK_NODATA;
+}
+
+/* Blobs have no 'TRANSFER_TO_HOST_2D' step: when they cannot be read in place,
+ * refresh the rows about to be shown from the scattered backing instead.
+ */
+static bool vgpu_sw_blob_gather(struct vgpu_sw_resource_2d *res_2d,
+                                uint32_t x,
+                                uint32_t y,
+                                uint32_t width,
+                                uint32_t height)
+{
+    struct virtio_gpu_trans_to_host_2d req = {
+        .r = {x, y, width, height},
+        .offset = res_2d->offset + (uint64_t) y * res_2d->stride +
+                  (uint64_t) x * (res_2d->bits_per_pixel / 8),
+        .resource_id = res_2d->resource_id,
+    };
+
+    if (!res_2d->blob_size || res_2d->direct)
+        return true;
+    /* The host copy is only sized while the backing is scattered. */
+    if (!res_2d->iovec ||
+        res_2d->image_size < (size_t) res_2d->stride * res_2d->height)
+        return false;
+    return vgpu_sw_copy_image_from_pages(&req, res_2d);
+}
+
+static uint32_t vgpu_sw_hash_resource_id(uint32_t resource_id)
+{
+    /* Fibonacci hashing: Linux hands out ids sequentially from 1 */
+    return resource_id * 0x9e3779b9U;
+}
+
+static void vgpu_sw_res_slot_insert(struct vgpu_sw_resource_2d **slots,
+                                    uint32_t mask,
+                                    struct vgpu_sw_resource_2d *res_2d)
+{
+    uint32_t i = vgpu_sw_hash_resource_id(res_2d->resource_id) & mask;
+    while (slots[i])
+        i = (i + 1) & mask;
+    slots[i] = res_2d;
+}
+
+static int32_t vgpu_sw_res_slot(uint32_t resource_id)
+{
+    struct vgpu_sw_resource_2d **slots = g_vgpu_sw_res_2d_table.slots;
+    if (!g_vgpu_sw_res_2d_table.capacity)
+        return -1;
+    uint32_t mask = g_vgpu_sw_res_2d_table.capacity - 1;
+    for (uint32_t i = vgpu_sw_hash_resource_id(resource_id) & mask; slots[i];
+         i = (i + 1) & mask) {
+        if (slots[i]->resource_id == resource_id)
+            return i;
+    }
+    return -1;
+}
+
+static bool vgpu_sw_res_table_add(struct vgpu_sw_resource_2d *res_2d)
+{
+    uint32_t capacity = g_vgpu_sw_res_2d_table.capacity;
+
+    if ((g_vgpu_sw_res_2d_table.count + 1) * 2 > capacity) {
+        uint32_t new_capacity = capacity ? capacity * 2 : VGPU_SW_RES_TABLE_MIN;
+        struct vgpu_sw_resource_2d **slots =
+            calloc(new_capacity, sizeof(struct vgpu_sw_resource_2d *));
+        if (!slots)
+            return false;
+
+        for (uint32_t i = 0; i < capacity; i++) {
+            if (g_vgpu_sw_res_2d_table.slots[i])
+                vgpu_sw_res_slot_insert(slots, new_capacity - 1,
+                                        g_vgpu_sw_res_2d_table.slots[i]);
+        }
+        free(g_vgpu_sw_res_2d_table.slots);
+        g_vgpu_sw_res_2d_table.slots = slots;
+        g_vgpu_sw_res_2d_table.capacity = capacity = new_capacity;
+    }
+
+    vgpu_sw_res_slot_insert(g_vgpu_sw_res_2d_table.slots, capacity - 1, res_2d);
+    g_vgpu_sw_res_2d_table.count++;
+    return true;
+}
+
+/* Backward-shift deletion keeps probe sequences intact without tombstones */
+static void vgpu_sw_res_table_remove(uint32_t resource_id)
+{
+    struct vgpu_sw_resource_2d **slots = g_vgpu_sw_res_2d_table.slots;
+    int32_t slot = vgpu_sw_res_slot(resource_id);
+    if (slot < 0)
+        return;
+
+    uint32_t mask = g_vgpu_sw_res_2d_table.capacity - 1;
+    uint32_t i = slot;
+    slots[i] = NULL;
+    for (uint32_t j = (i + 1) & mask; slots[j]; j = (j + 1) & mask) {
+        uint32_t home = vgpu_sw_hash_resource_id(slots[j]->resource_id) & mask;
+        /* Leave entries whose home lies cyclically within (i, j] */
+        if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+            continue;
+        slots[i] = slots[j];
+        slots[j] = NULL;
+        i = j;
+    }
+    g_vgpu_sw_res_2d_table.count--;
+}
+
 static void vgpu_sw_destroy_resource_2d(struct vgpu_sw_resource_2d *res_2d)
 {
+    vgpu_sw_res_table_remove(res_2d->resource_id);
     list_del(&res_2d->list);
     g_vgpu_sw_hostmem -= res_2d->image_size;
     free(res_2d->image);
@@ -208,13 +508,8 @@ static void vgpu_sw_destroy_resource_2d(struct vgpu_sw_resource_2d *res_2d)
 
 static struct vgpu_sw_resource_2d *vgpu_sw_get_resource_2d(uint32_t resource_id)
 {
-    struct vgpu_sw_resource_2d *res_2d;
-    list_for_each_entry (res_2d, &g_vgpu_sw_res_2d_list, list) {
-        if (res_2d->resource_id == resource_id)
-            return res_2d;
-    }
-
-    return NULL;
+    int32_t slot = vgpu_sw_res_slot(resource_id);
+    return slot < 0 ? NULL : g_vgpu_sw_res_2d_table.slots[slot];
 }
 
 static struct virtio_gpu_scanout_info *vgpu_sw_get_scanout(
@@ -228,12 +523,80 @@ static struct virtio_gpu_scanout_info *vgpu_sw_get_scanout(
     return scanout->enabled ? scanout : NULL;
 }
 
+static bool vgpu_sw_rect_is_empty(const struct vgpu_display_rect *rect)
+{
+    return rect->width == 0 || rect->height == 0;
+}
+
+/* Grow 'dst' to the bounding box of 'dst' and 'src'. */
+static void vgpu_sw_rect_union(struct vgpu_display_rect *dst,
+                               const struct vgpu_display_rect *src)
+{
+    if (vgpu_sw_rect_is_empty(src))
+        return;
+    if (vgpu_sw_rect_is_empty(dst)) {
+        *dst = *src;
+        return;
+    }
+
+    uint32_t x1 = MIN(dst->x, src->x);
+    uint32_t y1 = MIN(dst->y, src->y);
+    uint32_t x2 = dst->x + dst->width;
+    uint32_t y2 = dst->y + dst->height;
+
+    if (src->x + src->width > x2)
+        x2 = src->x + src->width;
+    if (src->y + src->height > y2)
+        y2 = src->y + src->height;
+
+    *dst = (struct vgpu_display_rect) {x1, y1, x2 - x1, y2 - y1};
+}
+
+/* Clip a rectangle in resource coordinates against the 'SET_SCANOUT' view and
+ * translate the result into view coordinates. Returns false when the two do
+ * not overlap.
+ */
+static bool vgpu_sw_rect_to_view(const struct virtio_gpu_rect *rect,
+                                 const struct virtio_gpu_scanout_info *scanout,
+                                 struct vgpu_display_rect *out)
+{
+    /* Both rectangles were validated against the resource size, so their
+     * right and bottom edges fit in 'uint64_t' without wrapping.
+     */
+    uint64_t x1 = rect->x > scanout->src_x ? rect->x : scanout->src_x;
+    uint64_t y1 = rect->y > scanout->src_y ? rect->y : scanout->src_y;
+    uint64_t x2 = MIN((uint64_t) rect->x + rect->width,
+                      (uint64_t) scanout->src_x + scanout->src_w);
+    uint64_t y2 = MIN((uint64_t) rect->y + rect->height,
+                      (uint64_t) scanout->src_y + scanout->src_h);
+
+    if (x1 >= x2 || y1 >= y2)
+        return false;
+
+    *out = (struct vgpu_display_rect) {
+        .x = (uint32_t) (x1 - scanout->src_x),
+        .y = (uint32_t) (y1 - scanout->src_y),
+        .width = (uint32_t) (x2 - x1),
+        .height = (uint32_t) (y2 - y1),
+    };
+    return true;
+}
+
+/* Snapshot a plane into a display payload. Primary planes pass their
+ * 'scanout' so only its view is captured, cursor planes pass NULL and capture
+ * the whole resource.
+ */
 static struct vgpu_display_payload *vgpu_sw_create_window_payload(
-    const struct vgpu_sw_resource_2d *res_2d,
+    struct vgpu_sw_resource_2d *res_2d,
     const struct virtio_gpu_scanout_info *scanout,
-    const char *plane_name)
+    uint32_t scanout_id,
+    enum vgpu_display_plane plane,
+    const struct vgpu_display_rect *damage)
 {
-    if (!res_2d || !res_2d->image) {
+    const char *plane_name =
+        plane == VGPU_DISPLAY_PLANE_PRIMARY ? "primary" : "cursor";
+
+    if (!res_2d || (!res_2d->image && !res_2d->direct)) {
         fprintf(stderr, VIRTIO_GPU_LOG_PREFIX "%s(): missing %s image\n",
                 __func__, plane_name);
         return NULL;
@@ -266,73 +629,205 @@ static struct vgpu_display_payload *vgpu_sw_create_window_payload(
         return NULL;
     }
 
-    size_t row_bytes = (size_t) width * bytes_per_pixel;
-    if (row_bytes / width != bytes_per_pixel) {
+    /* Without a damage rectangle the whole plane is snapshotted. Otherwise the
+     * caller already clipped it to the view.
+     */
+    struct vgpu_display_rect rect = {0, 0, width, height};
+    if (damage)
+        rect = *damage;
+    if (vgpu_sw_rect_is_empty(&rect) || rect.x > width - rect.width ||
+        rect.y > height - rect.height) {
+        fprintf(stderr,
+                VIRTIO_GPU_LOG_PREFIX
+                "%s(): %s damage %u,%u %ux%u exceeds view %ux%u\n",
+                __func__, plane_name, rect.x, rect.y, rect.width, rect.height,
+                width, height);
+        return NULL;
+    }
+
+    size_t view_row_bytes = (size_t) width * bytes_per_pixel;
+    if (view_row_bytes / width != bytes_per_pixel) {
         fprintf(stderr, VIRTIO_GPU_LOG_PREFIX "%s(): %s row size overflow\n",
                 __func__, plane_name);
         return NULL;
     }
-    if (row_bytes > UINT32_MAX) {
+    if (view_row_bytes > UINT32_MAX) {
         fprintf(stderr,
                 VIRTIO_GPU_LOG_PREFIX "%s(): %s row size exceeds uint32_t\n",
                 __func__, plane_name);
         return NULL;
     }
-    if (res_2d->stride < row_bytes) {
+    if (res_2d->stride < view_row_bytes) {
         fprintf(stderr,
                 VIRTIO_GPU_LOG_PREFIX
                 "%s(): invalid %s stride %u for row size %zu\n",
-                __func__, plane_name, res_2d->stride, row_bytes);
+                __func__, plane_name, res_2d->stride, view_row_bytes);
         return NULL;
     }
 
-    size_t pixels_size = row_bytes * height;
-    if (pixels_size / height != row_bytes) {
+    /* The damage lies inside the view, so its rows and total size are bounded
+     * by the checks above.
+     */
+    size_t row_bytes = (size_t) rect.width * bytes_per_pixel;
+    size_t pixels_size = row_bytes * rect.height;
+    if (pixels_size / rect.height != row_bytes) {
         fprintf(stderr, VIRTIO_GPU_LOG_PREFIX "%s(): %s image size overflow\n",
                 __func__, plane_name);
         return NULL;
     }
 
-    size_t alloc_size = sizeof(struct vgpu_display_payload) + pixels_size;
-    if (alloc_size < pixels_size) {
-        fprintf(stderr, VIRTIO_GPU_LOG_PREFIX "%s(): %s allocation overflow\n",
+    if (!vgpu_sw_blob_gather(res_2d, src_x + rect.x, src_y + rect.y,
+                             rect.width, rect.height)) {
+        fprintf(stderr,
+                VIRTIO_GPU_LOG_PREFIX "%s(): incomplete %s blob backing\n",
                 __func__, plane_name);
         return NULL;
     }
 
-    struct vgpu_display_payload *payload = malloc(alloc_size);
-    if (!payload) {
-        fprintf(stderr,
-                VIRTIO_GPU_LOG_PREFIX "%s(): failed to allocate %s snapshot\n",
+    const uint8_t *image =
+        res_2d->direct ? res_2d->direct + res_2d->offset
+                       : (const uint8_t *) res_2d->image;
+    const uint8_t *src_pixels = image +
+                                ((size_t) src_y + rect.y) * res_2d->stride +
+                                ((size_t) src_x + rect.x) * bytes_per_pixel;
+
+    /* Frames reach the display in host order, so the window backend never
+     * has to convert pixels itself. The cursor always carries alpha, taken
+     * from the padding byte of X formats, and is premultiplied so that it
+     * blends and scales without dark fringes.
+     */
+    uint32_t host_format;
+    enum vgpu_pixel_swizzle swizzle =
+        vgpu_sw_format_swizzle(res_2d->format, &host_format);
+    bool cursor = plane == VGPU_DISPLAY_PLANE_CURSOR;
+    if (cursor)
+        host_format = VIRTIO_GPU_FORMAT_B8G8R8A8_UNORM;
+
+    /* Reserve room for the whole view rather than just this damage, so the
+     * pooled buffer does not need to grow again for the next, larger update.
+     * A primary plane read in place needs no room at all.
+     */
+    bool in_place = res_2d->direct && !cursor && swizzle == VGPU_PIXEL_COPY;
+    size_t view_size = view_row_bytes * height;
+    if (view_size / height != view_row_bytes) {
+        fprintf(stderr, VIRTIO_GPU_LOG_PREFIX "%s(): %s image size overflow\n",
                 __func__, plane_name);
         return NULL;
     }
 
-    payload->cpu.format = res_2d->format;
+    /* A NULL result means every buffer of this plane is still queued or being
+     * displayed (or growing one failed); the frame is dropped like one that
+     * found the display queue full.
+     */
+    struct vgpu_display_payload *payload = vgpu_display_acquire_payload(
+        scanout_id, plane, in_place ? 0 : view_size);
+    if (!payload)
+        return NULL;
+
+    payload->cpu.format = host_format;
     payload->cpu.width = width;
     payload->cpu.height = height;
-    payload->cpu.stride = (uint32_t) row_bytes;
+    payload->cpu.damage = rect;
     payload->cpu.bits_per_pixel = res_2d->bits_per_pixel;
-    payload->cpu.pixels = (uint8_t *) (payload + 1);
 
-    /* The cropped view is contiguous only when the source stride matches this
-     * snapshot's row size. Otherwise each source row still carries padding or
-     * untouched pixels outside the requested view, so the snapshot must be
-     * packed row by row.
+    /* Hand guest memory to the display as is, with the resource's stride. */
+    if (in_place) {
+        payload->cpu.pixels = (uint8_t *) src_pixels;
+        payload->cpu.stride = res_2d->stride;
+        return payload;
+    }
+    payload->cpu.stride = (uint32_t) row_bytes;
+
+    /* The snapshot is packed: each source row may still carry padding or
+     * untouched pixels outside the damage, which the copy leaves behind.
+     */
+    vgpu_pixel_convert(payload->cpu.pixels, row_bytes, src_pixels,
+                       res_2d->stride, rect.width, rect.height, swizzle,
+                       cursor);
+
+    return payload;
+}
+
+/* Map the 'nr_entries' backing entries that follow a request in 'vq_desc[1]'
+ * into a new 'iovec' array. Returns the control response type to send, or 0
+ * when the descriptor chain itself is malformed and the device must fail.
+ */
+static uint32_t vgpu_sw_map_backing(virtio_gpu_state_t *vgpu,
+                                    struct virtq_desc *vq_desc,
+                                    uint32_t nr_entries,
+                                    struct iovec **iovec)
+{
+    if (vq_desc[1].flags & VIRTIO_DESC_F_WRITE) {
+        fprintf(stderr,
+                VIRTIO_GPU_LOG_PREFIX
+                "%s(): backing entries descriptor is writable\n",
+                __func__);
+        return 0;
+    }
+
+    if (nr_entries == 0 || nr_entries > VGPU_SW_MAX_BACKING_ENTRIES) {
+        fprintf(stderr,
+                VIRTIO_GPU_LOG_PREFIX "%s(): invalid backing entry count %u\n",
+                __func__, nr_entries);
+        return VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
+    }
+
+    /* The entry cap above keeps 'entries_size' small. semu currently targets
+     * 64-bit hosts, so this path does not guard for 32-bit host overflow yet.
      */
-    const uint8_t *src_pixels = (const uint8_t *) res_2d->image +
-                                (size_t) src_y * res_2d->stride +
-                                (size_t) src_x * bytes_per_pixel;
-    if (res_2d->stride == row_bytes) {
-        memcpy(payload->cpu.pixels, src_pixels, pixels_size);
-    } else {
-        for (uint32_t y = 0; y < height; y++) {
-            memcpy(payload->cpu.pixels + (size_t) y * row_bytes,
-                   src_pixels + (size_t) y * res_2d->stride, row_bytes);
+    size_t entries_size = sizeof(struct virtio_gpu_mem_entry) * nr_entries;
+
+    if (vq_desc[1].len < entries_size) {
+        fprintf(stderr,
+                VIRTIO_GPU_LOG_PREFIX
+                "%s(): backing entries descriptor too small\n",
+                __func__);
+        return VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
+    }
+
+    struct virtio_gpu_mem_entry *pages = virtio_gpu_mem_guest_to_host(
+        vgpu, vq_desc[1].addr, (uint32_t) entries_size);
+    if (!pages)
+        return 0;
+
+    struct iovec *iov = malloc(sizeof(struct iovec) * nr_entries);
+    if (!iov) {
+        fprintf(stderr,
+                VIRTIO_GPU_LOG_PREFIX "%s(): failed to allocate io vector\n",
+                __func__);
+        return 0;
+    }
+
+    /* Convert each guest-provided backing entry into one host-side 'iovec'. */
+    for (size_t i = 0; i < nr_entries; i++) {
+        if (pages[i].addr > UINT32_MAX) {
+            fprintf(stderr,
+                    VIRTIO_GPU_LOG_PREFIX "%s(): page %zu addr_high non-zero\n",
+                    __func__, i);
+            free(iov);
+            return VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
+        }
+
+        /* Record the address and length of the i-th page. */
+        iov[i].iov_base = virtio_gpu_mem_guest_to_host(
+            vgpu, (uint32_t) pages[i].addr, pages[i].length);
+        iov[i].iov_len = pages[i].length;
+
+        /* Corrupted page address */
+        if (!iov[i].iov_base) {
+            fprintf(stderr,
+                    VIRTIO_GPU_LOG_PREFIX
+                    "%s(): backing entry %zu guest address 0x%llx length %u "
+                    "is out of guest RAM\n",
+                    __func__, i, (unsigned long long) pages[i].addr,
+                    pages[i].length);
+            free(iov);
+            return VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
         }
     }
 
-    return payload;
+    *iovec = iov;
+    return VIRTIO_GPU_RESP_OK_NODATA;
 }
 
 /* Backend Implementation */
@@ -343,8 +838,14 @@ static void vgpu_sw_reset(virtio_gpu_state_t *vgpu)
      * per-plane generation; 'vgpu_display_pop_cmd()' consumes those clears
      * first, then drops older queued frame commands as stale.
      *
-     * Queued frame payloads are deep copies, so destroying resources after the
-     * clear publication cannot dangle any display payload still in the bridge.
+     * A queued payload either holds a copy in the bridge's own buffers or,
+     * for a primary plane read in place, points into guest RAM. Destroying
+     * the resources below dangles neither: the bridge owns the copies, and
+     * guest RAM stays mapped for the life of the emulator. The clears make
+     * the consumer drop in-place frames as stale rather than show pages the
+     * guest may already reuse; one it is uploading at this moment at worst
+     * reads such a page. Resource unref and backing detach follow the same
+     * rule.
      * The display queue is SPSC and consumer-owned, so reset does not drain it
      * from the producer side. The bounded queue releases stale payloads when
      * the SDL consumer pops them.
@@ -356,6 +857,8 @@ static void vgpu_sw_reset(virtio_gpu_state_t *vgpu)
         PRIV(vgpu)->scanouts[i].src_y = 0;
         PRIV(vgpu)->scanouts[i].src_w = 0;
         PRIV(vgpu)->scanouts[i].src_h = 0;
+        g_vgpu_sw_damage[i] = (struct vgpu_display_rect) {0};
+        g_vgpu_sw_flushes[i] = 0;
         vgpu_display_publish_primary_clear(i);
         vgpu_display_publish_cursor_clear(i);
     }
@@ -422,7 +925,7 @@ static void vgpu_sw_resource_create_2d_handler(virtio_gpu_state_t *vgpu,
 
     /* Reject re-use of an already-live resource id. Without this check the
      * guest could orphan the previous resource (its 'image' and 'iovec' would
-     * leak because 'vgpu_sw_get_resource_2d()' returns the first match) and
+     * leak because 'vgpu_sw_get_resource_2d()' finds only one of them) and
      * confuse later 'TRANSFER' / 'FLUSH' / 'UNREF' requests that target the
      * same id. Spec explicitly allows the device to fail this.
      */
@@ -450,20 +953,8 @@ static void vgpu_sw_resource_create_2d_handler(virtio_gpu_state_t *vgpu,
     }
     res_2d->resource_id = request->resource_id;
 
-    /* The software backend currently supports only 32bpp packed formats. */
-    uint32_t bits_per_pixel;
-    switch (request->format) {
-    case VIRTIO_GPU_FORMAT_B8G8R8A8_UNORM:
-    case VIRTIO_GPU_FORMAT_B8G8R8X8_UNORM:
-    case VIRTIO_GPU_FORMAT_A8R8G8B8_UNORM:
-    case VIRTIO_GPU_FORMAT_X8R8G8B8_UNORM:
-    case VIRTIO_GPU_FORMAT_R8G8B8A8_UNORM:
-    case VIRTIO_GPU_FORMAT_X8B8G8R8_UNORM:
-    case VIRTIO_GPU_FORMAT_A8B8G8R8_UNORM:
-    case VIRTIO_GPU_FORMAT_R8G8B8X8_UNORM:
-        bits_per_pixel = 32;
-        break;
-    default:
+    uint32_t bits_per_pixel = vgpu_sw_format_bpp(request->format);
+    if (!bits_per_pixel) {
         fprintf(stderr, VIRTIO_GPU_LOG_PREFIX "%s(): unsupported format %u\n",
                 __func__, request->format);
         free(res_2d);
@@ -550,6 +1041,16 @@ static void vgpu_sw_resource_create_2d_handler(virtio_gpu_state_t *vgpu,
         *plen = 0;
         return;
     }
+    if (!vgpu_sw_res_table_add(res_2d)) {
+        fprintf(stderr,
+                VIRTIO_GPU_LOG_PREFIX "%s(): failed to grow resource table\n",
+                __func__);
+        free(res_2d->image);
+        free(res_2d);
+        virtio_gpu_set_fail(vgpu);
+        *plen = 0;
+        return;
+    }
     res_2d->image_size = image_size;
     g_vgpu_sw_hostmem += image_size;
     list_push(&res_2d->list, &g_vgpu_sw_res_2d_list);
@@ -560,9 +1061,9 @@ static void vgpu_sw_resource_create_2d_handler(virtio_gpu_state_t *vgpu,
         virtio_gpu_set_fail(vgpu);
 }
 
-static void vgpu_sw_cmd_resource_unref_handler(virtio_gpu_state_t *vgpu,
-                                               struct virtq_desc *vq_desc,
-                                               uint32_t *plen)
+static void vgpu_sw_resource_create_blob_handler(virtio_gpu_state_t *vgpu,
+                                                 struct virtq_desc *vq_desc,
+                                                 uint32_t *plen)
 {
     const struct virtq_desc *response_desc = virtio_gpu_get_response_desc(
         vq_desc, sizeof(struct virtio_gpu_ctrl_hdr));
@@ -572,60 +1073,107 @@ static void vgpu_sw_cmd_resource_unref_handler(virtio_gpu_state_t *vgpu,
         return;
     }
 
-    struct virtio_gpu_res_unref *request = virtio_gpu_get_request(
-        vgpu, vq_desc, sizeof(struct virtio_gpu_res_unref));
+    struct virtio_gpu_resource_create_blob *request = virtio_gpu_get_request(
+        vgpu, vq_desc, sizeof(struct virtio_gpu_resource_create_blob));
     if (!request) {
         virtio_gpu_set_fail(vgpu);
         *plen = 0;
         return;
     }
 
-    struct vgpu_sw_resource_2d *res_2d =
-        vgpu_sw_get_resource_2d(request->resource_id);
-    if (!res_2d) {
+    uint32_t type = VIRTIO_GPU_RESP_OK_NODATA;
+    uint64_t backing_size = 0;
+
+    /* Same id rules as 'RESOURCE_CREATE_2D'. */
+    if (request->resource_id == 0 ||
+        vgpu_sw_get_resource_2d(request->resource_id)) {
         fprintf(stderr,
-                VIRTIO_GPU_LOG_PREFIX
-                "%s(): resource unref references invalid resource id %u\n",
+                VIRTIO_GPU_LOG_PREFIX "%s(): invalid or used resource id %u\n",
                 __func__, request->resource_id);
-        *plen = virtio_gpu_write_ctrl_response(
-            vgpu, &request->hdr, response_desc,
-            VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID);
-        if (!*plen)
-            virtio_gpu_set_fail(vgpu);
-        return;
+        type = VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID;
+        goto leave;
     }
 
-    /* Clear any visible plane using this resource before it is freed. */
-    for (uint32_t i = 0; i < PRIV(vgpu)->num_scanouts; i++) {
-        struct virtio_gpu_scanout_info *scanout = &PRIV(vgpu)->scanouts[i];
+    /* Host and host3d blobs need virgl or a mappable shared memory region,
+     * neither of which this backend offers.
+     */
+    if (request->blob_mem != VIRTIO_GPU_BLOB_MEM_GUEST || request->size == 0) {
+        fprintf(stderr,
+                VIRTIO_GPU_LOG_PREFIX
+                "%s(): unsupported blob memory %u or size %llu\n",
+                __func__, request->blob_mem,
+                (unsigned long long) request->size);
+        type = VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
+        goto leave;
+    }
 
-        if (!scanout->enabled)
-            continue;
+    struct vgpu_sw_resource_2d *res_2d = calloc(1, sizeof(*res_2d));
+    if (!res_2d) {
+        fprintf(stderr,
+                VIRTIO_GPU_LOG_PREFIX "%s(): failed to allocate new resource\n",
+                __func__);
+        virtio_gpu_set_fail(vgpu);
+        *plen = 0;
+        return;
+    }
+    res_2d->resource_id = request->resource_id;
+    res_2d->blob_size = request->size;
 
-        if (scanout->primary_resource_id == request->resource_id) {
-            scanout->primary_resource_id = 0;
-            scanout->src_x = scanout->src_y = 0;
-            scanout->src_w = scanout->src_h = 0;
-            vgpu_display_publish_primary_clear(i);
-        }
+    /* Guest blobs come with their backing, in the layout 'ATTACH_BACKING'
+     * uses.
+     */
+    type = vgpu_sw_map_backing(vgpu, vq_desc, request->nr_entries,
+                               &res_2d->iovec);
+    if (!type) {
+        free(res_2d);
+        virtio_gpu_set_fail(vgpu);
+        *plen = 0;
+        return;
+    }
+    if (type != VIRTIO_GPU_RESP_OK_NODATA) {
+        free(res_2d);
+        goto leave;
+    }
+    res_2d->page_cnt = request->nr_entries;
 
-        if (scanout->cursor_resource_id == request->resource_id) {
-            scanout->cursor_resource_id = 0;
-            vgpu_display_publish_cursor_clear(i);
-        }
+    /* Entry lengths are 32-bit and capped in number, so this cannot wrap. */
+    for (size_t i = 0; i < res_2d->page_cnt; i++)
+        backing_size += res_2d->iovec[i].iov_len;
+    if (backing_size < res_2d->blob_size) {
+        fprintf(stderr,
+                VIRTIO_GPU_LOG_PREFIX
+                "%s(): backing of %llu bytes is smaller than blob of %llu\n",
+                __func__, (unsigned long long) backing_size,
+                (unsigned long long) res_2d->blob_size);
+        free(res_2d->iovec);
+        free(res_2d);
+        type = VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
+        goto leave;
     }
 
-    vgpu_sw_destroy_resource_2d(res_2d);
+    if (!vgpu_sw_res_table_add(res_2d)) {
+        fprintf(stderr,
+                VIRTIO_GPU_LOG_PREFIX "%s(): failed to grow resource table\n",
+                __func__);
+        free(res_2d->iovec);
+        free(res_2d);
+        virtio_gpu_set_fail(vgpu);
+        *plen = 0;
+        return;
+    }
+    vgpu_sw_update_direct(res_2d);
+    list_push(&res_2d->list, &g_vgpu_sw_res_2d_list);
 
+leave:
     *plen = virtio_gpu_write_ctrl_response(vgpu, &request->hdr, response_desc,
-                                           VIRTIO_GPU_RESP_OK_NODATA);
+                                           type);
     if (!*plen)
         virtio_gpu_set_fail(vgpu);
 }
 
-static void vgpu_sw_cmd_set_scanout_handler(virtio_gpu_state_t *vgpu,
-                                            struct virtq_desc *vq_desc,
-                                            uint32_t *plen)
+static void vgpu_sw_cmd_resource_unref_handler(virtio_gpu_state_t *vgpu,
+                                               struct virtq_desc *vq_desc,
+                                               uint32_t *plen)
 {
     const struct virtq_desc *response_desc = virtio_gpu_get_response_desc(
         vq_desc, sizeof(struct virtio_gpu_ctrl_hdr));
@@ -635,27 +1183,78 @@ static void vgpu_sw_cmd_set_scanout_handler(virtio_gpu_state_t *vgpu,
         return;
     }
 
-    struct virtio_gpu_set_scanout *request = virtio_gpu_get_request(
-        vgpu, vq_desc, sizeof(struct virtio_gpu_set_scanout));
+    struct virtio_gpu_res_unref *request = virtio_gpu_get_request(
+        vgpu, vq_desc, sizeof(struct virtio_gpu_res_unref));
     if (!request) {
         virtio_gpu_set_fail(vgpu);
         *plen = 0;
         return;
     }
 
-    struct virtio_gpu_scanout_info *scanout =
-        vgpu_sw_get_scanout(vgpu, request->scanout_id);
-    if (!scanout) {
-        fprintf(stderr, VIRTIO_GPU_LOG_PREFIX "%s(): invalid scanout id %u\n",
-                __func__, request->scanout_id);
+    struct vgpu_sw_resource_2d *res_2d =
+        vgpu_sw_get_resource_2d(request->resource_id);
+    if (!res_2d) {
+        fprintf(stderr,
+                VIRTIO_GPU_LOG_PREFIX
+                "%s(): resource unref references invalid resource id %u\n",
+                __func__, request->resource_id);
         *plen = virtio_gpu_write_ctrl_response(
             vgpu, &request->hdr, response_desc,
-            VIRTIO_GPU_RESP_ERR_INVALID_SCANOUT_ID);
+            VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID);
         if (!*plen)
             virtio_gpu_set_fail(vgpu);
         return;
     }
 
+    /* Clear any visible plane using this resource before it is freed. */
+    for (uint32_t i = 0; i < PRIV(vgpu)->num_scanouts; i++) {
+        struct virtio_gpu_scanout_info *scanout = &PRIV(vgpu)->scanouts[i];
+
+        if (!scanout->enabled)
+            continue;
+
+        if (scanout->primary_resource_id == request->resource_id) {
+            scanout->primary_resource_id = 0;
+            scanout->src_x = scanout->src_y = 0;
+            scanout->src_w = scanout->src_h = 0;
+            g_vgpu_sw_damage[i] = (struct vgpu_display_rect) {0};
+            g_vgpu_sw_flushes[i] = 0;
+            vgpu_display_publish_primary_clear(i);
+        }
+
+        if (scanout->cursor_resource_id == request->resource_id) {
+            scanout->cursor_resource_id = 0;
+            vgpu_display_publish_cursor_clear(i);
+        }
+    }
+
+    vgpu_sw_destroy_resource_2d(res_2d);
+
+    *plen = virtio_gpu_write_ctrl_response(vgpu, &request->hdr, response_desc,
+                                           VIRTIO_GPU_RESP_OK_NODATA);
+    if (!*plen)
+        virtio_gpu_set_fail(vgpu);
+}
+
+/* Shared body of 'SET_SCANOUT' and 'SET_SCANOUT_BLOB'. 'blob' is the latter's
+ * request, which also describes the image layout inside the blob, or NULL.
+ * Returns the control response type.
+ */
+static uint32_t vgpu_sw_set_scanout(
+    virtio_gpu_state_t *vgpu,
+    uint32_t scanout_id,
+    uint32_t resource_id,
+    const struct virtio_gpu_rect *r,
+    const struct virtio_gpu_set_scanout_blob *blob)
+{
+    struct virtio_gpu_scanout_info *scanout =
+        vgpu_sw_get_scanout(vgpu, scanout_id);
+    if (!scanout) {
+        fprintf(stderr, VIRTIO_GPU_LOG_PREFIX "%s(): invalid scanout id %u\n",
+                __func__, scanout_id);
+        return VIRTIO_GPU_RESP_ERR_INVALID_SCANOUT_ID;
+    }
+
     /* Keep 'resource_id' 0 unavailable for real resources. The virtio spec
      * explicitly documents 'resource_id = 0' as the 'SET_SCANOUT' disable
      * sentinel.
@@ -663,77 +1262,265 @@ static void vgpu_sw_cmd_set_scanout_handler(virtio_gpu_state_t *vgpu,
      * as 'handle + 1', so they are always greater than 0. See
      * 'virtgpu_object.c' for details.
      */
-    if (request->resource_id == 0) {
+    if (resource_id == 0) {
         scanout->primary_resource_id = 0;
         scanout->src_x = scanout->src_y = 0;
         scanout->src_w = scanout->src_h = 0;
-        vgpu_display_publish_primary_clear(request->scanout_id);
-        goto leave;
+        g_vgpu_sw_damage[scanout_id] = (struct vgpu_display_rect) {0};
+        g_vgpu_sw_flushes[scanout_id] = 0;
+        vgpu_display_publish_primary_clear(scanout_id);
+        return VIRTIO_GPU_RESP_OK_NODATA;
     }
 
     /* Retrieve 2D resource */
-    struct vgpu_sw_resource_2d *res_2d =
-        vgpu_sw_get_resource_2d(request->resource_id);
+    struct vgpu_sw_resource_2d *res_2d = vgpu_sw_get_resource_2d(resource_id);
     if (!res_2d) {
         fprintf(stderr, VIRTIO_GPU_LOG_PREFIX "%s(): invalid resource id %u\n",
-                __func__, request->resource_id);
-        *plen = virtio_gpu_write_ctrl_response(
-            vgpu, &request->hdr, response_desc,
-            VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID);
-        if (!*plen)
-            virtio_gpu_set_fail(vgpu);
-        return;
+                __func__, resource_id);
+        return VIRTIO_GPU_RESP_ERR_INVALID_RESOURCE_ID;
+    }
+
+    /* Only blobs take their layout from the scanout request. Multi-planar
+     * layouts do not occur with the single-plane formats supported here, so
+     * only the first stride and offset matter.
+     */
+    if (!blob != !res_2d->blob_size) {
+        fprintf(stderr,
+                VIRTIO_GPU_LOG_PREFIX
+                "%s(): resource %u is %sa blob resource\n",
+                __func__, resource_id, blob ? "not " : "");
+        return VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
+    }
+    if (blob) {
+        uint32_t type = vgpu_sw_blob_set_layout(
+            res_2d, blob->format, blob->width, blob->height, blob->strides[0],
+            blob->offsets[0]);
+        if (type != VIRTIO_GPU_RESP_OK_NODATA) {
+            fprintf(stderr,
+                    VIRTIO_GPU_LOG_PREFIX
+                    "%s(): invalid blob layout %ux%u format %u stride %u "
+                    "offset %u for resource %u\n",
+                    __func__, blob->width, blob->height, blob->format,
+                    blob->strides[0], blob->offsets[0], resource_id);
+            return type;
+        }
     }
 
     /* Validate that the source rectangle fits within the resource without
      * relying on wrapping 32-bit additions.
      */
-    if (!vgpu_sw_rect_fits(res_2d->width, res_2d->height, &request->r)) {
+    if (!vgpu_sw_rect_fits(res_2d->width, res_2d->height, r)) {
         fprintf(stderr,
                 VIRTIO_GPU_LOG_PREFIX
                 "%s(): source rect %u,%u %ux%u exceeds resource %ux%u\n",
-                __func__, request->r.x, request->r.y, request->r.width,
-                request->r.height, res_2d->width, res_2d->height);
-        *plen = virtio_gpu_write_ctrl_response(
-            vgpu, &request->hdr, response_desc,
-            VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER);
-        if (!*plen)
-            virtio_gpu_set_fail(vgpu);
-        return;
+                __func__, r->x, r->y, r->width, r->height, res_2d->width,
+                res_2d->height);
+        return VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
     }
 
     /* The source rectangle is displayed into this scanout, view size is bounded
      * by the advertised scanout size.
      */
-    if (request->r.width > scanout->width ||
-        request->r.height > scanout->height) {
+    if (r->width > scanout->width || r->height > scanout->height) {
         fprintf(stderr,
                 VIRTIO_GPU_LOG_PREFIX
                 "%s(): source rect %ux%u exceeds scanout %ux%u\n",
-                __func__, request->r.width, request->r.height, scanout->width,
+                __func__, r->width, r->height, scanout->width,
                 scanout->height);
-        *plen = virtio_gpu_write_ctrl_response(
-            vgpu, &request->hdr, response_desc,
-            VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER);
-        if (!*plen)
-            virtio_gpu_set_fail(vgpu);
-        return;
+        return VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER;
     }
 
     /* Bind scanout with resource and record the source rectangle */
     scanout->primary_resource_id = res_2d->resource_id;
-    scanout->src_x = request->r.x;
-    scanout->src_y = request->r.y;
-    scanout->src_w = request->r.width;
-    scanout->src_h = request->r.height;
+    scanout->src_x = r->x;
+    scanout->src_y = r->y;
+    scanout->src_w = r->width;
+    scanout->src_h = r->height;
 
-leave:
+    /* The display keeps nothing that matches a new binding or view, so the
+     * next flush must carry the whole view.
+     */
+    g_vgpu_sw_damage[scanout_id] =
+        (struct vgpu_display_rect) {0, 0, scanout->src_w, scanout->src_h};
+    return VIRTIO_GPU_RESP_OK_NODATA;
+}
+
+static void vgpu_sw_cmd_set_scanout_handler(virtio_gpu_state_t *vgpu,
+                                            struct virtq_desc *vq_desc,
+                                            uint32_t *plen)
+{
+    const struct virtq_desc *response_desc = virtio_gpu_get_response_desc(
+        vq_desc, sizeof(struct virtio_gpu_ctrl_hdr));
+    if (!response_desc) {
+        virtio_gpu_set_fail(vgpu);
+        *plen = 0;
+        return;
+    }
+
+    struct virtio_gpu_set_scanout *request = virtio_gpu_get_request(
+        vgpu, vq_desc, sizeof(struct virtio_gpu_set_scanout));
+    if (!request) {
+        virtio_gpu_set_fail(vgpu);
+        *plen = 0;
+        return;
+    }
+
+    uint32_t type =
+        vgpu_sw_set_scanout(vgpu, request->scanout_id, request->resource_id,
+                            &request->r, NULL);
     *plen = virtio_gpu_write_ctrl_response(vgpu, &request->hdr, response_desc,
-                                           VIRTIO_GPU_RESP_OK_NODATA);
+                                           type);
+    if (!*plen)
+        virtio_gpu_set_fail(vgpu);
+}
+
+static void vgpu_sw_cmd_set_scanout_blob_handler(virtio_gpu_state_t *vgpu,
+                                                 struct virtq_desc *vq_desc,
+                                                 uint32_t *plen)
+{
+    const struct virtq_desc *response_desc = virtio_gpu_get_response_desc(
+        vq_desc, sizeof(struct virtio_gpu_ctrl_hdr));
+    if (!response_desc) {
+        virtio_gpu_set_fail(vgpu);
+        *plen = 0;
+        return;
+    }
+
+    struct virtio_gpu_set_scanout_blob *request = virtio_gpu_get_request(
+        vgpu, vq_desc, sizeof(struct virtio_gpu_set_scanout_blob));
+    if (!request) {
+        virtio_gpu_set_fail(vgpu);
+        *plen = 0;
+        return;
+    }
+
+    uint32_t type =
+        vgpu_sw_set_scanout(vgpu, request->scanout_id, request->resource_id,
+                            &request->r, request);
+    *plen = virtio_gpu_write_ctrl_response(vgpu, &request->hdr, response_desc,
+                                           type);
     if (!*plen)
         virtio_gpu_set_fail(vgpu);
 }
 
+/* Publish the damage accumulated for scanout 'scanout_id' as one primary
+ * frame, unless its refresh slot has not come yet or the display has no room
+ * for it. A deferred frame keeps its damage and flush count, so whichever of
+ * the next flush or 'vgpu_sw_refresh()' finds the slot open publishes it.
+ */
+static void vgpu_sw_publish_primary(virtio_gpu_state_t *vgpu,
+                                    uint32_t scanout_id,
+                                    uint64_t now_ns)
+{
+    struct virtio_gpu_scanout_info *scanout =
+        &PRIV(vgpu)->scanouts[scanout_id];
+    struct vgpu_display_rect *damage = &g_vgpu_sw_damage[scanout_id];
+
+    if (!vgpu_display_primary_refresh_pending(scanout_id) &&
+        vgpu_sw_rect_is_empty(damage)) {
+        g_vgpu_sw_flushes[scanout_id] = 0;
+        return;
+    }
+
+    /* Keep the producer non-blocking: while the display queue is full or
+     * every frame buffer is in flight, the frontend keeps showing its previous
+     * frame and the damage waits here.
+     */
+    if (!vgpu_display_primary_due(scanout_id, now_ns) ||
+        !vgpu_display_can_publish(scanout_id) ||
+        !vgpu_display_payload_available(scanout_id, VGPU_DISPLAY_PLANE_PRIMARY))
+        return;
+
+    /* A refresh the display asked for stays pending, and keeps
+     * 'vgpu_sw_refresh()' looking at this scanout, until it is served here.
+     */
+    if (vgpu_display_take_primary_refresh(scanout_id))
+        *damage =
+            (struct vgpu_display_rect) {0, 0, scanout->src_w, scanout->src_h};
+
+    struct vgpu_sw_resource_2d *res_2d =
+        vgpu_sw_get_resource_2d(scanout->primary_resource_id);
+    struct vgpu_display_payload *payload = vgpu_sw_create_window_payload(
+        res_2d, scanout, scanout_id, VGPU_DISPLAY_PLANE_PRIMARY, damage);
+    if (!payload) {
+        /* Not something waiting will fix; leave the damage for the next flush
+         * to retry instead of failing again on every refresh.
+         */
+        g_vgpu_sw_flushes[scanout_id] = 0;
+        return;
+    }
+
+    *damage = (struct vgpu_display_rect) {0};
+    if (g_vgpu_sw_flushes[scanout_id] > 1)
+        vgpu_display_count_coalesced(scanout_id,
+                                     g_vgpu_sw_flushes[scanout_id] - 1);
+    g_vgpu_sw_flushes[scanout_id] = 0;
+    vgpu_display_publish_primary_set(scanout_id, payload);
+}
+
+/* Whether scanout 'scanout_id' has a primary frame to publish: flushes that
+ * were deferred, or a full frame the display asked for.
+ */
+static bool vgpu_sw_primary_pending(virtio_gpu_state_t *vgpu,
+                                    uint32_t scanout_id)
+{
+    return (g_vgpu_sw_flushes[scanout_id] ||
+            vgpu_display_primary_refresh_pending(scanout_id)) &&
+           PRIV(vgpu)->scanouts[scanout_id].enabled;
+}
+
+/* Periodic hook: publish frames that pacing held back once their refresh slot
+ * has come, so the last flush of a burst is shown even if the guest then goes
+ * idle, as well as the full frames the display asked for. Idle scanouts cost
+ * one array scan.
+ */
+static void vgpu_sw_refresh(virtio_gpu_state_t *vgpu)
+{
+    static uint32_t ticks;
+    uint64_t now_ns = 0;
+
+    if (++ticks % VGPU_SW_REFRESH_TICKS)
+        return;
+
+    for (uint32_t i = 0; i < PRIV(vgpu)->num_scanouts; i++) {
+        if (!vgpu_sw_primary_pending(vgpu, i))
+            continue;
+
+        if (!now_ns)
+            now_ns = vgpu_display_now_ns();
+        vgpu_sw_publish_primary(vgpu, i, now_ns);
+    }
+}
+
+/* Idle hook: the harts are about to sleep and stop ticking 'vgpu_sw_refresh()',
+ * so publish what is due now and tell the emulator loop when to wake up for
+ * the rest. A frame the display has no room for is retried every millisecond
+ * rather than spun on.
+ */
+static int vgpu_sw_refresh_idle(virtio_gpu_state_t *vgpu)
+{
+    uint64_t now_ns = 0;
+    uint64_t next_ns = UINT64_MAX;
+
+    for (uint32_t i = 0; i < PRIV(vgpu)->num_scanouts; i++) {
+        if (!vgpu_sw_primary_pending(vgpu, i))
+            continue;
+
+        if (!now_ns)
+            now_ns = vgpu_display_now_ns();
+        vgpu_sw_publish_primary(vgpu, i, now_ns);
+        if (vgpu_sw_primary_pending(vgpu, i) &&
+            vgpu_display_primary_due_ns(i) < next_ns)
+            next_ns = vgpu_display_primary_due_ns(i);
+    }
+
+    if (next_ns == UINT64_MAX)
+        return -1;
+    if (next_ns <= now_ns)
+        return 1;
+    return (int) ((next_ns - now_ns + 999999ULL) / 1000000ULL);
+}
+
 static void vgpu_sw_cmd_resource_flush_handler(virtio_gpu_state_t *vgpu,
                                                struct virtq_desc *vq_desc,
                                                uint32_t *plen)
@@ -784,34 +1571,29 @@ static void vgpu_sw_cmd_resource_flush_handler(virtio_gpu_state_t *vgpu,
         return;
     }
 
-    /* Flush the resource to every scanout currently bound to it, using the
-     * source rectangle recorded by 'SET_SCANOUT' to display only the requested
-     * sub-region of the resource.
+    /* Flush the resource to every scanout currently bound to it. Only the part
+     * of 'request->r' inside the source rectangle recorded by 'SET_SCANOUT' is
+     * copied, together with any damage left over from earlier flushes that
+     * were not published yet. A flush arriving before the scanout's next
+     * refresh slot only adds to that damage, so a guest flushing faster than
+     * the display refreshes pays for one snapshot per frame, not per flush.
      */
+    uint64_t now_ns = 0;
     for (uint32_t i = 0; i < PRIV(vgpu)->num_scanouts; i++) {
         struct virtio_gpu_scanout_info *scanout = &PRIV(vgpu)->scanouts[i];
+        struct vgpu_display_rect flushed;
 
         if (!scanout->enabled ||
             scanout->primary_resource_id != request->resource_id)
             continue;
 
-        /* Keep the producer non-blocking: if the display queue is full or
-         * snapshot allocation fails below, this flush frame for scanout 'i' is
-         * dropped and the frontend keeps showing its previous published frame.
-         */
-        if (!vgpu_display_can_publish())
-            continue;
-
-        struct vgpu_display_payload *payload =
-            vgpu_sw_create_window_payload(res_2d, scanout, "primary");
-        if (!payload)
-            continue;
+        if (vgpu_sw_rect_to_view(&request->r, scanout, &flushed))
+            vgpu_sw_rect_union(&g_vgpu_sw_damage[i], &flushed);
+        g_vgpu_sw_flushes[i]++;
 
-        /* The publish path snapshots the whole 'SET_SCANOUT' view for this
-         * scanout. 'request->r' is not used here to further trim the payload
-         * for now.
-         */
-        vgpu_display_publish_primary_set(i, payload);
+        if (!now_ns)
+            now_ns = vgpu_display_now_ns();
+        vgpu_sw_publish_primary(vgpu, i, now_ns);
     }
 
     *plen = virtio_gpu_write_ctrl_response(vgpu, &request->hdr, response_desc,
@@ -854,6 +1636,13 @@ static void vgpu_sw_cmd_transfer_to_host_2d_handler(virtio_gpu_state_t *vgpu,
         return;
     }
 
+    /* Blobs are read from their backing when they are shown, so there is
+     * nothing to copy ahead of time. Linux still sends transfers for blobs
+     * backing dumb buffers.
+     */
+    if (res_2d->blob_size)
+        goto leave;
+
     /* Check if backing has been attached */
     if (!res_2d->iovec) {
         fprintf(stderr,
@@ -898,6 +1687,18 @@ static void vgpu_sw_cmd_transfer_to_host_2d_handler(virtio_gpu_state_t *vgpu,
         return;
     }
 
+    /* A resource read in place already shows what the transfer would copy,
+     * provided the transfer keeps the backing's layout. Any other offset
+     * makes the host image authoritative again.
+     */
+    if (res_2d->direct) {
+        if (req->offset ==
+            (uint64_t) req->r.y * res_2d->stride +
+                (uint64_t) req->r.x * (res_2d->bits_per_pixel / 8))
+            goto leave;
+        vgpu_sw_drop_direct(res_2d);
+    }
+
     /* Transfer frame data from guest to host */
     if (!vgpu_sw_copy_image_from_pages(req, res_2d)) {
         fprintf(stderr,
@@ -911,6 +1712,7 @@ static void vgpu_sw_cmd_transfer_to_host_2d_handler(virtio_gpu_state_t *vgpu,
         return;
     }
 
+leave:
     *plen = virtio_gpu_write_ctrl_response(vgpu, &req->hdr, response_desc,
                                            VIRTIO_GPU_RESP_OK_NODATA);
     if (!*plen)
@@ -938,56 +1740,6 @@ static void vgpu_sw_cmd_resource_attach_backing_handler(
         return;
     }
 
-    if (vq_desc[1].flags & VIRTIO_DESC_F_WRITE) {
-        fprintf(stderr,
-                VIRTIO_GPU_LOG_PREFIX
-                "%s(): backing entries descriptor is writable\n",
-                __func__);
-        virtio_gpu_set_fail(vgpu);
-        *plen = 0;
-        return;
-    }
-
-    if (backing_info->nr_entries == 0 ||
-        backing_info->nr_entries > VGPU_SW_MAX_BACKING_ENTRIES) {
-        fprintf(stderr,
-                VIRTIO_GPU_LOG_PREFIX "%s(): invalid backing entry count %u\n",
-                __func__, backing_info->nr_entries);
-        *plen = virtio_gpu_write_ctrl_response(
-            vgpu, &backing_info->hdr, response_desc,
-            VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER);
-        if (!*plen)
-            virtio_gpu_set_fail(vgpu);
-        return;
-    }
-
-    /* The entry cap above keeps 'entries_size' small. semu currently targets
-     * 64-bit hosts, so this path does not guard for 32-bit host overflow yet.
-     */
-    size_t entries_size =
-        sizeof(struct virtio_gpu_mem_entry) * backing_info->nr_entries;
-
-    if (vq_desc[1].len < entries_size) {
-        fprintf(stderr,
-                VIRTIO_GPU_LOG_PREFIX
-                "%s(): backing entries descriptor too small\n",
-                __func__);
-        *plen = virtio_gpu_write_ctrl_response(
-            vgpu, &backing_info->hdr, response_desc,
-            VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER);
-        if (!*plen)
-            virtio_gpu_set_fail(vgpu);
-        return;
-    }
-
-    struct virtio_gpu_mem_entry *pages = virtio_gpu_mem_guest_to_host(
-        vgpu, vq_desc[1].addr, (uint32_t) entries_size);
-    if (!pages) {
-        virtio_gpu_set_fail(vgpu);
-        *plen = 0;
-        return;
-    }
-
     /* Retrieve 2D resource */
     struct vgpu_sw_resource_2d *res_2d =
         vgpu_sw_get_resource_2d(backing_info->resource_id);
@@ -1017,61 +1769,20 @@ static void vgpu_sw_cmd_resource_attach_backing_handler(
     }
 
     /* Dispatch page memories to the 2D resource */
-    res_2d->page_cnt = backing_info->nr_entries;
-    res_2d->iovec = malloc(sizeof(struct iovec) * backing_info->nr_entries);
-    if (!res_2d->iovec) {
-        fprintf(stderr,
-                VIRTIO_GPU_LOG_PREFIX "%s(): failed to allocate io vector\n",
-                __func__);
+    uint32_t type = vgpu_sw_map_backing(vgpu, vq_desc, backing_info->nr_entries,
+                                        &res_2d->iovec);
+    if (!type) {
         virtio_gpu_set_fail(vgpu);
         *plen = 0;
         return;
     }
-
-    /* Convert each guest-provided backing entry into one host-side 'iovec'. */
-    for (size_t i = 0; i < backing_info->nr_entries; i++) {
-        if (pages[i].addr > UINT32_MAX) {
-            fprintf(stderr,
-                    VIRTIO_GPU_LOG_PREFIX "%s(): page %zu addr_high non-zero\n",
-                    __func__, i);
-            free(res_2d->iovec);
-            res_2d->iovec = NULL;
-            res_2d->page_cnt = 0;
-            *plen = virtio_gpu_write_ctrl_response(
-                vgpu, &backing_info->hdr, response_desc,
-                VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER);
-            if (!*plen)
-                virtio_gpu_set_fail(vgpu);
-            return;
-        }
-
-        /* Attach address and length of i-th page to the 2D resource. */
-        res_2d->iovec[i].iov_base = virtio_gpu_mem_guest_to_host(
-            vgpu, (uint32_t) pages[i].addr, pages[i].length);
-        res_2d->iovec[i].iov_len = pages[i].length;
-
-        /* Corrupted page address */
-        if (!res_2d->iovec[i].iov_base) {
-            fprintf(stderr,
-                    VIRTIO_GPU_LOG_PREFIX
-                    "%s(): backing entry %zu guest address 0x%llx length %u "
-                    "is out of guest RAM\n",
-                    __func__, i, (unsigned long long) pages[i].addr,
-                    pages[i].length);
-            free(res_2d->iovec);
-            res_2d->iovec = NULL;
-            res_2d->page_cnt = 0;
-            *plen = virtio_gpu_write_ctrl_response(
-                vgpu, &backing_info->hdr, response_desc,
-                VIRTIO_GPU_RESP_ERR_INVALID_PARAMETER);
-            if (!*plen)
-                virtio_gpu_set_fail(vgpu);
-            return;
-        }
+    if (type == VIRTIO_GPU_RESP_OK_NODATA) {
+        res_2d->page_cnt = backing_info->nr_entries;
+        vgpu_sw_update_direct(res_2d);
     }
 
-    *plen = virtio_gpu_write_ctrl_response(
-        vgpu, &backing_info->hdr, response_desc, VIRTIO_GPU_RESP_OK_NODATA);
+    *plen = virtio_gpu_write_ctrl_response(vgpu, &backing_info->hdr,
+                                           response_desc, type);
     if (!*plen)
         virtio_gpu_set_fail(vgpu);
 }
@@ -1124,7 +1835,28 @@ static void vgpu_sw_cmd_resource_detach_backing_handler(
         return;
     }
 
+    /* Frames still queued for the display may read this backing in place.
+     * The guest is free to reuse the pages once it is detached, so have the
+     * consumer drop those frames as stale and ask for a full one, which comes
+     * from the host copy, if the resource has one.
+     */
+    if (res_2d->direct) {
+        for (uint32_t i = 0; i < PRIV(vgpu)->num_scanouts; i++) {
+            struct virtio_gpu_scanout_info *scanout =
+                &PRIV(vgpu)->scanouts[i];
+
+            if (!scanout->enabled ||
+                scanout->primary_resource_id != request->resource_id)
+                continue;
+
+            vgpu_display_publish_primary_clear(i);
+            if (!res_2d->blob_size)
+                vgpu_display_request_primary_refresh(i);
+        }
+    }
+
     /* Detach backing and free the 'iovec' array. */
+    vgpu_sw_drop_direct(res_2d);
     free(res_2d->iovec);
     res_2d->iovec = NULL;
     res_2d->page_cnt = 0;
@@ -1215,6 +1947,24 @@ static void vgpu_sw_cmd_update_cursor_handler(virtio_gpu_state_t *vgpu,
         return;
     }
 
+    /* Nothing describes the image in a blob used as a cursor. Like QEMU,
+     * assume the 64x64 ARGB8888 image the Linux driver always uses for its
+     * cursor plane.
+     */
+    if (res_2d->blob_size && res_2d->width == 0 &&
+        vgpu_sw_blob_set_layout(res_2d, VIRTIO_GPU_FORMAT_B8G8R8A8_UNORM,
+                                VGPU_SW_BLOB_CURSOR_SIZE,
+                                VGPU_SW_BLOB_CURSOR_SIZE,
+                                VGPU_SW_BLOB_CURSOR_SIZE * 4U,
+                                0) != VIRTIO_GPU_RESP_OK_NODATA) {
+        fprintf(stderr,
+                VIRTIO_GPU_LOG_PREFIX "%s(): blob %u too small for a cursor\n",
+                __func__, cursor->resource_id);
+        virtio_gpu_set_fail(vgpu);
+        *plen = 0;
+        return;
+    }
+
     if (res_2d->width == 0 || res_2d->height == 0 ||
         res_2d->width > scanout->width || res_2d->height > scanout->height) {
         fprintf(stderr,
@@ -1230,16 +1980,17 @@ static void vgpu_sw_cmd_update_cursor_handler(virtio_gpu_state_t *vgpu,
      * still visible and is used by RESOURCE_UNREF to decide whether to publish
      * a clear.
      */
-    if (!vgpu_display_can_publish()) {
+    if (!vgpu_display_can_publish(cursor->pos.scanout_id)) {
         *plen = 0;
         return;
     }
 
     struct vgpu_display_payload *payload =
-        vgpu_sw_create_window_payload(res_2d, NULL, "cursor");
+        vgpu_sw_create_window_payload(res_2d, NULL, cursor->pos.scanout_id,
+                                      VGPU_DISPLAY_PLANE_CURSOR, NULL);
     if (!payload) {
-        /* Allocation failure has the same visible result as a dropped
-         * publication: keep the old cursor binding.
+        /* Running out of cursor buffers has the same visible result as a
+         * dropped publication: keep the old cursor binding.
          */
         *plen = 0;
         return;
@@ -1301,16 +2052,18 @@ static void vgpu_sw_cmd_move_cursor_handler(virtio_gpu_state_t *vgpu,
     *plen = 0;
 }
 
-/* The software backend supports only CPU-backed 2D scanout resources today.
- * Optional virtio-gpu features for capsets, resource UUIDs, blob resources,
+/* The software backend supports CPU-backed 2D resources and guest-memory blob
+ * resources. Optional virtio-gpu features for capsets, resource UUIDs,
  * virgl/3D contexts, and blob mappings intentionally stay routed to
  * 'VIRTIO_GPU_CMD_UNDEF' so unsupported guest paths fail explicitly.
  *
  * TODO: Implement these handlers after the feature bits, backend resource
- * model, and display payload path grow matching virgl/blob support.
+ * model, and display payload path grow matching virgl support.
  */
 const struct virtio_gpu_cmd_backend g_virtio_gpu_backend = {
     .reset = vgpu_sw_reset,
+    .refresh = vgpu_sw_refresh,
+    .refresh_idle = vgpu_sw_refresh_idle,
     .get_display_info = virtio_gpu_get_display_info_handler,
     .resource_create_2d = vgpu_sw_resource_create_2d_handler,
     .resource_unref = vgpu_sw_cmd_resource_unref_handler,
@@ -1323,8 +2076,8 @@ const struct virtio_gpu_cmd_backend g_virtio_gpu_backend = {
     .get_capset = VIRTIO_GPU_CMD_UNDEF,
     .get_edid = virtio_gpu_get_edid_handler,
     .resource_assign_uuid = VIRTIO_GPU_CMD_UNDEF,
-    .resource_create_blob = VIRTIO_GPU_CMD_UNDEF,
-    .set_scanout_blob = VIRTIO_GPU_CMD_UNDEF,
+    .resource_create_blob = vgpu_sw_resource_create_blob_handler,
+    .set_scanout_blob = vgpu_sw_cmd_set_scanout_blob_handler,
     .ctx_create = VIRTIO_GPU_CMD_UNDEF,
     .ctx_destroy = VIRTIO_GPU_CMD_UNDEF,
     .ctx_attach_resource = VIRTIO_GPU_CMD_UNDEF,
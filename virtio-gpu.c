@@ -20,6 +20,7 @@
 
 #define VIRTIO_GPU_EVENT_DISPLAY (1 << 0)
 #define VIRTIO_GPU_F_EDID (1 << 1)
+#define VIRTIO_GPU_F_RESOURCE_BLOB (1 << 3)
 #define VIRTIO_GPU_F_CONTEXT_INIT (1 << 4)
 
 #define VIRTIO_GPU_QUEUE_NUM_MAX 1024
@@ -302,11 +303,9 @@ static void virtio_gpu_edid_set_detailed_timing(uint8_t *desc,
         v_front = DMT_BASE_V_FRONT;
         v_sync = DMT_BASE_V_SYNC;
     } else {
-        /* Fallback only for future multi-mode or non-default scanouts. The
-         * current machine registers one 1024x768 scanout, so this path is not
-         * reachable in the default build. Scale porch/sync proportions from
-         * the VESA DMT 1024x768@60Hz timing instead of inventing ad hoc
-         * ratios.
+        /* Any other scanout mode, as configured with '-S'. Scale porch/sync
+         * proportions from the VESA DMT 1024x768@60Hz timing instead of
+         * inventing ad hoc ratios.
          */
         h_blank = ((uint64_t) width * DMT_BASE_H_BLANK + DMT_BASE_WIDTH / 2U) /
                   DMT_BASE_WIDTH;
@@ -413,6 +412,7 @@ static void virtio_gpu_edid_set_detailed_timing(uint8_t *desc,
  * STANDARD" (defines EDID Structure Version 1, Revision 4).
  */
 static void virtio_gpu_generate_edid(uint8_t *edid,
+                                     uint32_t scanout_id,
                                      uint32_t width,
                                      uint32_t height)
 {
@@ -450,10 +450,16 @@ static void virtio_gpu_generate_edid(uint8_t *edid,
     edid[8] = vendor_id >> 8;
     edid[9] = vendor_id & 0xff;
 
-    /* Check EDID 1.4 Sections 3.4.2 and 3.4.3: product code and serial
-     * number, all zeros if unused.
+    /* Check EDID 1.4 Sections 3.4.2 and 3.4.3: product code, unused, and a
+     * little-endian serial number. Number the monitors after their scanout so
+     * that a multi-head guest tells them apart and remembers its layout.
      */
-    memset(&edid[10], 0, sizeof(uint16_t) + sizeof(uint32_t));
+    memset(&edid[10], 0, sizeof(uint16_t));
+    uint32_t serial = scanout_id + 1U;
+    edid[12] = serial & 0xff;
+    edid[13] = (serial >> 8) & 0xff;
+    edid[14] = (serial >> 16) & 0xff;
+    edid[15] = (serial >> 24) & 0xff;
 
     /* Check EDID 1.4 Section 3.4.4: week of manufacture, 0 if unused. */
     edid[16] = 0;
@@ -573,8 +579,8 @@ void virtio_gpu_get_edid_handler(virtio_gpu_state_t *vgpu,
     memset(response, 0, sizeof(*response));
     response->hdr.type = VIRTIO_GPU_RESP_OK_EDID;
     response->size = EDID_BLOCK_SIZE; /* One base EDID block. */
-    virtio_gpu_generate_edid((uint8_t *) response->edid, scanout->width,
-                             scanout->height);
+    virtio_gpu_generate_edid((uint8_t *) response->edid, request->scanout,
+                             scanout->width, scanout->height);
 
     if (request->hdr.flags & VIRTIO_GPU_FLAG_FENCE) {
         response->hdr.flags = VIRTIO_GPU_FLAG_FENCE;
@@ -871,11 +877,11 @@ static bool virtio_gpu_reg_read(virtio_gpu_state_t *vgpu,
         *value = VIRTIO_VENDOR_ID;
         return true;
     case _(DeviceFeatures):
-        /* TODO: Advertise virgl/3D and blob-resource feature bits after the
-         * backend supports their command and display paths.
+        /* TODO: Advertise virgl/3D feature bits after the backend supports
+         * their command and display paths.
          */
         *value = vgpu->DeviceFeaturesSel == 0
-                     ? VIRTIO_GPU_F_EDID
+                     ? VIRTIO_GPU_F_EDID | VIRTIO_GPU_F_RESOURCE_BLOB
                      : (vgpu->DeviceFeaturesSel == 1 ? VIRTIO_F_VERSION_1 : 0);
         return true;
     case _(QueueNumMax):
@@ -892,8 +898,9 @@ static bool virtio_gpu_reg_read(virtio_gpu_state_t *vgpu,
         return true;
     case _(SHMLenLow):
     case _(SHMLenHigh):
-        /* TODO: Implement shared-memory regions before advertising
-         * VIRTIO_GPU_F_RESOURCE_BLOB.
+        /* Only guest-memory blobs are supported, so there is no host-visible
+         * shared memory region; a length of -1 tells the driver so, and it
+         * then never asks to map a blob.
          */
         *value = -1;
         return true;
@@ -1163,6 +1170,27 @@ void virtio_gpu_init(virtio_gpu_state_t *vgpu)
     vgpu->priv = &virtio_gpu_data;
 }
 
+void virtio_gpu_refresh(virtio_gpu_state_t *vgpu)
+{
+    if (!(vgpu->Status & VIRTIO_STATUS__DRIVER_OK) ||
+        (vgpu->Status & VIRTIO_STATUS__DEVICE_NEEDS_RESET))
+        return;
+
+    if (g_virtio_gpu_backend.refresh)
+        g_virtio_gpu_backend.refresh(vgpu);
+}
+
+int virtio_gpu_refresh_idle(virtio_gpu_state_t *vgpu)
+{
+    if (!(vgpu->Status & VIRTIO_STATUS__DRIVER_OK) ||
+        (vgpu->Status & VIRTIO_STATUS__DEVICE_NEEDS_RESET))
+        return -1;
+
+    if (!g_virtio_gpu_backend.refresh_idle)
+        return -1;
+    return g_virtio_gpu_backend.refresh_idle(vgpu);
+}
+
 uint32_t virtio_gpu_register_scanout(virtio_gpu_state_t *vgpu,
                                      uint32_t width,
                                      uint32_t height)
@@ -142,6 +142,34 @@ PACKED(struct virtio_gpu_mem_entry {
     uint32_t padding;
 });
 
+/* Only guest-memory blobs exist without virgl; the other kinds need a host
+ * allocation or a mappable shared memory region.
+ */
+#define VIRTIO_GPU_BLOB_MEM_GUEST 0x0001
+
+PACKED(struct virtio_gpu_resource_create_blob {
+    struct virtio_gpu_ctrl_hdr hdr;
+    uint32_t resource_id;
+    uint32_t blob_mem;
+    uint32_t blob_flags;
+    uint32_t nr_entries;
+    uint64_t blob_id;
+    uint64_t size;
+});
+
+PACKED(struct virtio_gpu_set_scanout_blob {
+    struct virtio_gpu_ctrl_hdr hdr;
+    struct virtio_gpu_rect r;
+    uint32_t scanout_id;
+    uint32_t resource_id;
+    uint32_t width;
+    uint32_t height;
+    uint32_t format;
+    uint32_t padding;
+    uint32_t strides[4];
+    uint32_t offsets[4];
+});
+
 PACKED(struct virtio_gpu_cmd_get_edid {
     struct virtio_gpu_ctrl_hdr hdr;
     uint32_t scanout;
@@ -326,9 +354,12 @@ typedef void (*virtio_gpu_cmd_func)(virtio_gpu_state_t *vgpu,
                                     struct virtq_desc *vq_desc,
                                     uint32_t *plen);
 typedef void (*virtio_gpu_backend_lifecycle_func)(virtio_gpu_state_t *vgpu);
+typedef int (*virtio_gpu_backend_timeout_func)(virtio_gpu_state_t *vgpu);
 
 struct virtio_gpu_cmd_backend {
     virtio_gpu_backend_lifecycle_func reset;
+    virtio_gpu_backend_lifecycle_func refresh;
+    virtio_gpu_backend_timeout_func refresh_idle;
     /* 2D commands */
     virtio_gpu_cmd_func get_display_info;
     virtio_gpu_cmd_func resource_create_2d;
@@ -141,7 +141,7 @@ static struct vinput_key_map_entry vinput_key_map[] = {
     DEF_KEY_MAP(SDL_SCANCODE_DELETE, SEMU_KEY_DELETE),
 };
 
-static bool vinput_push_cmd(int dev_id, const struct vinput_cmd *event)
+bool vinput_push_cmd(int dev_id, const struct vinput_cmd *event)
 {
     struct vinput_cmd_queue *queue = &vinput_cmd_queues[dev_id];
     uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
@@ -170,7 +170,7 @@ static bool vinput_push_cmd(int dev_id, const struct vinput_cmd *event)
      * ordered architectures can lose a wake-up.
      */
     if (!__atomic_exchange_n(&vinput_cmd_wake_pending, true, __ATOMIC_SEQ_CST))
-        g_window.window_wake_backend();
+        g_window->window_wake_backend();
 
     return true;
 }
@@ -282,7 +282,7 @@ void vinput_reset_host_events(int dev_id)
     if (!vinput_all_queues_empty() &&
         !__atomic_exchange_n(&vinput_cmd_wake_pending, true,
                              __ATOMIC_SEQ_CST)) {
-        g_window.window_wake_backend();
+        g_window->window_wake_backend();
     }
 }
 
@@ -305,14 +305,19 @@ bool vinput_handle_events(void)
             return true;
         case SDL_WINDOWEVENT:
             if (e.window.event == SDL_WINDOWEVENT_FOCUS_LOST)
-                g_window.window_set_mouse_grab(false);
+                g_window->window_set_mouse_grab(false);
+            /* With several scanout windows SDL only sends 'SDL_QUIT' once the
+             * last one is closed; closing any of them stops the emulator.
+             */
+            else if (e.window.event == SDL_WINDOWEVENT_CLOSE)
+                return true;
             break;
         case SDL_KEYDOWN:
-            if (g_window.window_is_mouse_grabbed() &&
+            if (g_window->window_is_mouse_grabbed() &&
                 e.key.keysym.scancode == SDL_SCANCODE_G &&
                 (e.key.keysym.mod & KMOD_CTRL) &&
                 (e.key.keysym.mod & KMOD_ALT)) {
-                g_window.window_set_mouse_grab(false);
+                g_window->window_set_mouse_grab(false);
                 break;
             }
             /* EV_REP is advertised, so the guest kernel drives key repeat.
@@ -340,7 +345,7 @@ bool vinput_handle_events(void)
             }
             break;
         case SDL_MOUSEBUTTONDOWN:
-            g_window.window_set_mouse_grab(true);
+            g_window->window_set_mouse_grab(true);
             linux_key = vinput_sdl_button_to_linux_key(e.button.button);
             if (linux_key >= 0) {
                 struct vinput_cmd event = {
@@ -363,7 +368,7 @@ bool vinput_handle_events(void)
             }
             break;
         case SDL_MOUSEMOTION: {
-            if (!g_window.window_is_mouse_grabbed() ||
+            if (!g_window->window_is_mouse_grabbed() ||
                 (e.motion.xrel == 0 && e.motion.yrel == 0))
                 break;
             struct vinput_cmd event = {
@@ -61,6 +61,12 @@ struct vinput_cmd {
  */
 bool vinput_handle_events(void);
 
+/* Push one input event into the per-device queue. Producer side of the SPSC
+ * queues: only the window backend's main-loop thread may call this. Returns
+ * false, dropping the event, when the queue is full.
+ */
+bool vinput_push_cmd(int dev_id, const struct vinput_cmd *event);
+
 /* Pop one translated backend input event from the per-device queue. Called by
  * the emulator thread while draining work that arrived from the SDL/main
  * thread. dev_id selects which device's queue to read.
@@ -92,4 +98,16 @@ void vinput_reset_host_events(int dev_id);
  * bitmap_size must be >= VIRTIO_INPUT_CFG_PAYLOAD_SIZE.
  */
 int virtio_input_fill_ev_key_bitmap(uint8_t *bitmap, size_t bitmap_size);
+
+/* Scripted input, see virtio-input-script.c. 'vinput_script_open()' takes a
+ * script file or "unix:PATH" to listen on and returns false if it cannot be
+ * opened. The window backend calls 'vinput_script_poll()' from its main loop
+ * to inject the events that are due, and 'vinput_script_note_frame()' with
+ * the publish time of every primary frame it consumes.
+ * 'vinput_script_close()' prints the injection and latency summary.
+ */
+bool vinput_script_open(const char *spec);
+void vinput_script_poll(void);
+void vinput_script_note_frame(uint64_t publish_ns);
+void vinput_script_close(void);
 #endif /* SEMU_HAS(VIRTIOINPUT) */
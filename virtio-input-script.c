@@ -0,0 +1,380 @@
+/* Scripted virtio-input events, for repeatable interactive benchmarks.
+ *
+ * A script is a text file, or whatever a client writes to a Unix socket, with
+ * one timestamped event per line:
+ *
+ *   # milliseconds from the start, or '+N' after the previous event
+ *   500  key 30 down          (Linux key code; down, up or repeat)
+ *   +50  key 30 up
+ *   +0   button left down     (left, right or middle)
+ *   +16  move 10 -4           (relative motion)
+ *   +16  wheel 0 1            (horizontal, vertical scroll)
+ *
+ * Times count from when the file is opened or the client connects. Events are
+ * pushed into the same host queues SDL feeds, from the window backend's main
+ * loop, which is the only producer those SPSC queues allow.
+ *
+ * Each window backend reports the primary frames it consumes through
+ * 'vinput_script_note_frame()', which measures how long the guest took from
+ * an injected event to the next frame it flushed.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "virtio-input-codes.h"
+#include "virtio-input-event.h"
+
+#define VINPUT_SCRIPT_LOG_PREFIX "[SEMU vinput-script] "
+
+#define VINPUT_SCRIPT_LINE_MAX 256U
+#define VINPUT_SCRIPT_KEY_MAX 0x2ffU /* KEY_MAX in Linux evdev */
+
+struct vinput_script_event {
+    uint64_t due_ns;
+    int dev_id;
+    struct vinput_cmd cmd;
+};
+
+static struct {
+    bool active;
+    int fd;        /* script file or connected client, -1 between clients */
+    int listen_fd; /* Unix socket, or -1 when playing a file */
+    char *socket_path;
+
+    char buf[VINPUT_SCRIPT_LINE_MAX];
+    size_t len;
+    unsigned int line;
+    bool skipping; /* discarding the rest of an overlong line */
+
+    uint64_t start_ns;
+    uint64_t last_due_ns;
+    bool pending;
+    struct vinput_script_event event;
+
+    /* Input-to-frame latency: the oldest injected event no frame has
+     * followed yet, and the statistics of those that were.
+     */
+    uint64_t unanswered_ns;
+    uint64_t injected;
+    uint64_t dropped;
+    uint64_t answered;
+    uint64_t latency_ns;
+    uint64_t max_latency_ns;
+} vinput_script = {.fd = -1, .listen_fd = -1};
+
+static uint64_t vinput_script_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool vinput_script_parse_int(const char *s, long min, long max, long *v)
+{
+    char *end;
+    errno = 0;
+    *v = strtol(s, &end, 0);
+    return !errno && end != s && !*end && *v >= min && *v <= max;
+}
+
+/* Parse one line into 'vinput_script.event'. Returns false for blank and
+ * comment lines, and for malformed ones after reporting them.
+ */
+static bool vinput_script_parse_line(char *line)
+{
+    char *save;
+    char *stamp = strtok_r(line, " \t\r", &save);
+    if (!stamp || *stamp == '#')
+        return false;
+
+    char *verb = strtok_r(NULL, " \t\r", &save);
+    char *arg1 = strtok_r(NULL, " \t\r", &save);
+    char *arg2 = strtok_r(NULL, " \t\r", &save);
+    struct vinput_script_event *event = &vinput_script.event;
+    long ms, a, b;
+
+    bool relative = *stamp == '+';
+    if (!vinput_script_parse_int(stamp + relative, 0, 86400000L, &ms) ||
+        !verb || !arg1 || !arg2 || strtok_r(NULL, " \t\r", &save))
+        goto invalid;
+
+    if (!strcmp(verb, "key")) {
+        if (!vinput_script_parse_int(arg1, 1, VINPUT_SCRIPT_KEY_MAX, &a))
+            goto invalid;
+        if (!strcasecmp(arg2, "down"))
+            b = 1;
+        else if (!strcasecmp(arg2, "up"))
+            b = 0;
+        else if (!strcasecmp(arg2, "repeat"))
+            b = 2;
+        else
+            goto invalid;
+        event->dev_id = VINPUT_KEYBOARD_ID;
+        event->cmd = (struct vinput_cmd) {
+            .type = VINPUT_CMD_KEYBOARD_KEY,
+            .u.keyboard_key = {.key = (uint32_t) a, .value = (uint32_t) b},
+        };
+    } else if (!strcmp(verb, "button")) {
+        if (!strcasecmp(arg1, "left"))
+            a = SEMU_BTN_LEFT;
+        else if (!strcasecmp(arg1, "right"))
+            a = SEMU_BTN_RIGHT;
+        else if (!strcasecmp(arg1, "middle"))
+            a = SEMU_BTN_MIDDLE;
+        else
+            goto invalid;
+        if (strcasecmp(arg2, "down") && strcasecmp(arg2, "up"))
+            goto invalid;
+        event->dev_id = VINPUT_MOUSE_ID;
+        event->cmd = (struct vinput_cmd) {
+            .type = VINPUT_CMD_MOUSE_BUTTON,
+            .u.mouse_button = {.button = (uint32_t) a,
+                               .pressed = !strcasecmp(arg2, "down")},
+        };
+    } else if (!strcmp(verb, "move") || !strcmp(verb, "wheel")) {
+        if (!vinput_script_parse_int(arg1, INT32_MIN, INT32_MAX, &a) ||
+            !vinput_script_parse_int(arg2, INT32_MIN, INT32_MAX, &b))
+            goto invalid;
+        event->dev_id = VINPUT_MOUSE_ID;
+        if (!strcmp(verb, "move"))
+            event->cmd = (struct vinput_cmd) {
+                .type = VINPUT_CMD_MOUSE_MOTION,
+                .u.mouse_motion = {.dx = (int32_t) a, .dy = (int32_t) b},
+            };
+        else
+            event->cmd = (struct vinput_cmd) {
+                .type = VINPUT_CMD_MOUSE_WHEEL,
+                .u.mouse_wheel = {.dx = (int32_t) a, .dy = (int32_t) b},
+            };
+    } else {
+        goto invalid;
+    }
+
+    uint64_t offset_ns = (uint64_t) ms * 1000000ULL;
+    event->due_ns = relative ? vinput_script.last_due_ns + offset_ns
+                             : vinput_script.start_ns + offset_ns;
+    vinput_script.last_due_ns = event->due_ns;
+    return true;
+
+invalid:
+    fprintf(stderr,
+            VINPUT_SCRIPT_LOG_PREFIX "line %u: ignoring malformed event\n",
+            vinput_script.line);
+    return false;
+}
+
+/* Stop reading the current source: a file is done, a socket waits for the
+ * next client.
+ */
+static void vinput_script_close_source(void)
+{
+    if (vinput_script.fd >= 0)
+        close(vinput_script.fd);
+    vinput_script.fd = -1;
+    vinput_script.len = 0;
+    vinput_script.skipping = false;
+    vinput_script.pending = false;
+    if (vinput_script.listen_fd < 0)
+        vinput_script.active = false;
+}
+
+static void vinput_script_begin_source(int fd)
+{
+    vinput_script.fd = fd;
+    vinput_script.len = 0;
+    vinput_script.line = 0;
+    vinput_script.skipping = false;
+    vinput_script.start_ns = vinput_script_now_ns();
+    vinput_script.last_due_ns = vinput_script.start_ns;
+}
+
+/* Read up to the next event into 'vinput_script.event'. Returns false when
+ * no complete line is available yet, or the source ended.
+ */
+static bool vinput_script_next_event(void)
+{
+    for (;;) {
+        char *nl = memchr(vinput_script.buf, '\n', vinput_script.len);
+        if (nl) {
+            size_t used = (size_t) (nl - vinput_script.buf) + 1;
+            *nl = '\0';
+            vinput_script.line++;
+            bool parsed = vinput_script_parse_line(vinput_script.buf);
+            memmove(vinput_script.buf, vinput_script.buf + used,
+                    vinput_script.len - used);
+            vinput_script.len -= used;
+            if (parsed)
+                return true;
+            continue;
+        }
+
+        if (vinput_script.len == sizeof(vinput_script.buf)) {
+            fprintf(stderr,
+                    VINPUT_SCRIPT_LOG_PREFIX "line %u: too long, ignored\n",
+                    ++vinput_script.line);
+            vinput_script.skipping = true;
+            vinput_script.len = 0;
+        }
+
+        ssize_t n =
+            read(vinput_script.fd, vinput_script.buf + vinput_script.len,
+                 sizeof(vinput_script.buf) - vinput_script.len);
+        if (n > 0) {
+            vinput_script.len += (size_t) n;
+            if (vinput_script.skipping) {
+                nl = memchr(vinput_script.buf, '\n', vinput_script.len);
+                size_t used = nl ? (size_t) (nl - vinput_script.buf) + 1
+                                 : vinput_script.len;
+                memmove(vinput_script.buf, vinput_script.buf + used,
+                        vinput_script.len - used);
+                vinput_script.len -= used;
+                vinput_script.skipping = !nl;
+            }
+            continue;
+        }
+        if (n < 0 &&
+            (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+            return false;
+
+        /* End of the source; a last line without a newline still counts. */
+        if (vinput_script.len && !vinput_script.skipping) {
+            vinput_script.buf[vinput_script.len++] = '\n';
+            continue;
+        }
+        vinput_script_close_source();
+        return false;
+    }
+}
+
+bool vinput_script_open(const char *spec)
+{
+    if (!strncmp(spec, "unix:", 5)) {
+        const char *path = spec + 5;
+        struct sockaddr_un addr = {.sun_family = AF_UNIX};
+        if (!*path || strlen(path) >= sizeof(addr.sun_path)) {
+            fprintf(stderr,
+                    VINPUT_SCRIPT_LOG_PREFIX "invalid socket path '%s'\n",
+                    path);
+            return false;
+        }
+        strcpy(addr.sun_path, path);
+
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || fcntl(fd, F_SETFL, O_NONBLOCK) < 0 ||
+            bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+            listen(fd, 1) < 0) {
+            fprintf(stderr,
+                    VINPUT_SCRIPT_LOG_PREFIX "cannot listen on '%s': %s\n",
+                    path, strerror(errno));
+            if (fd >= 0)
+                close(fd);
+            return false;
+        }
+        vinput_script.listen_fd = fd;
+        vinput_script.socket_path = strdup(path);
+    } else {
+        int fd = open(spec, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, VINPUT_SCRIPT_LOG_PREFIX "cannot open '%s': %s\n",
+                    spec, strerror(errno));
+            return false;
+        }
+        vinput_script_begin_source(fd);
+    }
+
+    vinput_script.active = true;
+    return true;
+}
+
+void vinput_script_poll(void)
+{
+    if (!vinput_script.active)
+        return;
+
+    if (vinput_script.fd < 0) {
+        int fd = accept(vinput_script.listen_fd, NULL, NULL);
+        if (fd < 0)
+            return;
+        if (fcntl(fd, F_SETFL, O_NONBLOCK) < 0) {
+            close(fd);
+            return;
+        }
+        vinput_script_begin_source(fd);
+    }
+
+    uint64_t now_ns = vinput_script_now_ns();
+    for (;;) {
+        if (!vinput_script.pending) {
+            if (!vinput_script_next_event())
+                return;
+            vinput_script.pending = true;
+        }
+        if (vinput_script.event.due_ns > now_ns)
+            return;
+
+        vinput_script.pending = false;
+        if (!vinput_push_cmd(vinput_script.event.dev_id,
+                             &vinput_script.event.cmd)) {
+            vinput_script.dropped++;
+            continue;
+        }
+        vinput_script.injected++;
+        if (!vinput_script.unanswered_ns)
+            vinput_script.unanswered_ns = now_ns;
+    }
+}
+
+void vinput_script_note_frame(uint64_t publish_ns)
+{
+    if (!vinput_script.unanswered_ns ||
+        publish_ns < vinput_script.unanswered_ns)
+        return;
+
+    uint64_t latency = publish_ns - vinput_script.unanswered_ns;
+    vinput_script.unanswered_ns = 0;
+    vinput_script.answered++;
+    vinput_script.latency_ns += latency;
+    if (latency > vinput_script.max_latency_ns)
+        vinput_script.max_latency_ns = latency;
+}
+
+void vinput_script_close(void)
+{
+    if (vinput_script.injected || vinput_script.dropped) {
+        fprintf(stderr,
+                VINPUT_SCRIPT_LOG_PREFIX "%" PRIu64 " events injected, %" PRIu64
+                                         " dropped",
+                vinput_script.injected, vinput_script.dropped);
+        if (vinput_script.answered)
+            fprintf(stderr,
+                    "; input to next frame avg %.3f ms max %.3f ms over "
+                    "%" PRIu64 " frames",
+                    (double) vinput_script.latency_ns / 1e6 /
+                        (double) vinput_script.answered,
+                    (double) vinput_script.max_latency_ns / 1e6,
+                    vinput_script.answered);
+        fputc('\n', stderr);
+    }
+
+    if (vinput_script.fd >= 0)
+        close(vinput_script.fd);
+    if (vinput_script.listen_fd >= 0) {
+        close(vinput_script.listen_fd);
+        unlink(vinput_script.socket_path);
+    }
+    free(vinput_script.socket_path);
+    memset(&vinput_script, 0, sizeof(vinput_script));
+    vinput_script.fd = vinput_script.listen_fd = -1;
+}
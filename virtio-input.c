@@ -363,8 +363,22 @@ static void virtio_input_update_eventq(int dev_id,
         return;
     }
 
+    /* When the guest supplied fewer buffers than the batch needs, deliver the
+     * reports that fit and drop the rest. Cut at a 'SYN_REPORT' so the guest
+     * never sees half a report.
+     */
+    uint32_t fit = ev_cnt;
+    if (fit > avail_delta) {
+        fit = 0;
+        for (uint32_t i = 0; i < avail_delta; i++) {
+            if (input_ev[i].type == SEMU_EV_SYN &&
+                input_ev[i].code == SEMU_SYN_REPORT)
+                fit = i + 1;
+        }
+    }
+
     /* No buffers available - drop event or handle later */
-    if (queue->last_avail == new_avail) {
+    if (fit == 0) {
 #if SEMU_INPUT_DEBUG
         fprintf(stderr, VINPUT_DEBUG_PREFIX "drop dev=%d (no guest buffers)\n",
                 dev_id);
@@ -372,10 +386,16 @@ static void virtio_input_update_eventq(int dev_id,
         /* TODO: Consider buffering events instead of dropping them */
         return;
     }
+#if SEMU_INPUT_DEBUG
+    if (fit < ev_cnt)
+        fprintf(stderr,
+                VINPUT_DEBUG_PREFIX "drop dev=%d %u of %u events (guest "
+                                    "buffers)\n",
+                dev_id, ev_cnt - fit, ev_cnt);
+#endif
 
     /* Try to write events to used ring */
-    bool wrote_events =
-        virtio_input_desc_handler(vinput, input_ev, ev_cnt, queue);
+    bool wrote_events = virtio_input_desc_handler(vinput, input_ev, fit, queue);
 
     /* Send interrupt only if we actually wrote events, unless
      * VIRTQ_AVAIL_F_NO_INTERRUPT is set
@@ -384,7 +404,94 @@ static void virtio_input_update_eventq(int dev_id,
         vinput->InterruptStatus |= VIRTIO_INT__USED_RING;
 }
 
-static void virtio_input_update_key(uint32_t key, uint32_t ev_value)
+/* Events collected for one device while draining the host queues, then
+ * written to its eventq in one go: one used ring update and one interrupt for
+ * the whole batch instead of one per host event.
+ *
+ * Relative motion and scroll are not appended as they arrive. They are summed
+ * in 'rel' and emitted as a single report when something else must follow
+ * them, or at the end of the drain, so a burst of host motion events costs the
+ * guest one report instead of one each. Evdev allows all REL axes in a single
+ * report, and summing them keeps the total movement exact.
+ */
+#define VINPUT_BATCH_EVENTS 128U
+
+enum {
+    VINPUT_BATCH_REL_X = 0,
+    VINPUT_BATCH_REL_Y,
+    VINPUT_BATCH_REL_HWHEEL,
+    VINPUT_BATCH_REL_WHEEL,
+    VINPUT_BATCH_REL_CNT,
+};
+
+static const uint16_t vinput_batch_rel_code[VINPUT_BATCH_REL_CNT] = {
+    [VINPUT_BATCH_REL_X] = SEMU_REL_X,
+    [VINPUT_BATCH_REL_Y] = SEMU_REL_Y,
+    [VINPUT_BATCH_REL_HWHEEL] = SEMU_REL_HWHEEL,
+    [VINPUT_BATCH_REL_WHEEL] = SEMU_REL_WHEEL,
+};
+
+struct vinput_batch {
+    int dev_id;
+    uint32_t ev_cnt;
+    struct virtio_input_event events[VINPUT_BATCH_EVENTS];
+    int64_t rel[VINPUT_BATCH_REL_CNT];
+};
+
+static void virtio_input_batch_submit(struct vinput_batch *batch)
+{
+    if (!batch->ev_cnt)
+        return;
+
+    virtio_input_update_eventq(batch->dev_id, batch->events, batch->ev_cnt);
+    batch->ev_cnt = 0;
+}
+
+/* Append one complete report, submitting the batch first if it is full. */
+static void virtio_input_batch_append(struct vinput_batch *batch,
+                                      const struct virtio_input_event *input_ev,
+                                      uint32_t ev_cnt)
+{
+    if (batch->ev_cnt + ev_cnt > VINPUT_BATCH_EVENTS)
+        virtio_input_batch_submit(batch);
+
+    memcpy(&batch->events[batch->ev_cnt], input_ev,
+           ev_cnt * sizeof(*input_ev));
+    batch->ev_cnt += ev_cnt;
+}
+
+/* Emit the relative motion and scroll summed so far as one report. */
+static void virtio_input_batch_flush_rel(struct vinput_batch *batch)
+{
+    struct virtio_input_event input_ev[VINPUT_BATCH_REL_CNT + 1];
+    uint32_t ev_cnt = 0;
+
+    for (int i = 0; i < VINPUT_BATCH_REL_CNT; i++) {
+        int64_t value = batch->rel[i];
+        if (!value)
+            continue;
+        if (value > INT32_MAX)
+            value = INT32_MAX;
+        if (value < INT32_MIN)
+            value = INT32_MIN;
+        input_ev[ev_cnt++] = (struct virtio_input_event) {
+            .type = SEMU_EV_REL,
+            .code = vinput_batch_rel_code[i],
+            .value = (uint32_t) (int32_t) value,
+        };
+        batch->rel[i] = 0;
+    }
+    if (!ev_cnt)
+        return;
+
+    input_ev[ev_cnt++] = (struct virtio_input_event) {
+        .type = SEMU_EV_SYN, .code = SEMU_SYN_REPORT, .value = 0};
+    virtio_input_batch_append(batch, input_ev, ev_cnt);
+}
+
+static void virtio_input_update_key(struct vinput_batch *batch,
+                                    uint32_t key,
+                                    uint32_t ev_value)
 {
 #if SEMU_INPUT_DEBUG
     fprintf(stderr, VINPUT_DEBUG_PREFIX "key code=%u value=%u\n", key,
@@ -397,10 +504,11 @@ static void virtio_input_update_key(uint32_t key, uint32_t ev_value)
     };
 
     size_t ev_cnt = ARRAY_SIZE(input_ev);
-    virtio_input_update_eventq(VINPUT_KEYBOARD_ID, input_ev, ev_cnt);
+    virtio_input_batch_append(batch, input_ev, ev_cnt);
 }
 
-static void virtio_input_update_mouse_button_state(uint32_t button,
+static void virtio_input_update_mouse_button_state(struct vinput_batch *batch,
+                                                   uint32_t button,
                                                    bool pressed)
 {
 #if SEMU_INPUT_DEBUG
@@ -412,65 +520,45 @@ static void virtio_input_update_mouse_button_state(uint32_t button,
         {.type = SEMU_EV_SYN, .code = SEMU_SYN_REPORT, .value = 0},
     };
 
+    /* The click lands where the pointer was when it happened, so the motion
+     * leading up to it goes first.
+     */
+    virtio_input_batch_flush_rel(batch);
+
     size_t ev_cnt = ARRAY_SIZE(input_ev);
-    virtio_input_update_eventq(VINPUT_MOUSE_ID, input_ev, ev_cnt);
+    virtio_input_batch_append(batch, input_ev, ev_cnt);
 }
 
-static void virtio_input_update_mouse_motion(int32_t dx, int32_t dy)
+static void virtio_input_update_mouse_motion(struct vinput_batch *batch,
+                                             int32_t dx,
+                                             int32_t dy)
 {
 #if SEMU_INPUT_DEBUG
     fprintf(stderr, VINPUT_DEBUG_PREFIX "motion dx=%d dy=%d\n", dx, dy);
 #endif
-    struct virtio_input_event input_ev[3];
-    uint32_t ev_cnt = 0;
-
-    if (dx)
-        input_ev[ev_cnt++] = (struct virtio_input_event) {
-            .type = SEMU_EV_REL, .code = SEMU_REL_X, .value = (uint32_t) dx};
-    if (dy)
-        input_ev[ev_cnt++] = (struct virtio_input_event) {
-            .type = SEMU_EV_REL, .code = SEMU_REL_Y, .value = (uint32_t) dy};
-    if (!ev_cnt)
-        return;
-
-    input_ev[ev_cnt++] = (struct virtio_input_event) {
-        .type = SEMU_EV_SYN, .code = SEMU_SYN_REPORT, .value = 0};
-
-    virtio_input_update_eventq(VINPUT_MOUSE_ID, input_ev, ev_cnt);
+    batch->rel[VINPUT_BATCH_REL_X] += dx;
+    batch->rel[VINPUT_BATCH_REL_Y] += dy;
 }
 
-static void virtio_input_update_scroll(int32_t dx, int32_t dy)
+static void virtio_input_update_scroll(struct vinput_batch *batch,
+                                       int32_t dx,
+                                       int32_t dy)
 {
 #if SEMU_INPUT_DEBUG
     fprintf(stderr, VINPUT_DEBUG_PREFIX "scroll dx=%d dy=%d\n", dx, dy);
 #endif
-    /* Build only the non-zero axis events and always terminate with SYN_REPORT.
-     * dx > 0: scroll right, dy > 0: scroll up (matches Linux evdev convention).
+    /* dx > 0: scroll right, dy > 0: scroll up (matches Linux evdev
+     * convention).
      */
-    struct virtio_input_event input_ev[3];
-    uint32_t ev_cnt = 0;
-
-    if (dx)
-        input_ev[ev_cnt++] =
-            (struct virtio_input_event) {.type = SEMU_EV_REL,
-                                         .code = SEMU_REL_HWHEEL,
-                                         .value = (uint32_t) dx};
-    if (dy)
-        input_ev[ev_cnt++] =
-            (struct virtio_input_event) {.type = SEMU_EV_REL,
-                                         .code = SEMU_REL_WHEEL,
-                                         .value = (uint32_t) dy};
-    if (!ev_cnt)
-        return;
-
-    input_ev[ev_cnt++] = (struct virtio_input_event) {
-        .type = SEMU_EV_SYN, .code = SEMU_SYN_REPORT, .value = 0};
-
-    virtio_input_update_eventq(VINPUT_MOUSE_ID, input_ev, ev_cnt);
+    batch->rel[VINPUT_BATCH_REL_HWHEEL] += dx;
+    batch->rel[VINPUT_BATCH_REL_WHEEL] += dy;
 }
 
 void virtio_input_drain_host_events(void)
 {
+    struct vinput_batch keyboard = {.dev_id = VINPUT_KEYBOARD_ID};
+    struct vinput_batch mouse = {.dev_id = VINPUT_MOUSE_ID};
+
     for (;;) {
         struct vinput_cmd event;
 
@@ -489,7 +577,7 @@ void virtio_input_drain_host_events(void)
          */
         while (vinput_pop_cmd(VINPUT_KEYBOARD_ID, &event)) {
             if (event.type == VINPUT_CMD_KEYBOARD_KEY)
-                virtio_input_update_key(event.u.keyboard_key.key,
+                virtio_input_update_key(&keyboard, event.u.keyboard_key.key,
                                         event.u.keyboard_key.value);
         }
 
@@ -497,14 +585,15 @@ void virtio_input_drain_host_events(void)
             switch (event.type) {
             case VINPUT_CMD_MOUSE_BUTTON:
                 virtio_input_update_mouse_button_state(
-                    event.u.mouse_button.button, event.u.mouse_button.pressed);
+                    &mouse, event.u.mouse_button.button,
+                    event.u.mouse_button.pressed);
                 break;
             case VINPUT_CMD_MOUSE_MOTION:
-                virtio_input_update_mouse_motion(event.u.mouse_motion.dx,
-                                                 event.u.mouse_motion.dy);
+                virtio_input_update_mouse_motion(
+                    &mouse, event.u.mouse_motion.dx, event.u.mouse_motion.dy);
                 break;
             case VINPUT_CMD_MOUSE_WHEEL:
-                virtio_input_update_scroll(event.u.mouse_wheel.dx,
+                virtio_input_update_scroll(&mouse, event.u.mouse_wheel.dx,
                                            event.u.mouse_wheel.dy);
                 break;
             default:
@@ -515,6 +604,13 @@ void virtio_input_drain_host_events(void)
         if (vinput_rearm_cmd_wake())
             break;
     }
+
+    /* Everything popped above reaches the guest before the caller raises the
+     * interrupts, so a drain costs at most one interrupt per device.
+     */
+    virtio_input_batch_submit(&keyboard);
+    virtio_input_batch_flush_rel(&mouse);
+    virtio_input_batch_submit(&mouse);
 }
 
 static void virtio_input_properties(int dev_id)
@@ -58,18 +58,58 @@ static inline uint32_t vnet_preprocess(virtio_net_state_t *vnet, uint32_t addr)
     return addr >> 2;
 }
 
+#if !defined(__APPLE__)
+/* Hand both virtqueues to the external switch once the driver is ready */
+static void virtio_net_vhost_user_start(virtio_net_state_t *vnet)
+{
+    vhost_user_vring_t vrings[VHOST_USER_QUEUE_NUM];
+    for (int i = 0; i < VHOST_USER_QUEUE_NUM; i++) {
+        virtio_net_queue_t *queue = &vnet->queues[i];
+        if (!queue->ready)
+            return virtio_net_set_fail(vnet);
+        vrings[i] = (vhost_user_vring_t){
+            .num = queue->QueueNum,
+            .desc_addr = queue->QueueDesc << 2,
+            .avail_addr = queue->QueueAvail << 2,
+            .used_addr = queue->QueueUsed << 2,
+            .last_avail = queue->last_avail,
+        };
+    }
+    uint64_t features =
+        (uint64_t) vnet->DriverFeatures1 << 32 | vnet->DriverFeatures;
+    if (!net_vhost_user_start((net_vhostuser_options_t *) vnet->peer.op,
+                              features, vnet->ram, vnet->ram_fd, RAM_SIZE,
+                              vrings))
+        virtio_net_set_fail(vnet);
+}
+#endif
+
 static void virtio_net_update_status(virtio_net_state_t *vnet, uint32_t status)
 {
+#if !defined(__APPLE__)
+    bool was_driver_ok = vnet->Status & VIRTIO_STATUS__DRIVER_OK;
+#endif
     vnet->Status |= status;
-    if (status)
+    if (status) {
+#if !defined(__APPLE__)
+        if (!was_driver_ok && (status & VIRTIO_STATUS__DRIVER_OK) &&
+            vnet->peer.type == NETDEV_IMPL_vhostuser)
+            virtio_net_vhost_user_start(vnet);
+#endif
         return;
+    }
 
     /* Reset */
+#if !defined(__APPLE__)
+    if (vnet->peer.type == NETDEV_IMPL_vhostuser)
+        net_vhost_user_stop((net_vhostuser_options_t *) vnet->peer.op);
+#endif
     netdev_t peer = vnet->peer;
     uint32_t *ram = vnet->ram;
+    int ram_fd = vnet->ram_fd;
     void *priv = vnet->priv;
     memset(vnet, 0, sizeof(*vnet));
-    vnet->peer = peer, vnet->ram = ram;
+    vnet->peer = peer, vnet->ram = ram, vnet->ram_fd = ram_fd;
     vnet->priv = priv;
 }
 
@@ -168,25 +208,28 @@ static ssize_t handle_read(netdev_t *netdev,
     case _(user): {
         net_user_options_t *usr = (net_user_options_t *) netdev->op;
 
-        plen = readv(usr->guest_to_host_channel[SLIRP_READ_SIDE], iovs_cursor,
-                     niovs);
-        if (plen < 0 && (errno == EWOULDBLOCK || errno == EAGAIN)) {
+        plen = net_slirp_readv(usr, iovs_cursor, niovs);
+        if (plen < 0) {
             queue->fd_ready = false;
             return -1;
         }
-
+        break;
+    }
+    case _(socket): {
+        net_socket_options_t *sock = (net_socket_options_t *) netdev->op;
+        plen = net_socket_readv(sock, iovs_cursor, niovs);
         if (plen < 0) {
-            plen = 0;
-            fprintf(stderr, "[VNET] could not read packet: %s\n",
-                    strerror(errno));
+            queue->fd_ready = false;
+            return -1;
         }
-
         break;
     }
     default:
         break;
     }
 #undef _
+    if (plen > 0 && netdev->pcap)
+        pcap_write_iov(netdev->pcap, iovs_cursor, niovs, plen);
     return plen;
 }
 
@@ -229,19 +272,40 @@ static ssize_t handle_write(netdev_t *netdev,
 #endif
     case _(user): {
         net_user_options_t *usr = (net_user_options_t *) netdev->op;
-        ssize_t written = writev(usr->host_to_guest_channel[SLIRP_WRITE_SIDE],
-                                 iovs_cursor, niovs);
-        if (written < 0) {
+        plen = net_slirp_writev(usr, iovs_cursor, niovs);
+        if (plen < 0 && errno == EAGAIN) {
             queue->fd_ready = false;
             return -1;
         }
-        plen = written;
+        if (plen < 0) {
+            /* Drop oversized frames rather than stalling the queue */
+            plen = 0;
+            fprintf(stderr, "[VNET] could not write packet: %s\n",
+                    strerror(errno));
+        }
+        break;
+    }
+    case _(socket): {
+        net_socket_options_t *sock = (net_socket_options_t *) netdev->op;
+        plen = net_socket_writev(sock, iovs_cursor, niovs);
+        if (plen < 0 && errno == EAGAIN) {
+            queue->fd_ready = false;
+            return -1;
+        }
+        if (plen < 0) {
+            plen = 0;
+            fprintf(stderr, "[VNET] could not write packet: %s\n",
+                    strerror(errno));
+        }
         break;
     }
     default:
         break;
     }
 #undef _
+    /* Capture only frames that actually left; dropped ones report 0 */
+    if (plen > 0 && netdev->pcap)
+        pcap_write_iov(netdev->pcap, iovs_cursor, niovs, plen);
     return plen;
 }
 
@@ -344,14 +408,20 @@ VNET_GENERATE_QUEUE_HANDLER(tx, write, VNET_QUEUE_TX, false)
 
 void virtio_net_refresh_queue(virtio_net_state_t *vnet)
 {
-    if (!(vnet->Status & VIRTIO_STATUS__DRIVER_OK) ||
-        (vnet->Status & VIRTIO_STATUS__DEVICE_NEEDS_RESET))
-        return;
-
     /* Skip if peer network device is not initialized */
     if (!vnet->peer.op)
         return;
 
+    /* A socket hub repeats frames between its peers whatever its own guest
+     * is doing, even before the driver is up.
+     */
+    if (vnet->peer.type == NETDEV_IMPL_socket)
+        net_socket_poll((net_socket_options_t *) vnet->peer.op);
+
+    if (!(vnet->Status & VIRTIO_STATUS__DRIVER_OK) ||
+        (vnet->Status & VIRTIO_STATUS__DEVICE_NEEDS_RESET))
+        return;
+
     netdev_impl_t dev_type = vnet->peer.type;
 #define _(dev) NETDEV_IMPL_##dev
     switch (dev_type) {
@@ -385,25 +455,41 @@ void virtio_net_refresh_queue(virtio_net_state_t *vnet)
         }
         break;
     }
+    case _(vhostuser): {
+        /* The switch moves frames through the virtqueues by itself and only
+         * reports completions.
+         */
+        if (net_vhost_user_poll_call(
+                (net_vhostuser_options_t *) vnet->peer.op))
+            vnet->InterruptStatus |= VIRTIO_INT__USED_RING;
+        break;
+    }
 #endif
     case _(user): {
+        /* Frames sent by the guest are consumed by the slirp thread. The
+         * rings are checked directly, so no system call is made per tick.
+         */
         net_user_options_t *usr = (net_user_options_t *) vnet->peer.op;
-        struct pollfd pfd[3] = {
-            {usr->guest_to_host_channel[SLIRP_READ_SIDE], POLLIN, 0},
-            {usr->host_to_guest_channel[SLIRP_READ_SIDE], POLLIN, 0},
-            {usr->host_to_guest_channel[SLIRP_WRITE_SIDE], POLLOUT, 0}};
-        poll(pfd, 3, 0);
-        if (pfd[0].revents & POLLIN) {
+        if (net_slirp_rx_pending(usr)) {
             vnet->queues[VNET_QUEUE_RX].fd_ready = true;
             virtio_net_try_rx(vnet);
         }
-        if (pfd[1].revents & POLLIN) {
-            net_slirp_read(usr);
-        }
-        if (pfd[2].revents & POLLOUT) {
-            vnet->queues[VNET_QUEUE_TX].fd_ready = true;
-            virtio_net_try_tx(vnet);
+        net_slirp_rx_rearm(usr);
+        /* A full TX ring clears 'fd_ready' again in 'handle_write()' */
+        vnet->queues[VNET_QUEUE_TX].fd_ready = true;
+        virtio_net_try_tx(vnet);
+        break;
+    }
+    case _(socket): {
+        net_socket_options_t *sock = (net_socket_options_t *) vnet->peer.op;
+        if (net_socket_rx_pending(sock)) {
+            vnet->queues[VNET_QUEUE_RX].fd_ready = true;
+            virtio_net_try_rx(vnet);
         }
+        vnet->queues[VNET_QUEUE_TX].fd_ready = true;
+        virtio_net_try_tx(vnet);
+        /* The whole TX burst leaves in one write per peer */
+        net_socket_flush(sock);
         break;
     }
     default:
@@ -412,6 +498,50 @@ void virtio_net_refresh_queue(virtio_net_state_t *vnet)
 #undef _
 }
 
+int virtio_net_get_rx_fd(virtio_net_state_t *vnet)
+{
+    if (!vnet->peer.op)
+        return -1;
+
+    /* A socket hub repeats frames between its peers and accepts new ones
+     * while its own guest is down or out of RX buffers, so its sockets are
+     * always watched. Only delivery into the guest waits for buffers.
+     */
+    if (vnet->peer.type == NETDEV_IMPL_socket)
+        return net_socket_get_fd((net_socket_options_t *) vnet->peer.op);
+
+    if (!(vnet->Status & VIRTIO_STATUS__DRIVER_OK) ||
+        (vnet->Status & VIRTIO_STATUS__DEVICE_NEEDS_RESET))
+        return -1;
+
+    /* Without posted RX buffers a readable peer could not be drained, and
+     * watching it would only keep the caller's poll() spinning.
+     */
+    virtio_net_queue_t *queue = &vnet->queues[VNET_QUEUE_RX];
+    if (!queue->ready ||
+        queue->last_avail == (uint16_t) (vnet->ram[queue->QueueAvail] >> 16))
+        return -1;
+
+#define _(dev) NETDEV_IMPL_##dev
+    switch (vnet->peer.type) {
+#if defined(__APPLE__)
+    case _(vmnet):
+        return net_vmnet_get_fd((net_vmnet_state_t *) vnet->peer.op);
+#else
+    case _(tap):
+        return ((net_tap_options_t *) vnet->peer.op)->tap_fd;
+    case _(vhostuser):
+        return ((net_vhostuser_options_t *) vnet->peer.op)
+            ->call_fd[VNET_QUEUE_RX];
+#endif
+    case _(user):
+        return net_slirp_get_fd((net_user_options_t *) vnet->peer.op);
+    default:
+        return -1;
+    }
+#undef _
+}
+
 void virtio_net_recv_from_peer(void *peer)
 {
     virtio_net_state_t *vnet = (virtio_net_state_t *) peer;
@@ -489,7 +619,10 @@ static bool virtio_net_reg_write(virtio_net_state_t *vnet,
         vnet->DeviceFeaturesSel = value;
         return true;
     case _(DriverFeatures):
-        vnet->DriverFeaturesSel == 0 ? (vnet->DriverFeatures = value) : 0;
+        if (vnet->DriverFeaturesSel == 0)
+            vnet->DriverFeatures = value;
+        else if (vnet->DriverFeaturesSel == 1)
+            vnet->DriverFeatures1 = value;
         return true;
     case _(DriverFeaturesSel):
         vnet->DriverFeaturesSel = value;
@@ -538,6 +671,16 @@ static bool virtio_net_reg_write(virtio_net_state_t *vnet,
         return true;
 
     case _(QueueNotify):
+#if !defined(__APPLE__)
+        if (vnet->peer.op && vnet->peer.type == NETDEV_IMPL_vhostuser) {
+            if (value < ARRAY_SIZE(vnet->queues))
+                net_vhost_user_kick((net_vhostuser_options_t *) vnet->peer.op,
+                                    value);
+            else
+                virtio_net_set_fail(vnet);
+            return true;
+        }
+#endif
         if (value < ARRAY_SIZE(vnet->queues)) {
             switch (value) {
             case VNET_QUEUE_RX:
@@ -637,6 +780,11 @@ bool virtio_net_init(virtio_net_state_t *vnet, const char *name)
 #if defined(__APPLE__)
     if (vnet->peer.type == NETDEV_IMPL_vmnet)
         vnet->queues[VNET_QUEUE_TX].fd_ready = true;
+#else
+    if (vnet->peer.type == NETDEV_IMPL_vhostuser && vnet->ram_fd < 0) {
+        fprintf(stderr, "vhostuser requires guest RAM in shared memory\n");
+        return false;
+    }
 #endif
 
     return true;
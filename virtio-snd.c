@@ -1,9 +1,12 @@
+#include <errno.h>
 #include <inttypes.h>
 #include <math.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <portaudio.h>
 
@@ -15,6 +18,13 @@
 
 #define VSND_DEV_CNT_MAX 1
 
+/* Stream 0 plays back, stream 1 captures */
+#define VSND_STREAM_CNT 2
+enum {
+    VSND_STREAM_OUT = 0,
+    VSND_STREAM_IN = 1,
+};
+
 #define VSND_QUEUE_NUM_MAX 1024
 #define vsndq (vsnd->queues[vsnd->QueueSel])
 
@@ -267,23 +277,33 @@ typedef struct {
     uint8_t positions[VIRTIO_SND_CHMAP_MAX_SIZE];
 } virtio_snd_chmap_info_t;
 
-typedef struct {
-    pthread_cond_t readable, writable;
-    int buf_ev_notify;
-    int releasing;
-    pthread_mutex_t lock;
-} virtio_snd_queue_lock_t;
-
 typedef struct {
     uint32_t stream_id;
 } vsnd_stream_sel_t;
 
+/* Single-producer, single-consumer byte ring carrying PCM frames between an
+ * I/O thread and the host backend without locks: from the TX thread to the
+ * backend for playback, and the other way round for capture. 'head' and
+ * 'tail' run freely and are only ever advanced by the producer and the
+ * consumer, respectively; their difference is the number of queued bytes.
+ */
+#define VSND_RING_SIZE (256 * 1024) /* Must be power of 2 */
 typedef struct {
-    void *addr; /* points to the guest OS buffer */
-    uint32_t len;
-    uint32_t pos; /* current position in this node */
-    struct list_head q;
-} vsnd_buf_queue_node_t;
+    uint8_t *buf;
+    uint32_t limit; /* bytes the ring may hold for the current stream */
+    uint32_t head;
+    uint32_t tail;
+} vsnd_pcm_ring_t;
+
+/* What the host side of a stream saw between PREPARE and RELEASE */
+typedef struct {
+    uint64_t bytes;       /* PCM bytes moved to or from the host */
+    uint64_t xruns;       /* host periods the ring could not fully serve */
+    uint64_t xrun_bytes;  /* silence played, or captured bytes dropped */
+    uint64_t max_late_ns; /* worst tick lateness of a clocked backend */
+    uint64_t run_ns;      /* time spent between START and STOP */
+    uint64_t start_ns;
+} vsnd_stats_t;
 
 /* hold the settings of each stream */
 typedef struct {
@@ -293,31 +313,78 @@ typedef struct {
     virtio_snd_pcm_set_params_t pp;
     PaStream *pa_stream;
 
-    // PCM frame queue lock
-    virtio_snd_queue_lock_t lock;
-    // PCM frame doubly-ended queue
-    vsnd_buf_queue_node_t buf;
-    struct list_head buf_queue_head;
+    // PCM frames between the I/O threads and the host backend
+    vsnd_pcm_ring_t ring;
+    uint32_t bytes_per_sec;
+    int releasing; /* makes an I/O thread waiting on the ring give up */
+
+    // null and file backends
+    pthread_t clock;
+    int running;
+    FILE *file;
+    uint32_t file_bytes; /* WAV data written, or left to read */
+    vsnd_stats_t stats;
 
     // playback control
     vsnd_stream_sel_t v;
 } virtio_snd_prop_t;
 
 static virtio_snd_config_t vsnd_configs[VSND_DEV_CNT_MAX];
-static virtio_snd_prop_t vsnd_props[VSND_DEV_CNT_MAX] = {
-    [0 ... VSND_DEV_CNT_MAX - 1].pp.hdr.hdr.code = VIRTIO_SND_R_PCM_SET_PARAMS,
-    [0 ... VSND_DEV_CNT_MAX - 1].lock =
-        {
-            .lock = PTHREAD_MUTEX_INITIALIZER,
-            .readable = PTHREAD_COND_INITIALIZER,
-            .writable = PTHREAD_COND_INITIALIZER,
-        },
+static virtio_snd_prop_t vsnd_props[VSND_STREAM_CNT] = {
+    [0 ... VSND_STREAM_CNT - 1].pp.hdr.hdr.code = VIRTIO_SND_R_PCM_SET_PARAMS,
 };
 static int vsnd_dev_cnt = 0;
 
+/* Host side of a stream. PortAudio drives the ring from its own callback
+ * thread; the null and file backends have no device clock, so a thread ticks
+ * them at the stream's rate instead.
+ */
+typedef struct {
+    const char *name;
+    bool (*open)(virtio_snd_prop_t *props, uint32_t rate, uint32_t frames);
+    bool (*start)(virtio_snd_prop_t *props);
+    void (*stop)(virtio_snd_prop_t *props);
+    void (*close)(virtio_snd_prop_t *props);
+} vsnd_backend_t;
+
+static const vsnd_backend_t *vsnd_backend;
+static char *vsnd_in_path, *vsnd_out_path; /* WAV files of the file backend */
+
+/* PCM I/O may wait for the host, so the TX and RX queues are each served by a
+ * thread of their own rather than the emulator thread.
+ */
+typedef struct {
+    virtio_snd_state_t *vsnd;
+    int queue;
+    int ev_notify;
+    pthread_cond_t cond;
+} vsnd_io_thread_t;
+
 static pthread_mutex_t virtio_snd_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t virtio_snd_tx_cond = PTHREAD_COND_INITIALIZER;
-static int tx_ev_notify;
+static vsnd_io_thread_t vsnd_io_threads[] = {
+    {.queue = VSND_QUEUE_TX, .cond = PTHREAD_COND_INITIALIZER},
+    {.queue = VSND_QUEUE_RX, .cond = PTHREAD_COND_INITIALIZER},
+};
+
+/* Serializes the processing of each virtqueue, which a stream release also
+ * does from the control path to flush pending I/O messages.
+ */
+static pthread_mutex_t vsnd_queue_locks[4] = {
+    [0 ... 3] = PTHREAD_MUTEX_INITIALIZER,
+};
+
+static inline uint8_t vsnd_direction(uint32_t stream_id)
+{
+    return stream_id == VSND_STREAM_IN ? VIRTIO_SND_D_INPUT
+                                       : VIRTIO_SND_D_OUTPUT;
+}
+
+static inline uint64_t vsnd_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
 
 /* vsnd virtq callback type */
 typedef int (*vsnd_virtq_cb)(virtio_snd_state_t *,       /* vsnd state */
@@ -336,10 +403,9 @@ static void virtio_queue_notify_handler(virtio_snd_state_t *vsnd, int index);
 static void __virtio_snd_frame_enqueue(void *payload,
                                        uint32_t n,
                                        uint32_t stream_id);
-typedef struct {
-    struct virtq_desc vq_desc;
-    struct list_head q;
-} virtq_desc_queue_node_t;
+static uint32_t __virtio_snd_frame_read(void *payload,
+                                        uint32_t n,
+                                        uint32_t stream_id);
 
 /* Flush only stream_id 0.
  * FIXME: let TX queue flushing can select arbitrary stream_id.
@@ -356,62 +422,54 @@ static uint32_t flush_stream_id = 0;
          * representing PCM frames.                                            \
          * the last part contains one descriptor as follows:                   \
          *   struct virtio_snd_pcm_status                                      \
+         * The chain is walked in place, so the descriptors are not copied.    \
          */                                                                    \
-        virtq_desc_queue_node_t *node;                                         \
-        struct list_head q;                                                    \
-        INIT_LIST_HEAD(&q);                                                    \
-                                                                               \
-        /* Collect the descriptors */                                          \
-        int cnt = 0;                                                           \
-        for (;;) {                                                             \
-            /* The size of the `struct virtq_desc` is 4 words */               \
-            const uint32_t *desc =                                             \
-                &vsnd->ram[queue->QueueDesc + desc_idx * 4];                   \
-                                                                               \
-            /* Retrieve the fields of current descriptor */                    \
-            node = (virtq_desc_queue_node_t *) malloc(sizeof(*node));          \
-            node->vq_desc.addr = desc[0];                                      \
-            node->vq_desc.len = desc[2];                                       \
-            node->vq_desc.flags = desc[3];                                     \
-            list_push(&node->q, &q);                                           \
-            desc_idx = desc[3] >> 16; /* vq_desc[desc_cnt].next */             \
-                                                                               \
-            cnt++;                                                             \
-                                                                               \
-            /* Leave the loop if next-flag is not set */                       \
-            if (!(desc[3] & VIRTIO_DESC_F_NEXT))                               \
-                break;                                                         \
-        }                                                                      \
-                                                                               \
-        int idx = 0;                                                           \
         uint32_t stream_id = 0; /* Explicitly set the stream_id */             \
         uintptr_t base = (uintptr_t) vsnd->ram;                                \
         uint32_t ret_len = 0;                                                  \
         uint8_t bad_msg_err = 0;                                               \
-        list_for_each_entry (node, &q, q) {                                    \
-            uint32_t addr = node->vq_desc.addr;                                \
-            uint32_t len = node->vq_desc.len;                                  \
+        for (uint32_t idx = 0;; idx++) {                                       \
+            if (desc_idx >= queue->QueueNum || idx >= queue->QueueNum)         \
+                return -1;                                                     \
+            /* The size of the `struct virtq_desc` is 4 words */               \
+            const struct virtq_desc *desc =                                    \
+                (struct virtq_desc *) &vsnd->ram[queue->QueueDesc +            \
+                                                 desc_idx * 4];                \
+            uint32_t addr = desc->addr;                                        \
+            uint32_t len = desc->len;                                          \
+            bool last = !(desc->flags & VIRTIO_DESC_F_NEXT);                   \
+            desc_idx = desc->next;                                             \
+                                                                               \
+            /* Every part is read or written in place, so keep the whole       \
+             * descriptor, and the headers at both ends, inside guest RAM.     \
+             */                                                                \
+            if (addr >= RAM_SIZE || len > RAM_SIZE - addr)                     \
+                return -1;                                                     \
+            if ((idx == 0 && len < sizeof(virtio_snd_pcm_xfer_t)) ||           \
+                (idx > 0 && last && len < sizeof(virtio_snd_pcm_status_t)))    \
+                return -1;                                                     \
+                                                                               \
             if (idx == 0) { /* the first descriptor */                         \
                 const virtio_snd_pcm_xfer_t *request =                         \
                     (virtio_snd_pcm_xfer_t *) (base + addr);                   \
                 stream_id = request->stream_id;                                \
                 IIF(WRITE)(/* enqueue frames */                                \
                            bad_msg_err =                                       \
-                               stream_id >= VSND_DEV_CNT_MAX ? 1 : 0;          \
+                               stream_id != VSND_STREAM_OUT ? 1 : 0;           \
                            , /* flush queue */                                 \
                            bad_msg_err =                                       \
                                stream_id != flush_stream_id                    \
                                    ? 1                                         \
                                    : 0; /* select only stream_id 0 */          \
-                           ) goto early_continue;                              \
-            } else if (idx == cnt - 1) { /* the last descriptor */             \
-                IIF(WRITE)(              /* enqueue frames */                  \
-                           ,             /* flush queue */                     \
+                )                                                              \
+            } else if (last) { /* the last descriptor */                       \
+                IIF(WRITE)(        /* enqueue frames */                        \
+                           ,       /* flush queue */                           \
                            if (bad_msg_err == 1) {                             \
                                fprintf(stderr,                                 \
                                        "ignore flush stream_id %" PRIu32 "\n", \
                                        stream_id);                             \
-                               goto early_continue;                            \
+                               break;                                          \
                            } fprintf(stderr, "flush stream_id %" PRIu32 "\n",  \
                                      stream_id);)                              \
                     virtio_snd_pcm_status_t *response =                        \
@@ -420,40 +478,21 @@ static uint32_t flush_stream_id = 0;
                     bad_msg_err ? VIRTIO_SND_S_IO_ERR : VIRTIO_SND_S_OK;       \
                 response->latency_bytes = ret_len;                             \
                 *plen = sizeof(*response);                                     \
-                goto early_continue;                                           \
+            } else {                                                           \
+                IIF(WRITE)(/* enqueue frames */                                \
+                           void *payload = (void *) (base + addr);             \
+                           if (bad_msg_err == 0) __virtio_snd_frame_enqueue(   \
+                               payload, len, stream_id);                       \
+                           , /* flush queue */                                 \
+                           (void) stream_id;                                   \
+                           /* Suppress unused variable warning. */)            \
+                    ret_len += len;                                            \
             }                                                                  \
                                                                                \
-            IIF(WRITE)(/* enqueue frames */                                    \
-                       void *payload = (void *) (base + addr);                 \
-                       if (bad_msg_err == 0) __virtio_snd_frame_enqueue(       \
-                           payload, len, stream_id);                           \
-                       , /* flush queue */                                     \
-                       (void) stream_id;                                       \
-                       /* Suppress unused variable warning. */) ret_len +=     \
-                len;                                                           \
-                                                                               \
-        early_continue:                                                        \
-            idx++;                                                             \
-        }                                                                      \
-                                                                               \
-        if (bad_msg_err != 0)                                                  \
-            goto finally;                                                      \
-        IIF(WRITE)(/* enque frames */                                          \
-                   virtio_snd_prop_t *props = &vsnd_props[stream_id];          \
-                   pthread_mutex_lock(&props->lock.lock);                      \
-                   props->lock.buf_ev_notify++;                                \
-                   pthread_cond_signal(&props->lock.readable);                 \
-                   pthread_mutex_unlock(&props->lock.lock);, /* flush queue */ \
-                   )                                                           \
-                                                                               \
-            /* Tear down the descriptor list and free space. */                \
-            virtq_desc_queue_node_t *tmp = NULL;                               \
-        list_for_each_entry_safe (node, tmp, &q, q) {                          \
-            list_del(&node->q);                                                \
-            free(node);                                                        \
+            if (last)                                                          \
+                break;                                                         \
         }                                                                      \
                                                                                \
-    finally:                                                                   \
         return 0;                                                              \
     } while (0)
 
@@ -473,6 +512,62 @@ static int virtio_snd_io_desc_flush_handler(virtio_snd_state_t *vsnd,
     VSND_TX_QUEUE_BODY(0);
 }
 
+static int virtio_snd_rx_desc_handler(virtio_snd_state_t *vsnd,
+                                      const virtio_snd_queue_t *queue,
+                                      uint32_t desc_idx,
+                                      uint32_t *plen)
+{
+    /* A capture message is laid out like a playback one, except that the
+     * descriptors between struct virtio_snd_pcm_xfer and struct
+     * virtio_snd_pcm_status are written by the device. Once the stream is
+     * released, pending messages complete with whatever was captured.
+     */
+    uintptr_t base = (uintptr_t) vsnd->ram;
+    uint32_t stream_id = 0;
+    uint32_t filled = 0, wanted = 0;
+    for (uint32_t idx = 0;; idx++) {
+        if (desc_idx >= queue->QueueNum || idx >= queue->QueueNum)
+            return -1;
+        /* The size of the `struct virtq_desc` is 4 words */
+        const struct virtq_desc *desc =
+            (struct virtq_desc *) &vsnd->ram[queue->QueueDesc + desc_idx * 4];
+        uint32_t addr = desc->addr;
+        uint32_t len = desc->len;
+        bool last = !(desc->flags & VIRTIO_DESC_F_NEXT);
+        desc_idx = desc->next;
+
+        if (addr >= RAM_SIZE || len > RAM_SIZE - addr)
+            return -1;
+        if ((idx == 0 && len < sizeof(virtio_snd_pcm_xfer_t)) ||
+            (idx > 0 && last && len < sizeof(virtio_snd_pcm_status_t)))
+            return -1;
+
+        if (idx == 0) { /* the first descriptor */
+            const virtio_snd_pcm_xfer_t *request =
+                (virtio_snd_pcm_xfer_t *) (base + addr);
+            stream_id = request->stream_id;
+        } else if (last) { /* the last descriptor */
+            virtio_snd_pcm_status_t *response =
+                (virtio_snd_pcm_status_t *) (base + addr);
+            vsnd_pcm_ring_t *ring = &vsnd_props[VSND_STREAM_IN].ring;
+            response->status = stream_id == VSND_STREAM_IN
+                                   ? VIRTIO_SND_S_OK
+                                   : VIRTIO_SND_S_IO_ERR;
+            response->latency_bytes =
+                __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) - ring->tail;
+            *plen = filled + sizeof(*response);
+            break;
+        } else if (stream_id == VSND_STREAM_IN && filled == wanted) {
+            /* Keep the captured frames contiguous */
+            wanted += len;
+            filled += __virtio_snd_frame_read((void *) (base + addr), len,
+                                              stream_id);
+        }
+    }
+
+    return 0;
+}
+
 static void virtio_snd_set_fail(virtio_snd_state_t *vsnd)
 {
     uint32_t status = __atomic_fetch_or(
@@ -519,7 +614,7 @@ static void virtio_snd_read_jack_info_handler(
     const virtio_snd_query_info_t *query,
     uint32_t *plen)
 {
-    uint32_t cnt = query->count;
+    uint32_t cnt = MIN(query->count, VSND_STREAM_CNT);
     for (uint32_t i = 0; i < cnt; i++) {
         info[i].hdr.hda_fn_nid = 0;
         info[i].features = 0;
@@ -545,7 +640,7 @@ static void virtio_snd_read_pcm_info_handler(
     const virtio_snd_query_info_t *query,
     uint32_t *plen)
 {
-    uint32_t cnt = query->count;
+    uint32_t cnt = MIN(query->count, VSND_STREAM_CNT);
     for (uint32_t i = 0; i < cnt; i++) {
         info[i].hdr.hda_fn_nid = 0;
         info[i].features = 0;
@@ -555,7 +650,7 @@ static void virtio_snd_read_pcm_info_handler(
 #define _(rate) info[i].rates |= (1 << VIRTIO_SND_PCM_RATE_##rate);
         SND_PCM_RATE
 #undef _
-        info[i].direction = VIRTIO_SND_D_OUTPUT;
+        info[i].direction = vsnd_direction(i);
         info[i].channels_min = 1;
         info[i].channels_max = 1;
         memset(&info[i].padding, 0, sizeof(info[i].padding));
@@ -567,7 +662,7 @@ static void virtio_snd_read_pcm_info_handler(
 #define _(rate) props->p.rates |= (1 << VIRTIO_SND_PCM_RATE_##rate);
         SND_PCM_RATE
 #undef _
-        props->p.direction = VIRTIO_SND_D_OUTPUT;
+        props->p.direction = vsnd_direction(i);
         props->p.channels_min = 1;
         props->p.channels_max = 1;
         memset(&props->p.padding, 0, sizeof(props->p.padding));
@@ -580,16 +675,16 @@ static void virtio_snd_read_chmap_info_handler(
     const virtio_snd_query_info_t *query,
     uint32_t *plen)
 {
-    uint32_t cnt = query->count;
+    uint32_t cnt = MIN(query->count, VSND_STREAM_CNT);
     for (uint32_t i = 0; i < cnt; i++) {
         info[i].hdr.hda_fn_nid = 0;
-        info[i].direction = VIRTIO_SND_D_OUTPUT;
+        info[i].direction = vsnd_direction(i);
         info[i].channels = 1;
         info[i].positions[0] = VIRTIO_SND_CHMAP_MONO;
 
         virtio_snd_prop_t *props = &vsnd_props[i];
         props->c.hdr.hda_fn_nid = 0;
-        props->c.direction = VIRTIO_SND_D_OUTPUT;
+        props->c.direction = vsnd_direction(i);
         props->c.channels = 1;
         props->c.positions[0] = VIRTIO_SND_CHMAP_MONO;
     }
@@ -664,24 +759,19 @@ static void virtio_snd_read_pcm_prepare(const virtio_snd_pcm_hdr_t *query,
     /* Calculate the period size (in frames) for CNFA . */
     uint32_t cnfa_period_frames = cnfa_period_bytes / VSND_CNFA_FRAME_SZ;
 
-    INIT_LIST_HEAD(&props->buf_queue_head);
-    props->lock.releasing = 0;
-    props->lock.buf_ev_notify = 0;
-    PaStreamParameters params = {
-        .device = Pa_GetDefaultOutputDevice(),
-        .channelCount = props->pp.channels,
-        .sampleFormat = paInt16,
-        .suggestedLatency = 0.1, /* 100 ms */
-        .hostApiSpecificStreamInfo = NULL,
-    };
-    PaError err = Pa_OpenStream(&props->pa_stream, NULL, /* no input */
-                                &params, rate, cnfa_period_frames, paClipOff,
-                                virtio_snd_stream_cb, &props->v);
-    if (err != paNoError) {
-        fprintf(stderr, "Cannot create PortAudio\n");
-        printf("PortAudio error: %s\n", Pa_GetErrorText(err));
+    /* Hold up to one guest buffer worth of frames, so the host adds no more
+     * latency than the guest asked for.
+     */
+    uint32_t limit = 1;
+    while (limit < props->pp.buffer_bytes && limit < VSND_RING_SIZE)
+        limit <<= 1;
+    props->ring.limit = limit;
+    props->ring.head = props->ring.tail = 0;
+    props->bytes_per_sec = bps_rate;
+    memset(&props->stats, 0, sizeof(props->stats));
+    __atomic_store_n(&props->releasing, 0, __ATOMIC_RELEASE);
+    if (!vsnd_backend->open(props, rate, cnfa_period_frames))
         return;
-    }
 
     *plen = 0;
 }
@@ -703,12 +793,9 @@ static void virtio_snd_read_pcm_start(const virtio_snd_pcm_hdr_t *query,
 
     /* Control the callback to start playing */
     props->pp.hdr.hdr.code = VIRTIO_SND_R_PCM_START;
-    PaError err = Pa_StartStream(props->pa_stream);
-    if (err != paNoError) {
-        fprintf(stderr, "get error in pcm_start\n");
-        printf("PortAudio error: %s\n", Pa_GetErrorText(err));
+    props->stats.start_ns = vsnd_now_ns();
+    if (!vsnd_backend->start(props))
         return;
-    }
 
     *plen = 0;
 }
@@ -730,12 +817,8 @@ static void virtio_snd_read_pcm_stop(const virtio_snd_pcm_hdr_t *query,
 
     /* Control the callback to stop playing */
     props->pp.hdr.hdr.code = VIRTIO_SND_R_PCM_STOP;
-    PaError err = Pa_StopStream(props->pa_stream);
-    if (err != paNoError) {
-        fprintf(stderr, "get error in pcm_stop\n");
-        printf("PortAudio error: %s\n", Pa_GetErrorText(err));
-        return;
-    }
+    vsnd_backend->stop(props);
+    props->stats.run_ns += vsnd_now_ns() - props->stats.start_ns;
 
     *plen = 0;
 }
@@ -759,29 +842,10 @@ static void virtio_snd_read_pcm_release(const virtio_snd_pcm_hdr_t *query,
 
     props->pp.hdr.hdr.code = VIRTIO_SND_R_PCM_RELEASE;
 
-    /* Signal the release flag so enqueue/dequeue waiters bail out,
-     * then broadcast both condvars to wake any blocked threads.
-     */
-    pthread_mutex_lock(&props->lock.lock);
-    props->lock.releasing = 1;
-    pthread_cond_broadcast(&props->lock.readable);
-    pthread_cond_broadcast(&props->lock.writable);
-    pthread_mutex_unlock(&props->lock.lock);
-
-    vsnd_buf_queue_node_t *tmp = NULL;
-    vsnd_buf_queue_node_t *node;
-    if (!list_empty(&props->buf_queue_head)) {
-        list_for_each_entry_safe (node, tmp, &props->buf_queue_head, q) {
-            list_del(&node->q);
-            free(node);
-        }
-    }
+    /* Make an I/O thread waiting on the ring bail out */
+    __atomic_store_n(&props->releasing, 1, __ATOMIC_RELEASE);
 
-    PaError err = Pa_CloseStream(props->pa_stream);
-    if (err != paNoError) {
-        fprintf(stderr, "get error in pcm_release\n");
-        printf("PortAudio error: %s\n", Pa_GetErrorText(err));
-    }
+    vsnd_backend->close(props);
 
     /* virtio-v1.3-csd01, 5.14.6.6.5.1,
      * Device Requirements: Stream Release
@@ -791,51 +855,79 @@ static void virtio_snd_read_pcm_release(const virtio_snd_pcm_hdr_t *query,
      * - The device MUST NOT complete the control request while there
      *   are pending I/O messages for the specified stream ID.
      */
-    virtio_queue_notify_handler(vsnd, VSND_FLUSH_QUEUE | 0x2);
+    virtio_queue_notify_handler(
+        vsnd, VSND_FLUSH_QUEUE | (stream_id == VSND_STREAM_IN ? VSND_QUEUE_RX
+                                                              : VSND_QUEUE_TX));
 
     *plen = 0;
 }
 
-static void __virtio_snd_frame_dequeue(void *out,
-                                       uint32_t n,
-                                       uint32_t stream_id)
+/* Copy up to 'n' bytes out of 'ring' without blocking, returning the count */
+static uint32_t vsnd_ring_read(vsnd_pcm_ring_t *ring, void *out, uint32_t n)
 {
-    virtio_snd_prop_t *props = &vsnd_props[stream_id];
+    uint32_t tail = ring->tail;
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t len = MIN(n, head - tail);
+    uint32_t off = tail & (VSND_RING_SIZE - 1);
+    uint32_t first = MIN(len, VSND_RING_SIZE - off);
+
+    memcpy(out, ring->buf + off, first);
+    memcpy((uint8_t *) out + first, ring->buf, len - first);
+    __atomic_store_n(&ring->tail, tail + len, __ATOMIC_RELEASE);
+    return len;
+}
 
-    pthread_mutex_lock(&props->lock.lock);
-    while (props->lock.buf_ev_notify < 1 && !props->lock.releasing)
-        pthread_cond_wait(&props->lock.readable, &props->lock.lock);
+/* Copy up to 'n' bytes into 'ring' without blocking, returning the count */
+static uint32_t vsnd_ring_write(vsnd_pcm_ring_t *ring,
+                                const void *in,
+                                uint32_t n)
+{
+    uint32_t head = ring->head;
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint32_t len = MIN(n, ring->limit - (head - tail));
+    uint32_t off = head & (VSND_RING_SIZE - 1);
+    uint32_t first = MIN(len, VSND_RING_SIZE - off);
+
+    memcpy(ring->buf + off, in, first);
+    memcpy(ring->buf, (const uint8_t *) in + first, len - first);
+    __atomic_store_n(&ring->head, head + len, __ATOMIC_RELEASE);
+    return len;
+}
 
-    if (props->lock.releasing) {
-        pthread_mutex_unlock(&props->lock.lock);
-        memset(out, 0, n);
-        return;
-    }
+/* Sleep for roughly the time the host needs to move 'n' more bytes through
+ * the ring. Polling keeps the backend side free of any lock or condition
+ * variable.
+ */
+static void vsnd_ring_wait(const virtio_snd_prop_t *props, uint32_t n)
+{
+    uint64_t us = props->bytes_per_sec
+                      ? (uint64_t) n * 1000000 / props->bytes_per_sec
+                      : 0;
+    usleep(us < 1000 ? 1000 : MIN(us, 10000));
+}
 
-    /* Get the PCM frames from queue */
-    uint32_t written_bytes = 0;
-    while (!list_empty(&props->buf_queue_head) && written_bytes < n) {
-        vsnd_buf_queue_node_t *node =
-            list_first_entry(&props->buf_queue_head, vsnd_buf_queue_node_t, q);
-        uint32_t left = n - written_bytes;
-        uint32_t actual = node->len - node->pos;
-        uint32_t len =
-            left < actual ? left : actual; /* Naive min implementation */
-
-        memcpy(out + written_bytes, node->addr + node->pos, len);
-
-        written_bytes += len;
-        node->pos += len;
-        if (node->pos >= node->len) {
-            list_del(&node->q);
-            free(node->addr);
-            free(node);
-        }
+/* Move one host period of 'n' bytes between the ring of a stream and the
+ * backend. This runs on the backend thread, which must never block: playback
+ * pads a short ring with silence and capture drops what does not fit.
+ */
+static void vsnd_stream_period(virtio_snd_prop_t *props,
+                               const void *in,
+                               void *out,
+                               uint32_t n)
+{
+    uint32_t len;
+    if (props->v.stream_id == VSND_STREAM_IN) {
+        len = vsnd_ring_write(&props->ring, in, n);
+    } else {
+        len = vsnd_ring_read(&props->ring, out, n);
+        memset((uint8_t *) out + len, 0, n - len);
     }
 
-    props->lock.buf_ev_notify--;
-    pthread_cond_signal(&props->lock.writable);
-    pthread_mutex_unlock(&props->lock.lock);
+    props->stats.bytes += len;
+    if (len < n) {
+        props->stats.xruns++;
+        props->stats.xrun_bytes += n - len;
+    }
 }
 
 static int virtio_snd_stream_cb(const void *input,
@@ -850,11 +942,293 @@ static int virtio_snd_stream_cb(const void *input,
     int channels = vsnd_props[id].pp.channels;
     uint32_t out_buf_sz = frame_cnt * channels;
     uint32_t out_buf_bytes = out_buf_sz * VSND_CNFA_FRAME_SZ;
-    __virtio_snd_frame_dequeue(output, out_buf_bytes, id);
+    vsnd_stream_period(&vsnd_props[id], input, output, out_buf_bytes);
 
     return paContinue;
 }
 
+static bool vsnd_pa_open(virtio_snd_prop_t *props,
+                         uint32_t rate,
+                         uint32_t frames)
+{
+    bool input = props->v.stream_id == VSND_STREAM_IN;
+    PaStreamParameters params = {
+        .device =
+            input ? Pa_GetDefaultInputDevice() : Pa_GetDefaultOutputDevice(),
+        .channelCount = props->pp.channels,
+        .sampleFormat = paInt16,
+        .suggestedLatency = 0.1, /* 100 ms */
+        .hostApiSpecificStreamInfo = NULL,
+    };
+    PaError err = Pa_OpenStream(&props->pa_stream, input ? &params : NULL,
+                                input ? NULL : &params, rate, frames,
+                                paClipOff, virtio_snd_stream_cb, &props->v);
+    if (err != paNoError) {
+        fprintf(stderr, "Cannot create PortAudio\n");
+        printf("PortAudio error: %s\n", Pa_GetErrorText(err));
+        return false;
+    }
+    return true;
+}
+
+static bool vsnd_pa_start(virtio_snd_prop_t *props)
+{
+    PaError err = Pa_StartStream(props->pa_stream);
+    if (err != paNoError) {
+        fprintf(stderr, "get error in pcm_start\n");
+        printf("PortAudio error: %s\n", Pa_GetErrorText(err));
+        return false;
+    }
+    return true;
+}
+
+static void vsnd_pa_stop(virtio_snd_prop_t *props)
+{
+    PaError err = Pa_StopStream(props->pa_stream);
+    if (err != paNoError) {
+        fprintf(stderr, "get error in pcm_stop\n");
+        printf("PortAudio error: %s\n", Pa_GetErrorText(err));
+    }
+}
+
+static void vsnd_pa_close(virtio_snd_prop_t *props)
+{
+    PaError err = Pa_CloseStream(props->pa_stream);
+    if (err != paNoError) {
+        fprintf(stderr, "get error in pcm_release\n");
+        printf("PortAudio error: %s\n", Pa_GetErrorText(err));
+    }
+}
+
+/* Canonical 44-byte header of a 16-bit PCM WAV file */
+typedef struct {
+    char riff[4];
+    uint32_t riff_size;
+    char wave[4];
+    char fmt[4];
+    uint32_t fmt_size;
+    uint16_t format; /* 1: PCM */
+    uint16_t channels;
+    uint32_t rate;
+    uint32_t byte_rate;
+    uint16_t block_align;
+    uint16_t bits;
+    char data[4];
+    uint32_t data_size;
+} vsnd_wav_header_t;
+
+static void vsnd_wav_write_header(virtio_snd_prop_t *props)
+{
+    uint16_t channels = props->pp.channels;
+    vsnd_wav_header_t hdr = {
+        .riff = "RIFF",
+        .riff_size = 36 + props->file_bytes,
+        .wave = "WAVE",
+        .fmt = "fmt ",
+        .fmt_size = 16,
+        .format = 1,
+        .channels = channels,
+        .rate = props->bytes_per_sec / (channels * VSND_CNFA_FRAME_SZ),
+        .byte_rate = props->bytes_per_sec,
+        .block_align = channels * VSND_CNFA_FRAME_SZ,
+        .bits = VSND_CNFA_FRAME_SZ * 8,
+        .data = "data",
+        .data_size = props->file_bytes,
+    };
+    rewind(props->file);
+    fwrite(&hdr, sizeof(hdr), 1, props->file);
+}
+
+/* Position 'props->file' at the samples of a 16-bit PCM WAV file */
+static bool vsnd_wav_read_header(virtio_snd_prop_t *props, const char *path)
+{
+    char id[4];
+    uint32_t size;
+    uint16_t fmt[8]; /* format, channels, rate, byte rate, align, bits */
+    bool have_fmt = false;
+
+    if (fread(id, 4, 1, props->file) != 1 || memcmp(id, "RIFF", 4) ||
+        fread(&size, 4, 1, props->file) != 1 ||
+        fread(id, 4, 1, props->file) != 1 || memcmp(id, "WAVE", 4))
+        goto bad;
+
+    while (fread(id, 4, 1, props->file) == 1 &&
+           fread(&size, 4, 1, props->file) == 1) {
+        if (!memcmp(id, "data", 4)) {
+            if (!have_fmt)
+                break;
+            props->file_bytes = size;
+            return true;
+        }
+        if (!memcmp(id, "fmt ", 4) && size >= sizeof(fmt)) {
+            if (fread(fmt, sizeof(fmt), 1, props->file) != 1)
+                break;
+            if (fmt[0] != 1 || fmt[7] != VSND_CNFA_FRAME_SZ * 8) {
+                fprintf(stderr, "virtio-snd: '%s' is not 16-bit PCM\n", path);
+                return false;
+            }
+            uint32_t rate = fmt[2] | (uint32_t) fmt[3] << 16;
+            if (fmt[1] != props->pp.channels ||
+                rate * fmt[1] * VSND_CNFA_FRAME_SZ != props->bytes_per_sec)
+                fprintf(stderr,
+                        "virtio-snd: '%s' has %u channel(s) at %" PRIu32
+                        " Hz, feeding it unconverted\n",
+                        path, fmt[1], rate);
+            have_fmt = true;
+            size -= sizeof(fmt);
+        }
+        /* Chunks are padded to an even size */
+        if (fseek(props->file, size + (size & 1), SEEK_CUR))
+            break;
+    }
+
+bad:
+    fprintf(stderr, "virtio-snd: '%s' is not a WAV file\n", path);
+    return false;
+}
+
+static void vsnd_report(const virtio_snd_prop_t *props)
+{
+    const vsnd_stats_t *st = &props->stats;
+    double audio =
+        props->bytes_per_sec ? (double) st->bytes / props->bytes_per_sec : 0;
+    fprintf(stderr,
+            "virtio-snd: %s stream %" PRIu32 " (%s): %.3f s of audio in %.3f "
+            "s, %" PRIu64 " xruns (%" PRIu64
+            " bytes), worst tick %.3f ms late\n",
+            props->v.stream_id == VSND_STREAM_IN ? "capture" : "playback",
+            props->v.stream_id, vsnd_backend->name, audio, st->run_ns / 1e9,
+            st->xruns, st->xrun_bytes, st->max_late_ns / 1e6);
+}
+
+#define VSND_CLOCK_HZ 100 /* ticks per second of the null and file backends */
+
+/* Stand-in for a device clock: every tick, move as many frames as the
+ * stream's rate has made due since START, so late ticks do not make the
+ * stream drift.
+ */
+static void *vsnd_clock_thread(void *arg)
+{
+    virtio_snd_prop_t *props = arg;
+    bool input = props->v.stream_id == VSND_STREAM_IN;
+    uint32_t frame_bytes = props->pp.channels * VSND_CNFA_FRAME_SZ;
+    uint64_t frame_rate = props->bytes_per_sec / frame_bytes;
+    /* A late tick catches up by at most a few periods at once */
+    uint32_t max_frames = 4 * frame_rate / VSND_CLOCK_HZ + 1;
+    uint8_t *buf = malloc(max_frames * frame_bytes);
+    if (!buf) {
+        fprintf(stderr, "virtio-snd: cannot allocate the clock buffer\n");
+        return NULL;
+    }
+
+    uint64_t start = vsnd_now_ns(), done = 0;
+    for (uint64_t tick = 1;
+         __atomic_load_n(&props->running, __ATOMIC_ACQUIRE); tick++) {
+        uint64_t due = start + tick * (1000000000ULL / VSND_CLOCK_HZ);
+        uint64_t now = vsnd_now_ns();
+        if (now < due) {
+            struct timespec ts = {
+                .tv_sec = (due - now) / 1000000000ULL,
+                .tv_nsec = (due - now) % 1000000000ULL,
+            };
+            nanosleep(&ts, NULL);
+            now = vsnd_now_ns();
+        }
+        if (now - due > props->stats.max_late_ns)
+            props->stats.max_late_ns = now - due;
+
+        uint64_t frames = (now - start) * frame_rate / 1000000000ULL - done;
+        frames = MIN(frames, max_frames);
+        done += frames;
+        uint32_t n = frames * frame_bytes;
+
+        if (input) {
+            /* Past the end of the WAV data, or without a file, capture
+             * silence.
+             */
+            uint32_t len = 0;
+            if (props->file)
+                len = fread(buf, 1, MIN(n, props->file_bytes), props->file);
+            props->file_bytes -= len;
+            memset(buf + len, 0, n - len);
+            vsnd_stream_period(props, buf, NULL, n);
+        } else {
+            vsnd_stream_period(props, NULL, buf, n);
+            if (props->file && fwrite(buf, 1, n, props->file) == n)
+                props->file_bytes += n;
+        }
+    }
+
+    free(buf);
+    return NULL;
+}
+
+static bool vsnd_clock_open(virtio_snd_prop_t *props,
+                            uint32_t rate,
+                            uint32_t frames)
+{
+    bool input = props->v.stream_id == VSND_STREAM_IN;
+    const char *path = input ? vsnd_in_path : vsnd_out_path;
+    props->file = NULL;
+    props->file_bytes = 0;
+    if (!path)
+        return true;
+
+    /* Every PREPARE restarts the input file and rewrites the output file */
+    props->file = fopen(path, input ? "rb" : "w+b");
+    if (!props->file) {
+        fprintf(stderr, "virtio-snd: cannot open '%s': %s\n", path,
+                strerror(errno));
+        return false;
+    }
+    if (input ? !vsnd_wav_read_header(props, path)
+              : (vsnd_wav_write_header(props), false)) {
+        fclose(props->file);
+        props->file = NULL;
+        return false;
+    }
+    return true;
+}
+
+static bool vsnd_clock_start(virtio_snd_prop_t *props)
+{
+    __atomic_store_n(&props->running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&props->clock, NULL, vsnd_clock_thread, props) != 0) {
+        fprintf(stderr, "virtio-snd: cannot create the clock thread\n");
+        props->running = 0;
+        return false;
+    }
+    return true;
+}
+
+static void vsnd_clock_stop(virtio_snd_prop_t *props)
+{
+    if (!__atomic_exchange_n(&props->running, 0, __ATOMIC_ACQ_REL))
+        return;
+    pthread_join(props->clock, NULL);
+}
+
+static void vsnd_clock_close(virtio_snd_prop_t *props)
+{
+    vsnd_clock_stop(props);
+    vsnd_report(props);
+    if (!props->file)
+        return;
+
+    if (props->v.stream_id != VSND_STREAM_IN)
+        vsnd_wav_write_header(props);
+    fclose(props->file);
+    props->file = NULL;
+}
+
+static const vsnd_backend_t vsnd_backends[] = {
+    {"portaudio", vsnd_pa_open, vsnd_pa_start, vsnd_pa_stop, vsnd_pa_close},
+    {"null", vsnd_clock_open, vsnd_clock_start, vsnd_clock_stop,
+     vsnd_clock_close},
+    {"file", vsnd_clock_open, vsnd_clock_start, vsnd_clock_stop,
+     vsnd_clock_close},
+};
+
 #define VSND_DESC_CNT 3
 static int virtio_snd_ctrl_desc_handler(virtio_snd_state_t *vsnd,
                                         const virtio_snd_queue_t *queue,
@@ -900,6 +1274,14 @@ static int virtio_snd_ctrl_desc_handler(virtio_snd_state_t *vsnd,
      */
     void *info = (void *) (uintptr_t) vsnd->ram + vq_desc[2].addr;
 
+    /* PCM stream requests start with struct virtio_snd_pcm_hdr */
+    if (type >= VIRTIO_SND_R_PCM_SET_PARAMS && type <= VIRTIO_SND_R_PCM_STOP &&
+        ((const virtio_snd_pcm_hdr_t *) query)->stream_id >= VSND_STREAM_CNT) {
+        response->code = VIRTIO_SND_S_BAD_MSG;
+        *plen = 0;
+        return 0;
+    }
+
     /* Process the data */
     switch (type) {
     case VIRTIO_SND_R_JACK_INFO:
@@ -947,11 +1329,11 @@ static vsnd_virtq_cb __virtio_snd_queue_op_tbl[8] = {
     virtio_snd_ctrl_desc_handler, /* control queue */
     NULL,                         /* event queue */
     virtio_snd_tx_desc_handler,   /* TX queue */
-    NULL,                         /* RX queue */
+    virtio_snd_rx_desc_handler,   /* RX queue */
     NULL, /* no need to flush control queue, so trigger a failed null check */
     NULL, /* no need to flush event queue, so trigger a failed null check */
     virtio_snd_io_desc_flush_handler, /* flush TX queue */
-    NULL,                             /* flush RX queue */
+    virtio_snd_rx_desc_handler, /* a released stream completes at once */
 };
 
 static void __virtio_snd_frame_enqueue(void *payload,
@@ -959,43 +1341,57 @@ static void __virtio_snd_frame_enqueue(void *payload,
                                        uint32_t stream_id)
 {
     virtio_snd_prop_t *props = &vsnd_props[stream_id];
+    const uint8_t *src = payload;
 
-    pthread_mutex_lock(&props->lock.lock);
-    while (props->lock.buf_ev_notify > 0 && !props->lock.releasing)
-        pthread_cond_wait(&props->lock.writable, &props->lock.lock);
-
-    if (props->lock.releasing) {
-        pthread_mutex_unlock(&props->lock.lock);
-        return;
-    }
-
-    /* Add a PCM frame to queue */
-    /* As stated in Linux Kernel mailing list [1], we keep the pointer
-     * points to the payload [2] so that we can always get up-to-date
-     * contents of PCM frames.
+    /* Copy the PCM frames into the ring before the buffer is returned to the
+     * guest. As stated in Linux Kernel mailing list [1], the payload may be
+     * rewritten once the request completes [2].
      * References:
      * [1] https://lore.kernel.org/all/ZQHPeD0fds9sYzHO@pc-79.home/T/
      * [2]
      * https://github.com/rust-vmm/vhost-device/blob/eb2e2227e41d48a52e4e6346189b772c5363879d/staging/vhost-device-sound/src/device.rs#L554
      */
-    vsnd_buf_queue_node_t *node = malloc(sizeof(*node));
-    if (!node)
-        goto tx_frame_enqueue_final;
-    node->addr = malloc(sizeof(*node->addr) * n);
-    if (!node->addr) {
-        free(node);
-        goto tx_frame_enqueue_final;
+    while (n > 0) {
+        if (__atomic_load_n(&props->releasing, __ATOMIC_ACQUIRE))
+            return;
+
+        uint32_t len = vsnd_ring_write(&props->ring, src, n);
+        if (!len) {
+            vsnd_ring_wait(props, n);
+            continue;
+        }
+        src += len;
+        n -= len;
     }
-    memcpy(node->addr, payload, n);
-    node->len = n;
-    node->pos = 0;
-    list_push(&node->q, &props->buf_queue_head);
+}
+
+/* Fill 'payload' with captured frames, waiting for the backend to produce
+ * them. Returns the number of bytes filled, which falls short only once the
+ * stream is released.
+ */
+static uint32_t __virtio_snd_frame_read(void *payload,
+                                        uint32_t n,
+                                        uint32_t stream_id)
+{
+    virtio_snd_prop_t *props = &vsnd_props[stream_id];
+    uint32_t filled = 0;
+
+    while (filled < n) {
+        if (__atomic_load_n(&props->releasing, __ATOMIC_ACQUIRE))
+            break;
 
-tx_frame_enqueue_final:
-    pthread_mutex_unlock(&props->lock.lock);
+        uint32_t len = vsnd_ring_read(&props->ring,
+                                      (uint8_t *) payload + filled, n - filled);
+        if (!len) {
+            vsnd_ring_wait(props, n - filled);
+            continue;
+        }
+        filled += len;
+    }
+    return filled;
 }
 
-static void virtio_queue_notify_handler(virtio_snd_state_t *vsnd, int index)
+static void __virtio_queue_notify_handler(virtio_snd_state_t *vsnd, int index)
 {
     uint32_t *ram = vsnd->ram;
     virtio_snd_queue_t *queue = &vsnd->queues[index & 0x03];
@@ -1049,32 +1445,45 @@ static void virtio_queue_notify_handler(virtio_snd_state_t *vsnd, int index)
         ram[vq_used_addr + 1] = len;    /* virtq_used_elem.len (le32) */
         queue->last_avail++;
         new_used++;
-    }
 
-    /* Check le32 len field of struct virtq_used_elem on the spec  */
-    vsnd->ram[queue->QueueUsed] &= MASK(16); /* Reset low 16 bits to zero */
-    vsnd->ram[queue->QueueUsed] |= ((uint32_t) new_used) << 16; /* len */
+        /* Complete each message on its own: PCM I/O may have waited for the
+         * host, and the guest should not wait for the rest of the batch.
+         */
+        /* Check le32 len field of struct virtq_used_elem on the spec  */
+        vsnd->ram[queue->QueueUsed] &= MASK(16); /* Reset low 16 bits to zero */
+        vsnd->ram[queue->QueueUsed] |= ((uint32_t) new_used) << 16; /* len */
 
-    /* Publish used-ring writes before making the IRQ visible to the guest. */
-    if (!(ram[queue->QueueAvail] & 1))
-        __atomic_fetch_or(&vsnd->InterruptStatus, VIRTIO_INT__USED_RING,
-                          __ATOMIC_RELEASE);
+        /* Publish used-ring writes before making the IRQ visible to the
+         * guest.
+         */
+        if (!(ram[queue->QueueAvail] & 1))
+            __atomic_fetch_or(&vsnd->InterruptStatus, VIRTIO_INT__USED_RING,
+                              __ATOMIC_RELEASE);
+    }
 }
 
-/* TX thread context */
-/* Receive PCM frames from driver. */
+static void virtio_queue_notify_handler(virtio_snd_state_t *vsnd, int index)
+{
+    pthread_mutex_t *lock = &vsnd_queue_locks[index & 0x03];
+    pthread_mutex_lock(lock);
+    __virtio_queue_notify_handler(vsnd, index);
+    pthread_mutex_unlock(lock);
+}
+
+/* TX and RX thread context */
+/* Exchange PCM frames with driver. */
 static void *func(void *args)
 {
-    virtio_snd_state_t *vsnd = (virtio_snd_state_t *) args;
+    vsnd_io_thread_t *io = (vsnd_io_thread_t *) args;
     for (;;) {
         pthread_mutex_lock(&virtio_snd_mutex);
-        while (tx_ev_notify <= 0)
-            pthread_cond_wait(&virtio_snd_tx_cond, &virtio_snd_mutex);
+        while (io->ev_notify <= 0)
+            pthread_cond_wait(&io->cond, &virtio_snd_mutex);
 
-        tx_ev_notify--;
+        io->ev_notify--;
         pthread_mutex_unlock(&virtio_snd_mutex);
 
-        virtio_queue_notify_handler(vsnd, 2);
+        virtio_queue_notify_handler(io->vsnd, io->queue);
     }
     pthread_exit(NULL);
 }
@@ -1189,11 +1598,14 @@ static bool virtio_snd_reg_write(virtio_snd_state_t *vsnd,
                 virtio_queue_notify_handler(vsnd, value);
                 break;
             case VSND_QUEUE_TX:
+            case VSND_QUEUE_RX: {
+                vsnd_io_thread_t *io = &vsnd_io_threads[value - VSND_QUEUE_TX];
                 pthread_mutex_lock(&virtio_snd_mutex);
-                tx_ev_notify++;
-                pthread_cond_signal(&virtio_snd_tx_cond);
+                io->ev_notify++;
+                pthread_cond_signal(&io->cond);
                 pthread_mutex_unlock(&virtio_snd_mutex);
                 break;
+            }
             default:
                 fprintf(stderr, "value %d not supported\n", value);
                 return false;
@@ -1266,7 +1678,50 @@ void virtio_snd_write(hart_t *vm,
     }
 }
 
-bool virtio_snd_init(virtio_snd_state_t *vsnd)
+/* "portaudio", "null", or "file[,in=capture.wav][,out=playback.wav]" */
+static bool vsnd_parse_backend(const char *spec)
+{
+    char *name = strdup(spec ? spec : vsnd_backends[0].name);
+    if (!name) {
+        fprintf(stderr, "Failed to allocate memory for audio backend\n");
+        return false;
+    }
+    char *opts = strchr(name, ',');
+    if (opts)
+        *opts++ = '\0';
+
+    vsnd_backend = NULL;
+    for (size_t i = 0; i < ARRAY_SIZE(vsnd_backends); i++) {
+        if (!strcmp(name, vsnd_backends[i].name))
+            vsnd_backend = &vsnd_backends[i];
+    }
+    if (!vsnd_backend) {
+        fprintf(stderr, "unsupported audio backend '%s'\n", name);
+        return false;
+    }
+
+    char *save = NULL;
+    for (char *opt = opts ? strtok_r(opts, ",", &save) : NULL; opt;
+         opt = strtok_r(NULL, ",", &save)) {
+        char *val = strchr(opt, '=');
+        if (!val || !val[1] || strcmp(vsnd_backend->name, "file")) {
+            fprintf(stderr, "unsupported audio backend option '%s'\n", opt);
+            return false;
+        }
+        *val++ = '\0';
+        if (!strcmp(opt, "in")) {
+            vsnd_in_path = val;
+        } else if (!strcmp(opt, "out")) {
+            vsnd_out_path = val;
+        } else {
+            fprintf(stderr, "unsupported audio backend option '%s'\n", opt);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool virtio_snd_init(virtio_snd_state_t *vsnd, const char *backend)
 {
     if (vsnd_dev_cnt >= VSND_DEV_CNT_MAX) {
         fprintf(stderr,
@@ -1279,17 +1734,40 @@ bool virtio_snd_init(virtio_snd_state_t *vsnd)
     vsnd->priv = &vsnd_configs[vsnd_dev_cnt++];
 
     PRIV(vsnd)->jacks = 1;
-    PRIV(vsnd)->streams = 1;
-    PRIV(vsnd)->chmaps = 1;
+    PRIV(vsnd)->streams = VSND_STREAM_CNT;
+    PRIV(vsnd)->chmaps = VSND_STREAM_CNT;
     PRIV(vsnd)->controls =
         0; /* virtio-snd device does not support control elements */
 
-    tx_ev_notify = 0;
-    pthread_t tid;
-    if (pthread_create(&tid, NULL, func, vsnd) != 0) {
-        fprintf(stderr, "cannot create TX thread\n");
-        return false;
+    if (!vsnd_parse_backend(backend))
+        exit(2);
+
+    for (int i = 0; i < VSND_STREAM_CNT; i++) {
+        vsnd_props[i].v.stream_id = i;
+        if (!vsnd_props[i].ring.buf)
+            vsnd_props[i].ring.buf = malloc(VSND_RING_SIZE);
+        if (!vsnd_props[i].ring.buf) {
+            fprintf(stderr, "Failed to allocate PCM ring buffer\n");
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < ARRAY_SIZE(vsnd_io_threads); i++) {
+        vsnd_io_thread_t *io = &vsnd_io_threads[i];
+        io->vsnd = vsnd;
+        io->ev_notify = 0;
+        pthread_t tid;
+        if (pthread_create(&tid, NULL, func, io) != 0) {
+            fprintf(stderr, "cannot create %s thread\n",
+                    io->queue == VSND_QUEUE_TX ? "TX" : "RX");
+            return false;
+        }
     }
+
+    /* The null and file backends work without any audio hardware */
+    if (vsnd_backend->open != vsnd_pa_open)
+        return true;
+
     /* Initialize PortAudio */
     PaError err = Pa_Initialize();
     if (err != paNoError) {
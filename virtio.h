@@ -33,17 +33,40 @@
 #define FUSE_READDIRPLUS 44
 #define FUSE_LOOKUP 1
 #define FUSE_FORGET 2
+#define FUSE_READLINK 5
 #define FUSE_RELEASEDIR 29
 #define FUSE_OPEN 14
 #define FUSE_READ 15
 #define FUSE_RELEASE 18
 #define FUSE_FLUSH 25
 #define FUSE_DESTROY 38
-/* TODO OP codes are below: */
+#define FUSE_SETATTR 4
 #define FUSE_MKDIR 9
-#define FUSE_WRITE 16
+#define FUSE_UNLINK 10
 #define FUSE_RMDIR 11
+#define FUSE_RENAME 12
+#define FUSE_WRITE 16
 #define FUSE_CREATE 35
+#define FUSE_SETUPMAPPING 48
+#define FUSE_REMOVEMAPPING 49
+
+/* Notification codes, sent in the 'error' field of a reply with 'unique' 0 */
+#define FUSE_NOTIFY_INVAL_INODE 2
+#define FUSE_NOTIFY_INVAL_ENTRY 3
+
+#define FUSE_SETUPMAPPING_FLAG_WRITE (1 << 0)
+#define FUSE_SETUPMAPPING_FLAG_READ (1 << 1)
+
+/* Valid fields of 'struct fuse_setattr_in' */
+#define FATTR_MODE (1 << 0)
+#define FATTR_UID (1 << 1)
+#define FATTR_GID (1 << 2)
+#define FATTR_SIZE (1 << 3)
+#define FATTR_ATIME (1 << 4)
+#define FATTR_MTIME (1 << 5)
+#define FATTR_FH (1 << 6)
+#define FATTR_ATIME_NOW (1 << 7)
+#define FATTR_MTIME_NOW (1 << 8)
 
 #define FUSE_ASYNC_READ (1 << 0)
 #define FUSE_POSIX_LOCKS (1 << 1)
@@ -70,6 +93,8 @@
 #define FUSE_MAX_PAGES (1 << 22)
 #define FUSE_CACHE_SYMLINKS (1 << 23)
 #define FUSE_NO_OPENDIR_SUPPORT (1 << 24)
+#define FUSE_EXPLICIT_INVAL_DATA (1 << 25)
+#define FUSE_MAP_ALIGNMENT (1 << 26)
 
 /* VirtIO MMIO registers */
 #define VIRTIO_REG_LIST                  \
@@ -0,0 +1,498 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "vgpu-display.h"
+#include "virtio-gpu.h"
+#if SEMU_HAS(VIRTIOINPUT)
+#include "virtio-input-event.h"
+#endif
+#include "window.h"
+
+#define WINDOW_LOG_PREFIX "[SEMU WINDOW] "
+
+/* With nothing else to wait on, poll the display bridge this often while it
+ * is empty. Frames are timestamped when published, so the polling delay shows
+ * up in the reported latency rather than hiding in it.
+ */
+#define HEADLESS_POLL_US 1000
+
+enum headless_dump_format {
+    HEADLESS_DUMP_NONE = 0,
+    HEADLESS_DUMP_PNG,
+    HEADLESS_DUMP_RAW,
+};
+
+/* Consumer-side state for one scanout. The display bridge only carries the
+ * damaged rows of each frame, so the sink keeps its own copy of the whole
+ * primary plane, like the SDL backend keeps a texture.
+ */
+struct headless_scanout {
+    uint8_t *fb; /* B8G8R8X8, 'width * 4' bytes per row */
+    uint32_t width;
+    uint32_t height;
+
+    uint64_t frames;         /* primary frames applied */
+    uint64_t rejected;       /* partial frames without a full one to patch */
+    uint64_t bytes;          /* pixel bytes copied out of payloads */
+    uint64_t latency_ns;     /* sum of publish-to-apply delays */
+    uint64_t max_latency_ns; /* worst publish-to-apply delay */
+    uint64_t first_ns;       /* publish time of the first frame */
+    uint64_t last_ns;        /* publish time of the latest frame */
+    uint64_t cursor_updates;
+    uint64_t cursor_moves;
+    uint64_t clears;
+    uint64_t dumped;
+};
+
+static struct headless_scanout headless_scanouts[VIRTIO_GPU_MAX_SCANOUTS];
+
+static enum headless_dump_format headless_dump;
+static const char *headless_dump_dir = "frames";
+static uint32_t headless_dump_every = 1;
+static bool headless_dump_failed;
+
+static int wake_write_fd = -1;
+static bool should_exit = false;
+
+/* "stats" or "dump[,dir=frames][,format=png|raw][,every=1]" */
+bool window_headless_configure(const char *spec)
+{
+    char *mode = strdup(spec);
+    if (!mode) {
+        fprintf(stderr, "Failed to allocate memory for frame sink options\n");
+        return false;
+    }
+    char *opts = strchr(mode, ',');
+    if (opts)
+        *opts++ = '\0';
+
+    if (!strcmp(mode, "stats")) {
+        headless_dump = HEADLESS_DUMP_NONE;
+    } else if (!strcmp(mode, "dump")) {
+        headless_dump = HEADLESS_DUMP_PNG;
+    } else {
+        fprintf(stderr, "unsupported frame sink '%s'\n", mode);
+        return false;
+    }
+
+    char *save = NULL;
+    for (char *opt = opts ? strtok_r(opts, ",", &save) : NULL; opt;
+         opt = strtok_r(NULL, ",", &save)) {
+        char *val = strchr(opt, '=');
+        if (!val || !val[1] || headless_dump == HEADLESS_DUMP_NONE) {
+            fprintf(stderr, "unsupported frame sink option '%s'\n", opt);
+            return false;
+        }
+        *val++ = '\0';
+        if (!strcmp(opt, "dir")) {
+            headless_dump_dir = val;
+        } else if (!strcmp(opt, "format") && !strcmp(val, "png")) {
+            headless_dump = HEADLESS_DUMP_PNG;
+        } else if (!strcmp(opt, "format") && !strcmp(val, "raw")) {
+            headless_dump = HEADLESS_DUMP_RAW;
+        } else if (!strcmp(opt, "every")) {
+            char *end;
+            unsigned long every = strtoul(val, &end, 10);
+            if (*end || every == 0 || every > UINT32_MAX) {
+                fprintf(stderr, "invalid frame sink option 'every=%s'\n", val);
+                return false;
+            }
+            headless_dump_every = (uint32_t) every;
+        } else {
+            fprintf(stderr, "unsupported frame sink option '%s=%s'\n", opt,
+                    val);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* PNG output is written without compression, so it needs neither zlib nor
+ * much CPU: the image data goes into stored deflate blocks, and only the
+ * CRC-32 and Adler-32 checksums have to be computed.
+ */
+static uint32_t headless_crc32_table[256];
+
+static void headless_crc32_init(void)
+{
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++)
+            c = (c & 1) ? 0xedb88320U ^ (c >> 1) : c >> 1;
+        headless_crc32_table[i] = c;
+    }
+}
+
+static uint32_t headless_crc32(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++)
+        crc = headless_crc32_table[(crc ^ buf[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+static void headless_put_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t) (v >> 24);
+    p[1] = (uint8_t) (v >> 16);
+    p[2] = (uint8_t) (v >> 8);
+    p[3] = (uint8_t) v;
+}
+
+/* Write one PNG chunk; 'data' may be NULL when 'len' is 0. */
+static bool headless_png_chunk(FILE *file,
+                               const char *type,
+                               const uint8_t *data,
+                               uint32_t len)
+{
+    uint8_t hdr[8];
+    headless_put_be32(hdr, len);
+    memcpy(hdr + 4, type, 4);
+    uint32_t crc = headless_crc32(0, hdr + 4, 4);
+    if (len)
+        crc = headless_crc32(crc, data, len);
+
+    uint8_t trailer[4];
+    headless_put_be32(trailer, crc);
+    return fwrite(hdr, sizeof(hdr), 1, file) == 1 &&
+           (!len || fwrite(data, len, 1, file) == 1) &&
+           fwrite(trailer, sizeof(trailer), 1, file) == 1;
+}
+
+/* Serialize the plane as 8-bit RGB. The zlib stream is built in memory,
+ * since every row of the image must be converted from B8G8R8X8 anyway.
+ */
+static bool headless_write_png(FILE *file, const struct headless_scanout *s)
+{
+    static const uint8_t signature[8] = {0x89, 'P',  'N',  'G',
+                                         '\r', '\n', 0x1a, '\n'};
+    size_t row_bytes = 1 + (size_t) s->width * 3; /* filter byte + RGB */
+    size_t raw_size = row_bytes * s->height;
+    size_t blocks = (raw_size + 0xfffe) / 0xffff;
+    size_t zlib_size = 2 + raw_size + blocks * 5 + 4;
+    if (zlib_size > UINT32_MAX)
+        return false;
+
+    uint8_t *zlib = malloc(zlib_size);
+    if (!zlib)
+        return false;
+
+    /* Stored deflate blocks hold at most 65535 bytes each, so a row may span
+     * two of them. Convert all rows first, then cut them into blocks.
+     */
+    uint8_t *raw = malloc(raw_size);
+    if (!raw) {
+        free(zlib);
+        return false;
+    }
+    for (uint32_t y = 0; y < s->height; y++) {
+        uint8_t *dst = raw + y * row_bytes;
+        const uint8_t *src = s->fb + (size_t) y * s->width * 4;
+        *dst++ = 0; /* filter type None */
+        for (uint32_t x = 0; x < s->width; x++, src += 4) {
+            *dst++ = src[2];
+            *dst++ = src[1];
+            *dst++ = src[0];
+        }
+    }
+
+    uint8_t *p = zlib;
+    *p++ = 0x78; /* deflate, 32 KiB window */
+    *p++ = 0x01; /* no preset dictionary, fastest; (0x78 << 8 | 1) % 31 == 0 */
+    uint32_t a = 1, b = 0;
+    for (size_t off = 0; off < raw_size;) {
+        size_t len = MIN(raw_size - off, (size_t) 0xffff);
+        *p++ = off + len == raw_size; /* BFINAL, BTYPE = stored */
+        *p++ = (uint8_t) len;
+        *p++ = (uint8_t) (len >> 8);
+        *p++ = (uint8_t) ~len;
+        *p++ = (uint8_t) (~len >> 8);
+        memcpy(p, raw + off, len);
+        for (size_t i = 0; i < len; i++) {
+            a = (a + p[i]) % 65521U;
+            b = (b + a) % 65521U;
+        }
+        p += len;
+        off += len;
+    }
+    headless_put_be32(p, b << 16 | a);
+    free(raw);
+
+    uint8_t ihdr[13];
+    headless_put_be32(ihdr, s->width);
+    headless_put_be32(ihdr + 4, s->height);
+    ihdr[8] = 8;  /* bit depth */
+    ihdr[9] = 2;  /* color type RGB */
+    ihdr[10] = 0; /* compression */
+    ihdr[11] = 0; /* filter */
+    ihdr[12] = 0; /* no interlace */
+
+    bool ok = fwrite(signature, sizeof(signature), 1, file) == 1 &&
+              headless_png_chunk(file, "IHDR", ihdr, sizeof(ihdr)) &&
+              headless_png_chunk(file, "IDAT", zlib, (uint32_t) zlib_size) &&
+              headless_png_chunk(file, "IEND", NULL, 0);
+    free(zlib);
+    return ok;
+}
+
+/* Dump the composed primary plane of scanout 'id'. Errors are reported once
+ * and stop further dumps, but not the frame accounting.
+ */
+static void headless_dump_frame(uint32_t id, struct headless_scanout *s)
+{
+    if (headless_dump == HEADLESS_DUMP_NONE || headless_dump_failed ||
+        (s->frames - 1) % headless_dump_every)
+        return;
+
+    char path[4096];
+    if (headless_dump == HEADLESS_DUMP_PNG)
+        snprintf(path, sizeof(path), "%s/scanout%" PRIu32 "-%06" PRIu64 ".png",
+                 headless_dump_dir, id, s->frames);
+    else
+        snprintf(path, sizeof(path),
+                 "%s/scanout%" PRIu32 "-%06" PRIu64 "-%" PRIu32 "x%" PRIu32
+                 ".bgrx",
+                 headless_dump_dir, id, s->frames, s->width, s->height);
+
+    FILE *file = fopen(path, "wb");
+    bool ok = file != NULL;
+    if (ok && headless_dump == HEADLESS_DUMP_PNG)
+        ok = headless_write_png(file, s);
+    else if (ok)
+        ok = fwrite(s->fb, (size_t) s->width * 4, s->height, file) == s->height;
+    if (file && fclose(file) != 0)
+        ok = false;
+
+    if (!ok) {
+        fprintf(stderr,
+                WINDOW_LOG_PREFIX "%s(): cannot write '%s': %s; frame dumps "
+                                  "stopped\n",
+                __func__, path, strerror(errno));
+        headless_dump_failed = true;
+        return;
+    }
+    s->dumped++;
+}
+
+/* Patch the damaged rows of a primary frame into the retained plane. A frame
+ * of a new size must cover the whole plane, otherwise a full one is requested
+ * from the GPU backend, exactly as the SDL backend does when it has to
+ * recreate its texture.
+ */
+static bool headless_apply_primary(struct headless_scanout *s,
+                                   const struct vgpu_display_cpu_payload *frame)
+{
+    const struct vgpu_display_rect *damage = &frame->damage;
+
+    if (frame->width != s->width || frame->height != s->height || !s->fb) {
+        if (damage->x != 0 || damage->y != 0 ||
+            damage->width != frame->width || damage->height != frame->height)
+            return false;
+
+        uint8_t *fb = malloc((size_t) frame->width * frame->height * 4);
+        if (!fb) {
+            fprintf(stderr,
+                    WINDOW_LOG_PREFIX "%s(): out of memory for %ux%u plane\n",
+                    __func__, frame->width, frame->height);
+            return false;
+        }
+        free(s->fb);
+        s->fb = fb;
+        s->width = frame->width;
+        s->height = frame->height;
+    }
+
+    size_t row_bytes = (size_t) damage->width * 4;
+    for (uint32_t y = 0; y < damage->height; y++) {
+        memcpy(s->fb + ((size_t) damage->y + y) * s->width * 4 +
+                   (size_t) damage->x * 4,
+               frame->pixels + (size_t) y * frame->stride, row_bytes);
+    }
+    s->bytes += row_bytes * damage->height;
+    return true;
+}
+
+static void window_set_wake_fd_headless(int fd)
+{
+    wake_write_fd = fd;
+}
+
+static void window_wake_backend_headless(void)
+{
+    if (wake_write_fd >= 0) {
+        char byte = 1;
+        ssize_t bytes_written = write(wake_write_fd, &byte, 1);
+        (void) bytes_written;
+    }
+}
+
+static void headless_drain_display_queue(void)
+{
+    struct vgpu_display_cmd cmd;
+
+    while (vgpu_display_pop_cmd(&cmd)) {
+        struct headless_scanout *s = &headless_scanouts[cmd.scanout_id];
+
+        switch (cmd.type) {
+        case VGPU_DISPLAY_CMD_PRIMARY_CLEAR:
+            free(s->fb);
+            s->fb = NULL;
+            s->width = s->height = 0;
+            s->clears++;
+            break;
+        case VGPU_DISPLAY_CMD_CURSOR_CLEAR:
+            s->clears++;
+            break;
+        case VGPU_DISPLAY_CMD_PRIMARY_SET: {
+            if (!headless_apply_primary(s, &cmd.u.primary_set.payload->cpu)) {
+                s->rejected++;
+                vgpu_display_request_primary_refresh(cmd.scanout_id);
+                window_wake_backend_headless();
+                break;
+            }
+
+#if SEMU_HAS(VIRTIOINPUT)
+            vinput_script_note_frame(cmd.publish_ns);
+#endif
+            uint64_t latency = vgpu_display_now_ns() - cmd.publish_ns;
+            if (!s->frames)
+                s->first_ns = cmd.publish_ns;
+            s->last_ns = cmd.publish_ns;
+            s->frames++;
+            s->latency_ns += latency;
+            if (latency > s->max_latency_ns)
+                s->max_latency_ns = latency;
+            headless_dump_frame(cmd.scanout_id, s);
+            break;
+        }
+        case VGPU_DISPLAY_CMD_CURSOR_SET:
+            s->cursor_updates++;
+            break;
+        case VGPU_DISPLAY_CMD_CURSOR_MOVE:
+            s->cursor_moves++;
+            break;
+        }
+
+        vgpu_display_release_cmd(&cmd);
+    }
+}
+
+static void headless_report(void)
+{
+    for (uint32_t i = 0; i < VIRTIO_GPU_MAX_SCANOUTS; i++) {
+        const struct headless_scanout *s = &headless_scanouts[i];
+        if (!s->frames && !s->rejected && !s->cursor_updates)
+            continue;
+
+        double span = (s->last_ns - s->first_ns) / 1e9;
+        fprintf(stderr,
+                WINDOW_LOG_PREFIX "scanout %" PRIu32 ": %" PRIu64
+                                  " frames in %.3f s (%.1f fps), %.1f MiB "
+                                  "copied, latency avg %.3f ms max %.3f ms, "
+                                  "%" PRIu64 " rejected, %" PRIu64
+                                  " cursor updates, %" PRIu64
+                                  " moves, %" PRIu64 " clears, %" PRIu64
+                                  " dumped\n",
+                i, s->frames, span,
+                span > 0 ? (s->frames - 1) / span : 0.0,
+                s->bytes / (1024.0 * 1024.0),
+                s->frames ? s->latency_ns / 1e6 / s->frames : 0.0,
+                s->max_latency_ns / 1e6, s->rejected, s->cursor_updates,
+                s->cursor_moves, s->clears, s->dumped);
+    }
+}
+
+static void window_init_headless(bool headless, uint32_t width, uint32_t height)
+{
+    /* There is no window to size; the plane follows the scanout mode. */
+    (void) headless;
+    (void) width;
+    (void) height;
+
+    headless_crc32_init();
+    if (headless_dump != HEADLESS_DUMP_NONE &&
+        mkdir(headless_dump_dir, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr,
+                WINDOW_LOG_PREFIX "%s(): cannot create '%s': %s; frame dumps "
+                                  "disabled\n",
+                __func__, headless_dump_dir, strerror(errno));
+        headless_dump_failed = true;
+    }
+}
+
+static void window_shutdown_headless(void)
+{
+    __atomic_store_n(&should_exit, true, __ATOMIC_RELAXED);
+    window_wake_backend_headless();
+}
+
+static bool window_is_closed_headless(void)
+{
+    return __atomic_load_n(&should_exit, __ATOMIC_RELAXED);
+}
+
+/* Runs on the main thread, as the consumer of the display bridge. */
+static void window_main_loop_headless(void)
+{
+    while (!window_is_closed_headless()) {
+#if SEMU_HAS(VIRTIOINPUT)
+        vinput_script_poll();
+#endif
+        headless_drain_display_queue();
+        usleep(HEADLESS_POLL_US);
+    }
+    headless_drain_display_queue();
+}
+
+static void window_cleanup_headless(void)
+{
+    wake_write_fd = -1;
+
+    struct vgpu_display_cmd cmd;
+    while (vgpu_display_pop_cmd(&cmd))
+        vgpu_display_release_cmd(&cmd);
+
+    headless_report();
+    vgpu_display_report();
+    for (uint32_t i = 0; i < VIRTIO_GPU_MAX_SCANOUTS; i++) {
+        free(headless_scanouts[i].fb);
+        memset(&headless_scanouts[i], 0, sizeof(headless_scanouts[i]));
+    }
+    should_exit = false;
+}
+
+#if SEMU_HAS(VIRTIOINPUT)
+/* No host pointer to grab. Without a window, input only comes from an '-I'
+ * script.
+ */
+static void window_set_mouse_grab_headless(bool grabbed)
+{
+    (void) grabbed;
+}
+
+static bool window_is_mouse_grabbed_headless(void)
+{
+    return false;
+}
+#endif
+
+const struct window_backend g_window_headless = {
+    .window_init = window_init_headless,
+    .window_main_loop = window_main_loop_headless,
+    .window_shutdown = window_shutdown_headless,
+    .window_cleanup = window_cleanup_headless,
+    .window_is_closed = window_is_closed_headless,
+    .window_set_wake_fd = window_set_wake_fd_headless,
+    .window_wake_backend = window_wake_backend_headless,
+#if SEMU_HAS(VIRTIOINPUT)
+    .window_set_mouse_grab = window_set_mouse_grab_headless,
+    .window_is_mouse_grabbed = window_is_mouse_grabbed_headless,
+#endif
+};
@@ -43,9 +43,10 @@ struct sdl_plane_info {
     SDL_Texture *texture;
 };
 
-/* SDL-owned retained state for one scanout. 'window_init_sw()' creates the
- * window/renderer, then 'window_drain_display_queue()' updates the primary and
- * cursor planes from queued display payloads before rendering them.
+/* SDL-owned retained state for one scanout. Each scanout has a window and
+ * renderer of its own, created by 'sdl_scanout_info_init()'; then
+ * 'window_drain_display_queue()' updates the primary and cursor planes from
+ * queued display payloads before rendering them.
  */
 struct sdl_scanout_info {
     struct sdl_plane_info primary_plane;
@@ -111,6 +112,10 @@ static void window_set_mouse_grab_sw(bool grabbed)
         return;
 
     if (grabbed) {
+        /* Grab whichever scanout window the click landed in. */
+        SDL_Window *focus = SDL_GetMouseFocus();
+        if (focus)
+            sdl_input_window = focus;
         if (SDL_SetRelativeMouseMode(SDL_TRUE) < 0) {
             fprintf(stderr,
                     "window_set_mouse_grab_sw(): failed to enable relative "
@@ -255,8 +260,17 @@ static SDL_Texture *sdl_plane_info_create_texture(
         return NULL;
     }
 
+    /* Cursor payloads carry premultiplied alpha, which 'SDL_BLENDMODE_BLEND'
+     * would apply a second time. Renderers without custom blend modes fall
+     * back to it anyway; only translucent cursor edges come out darker.
+     */
     if (plane->alpha_blend) {
-        if (SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND) < 0) {
+        SDL_BlendMode premultiplied = SDL_ComposeCustomBlendMode(
+            SDL_BLENDFACTOR_ONE, SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA,
+            SDL_BLENDOPERATION_ADD, SDL_BLENDFACTOR_ONE,
+            SDL_BLENDFACTOR_ONE_MINUS_SRC_ALPHA, SDL_BLENDOPERATION_ADD);
+        if (SDL_SetTextureBlendMode(texture, premultiplied) < 0 &&
+            SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND) < 0) {
             fprintf(stderr, "%s(): failed to enable texture blending: %s\n",
                     __func__, SDL_GetError());
         }
@@ -280,8 +294,22 @@ static bool sdl_plane_info_update_texture(
                          plane->height == frame->height &&
                          plane->sdl_format == sdl_format;
     SDL_Texture *texture = plane->texture;
+    const struct vgpu_display_rect *damage = &frame->damage;
+    SDL_Rect rect = {
+        .x = (int) damage->x,
+        .y = (int) damage->y,
+        .w = (int) damage->width,
+        .h = (int) damage->height,
+    };
 
     if (!reuse_texture) {
+        /* A new texture starts with undefined contents, so it can only be
+         * built from a frame that covers the whole plane.
+         */
+        if (damage->x != 0 || damage->y != 0 ||
+            damage->width != frame->width || damage->height != frame->height)
+            return false;
+
         texture =
             sdl_plane_info_create_texture(renderer, plane, frame, sdl_format);
         if (!texture)
@@ -291,7 +319,7 @@ static bool sdl_plane_info_update_texture(
     /* Keep the retained plane state unchanged until the new pixels are known
      * to be uploaded successfully.
      */
-    if (SDL_UpdateTexture(texture, NULL, frame->pixels, frame->stride) != 0) {
+    if (SDL_UpdateTexture(texture, &rect, frame->pixels, frame->stride) != 0) {
         fprintf(stderr, "%s(): failed to update %s texture: %s\n", __func__,
                 plane_name, SDL_GetError());
         if (!reuse_texture)
@@ -384,6 +412,64 @@ static void sdl_scanout_render(const struct sdl_scanout_info *scanout)
     SDL_RenderPresent(scanout->renderer);
 }
 
+/* Open the window and renderer of scanout 'scanout_id' at its registered
+ * mode, placed at 'x', 'y'.
+ */
+static bool sdl_scanout_info_init(struct sdl_scanout_info *scanout,
+                                  uint32_t scanout_id,
+                                  int x,
+                                  int y)
+{
+    uint32_t width, height;
+    char title[32];
+
+    vgpu_display_get_scanout_mode(scanout_id, &width, &height);
+    if (scanout_id == 0)
+        snprintf(title, sizeof(title), "semu");
+    else
+        snprintf(title, sizeof(title), "semu (display %" PRIu32 ")",
+                 scanout_id);
+
+    scanout->window =
+        SDL_CreateWindow(title, x, y, width, height, SDL_WINDOW_SHOWN);
+    if (!scanout->window) {
+        fprintf(stderr,
+                "window_init_sw(): failed to create SDL window for display "
+                "%" PRIu32 ": %s\n",
+                scanout_id, SDL_GetError());
+        return false;
+    }
+
+    scanout->renderer =
+        SDL_CreateRenderer(scanout->window, -1, SDL_RENDERER_ACCELERATED);
+    if (!scanout->renderer) {
+        fprintf(stderr,
+                "window_init_sw(): accelerated renderer not available, "
+                "trying software renderer: %s\n",
+                SDL_GetError());
+        scanout->renderer =
+            SDL_CreateRenderer(scanout->window, -1, SDL_RENDERER_SOFTWARE);
+    }
+    if (!scanout->renderer) {
+        fprintf(stderr,
+                "window_init_sw(): failed to create renderer for display "
+                "%" PRIu32 ": %s\n",
+                scanout_id, SDL_GetError());
+        SDL_DestroyWindow(scanout->window);
+        scanout->window = NULL;
+        return false;
+    }
+
+    scanout->window_width = width;
+    scanout->window_height = height;
+    scanout->cursor_plane.alpha_blend = true;
+
+    SDL_SetRenderDrawColor(scanout->renderer, 0, 0, 0, 255);
+    SDL_RenderClear(scanout->renderer);
+    SDL_RenderPresent(scanout->renderer);
+    return true;
+}
+
 static void window_drain_display_queue(void)
 {
     bool dirty_scanouts[VIRTIO_GPU_MAX_SCANOUTS] = {0};
@@ -416,13 +502,24 @@ static void window_drain_display_queue(void)
             dirty_scanouts[cmd.scanout_id] = true;
             break;
         case VGPU_DISPLAY_CMD_PRIMARY_SET:
-            /* Use '|=' to keep earlier dirty state for this scanout. A failed
-             * upload leaves the old texture visible and does not dirty the
-             * scanout by itself.
+            /* A successful upload dirties the scanout. A failed one leaves
+             * the old texture visible and does not clear dirty state set by
+             * earlier commands. Later frames only carry their damage, so ask
+             * the backend to publish the whole view again.
              */
-            dirty_scanouts[cmd.scanout_id] |= sdl_plane_info_update_texture(
-                scanout->renderer, &scanout->primary_plane,
-                cmd.u.primary_set.payload, "primary");
+            if (sdl_plane_info_update_texture(scanout->renderer,
+                                              &scanout->primary_plane,
+                                              cmd.u.primary_set.payload,
+                                              "primary")) {
+                dirty_scanouts[cmd.scanout_id] = true;
+#if SEMU_HAS(VIRTIOINPUT)
+                vinput_script_note_frame(cmd.publish_ns);
+#endif
+            } else {
+                /* The emulator may be asleep with every hart idle */
+                vgpu_display_request_primary_refresh(cmd.scanout_id);
+                window_wake_backend_sw();
+            }
             break;
         case VGPU_DISPLAY_CMD_CURSOR_SET:
             /* Use '|=' to keep earlier dirty state for this scanout. A failed
@@ -463,10 +560,15 @@ static void window_main_loop_sw(void)
         /* Block until the emulator calls 'window_shutdown_sw()', so 'main()'
          * can proceed to 'pthread_join()' rather than stopping the emulator
          * immediately. There is no SDL event loop in this mode, so the main
-         * thread just polls the shared close flag.
+         * thread just polls the shared close flag, replaying any input script
+         * on the way.
          */
-        while (!window_is_closed_sw())
+        while (!window_is_closed_sw()) {
+#if SEMU_HAS(VIRTIOINPUT)
+            vinput_script_poll();
+#endif
             usleep(10000);
+        }
         return;
     }
 
@@ -476,6 +578,7 @@ static void window_main_loop_sw(void)
      */
     while (!window_is_closed_sw()) {
 #if SEMU_HAS(VIRTIOINPUT)
+        vinput_script_poll();
         if (vinput_handle_events()) {
             /* User closed the window. Set the flag so 'window_shutdown_sw()'
              * (called from the emulator thread) does not race with us, then
@@ -495,7 +598,12 @@ static void window_main_loop_sw(void)
         if (SDL_WaitEventTimeout(&e, SDL_EVENT_WAIT_TIMEOUT_MS)) {
             uint32_t processed = 0;
             do {
-                if (e.type == SDL_QUIT) {
+                /* With several scanout windows SDL only quits once the last
+                 * one is gone; closing any of them stops the emulator.
+                 */
+                if (e.type == SDL_QUIT ||
+                    (e.type == SDL_WINDOWEVENT &&
+                     e.window.event == SDL_WINDOWEVENT_CLOSE)) {
                     window_shutdown_sw();
                     return;
                 }
@@ -534,65 +642,37 @@ static void window_init_sw(bool headless, uint32_t width, uint32_t height)
     sdl_initialized = true;
 
 #if SEMU_HAS(VIRTIOGPU)
-    /* The current machine setup registers exactly one scanout before calling
-     * 'window_init_sw()', so materialize scanout 0 directly here. If semu grows
-     * multiple scanouts later, this can be extended to iterate all registered
-     * scanouts or restored to an explicit per-scanout setup path.
+    /* One window per registered scanout, the later ones opened side by side
+     * to the right of the first. Scanout 0 is required; a later one that
+     * cannot be opened only leaves that head dark. Window sizes come from the
+     * scanout modes rather than from 'width' and 'height'.
      */
-    struct sdl_scanout_info *scanout = &sdl_scanouts[0];
-    scanout->window = SDL_CreateWindow("semu", SDL_WINDOWPOS_UNDEFINED,
-                                       SDL_WINDOWPOS_UNDEFINED, width, height,
-                                       SDL_WINDOW_SHOWN);
-    if (!scanout->window) {
-        fprintf(stderr,
-                "window_init_sw(): failed to create SDL window for display "
-                "0: %s\n"
-                "Running in headless mode.\n",
-                SDL_GetError());
-        headless_mode = true;
-        SDL_Quit();
-        sdl_initialized = false;
-        vgpu_display_set_unavailable();
-        return;
-    }
+    (void) width;
+    (void) height;
+    uint32_t scanout_count = vgpu_display_get_scanout_count();
+    int x = SDL_WINDOWPOS_UNDEFINED, y = SDL_WINDOWPOS_UNDEFINED;
+    for (uint32_t i = 0; i < scanout_count; i++) {
+        struct sdl_scanout_info *scanout = &sdl_scanouts[i];
+
+        if (!sdl_scanout_info_init(scanout, i, x, y)) {
+            if (i > 0)
+                continue;
+            fprintf(stderr, "Running in headless mode.\n");
+            headless_mode = true;
+            SDL_Quit();
+            sdl_initialized = false;
+            vgpu_display_set_unavailable();
+            return;
+        }
 
-    scanout->renderer =
-        SDL_CreateRenderer(scanout->window, -1, SDL_RENDERER_ACCELERATED);
-    if (!scanout->renderer) {
-        fprintf(stderr,
-                "window_init_sw(): accelerated renderer not available, "
-                "trying software renderer: %s\n",
-                SDL_GetError());
-        scanout->renderer =
-            SDL_CreateRenderer(scanout->window, -1, SDL_RENDERER_SOFTWARE);
+        SDL_GetWindowPosition(scanout->window, &x, &y);
+        x += (int) scanout->window_width;
     }
-    if (!scanout->renderer) {
-        fprintf(stderr,
-                "window_init_sw(): failed to create renderer for display "
-                "0: %s\n"
-                "Running in headless mode.\n",
-                SDL_GetError());
-        SDL_DestroyWindow(scanout->window);
-        scanout->window = NULL;
-        headless_mode = true;
-        SDL_Quit();
-        sdl_initialized = false;
-        vgpu_display_set_unavailable();
-        return;
-    }
-
-    scanout->window_width = width;
-    scanout->window_height = height;
-    scanout->cursor_plane.alpha_blend = true;
 
 #if SEMU_HAS(VIRTIOINPUT)
     if (!sdl_input_window)
-        sdl_input_window = scanout->window;
+        sdl_input_window = sdl_scanouts[0].window;
 #endif
-
-    SDL_SetRenderDrawColor(scanout->renderer, 0, 0, 0, 255);
-    SDL_RenderClear(scanout->renderer);
-    SDL_RenderPresent(scanout->renderer);
 #else /* !SEMU_HAS(VIRTIOGPU) */
     sdl_input_window = SDL_CreateWindow("semu", SDL_WINDOWPOS_UNDEFINED,
                                         SDL_WINDOWPOS_UNDEFINED, width, height,
@@ -630,6 +710,7 @@ static void window_cleanup_sw(void)
     struct vgpu_display_cmd cmd;
     while (vgpu_display_pop_cmd(&cmd))
         vgpu_display_release_cmd(&cmd);
+    vgpu_display_report();
 #elif SEMU_HAS(VIRTIOINPUT)
     if (sdl_input_window)
         SDL_DestroyWindow(sdl_input_window);
@@ -651,7 +732,7 @@ static void window_cleanup_sw(void)
     should_exit = false;
 }
 
-const struct window_backend g_window = {
+const struct window_backend g_window_sw = {
     .window_init = window_init_sw,
     .window_main_loop = window_main_loop_sw,
     .window_shutdown = window_shutdown_sw,
@@ -664,3 +745,5 @@ const struct window_backend g_window = {
     .window_is_mouse_grabbed = window_is_mouse_grabbed_sw,
 #endif
 };
+
+const struct window_backend *g_window = &g_window_sw;
@@ -9,9 +9,11 @@ struct window_backend {
     /* When headless is true, the backend skips SDL_Init / window creation and
      * behaves as if SDL had failed -- useful for batch runs (CI, 'make check')
      * that have no display attached.
-     * The caller also passes the default SDL window size. VirtIO-GPU builds
-     * use it as the initial scanout size; input-only builds use it for the
-     * grab target window because they do not have a display mode of their own.
+     * The caller also passes the default SDL window size. Input-only builds
+     * use it for the grab target window because they do not have a display
+     * mode of their own; VirtIO-GPU builds instead open one window per
+     * scanout, sized from the modes registered with
+     * 'vgpu_display_set_scanout_mode()'.
      */
     void (*window_init)(bool headless, uint32_t width, uint32_t height);
     /* Main loop function that runs on the main thread. If non-NULL, the
@@ -51,5 +53,24 @@ struct window_backend {
 #endif /* SEMU_HAS(VIRTIOINPUT) */
 };
 
-extern const struct window_backend g_window;
+/* SDL window backend, see window-sw.c. */
+extern const struct window_backend g_window_sw;
+
+#if SEMU_HAS(VIRTIOGPU)
+/* Display-less backend that consumes virtio-gpu frames, counts them and
+ * optionally dumps them to files, see window-headless.c.
+ */
+extern const struct window_backend g_window_headless;
+
+/* Configure 'g_window_headless' from a "stats" or
+ * "dump[,dir=DIR][,format=png|raw][,every=N]" option string. Returns false
+ * on a malformed one.
+ */
+bool window_headless_configure(const char *spec);
+#endif
+
+/* Backend the emulator talks to. Points at 'g_window_sw' unless 'main()'
+ * selects another one before calling 'window_init()'.
+ */
+extern const struct window_backend *g_window;
 #endif /* SEMU_HAS(VIRTIOINPUT) || SEMU_HAS(VIRTIOGPU) */